@@ -62,6 +62,7 @@ LOCAL_SRC_FILES := \
 	lnamespace.c\
 	lthread.c \
 	lthreadlib.c \
+	lasynclib.c \
 	lproclib.c\
 	lptrlib.c \
 	lsmgrlib.c \
@@ -71,6 +72,9 @@ LOCAL_SRC_FILES := \
 	json_parser.c \
 	lsuper.c\
 	lstruct.c \
+	lslice.c \
+	lprofile.c \
+	lclone.c \
 	sha256.c \
 	ltcc.c\
 	lpatchlib.c\
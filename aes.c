@@ -543,37 +543,137 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf,  uint32_t length)
 
 #if defined(CTR) && (CTR == 1)
 
+/* Increment the 128-bit big-endian counter in Iv */
+static void IncrementIv(uint8_t* Iv)
+{
+  int bi;
+  for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
+  {
+    if (Iv[bi] == 255)
+    {
+      Iv[bi] = 0;
+      continue;
+    }
+    Iv[bi] += 1;
+    break;
+  }
+}
+
 /* Symmetrical operation: same function for encrypting as for decrypting. Note any IV/nonce should never be reused with the same key */
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length)
 {
   uint8_t buffer[AES_BLOCKLEN];
-  
+  uint32_t whole = length - length % AES_BLOCKLEN;
   unsigned i;
-  int bi;
-  for (i = 0, bi = AES_BLOCKLEN; i < length; ++i, ++bi)
+
+  AES_CTR_xcrypt_blocks(ctx, buf, buf, whole / AES_BLOCKLEN);
+  if (whole < length) /* last partial block */
   {
-    if (bi == AES_BLOCKLEN) /* we need to regen xor compliment in buffer */
-    {
-      
-      memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
-      Cipher((state_t*)buffer,ctx->RoundKey);
+    memset(buffer, 0, AES_BLOCKLEN);
+    AES_CTR_xcrypt_blocks(ctx, buffer, buffer, 1);
+    for (i = whole; i < length; ++i)
+      buf[i] ^= buffer[i - whole];
+  }
+}
 
-      /* Increment Iv and handle overflow */
-      for (bi = (AES_BLOCKLEN - 1); bi >= 0; --bi)
-      {
-	/* inc will owerflow */
-        if (ctx->Iv[bi] == 255)
-	{
-          ctx->Iv[bi] = 0;
-          continue;
-        } 
-        ctx->Iv[bi] += 1;
-        break;   
-      }
-      bi = 0;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (AES128 == 1)
+#define AES_HAVE_AESNI 1
+#include <wmmintrin.h>
+
+/* Counter block 'ctr' (big-endian hi:lo) as a vector in memory order */
+__attribute__((target("aes,sse2")))
+static inline __m128i CounterBlock(uint64_t hi, uint64_t lo)
+{
+  uint8_t b[AES_BLOCKLEN];
+  int i;
+  for (i = 0; i < 8; ++i)
+  {
+    b[i] = (uint8_t)(hi >> (56 - 8 * i));
+    b[8 + i] = (uint8_t)(lo >> (56 - 8 * i));
+  }
+  return _mm_loadu_si128((const __m128i*)b);
+}
+
+/* AES-NI CTR over whole blocks, four blocks in flight at a time */
+__attribute__((target("aes,sse2")))
+static void CtrBlocksAesni(struct AES_ctx* ctx, uint8_t* out, const uint8_t* in, size_t nblocks)
+{
+  __m128i rk[Nr + 1];
+  uint64_t hi = 0, lo = 0;
+  size_t n = 0;
+  int i, r;
+
+  for (r = 0; r <= Nr; ++r)
+    rk[r] = _mm_loadu_si128((const __m128i*)(ctx->RoundKey + r * AES_BLOCKLEN));
+  for (i = 0; i < 8; ++i)
+  {
+    hi = (hi << 8) | ctx->Iv[i];
+    lo = (lo << 8) | ctx->Iv[8 + i];
+  }
+
+  for (; n + 4 <= nblocks; n += 4)
+  {
+    __m128i b[4];
+    for (i = 0; i < 4; ++i)
+    {
+      b[i] = _mm_xor_si128(CounterBlock(hi, lo), rk[0]);
+      if (++lo == 0) ++hi;
+    }
+    for (r = 1; r < Nr; ++r)
+      for (i = 0; i < 4; ++i)
+        b[i] = _mm_aesenc_si128(b[i], rk[r]);
+    for (i = 0; i < 4; ++i)
+    {
+      const uint8_t* src = in + (n + i) * AES_BLOCKLEN;
+      b[i] = _mm_aesenclast_si128(b[i], rk[Nr]);
+      b[i] = _mm_xor_si128(b[i], _mm_loadu_si128((const __m128i*)src));
+      _mm_storeu_si128((__m128i*)(out + (n + i) * AES_BLOCKLEN), b[i]);
     }
+  }
+  for (; n < nblocks; ++n)
+  {
+    __m128i b = _mm_xor_si128(CounterBlock(hi, lo), rk[0]);
+    if (++lo == 0) ++hi;
+    for (r = 1; r < Nr; ++r)
+      b = _mm_aesenc_si128(b, rk[r]);
+    b = _mm_aesenclast_si128(b, rk[Nr]);
+    b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)(in + n * AES_BLOCKLEN)));
+    _mm_storeu_si128((__m128i*)(out + n * AES_BLOCKLEN), b);
+  }
 
-    buf[i] = (buf[i] ^ buffer[bi]);
+  for (i = 0; i < 8; ++i)
+  {
+    ctx->Iv[i] = (uint8_t)(hi >> (56 - 8 * i));
+    ctx->Iv[8 + i] = (uint8_t)(lo >> (56 - 8 * i));
+  }
+}
+#endif
+
+void AES_CTR_xcrypt_blocks(struct AES_ctx* ctx, uint8_t* out, const uint8_t* in, size_t nblocks)
+{
+  size_t n;
+  int i;
+#if defined(AES_HAVE_AESNI)
+  static int aesni = -1;
+  if (aesni < 0)
+    aesni = __builtin_cpu_supports("aes") ? 1 : 0;
+  if (aesni)
+  {
+    CtrBlocksAesni(ctx, out, in, nblocks);
+    return;
+  }
+#endif
+  for (n = 0; n < nblocks; ++n)
+  {
+    uint8_t buffer[AES_BLOCKLEN];
+    memcpy(buffer, ctx->Iv, AES_BLOCKLEN);
+    Cipher((state_t*)buffer, ctx->RoundKey);
+    IncrementIv(ctx->Iv);
+    for (i = 0; i < AES_BLOCKLEN; ++i)
+      out[i] = in[i] ^ buffer[i];
+    in += AES_BLOCKLEN;
+    out += AES_BLOCKLEN;
   }
 }
 
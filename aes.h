@@ -2,6 +2,7 @@
 #define _AES_H_
 
 #include <stdint.h>
+#include <stddef.h>
 
 /**
  * @file aes.h
@@ -130,6 +131,16 @@ void AES_CBC_decrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
  */
 void AES_CTR_xcrypt_buffer(struct AES_ctx* ctx, uint8_t* buf, uint32_t length);
 
+/**
+ * @brief Encrypts/decrypts whole blocks in CTR mode, from 'in' to 'out'.
+ * @param ctx Pointer to the AES context; its IV is advanced by 'nblocks'.
+ * @param out Destination (may be the same as 'in').
+ * @param in Source.
+ * @param nblocks Number of 16-byte blocks.
+ * @note Uses AES-NI when the CPU has it. Output matches AES_CTR_xcrypt_buffer.
+ */
+void AES_CTR_xcrypt_blocks(struct AES_ctx* ctx, uint8_t* out, const uint8_t* in, size_t nblocks);
+
 #endif // #if defined(CTR) && (CTR == 1)
 
 
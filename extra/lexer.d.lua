@@ -108,13 +108,54 @@ local lexer = {}
 ---@field line integer The line number where the token occurred.
 ---@field value? any The semantic value of the token (e.g., for TK_NAME, TK_STRING, TK_INT).
 
+---@class TokenBuffer
+--- Token stream stored as parallel arrays. `#tokens`, `tokens[i]` (a fresh
+--- TokenInfo table), `ipairs` and `pairs` work as on an array of tokens;
+--- assign a TokenInfo to `tokens[i]` to change a token.
+---@field [integer] TokenInfo
+local TokenBuffer = {}
+
+---@param i integer
+---@return integer
+function TokenBuffer:token(i) end
+
+---@param i integer
+---@return integer
+function TokenBuffer:line(i) end
+
+---@param i integer
+---@return string
+function TokenBuffer:type(i) end
+
+---@param i integer
+---@return any
+function TokenBuffer:value(i) end
+
+--- First and last byte of the token in the source (nil for inserted tokens).
+---@param i integer
+---@return integer?, integer?
+function TokenBuffer:span(i) end
+
+--- Source text of the token (nil for inserted tokens).
+---@param i integer
+---@return string?
+function TokenBuffer:text(i) end
+
+---@return string? source The lexed source code.
+function TokenBuffer:source() end
+
+---@return TokenInfo[]
+function TokenBuffer:totable() end
+
+---@alias TokenList TokenBuffer|TokenInfo[]
+
 ---@class ASTNode
 ---@field type string The type of the node.
 ---@field elements (TokenInfo|ASTNode)[] The children of this node, which can be tokens or sub-nodes.
 
---- Lexes the given code into a flat array of tokens.
+--- Lexes the given code into a token buffer.
 ---@param code string The Lua source code to lex.
----@return TokenInfo[]
+---@return TokenBuffer
 function lexer.lex(code) end
 
 --- Obfuscates the given code.
@@ -124,13 +165,13 @@ function lexer.lex(code) end
 function lexer.obfuscate(code, options) end
 
 --- Finds the matching closer (e.g., 'end', '}') for the block opened at start_idx.
----@param tokens TokenInfo[]
+---@param tokens TokenList
 ---@param start_idx integer
 ---@return integer? index The index of the matching closing token, or nil.
 function lexer.find_match(tokens, start_idx) end
 
 --- Builds a nested Abstract Syntax Tree from a flat list of tokens.
----@param tokens TokenInfo[]
+---@param tokens TokenList
 ---@return ASTNode
 function lexer.build_tree(tokens) end
 
@@ -151,24 +192,24 @@ function lexer.token2str(token_id) end
 function lexer.gmatch(code) end
 
 --- Reconstructs Lua source code from a list of tokens.
----@param tokens TokenInfo[]
+---@param tokens TokenList
 ---@return string
 function lexer.reconstruct(tokens) end
 
 --- Scans the token stream for tokens matching a specific token ID or string type.
----@param tokens TokenInfo[] The token stream.
+---@param tokens TokenList The token stream.
 ---@param target integer|string The target token ID or string type.
 ---@return integer[] indices The indices of the matching tokens.
 function lexer.find_tokens(tokens, target) end
 
 --- Safely inserts a single token or an array of tokens at the specified index within the token stream.
----@param tokens TokenInfo[] The token stream (modified in-place).
+---@param tokens TokenList The token stream (modified in-place).
 ---@param index integer The index at which to insert.
----@param new_tokens TokenInfo|TokenInfo[] The token(s) to insert.
+---@param new_tokens TokenInfo|TokenList The token(s) to insert.
 function lexer.insert_tokens(tokens, index, new_tokens) end
 
 --- Removes a specified number of tokens starting from a given index.
----@param tokens TokenInfo[] The token stream (modified in-place).
+---@param tokens TokenList The token stream (modified in-place).
 ---@param index integer The index at which to start removing.
 ---@param count? integer The number of tokens to remove (defaults to 1).
 function lexer.remove_tokens(tokens, index, count) end
@@ -176,6 +217,6 @@ function lexer.remove_tokens(tokens, index, count) end
 return setmetatable(lexer, {
     ---@param self lexer
     ---@param code string
-    ---@return TokenInfo[]
+    ---@return TokenBuffer
     __call = function(self, code) end
 })
@@ -16,6 +16,7 @@
 #include "lua.h"
 
 #include "lapi.h"
+#include "lclone.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -34,6 +35,8 @@
 #include "lclass.h"
 #include "lnamespace.h"
 #include "lobfuscate.h"
+#include "lslice.h"
+#include "lbigint.h"
 
 __attribute__((noinline))
 void lapi_vmp_hook_point(void) {
@@ -164,6 +167,23 @@ LUA_API void lua_xmove (lua_State *from, lua_State *to, int n) {
 }
 
 
+/**
+ * @brief Copies into 'to' the contents of the independent state 'from'.
+ *
+ * @param from Source state.
+ * @param to Destination state.
+ * @param n Number of values on top of 'from' to copy.
+ */
+LUA_API void lua_clonestate (lua_State *from, lua_State *to, int n) {
+  lua_lock(to);
+  api_checknelems(from, n);
+  api_check(from, G(from) != G(to), "cloning a state into itself");
+  luaCL_clone(from, to, n);
+  luaC_checkGC(to);
+  lua_unlock(to);
+}
+
+
 /**
  * @brief Sets a new panic function.
  *
@@ -575,7 +595,7 @@ LUA_API int lua_compare (lua_State *L, int index1, int index2, int op) {
  */
 LUA_API unsigned (lua_numbertocstring) (lua_State *L, int idx, char *buff) {
   const TValue *o = index2value(L, idx);
-  if (ttisnumber(o)) {
+  if (ttisinteger(o) || ttisfloat(o)) {  /* (big integers need a string) */
     unsigned len = luaO_tostringbuff(o, buff);
     buff[len++] = '\0';  /* add final zero */
     return len;
@@ -600,6 +620,45 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 }
 
 
+/**
+ * @brief Converts an integer numeral of any size to a number.
+ *
+ * Pushes an integer, or a big integer when the value does not fit in one.
+ *
+ * @param L The Lua state.
+ * @param s The numeral (decimal or hexadecimal, with an optional sign).
+ * @param len Length of the numeral.
+ * @return 1 if the conversion succeeded (and a value was pushed), 0 otherwise.
+ */
+LUA_API int lua_stringtobig (lua_State *L, const char *s, size_t len) {
+  int ok;
+  lua_lock(L);
+  ok = luaB_fromstring(L, s, len, s2v(L->top.p));
+  if (ok)
+    api_incr_top(L);
+  lua_unlock(L);
+  return ok;
+}
+
+
+/**
+ * @brief Modular exponentiation of (big) integers.
+ *
+ * Pops a base, an exponent and a modulus and pushes 'base^exp % mod',
+ * which lies in [0, mod).
+ *
+ * @param L The Lua state.
+ */
+LUA_API void lua_powmod (lua_State *L) {
+  lua_lock(L);
+  api_checknelems(L, 3);
+  luaB_powmod(L, s2v(L->top.p - 3), s2v(L->top.p - 2), s2v(L->top.p - 1),
+              s2v(L->top.p - 3));
+  L->top.p -= 2;
+  lua_unlock(L);
+}
+
+
 /**
  * @brief Converts the Lua value at the given index to a C lua_Number.
  *
@@ -1445,7 +1504,7 @@ LUA_API void lua_settable (lua_State *L, int idx) {
      Table *h = hvalue(t);
      l_rwlock_wrlock(&h->lock);
      const TValue *res = luaH_get(h, s2v(L->top.p - 2));
-     if (!isempty(res) && !isabstkey(res)) {
+     if (!isempty(res) && !isabstkey(res) && !h->viewed) {
         setobj2t(L, cast(TValue *, res), s2v(L->top.p - 1));
         luaC_barrierback(L, obj2gco(h), s2v(L->top.p - 1));
         l_rwlock_unlock(&h->lock);
@@ -1490,7 +1549,7 @@ LUA_API void lua_seti (lua_State *L, int idx, lua_Integer n) {
      Table *h = hvalue(t);
      l_rwlock_wrlock(&h->lock);
      const TValue *res = luaH_getint(h, n);
-     if (!isempty(res) && !isabstkey(res)) {
+     if (!isempty(res) && !isabstkey(res) && !h->viewed) {
         setobj2t(L, cast(TValue *, res), s2v(L->top.p - 1));
         luaC_barrierback(L, obj2gco(h), s2v(L->top.p - 1));
         l_rwlock_unlock(&h->lock);
@@ -1847,6 +1906,8 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
     }
   }
   lua_unlock(L);
+  if (status == LUA_OK && G(L)->loadhook)  /* debugger watching loads? */
+    G(L)->loadhook(L);
   return status;
 }
 
@@ -1883,7 +1944,7 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
  * @param data Writer data.
  * @param strip Whether to strip debug info.
  * @param obfuscate_flags Obfuscation flags.
- * @param seed Random seed (0 for time-based).
+ * @param seed Random seed (0 for time-based; non-zero also makes the output reproducible).
  * @param log_path Path to log debug info (NULL for no log).
  * @return 0 on success, non-zero on failure.
  *
@@ -1912,6 +1973,47 @@ LUA_API int lua_dump_obfuscated (lua_State *L, lua_Writer writer, void *data,
 }
 
 
+/**
+ * @brief Dumps a function in the plain format.
+ *
+ * The plain format carries no protection and can only be loaded by the
+ * same build; it is meant for caches such as 'package.cachepath'.
+ *
+ * @param L Lua state.
+ * @param writer Writer function.
+ * @param data Writer data.
+ * @param strip Whether to strip debug info.
+ * @return 0 on success, non-zero on failure.
+ */
+LUA_API int lua_dump_plain (lua_State *L, lua_Writer writer, void *data,
+                            int strip) {
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top.p - 1);
+  if (isLfunction(o))
+    status = luaU_dump_plain(L, getproto(o), writer, data, strip);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
+
+/**
+ * @brief Returns the identifier of the instruction set.
+ *
+ * It is a hash of the names and modes of all opcodes and is recorded
+ * in plain chunks, which load only where it is the same.
+ *
+ * @return The identifier.
+ */
+LUA_API unsigned int lua_bytecodeid (void) {
+  return cast_uint(luaP_codeid());
+}
+
+
 /**
  * @brief Returns the status of the thread `L`.
  *
@@ -2025,6 +2127,16 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       luaC_changemode(L, KGC_INC);
       break;
     }
+    case LUA_GCBGFREE: {
+      int on = va_arg(argp, int);
+      res = luaM_setbgfree(L, on);
+      break;
+    }
+    case LUA_GCTHREADPOOL: {
+      int limit = va_arg(argp, int);
+      res = luaE_setthreadpool(L, limit);
+      break;
+    }
   
     default: res = -1;  /* invalid option */
   }
@@ -2033,6 +2145,31 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
   return res;
 }
 
+/**
+ * @brief Copies collector records newer than 'after' into 'ar'.
+ *
+ * @param L The Lua state.
+ * @param ar Array receiving the records, oldest first.
+ * @param n Size of 'ar'.
+ * @param after Sequence number of the last record already seen.
+ * @return The number of records copied.
+ */
+LUA_API int lua_gcstats (lua_State *L, lua_GCStat *ar, int n,
+                         lua_Unsigned after) {
+  GCStats *st;
+  lua_Unsigned first;
+  int i = 0;
+  lua_lock(L);
+  st = &G(L)->gcstats;
+  first = (st->n > LUAI_GCSTATS) ? st->n - LUAI_GCSTATS : 0;
+  if (after > first) first = after;
+  for (; first < st->n && i < n; first++)
+    ar[i++] = st->ring[first % LUAI_GCSTATS];
+  lua_unlock(L);
+  return i;
+}
+
+
 /**
  * @brief Returns the memory usage of the Lua state.
  *
@@ -2663,6 +2800,19 @@ LUA_API void lua_slice (lua_State *L, int idx, int start_idx, int end_idx, int s
   lua_unlock(L);
 }
 
+/*
+** Pushes a copy-on-write view of the slice of the table (or view) at
+** 'idx'; nil bounds take their defaults, as in 't[i:j:step]'.
+*/
+LUA_API void lua_sliceview (lua_State *L, int idx, int start_idx, int end_idx, int step_idx) {
+  lua_lock(L);
+  luaSL_view(L, L->top.p, index2value(L, idx), index2value(L, start_idx),
+             index2value(L, end_idx), index2value(L, step_idx));
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
 LUA_API void lua_setifaceflag (lua_State *L, int idx) {
   lua_lock(L);
   TValue *o = index2value(L, idx);
@@ -0,0 +1,1229 @@
+/*
+** $Id: lasynclib.c $
+** Event loop for async functions
+** See Copyright Notice in lua.h
+*/
+
+#define lasynclib_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+
+
+/*
+** Every call to an 'async' function runs as a task: a coroutine that
+** the loop resumes from C. A task runs until it has to wait; the C
+** primitives below register what they wait for (a timer, a readable
+** or writable descriptor, a channel) and yield the 'WAITING' marker,
+** which parks the task until the loop wakes it. Any other yield (what
+** 'await' compiles to) is answered right away on the next turn: a task
+** awaiting another task gets its results once it finishes, other
+** values come back unchanged.
+**
+** The loop keeps timers in a binary heap and waits on descriptors with
+** epoll on Linux and poll elsewhere. Channels from 'thread.channel'
+** wake the loop through a self-pipe that they write to on every send.
+*/
+
+
+#if defined(_WIN32)
+
+#include <windows.h>
+#define l_noio	1
+
+#else
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#if defined(__linux__) && !defined(LUA_ASYNC_USEPOLL)
+#include <sys/epoll.h>
+#define l_useepoll	1
+#endif
+
+#endif
+
+
+#define LOOPKEY		"_ASYNC_LOOP"
+#define SPAWNKEY	"_ASYNC_SPAWN"
+
+/* marker yielded by tasks parked on the loop */
+static const char waitingkey = 'w';
+#define WAITING		((void *)&waitingkey)
+
+/* uservalues of the loop */
+#define UV_REFS		1	/* anchors running tasks; indexed by their refs */
+#define UV_TASKS	2	/* task -> record, weak keys */
+#define UV_CHANS	3	/* channel -> number of watches through the self-pipe */
+
+
+typedef struct Timer {
+  double when;
+  unsigned int seq;  /* keeps timers with equal deadlines in order */
+  int ref;  /* task to wake */
+} Timer;
+
+
+typedef struct FdWait {
+  int rref, wref;  /* tasks waiting to read/write, or LUA_NOREF */
+  int armed;  /* descriptor known to epoll */
+} FdWait;
+
+
+typedef struct Ready {
+  int ref;
+  int nargs;  /* values waiting on the task's stack */
+} Ready;
+
+
+typedef struct Loop {
+  int epfd;  /* epoll descriptor, or -1 */
+  int wake[2];  /* self-pipe for channels, or -1 */
+  Timer *timers;
+  int ntimers, sizetimers;
+  unsigned int seq;
+  FdWait *fds;  /* indexed by descriptor */
+  int sizefds;
+  int nfdwaits;
+  Ready *ready;  /* ring buffer */
+  int firstready, nready, sizeready;
+  int *chanwaits;  /* tasks waiting on channels */
+  int nchanwaits, sizechanwaits;
+  int ntasks;  /* tasks that did not finish */
+  int running;  /* inside 'asyncio.run'? */
+} Loop;
+
+
+static void *growarray (lua_State *L, void *a, int *size, size_t elem,
+                        int min) {
+  int newsize = (*size < min) ? min : *size * 2;
+  void *na = realloc(a, (size_t)newsize * elem);
+  if (na == NULL)
+    luaL_error(L, "not enough memory");
+  *size = newsize;
+  return na;
+}
+
+
+static double now (void) {
+#if defined(_WIN32)
+  return (double)GetTickCount64() / 1000.0;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+}
+
+
+static Loop *getloop (lua_State *L) {
+  Loop *lp;
+  lua_getfield(L, LUA_REGISTRYINDEX, LOOPKEY);
+  lp = (Loop *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (lp == NULL)
+    luaL_error(L, "asyncio library not loaded");
+  return lp;
+}
+
+
+/* push uservalue 'uv' of the loop */
+static void pushuv (lua_State *L, int uv) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LOOPKEY);
+  lua_getiuservalue(L, -1, uv);
+  lua_remove(L, -2);
+}
+
+
+/* push the record of task 'co' (nil if it is not a task) */
+static int pushrecord (lua_State *L, int idx) {
+  idx = lua_absindex(L, idx);
+  pushuv(L, UV_TASKS);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);
+  lua_remove(L, -2);
+  return lua_type(L, -1) == LUA_TTABLE;
+}
+
+
+/* ref of the running task; raises an error outside tasks */
+static int selfref (lua_State *L, const char *fname) {
+  int ref;
+  lua_pushthread(L);
+  if (!lua_isyieldable(L) || !pushrecord(L, -1))
+    return luaL_error(L, "'asyncio.%s' must be called inside an async task",
+                      fname);
+  lua_getfield(L, -1, "ref");
+  ref = (int)lua_tointeger(L, -1);
+  lua_pop(L, 3);
+  return ref;
+}
+
+
+static void pushtask (lua_State *L, int ref) {
+  pushuv(L, UV_REFS);
+  lua_rawgeti(L, -1, ref);
+  lua_remove(L, -2);
+}
+
+
+/* schedule task 'ref' with the 'nargs' values on its stack */
+static void makeready (lua_State *L, Loop *lp, int ref, int nargs) {
+  int i;
+  if (lp->nready == lp->sizeready) {  /* ring full? unroll it into a larger one */
+    Ready *nr = (Ready *)malloc(sizeof(Ready) * (lp->sizeready ? lp->sizeready * 2 : 64));
+    if (nr == NULL)
+      luaL_error(L, "not enough memory");
+    for (i = 0; i < lp->nready; i++)
+      nr[i] = lp->ready[(lp->firstready + i) % lp->sizeready];
+    free(lp->ready);
+    lp->ready = nr;
+    lp->firstready = 0;
+    lp->sizeready = lp->sizeready ? lp->sizeready * 2 : 64;
+  }
+  i = (lp->firstready + lp->nready++) % lp->sizeready;
+  lp->ready[i].ref = ref;
+  lp->ready[i].nargs = nargs;
+}
+
+
+/*
+** {======================================================
+** Timers
+** =======================================================
+*/
+
+#define timerless(a,b) \
+	((a)->when < (b)->when || ((a)->when == (b)->when && (a)->seq < (b)->seq))
+
+static void addtimer (lua_State *L, Loop *lp, double when, int ref) {
+  int i;
+  if (lp->ntimers == lp->sizetimers)
+    lp->timers = (Timer *)growarray(L, lp->timers, &lp->sizetimers,
+                                    sizeof(Timer), 16);
+  i = lp->ntimers++;
+  while (i > 0) {  /* sift up */
+    int parent = (i - 1) / 2;
+    Timer t;
+    t.when = when; t.seq = lp->seq; t.ref = ref;
+    if (!timerless(&t, &lp->timers[parent])) break;
+    lp->timers[i] = lp->timers[parent];
+    i = parent;
+  }
+  lp->timers[i].when = when;
+  lp->timers[i].seq = lp->seq++;
+  lp->timers[i].ref = ref;
+}
+
+
+static void poptimer (Loop *lp) {
+  Timer last = lp->timers[--lp->ntimers];
+  int i = 0;
+  for (;;) {  /* sift down */
+    int child = 2 * i + 1;
+    if (child >= lp->ntimers) break;
+    if (child + 1 < lp->ntimers &&
+        timerless(&lp->timers[child + 1], &lp->timers[child]))
+      child++;
+    if (!timerless(&lp->timers[child], &last)) break;
+    lp->timers[i] = lp->timers[child];
+    i = child;
+  }
+  if (lp->ntimers > 0)
+    lp->timers[i] = last;
+}
+
+
+/* remove the timers of task 'ref', rebuilding the heap in place */
+static void droptimers (Loop *lp, int ref) {
+  int i, n = 0;
+  for (i = 0; i < lp->ntimers; i++) {
+    Timer t = lp->timers[i];
+    int j;
+    if (t.ref == ref) continue;
+    j = n++;
+    while (j > 0 && timerless(&t, &lp->timers[(j - 1) / 2])) {  /* sift up */
+      lp->timers[j] = lp->timers[(j - 1) / 2];
+      j = (j - 1) / 2;
+    }
+    lp->timers[j] = t;
+  }
+  lp->ntimers = n;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Descriptor waits
+** =======================================================
+*/
+
+#if !defined(l_noio)
+
+static void setnonblock (int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+
+/* tell the backend what to watch on 'fd' */
+static void armfd (lua_State *L, Loop *lp, int fd) {
+#if defined(l_useepoll)
+  FdWait *w = &lp->fds[fd];
+  struct epoll_event ev;
+  ev.events = EPOLLONESHOT;
+  if (w->rref != LUA_NOREF) ev.events |= EPOLLIN | EPOLLRDHUP;
+  if (w->wref != LUA_NOREF) ev.events |= EPOLLOUT;
+  ev.data.u64 = 0;
+  ev.data.fd = fd;
+  if (epoll_ctl(lp->epfd, w->armed ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) != 0) {
+    /* descriptor was closed and reused behind our back, or is new */
+    int op = (errno == ENOENT) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(lp->epfd, op, fd, &ev) != 0)
+      luaL_error(L, "cannot watch descriptor %d: %s", fd, strerror(errno));
+  }
+  w->armed = 1;
+#else
+  (void)L; (void)lp; (void)fd;  /* poll rebuilds its set on every turn */
+#endif
+}
+
+
+static void waitfd (lua_State *L, Loop *lp, int fd, int write, int ref) {
+  FdWait *w;
+  if (fd < 0)
+    luaL_error(L, "invalid descriptor %d", fd);
+  while (fd >= lp->sizefds) {
+    int i, old = lp->sizefds;
+    lp->fds = (FdWait *)growarray(L, lp->fds, &lp->sizefds, sizeof(FdWait), 64);
+    for (i = old; i < lp->sizefds; i++) {
+      lp->fds[i].rref = lp->fds[i].wref = LUA_NOREF;
+      lp->fds[i].armed = 0;
+    }
+  }
+  w = &lp->fds[fd];
+  if ((write ? w->wref : w->rref) != LUA_NOREF)
+    luaL_error(L, "another task is already waiting on descriptor %d", fd);
+  if (write) w->wref = ref; else w->rref = ref;
+  lp->nfdwaits++;
+  armfd(L, lp, fd);
+}
+
+
+/* wake the tasks waiting on 'fd' for the given readiness */
+static void firefd (lua_State *L, Loop *lp, int fd, int canread, int canwrite) {
+  FdWait *w = &lp->fds[fd];
+  if (canread && w->rref != LUA_NOREF) {
+    makeready(L, lp, w->rref, 0);
+    w->rref = LUA_NOREF;
+    lp->nfdwaits--;
+  }
+  if (canwrite && w->wref != LUA_NOREF) {
+    makeready(L, lp, w->wref, 0);
+    w->wref = LUA_NOREF;
+    lp->nfdwaits--;
+  }
+  if (w->rref != LUA_NOREF || w->wref != LUA_NOREF)
+    armfd(L, lp, fd);  /* one-shot: re-arm for the remaining waiter */
+}
+
+
+static void drainwake (Loop *lp) {
+  char buff[256];
+  while (read(lp->wake[0], buff, sizeof(buff)) > 0) { }
+}
+
+
+static void firechannels (lua_State *L, Loop *lp) {
+  int i, n = lp->nchanwaits;
+  drainwake(lp);
+  lp->nchanwaits = 0;
+  for (i = 0; i < n; i++)
+    makeready(L, lp, lp->chanwaits[i], 0);
+}
+
+
+/* wait for descriptors for at most 'timeout' seconds (-1: forever) */
+static void pollio (lua_State *L, Loop *lp, double timeout) {
+  int ms = (timeout < 0) ? -1 : (int)(timeout * 1000.0 + 0.999);
+#if defined(l_useepoll)
+  struct epoll_event evs[256];
+  int i, n = epoll_wait(lp->epfd, evs, 256, ms);
+  if (n < 0 && errno != EINTR)
+    luaL_error(L, "epoll_wait failed: %s", strerror(errno));
+  for (i = 0; i < n; i++) {
+    int fd = evs[i].data.fd;
+    unsigned int e = evs[i].events;
+    int err = (e & (EPOLLERR | EPOLLHUP)) != 0;
+    if (lp->wake[0] >= 0 && fd == lp->wake[0])
+      firechannels(L, lp);
+    else
+      firefd(L, lp, fd, err || (e & (EPOLLIN | EPOLLRDHUP)), err || (e & EPOLLOUT));
+  }
+#else
+  struct pollfd *pfd;
+  int i, n = 0, res;
+  pfd = (struct pollfd *)malloc(sizeof(struct pollfd) * (lp->nfdwaits + 1));
+  if (pfd == NULL)
+    luaL_error(L, "not enough memory");
+  for (i = 0; i < lp->sizefds && n < lp->nfdwaits; i++) {
+    FdWait *w = &lp->fds[i];
+    if (w->rref != LUA_NOREF || w->wref != LUA_NOREF) {
+      pfd[n].fd = i;
+      pfd[n].events = (w->rref != LUA_NOREF ? POLLIN : 0) |
+                      (w->wref != LUA_NOREF ? POLLOUT : 0);
+      pfd[n++].revents = 0;
+    }
+  }
+  if (lp->wake[0] >= 0) {
+    pfd[n].fd = lp->wake[0];
+    pfd[n].events = POLLIN;
+    pfd[n++].revents = 0;
+  }
+  res = poll(pfd, n, ms);
+  if (res < 0 && errno != EINTR) {
+    free(pfd);
+    luaL_error(L, "poll failed: %s", strerror(errno));
+  }
+  for (i = 0; res > 0 && i < n; i++) {
+    short e = pfd[i].revents;
+    int err = (e & (POLLERR | POLLHUP | POLLNVAL)) != 0;
+    if (e == 0) continue;
+    if (pfd[i].fd == lp->wake[0])
+      firechannels(L, lp);
+    else
+      firefd(L, lp, pfd[i].fd, err || (e & POLLIN), err || (e & POLLOUT));
+  }
+  free(pfd);
+#endif
+}
+
+#else
+
+static void pollio (lua_State *L, Loop *lp, double timeout) {
+  (void)L; (void)lp;
+  if (timeout > 0) Sleep((DWORD)(timeout * 1000.0 + 0.999));
+}
+
+#endif
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Tasks
+** =======================================================
+*/
+
+/* finish task 'co' with the 'n' values on its stack (or an error) */
+static void finish (lua_State *L, Loop *lp, lua_State *co, int n, int ok) {
+  int rec, i, j, nj;
+  lua_pushthread(co);
+  lua_xmove(co, L, 1);
+  pushrecord(L, -1);
+  rec = lua_gettop(L);
+  lua_getfield(L, rec, "ref");
+  pushuv(L, UV_REFS);
+  luaL_unref(L, -1, (int)lua_tointeger(L, -2));  /* task is no longer anchored */
+  lua_pop(L, 2);
+  lp->ntasks--;
+  lua_pushboolean(L, 1);
+  lua_setfield(L, rec, "done");
+  if (!ok) {  /* keep (nil, error) as results */
+    lua_pushnil(L);
+    lua_rawseti(L, rec, 1);
+    lua_xmove(co, L, 1);
+    lua_rawseti(L, rec, 2);
+    n = 2;
+  }
+  else {
+    for (i = n; i >= 1; i--) {
+      lua_xmove(co, L, 1);
+      lua_rawseti(L, rec, i);
+    }
+  }
+  lua_pushinteger(L, n);
+  lua_setfield(L, rec, "n");
+  /* hand the results to the tasks awaiting this one */
+  lua_getfield(L, rec, "joiners");
+  nj = lua_istable(L, -1) ? (int)lua_rawlen(L, -1) : 0;
+  if (!ok && nj == 0) {  /* nobody awaits it: propagate the error */
+    lua_rawgeti(L, rec, 2);
+    lua_error(L);
+  }
+  for (j = 1; j <= nj; j++) {
+    int ref;
+    lua_State *jt;
+    lua_rawgeti(L, -1, j);
+    ref = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    pushtask(L, ref);
+    jt = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    luaL_checkstack(jt, n, "too many results");
+    for (i = 1; i <= n; i++) {
+      lua_rawgeti(L, rec, i);
+      lua_xmove(L, jt, 1);
+    }
+    makeready(L, lp, ref, n);
+  }
+  lua_settop(L, rec - 2);
+}
+
+
+/*
+** Resume task 'co' with 'nargs' values on its stack and see why it
+** stopped.
+*/
+static void step (lua_State *L, Loop *lp, lua_State *co, int nargs) {
+  int nres;
+  int status = lua_resume(co, L, nargs, &nres);
+  if (status == LUA_YIELD) {
+    if (nres == 1 && lua_touserdata(co, -1) == WAITING)
+      lua_pop(co, 1);  /* parked; whatever it waits for will wake it */
+    else if (nres == 1 && lua_isthread(co, -1)) {  /* await a task? */
+      lua_xmove(co, L, 1);
+      if (!pushrecord(L, -1)) {  /* a plain coroutine: give it back */
+        lua_pop(L, 1);
+        lua_xmove(L, co, 1);
+        goto again;
+      }
+      if (lua_getfield(L, -1, "done") == LUA_TBOOLEAN) {  /* finished? */
+        int i, n;
+        lua_getfield(L, -2, "n");
+        n = (int)lua_tointeger(L, -1);
+        lua_pop(L, 2);
+        luaL_checkstack(co, n, "too many results");
+        for (i = 1; i <= n; i++) {
+          lua_rawgeti(L, -1, i);
+          lua_xmove(L, co, 1);
+        }
+        lua_pop(L, 2);
+        nres = n;
+        goto again;
+      }
+      lua_pop(L, 1);
+      if (lua_getfield(L, -1, "joiners") != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, -3, "joiners");
+      }
+      lua_pushthread(co);
+      lua_xmove(co, L, 1);
+      pushrecord(L, -1);
+      lua_getfield(L, -1, "ref");
+      lua_rawseti(L, -4, (lua_Integer)lua_rawlen(L, -4) + 1);
+      lua_pop(L, 5);
+    }
+    else {
+    again:  /* 'await' of a plain value: answer it on the next turn */
+      lua_pushthread(co);
+      lua_xmove(co, L, 1);
+      pushrecord(L, -1);
+      lua_getfield(L, -1, "ref");
+      makeready(L, lp, (int)lua_tointeger(L, -1), nres);
+      lua_pop(L, 3);
+    }
+  }
+  else
+    finish(L, lp, co, (status == LUA_OK) ? nres : 1, status == LUA_OK);
+}
+
+
+/*
+** spawn(f, ...): start 'f(...)' as a task and return its coroutine,
+** once it finishes or first has to wait.
+*/
+static int async_spawn (lua_State *L) {
+  Loop *lp = getloop(L);
+  int n = lua_gettop(L);
+  lua_State *co;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  co = lua_newthread(L);
+  lua_insert(L, 1);
+  lua_xmove(L, co, n);  /* function and arguments */
+  pushuv(L, UV_TASKS);
+  lua_pushvalue(L, 1);
+  lua_createtable(L, 0, 4);
+  pushuv(L, UV_REFS);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, luaL_ref(L, -2));
+  lua_setfield(L, -3, "ref");
+  lua_pop(L, 1);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  lp->ntasks++;
+  step(L, lp, co, n - 1);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/* the loop proper; runs in protected mode so errors leave 'running' clear */
+static int runloop (lua_State *L) {
+  Loop *lp = (Loop *)lua_touserdata(L, 1);
+  while (lp->ntasks > 0) {
+    int n = lp->nready;
+    double timeout = -1;
+    while (n-- > 0) {  /* run the tasks made ready before this turn */
+      Ready r = lp->ready[lp->firstready];
+      lua_State *co;
+      lp->firstready = (lp->firstready + 1) % lp->sizeready;
+      lp->nready--;
+      pushtask(L, r.ref);
+      co = lua_tothread(L, -1);
+      lua_pop(L, 1);
+      if (co != NULL)
+        step(L, lp, co, r.nargs);
+    }
+    if (lp->ntasks == 0) break;
+    if (lp->nready > 0)
+      timeout = 0;
+    else if (lp->ntimers > 0) {
+      timeout = lp->timers[0].when - now();
+      if (timeout < 0) timeout = 0;
+    }
+    else if (lp->nfdwaits == 0 && lp->nchanwaits == 0)
+      return luaL_error(L, "asyncio: %d task(s) wait for each other", lp->ntasks);
+    pollio(L, lp, timeout);
+    if (lp->ntimers > 0) {
+      double t = now();
+      while (lp->ntimers > 0 && lp->timers[0].when <= t) {
+        makeready(L, lp, lp->timers[0].ref, 0);
+        poptimer(lp);
+      }
+    }
+  }
+  return 0;
+}
+
+
+/*
+** run([f, ...]): drive the loop until every task finished. With a
+** function, spawn it first and return its results.
+*/
+static int async_run (lua_State *L) {
+  Loop *lp = getloop(L);
+  int main = 0, status;
+  if (lp->running)
+    return luaL_error(L, "'asyncio.run' is already running");
+  if (!lua_isnoneornil(L, 1)) {
+    lua_pushcfunction(L, async_spawn);
+    lua_insert(L, 1);
+    lua_call(L, lua_gettop(L) - 1, 1);
+    main = lua_gettop(L);
+  }
+  lp->running = 1;
+  lua_pushcfunction(L, runloop);
+  lua_pushlightuserdata(L, lp);
+  status = lua_pcall(L, 1, 0, 0);
+  lp->running = 0;
+  if (status != LUA_OK)
+    return lua_error(L);
+  if (main) {  /* return the results of the main task */
+    int i, n;
+    pushrecord(L, main);
+    lua_getfield(L, -1, "n");
+    n = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    luaL_checkstack(L, n, "too many results");
+    for (i = 1; i <= n; i++)
+      lua_rawgeti(L, main + 1, i);
+    return n;
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Awaitable primitives
+** =======================================================
+*/
+
+static int waited (lua_State *L, int status, lua_KContext ctx) {
+  (void)L; (void)status; (void)ctx;
+  return 0;
+}
+
+
+/* sleep(seconds): wait on a timer */
+static int async_sleep (lua_State *L) {
+  lua_Number secs = luaL_optnumber(L, 1, 0);
+  Loop *lp = getloop(L);
+  int ref = selfref(L, "sleep");
+  addtimer(L, lp, now() + (secs > 0 ? secs : 0), ref);
+  lua_pushlightuserdata(L, WAITING);
+  return lua_yieldk(L, 1, 0, waited);
+}
+
+
+static int async_now (lua_State *L) {
+  lua_pushnumber(L, (lua_Number)now());
+  return 1;
+}
+
+
+#if !defined(l_noio)
+
+static int ioresult (lua_State *L, const char *what) {
+  int en = errno;
+  luaL_pushfail(L);
+  lua_pushfstring(L, "%s: %s", what, strerror(en));
+  lua_pushinteger(L, en);
+  return 3;
+}
+
+#define wouldblock(e)	((e) == EAGAIN || (e) == EWOULDBLOCK)
+
+
+/* park the running task until 'fd' is ready, then continue with 'k' */
+static int parkfd (lua_State *L, const char *fname, int fd, int write,
+                   lua_KContext ctx, lua_KFunction k) {
+  Loop *lp = getloop(L);
+  waitfd(L, lp, fd, write, selfref(L, fname));
+  lua_pushlightuserdata(L, WAITING);
+  return lua_yieldk(L, 1, ctx, k);
+}
+
+
+static int readyfd (lua_State *L, int status, lua_KContext ctx) {
+  (void)status; (void)ctx;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/* readable(fd) / writable(fd): wait until 'fd' is ready */
+static int async_readable (lua_State *L) {
+  return parkfd(L, "readable", (int)luaL_checkinteger(L, 1), 0, 0, readyfd);
+}
+
+
+static int async_writable (lua_State *L) {
+  return parkfd(L, "writable", (int)luaL_checkinteger(L, 1), 1, 0, readyfd);
+}
+
+
+/* read(fd [, max]): some bytes, or nil at end of file */
+static int readk (lua_State *L, int status, lua_KContext ctx) {
+  int fd = (int)luaL_checkinteger(L, 1);
+  size_t max = (size_t)luaL_optinteger(L, 2, LUAL_BUFFERSIZE);
+  luaL_Buffer b;
+  char *p;
+  ssize_t n;
+  (void)status; (void)ctx;
+  lua_settop(L, 2);
+  p = luaL_buffinitsize(L, &b, max);
+  n = read(fd, p, max);
+  if (n > 0) {
+    luaL_pushresultsize(&b, (size_t)n);
+    return 1;
+  }
+  else if (n == 0) {
+    luaL_pushfail(L);
+    return 1;
+  }
+  lua_settop(L, 2);  /* drop the buffer */
+  if (wouldblock(errno))
+    return parkfd(L, "read", fd, 0, 0, readk);
+  else if (errno == EINTR)
+    return readk(L, LUA_OK, 0);
+  return ioresult(L, "read");
+}
+
+static int async_read (lua_State *L) {
+  return readk(L, LUA_OK, 0);
+}
+
+
+/* write(fd, s): write all of 's'; the context is the bytes written */
+static int writek (lua_State *L, int status, lua_KContext ctx) {
+  int fd = (int)luaL_checkinteger(L, 1);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
+  size_t done = (size_t)ctx;
+  (void)status;
+  while (done < len) {
+    ssize_t n = write(fd, s + done, len - done);
+    if (n >= 0)
+      done += (size_t)n;
+    else if (wouldblock(errno))
+      return parkfd(L, "write", fd, 1, (lua_KContext)done, writek);
+    else if (errno != EINTR)
+      return ioresult(L, "write");
+  }
+  lua_pushinteger(L, (lua_Integer)len);
+  return 1;
+}
+
+static int async_write (lua_State *L) {
+  return writek(L, LUA_OK, 0);
+}
+
+
+/* close(fd): forget about and close a descriptor */
+static int async_close (lua_State *L) {
+  int fd = (int)luaL_checkinteger(L, 1);
+  Loop *lp = getloop(L);
+  if (fd < lp->sizefds) {
+    FdWait *w = &lp->fds[fd];
+    if (w->rref != LUA_NOREF || w->wref != LUA_NOREF)
+      return luaL_error(L, "descriptor %d is being waited on", fd);
+#if defined(l_useepoll)
+    if (w->armed) epoll_ctl(lp->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+    w->armed = 0;
+  }
+  if (close(fd) != 0)
+    return ioresult(L, "close");
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/* pipe(): non-blocking read and write ends */
+static int async_pipe (lua_State *L) {
+  int p[2];
+  if (pipe(p) != 0)
+    return ioresult(L, "pipe");
+  setnonblock(p[0]);
+  setnonblock(p[1]);
+  lua_pushinteger(L, p[0]);
+  lua_pushinteger(L, p[1]);
+  return 2;
+}
+
+
+static struct addrinfo *resolve (lua_State *L, const char *host,
+                                 lua_Integer port, int passive) {
+  struct addrinfo hints, *res;
+  char serv[32];
+  int err;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  snprintf(serv, sizeof(serv), "%d", (int)port);
+  err = getaddrinfo(host, serv, &hints, &res);
+  if (err != 0)
+    luaL_error(L, "cannot resolve '%s': %s", host ? host : "*",
+               gai_strerror(err));
+  return res;
+}
+
+
+/* listen(host, port [, backlog]): a non-blocking listening socket and its port */
+static int async_listen (lua_State *L) {
+  const char *host = luaL_optstring(L, 1, NULL);
+  lua_Integer port = luaL_checkinteger(L, 2);
+  int backlog = (int)luaL_optinteger(L, 3, 1024);
+  struct addrinfo *res = resolve(L, (host && *host && strcmp(host, "*") != 0) ? host : NULL, port, 1);
+  struct addrinfo *ai;
+  int fd = -1, one = 1;
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, backlog) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    return ioresult(L, "listen");
+  setnonblock(fd);
+  lua_pushinteger(L, fd);
+  {  /* report the port actually bound, for port 0 */
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+    lua_Integer bound = port;
+    if (getsockname(fd, (struct sockaddr *)&sa, &len) == 0) {
+      if (sa.ss_family == AF_INET)
+        bound = ntohs(((struct sockaddr_in *)&sa)->sin_port);
+      else if (sa.ss_family == AF_INET6)
+        bound = ntohs(((struct sockaddr_in6 *)&sa)->sin6_port);
+    }
+    lua_pushinteger(L, bound);
+  }
+  return 2;
+}
+
+
+/* accept(fd): the next connection, as a non-blocking descriptor */
+static int acceptk (lua_State *L, int status, lua_KContext ctx) {
+  int fd = (int)luaL_checkinteger(L, 1);
+  int c;
+  (void)status; (void)ctx;
+  do {
+    c = accept(fd, NULL, NULL);
+  } while (c < 0 && errno == EINTR);
+  if (c < 0) {
+    if (wouldblock(errno))
+      return parkfd(L, "accept", fd, 0, 0, acceptk);
+    return ioresult(L, "accept");
+  }
+  setnonblock(c);
+  lua_pushinteger(L, c);
+  return 1;
+}
+
+static int async_accept (lua_State *L) {
+  return acceptk(L, LUA_OK, 0);
+}
+
+
+/* connect(host, port): a connected non-blocking socket */
+static int connectk (lua_State *L, int status, lua_KContext ctx) {
+  int fd = (int)ctx, err = 0;
+  socklen_t len = sizeof(err);
+  (void)status;
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+    close(fd);
+    errno = err ? err : errno;
+    return ioresult(L, "connect");
+  }
+  lua_pushinteger(L, fd);
+  return 1;
+}
+
+static int async_connect (lua_State *L) {
+  const char *host = luaL_checkstring(L, 1);
+  lua_Integer port = luaL_checkinteger(L, 2);
+  struct addrinfo *res = resolve(L, host, port, 0);
+  struct addrinfo *ai;
+  int fd = -1, one = 1;
+  for (ai = res; ai != NULL; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    setnonblock(fd);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  if (fd < 0)
+    return ioresult(L, "connect");
+  return parkfd(L, "connect", fd, 1, (lua_KContext)fd, connectk);
+}
+
+#endif
+
+
+/*
+** recv(ch): the next value from a 'thread.channel', or nil once it is
+** closed and empty. While parked the task watches the channel through
+** the loop's self-pipe; the context tells whether it is watching. The
+** task's record keeps the channel ('chan') and the loop counts its
+** watches, so that 'cancel' and the loop's finalizer can undo them.
+*/
+static int tryrecv (lua_State *L) {
+  lua_settop(L, 1);
+  lua_getfield(L, 1, "try_recv");
+  lua_pushvalue(L, 1);
+  lua_call(L, 1, 2);
+  if (lua_isnil(L, 2) && !lua_toboolean(L, 3))
+    return 0;  /* empty */
+  lua_settop(L, 2);
+  return 1;
+}
+
+
+/* (un)register the self-pipe with the channel at 'idx' */
+static void chanwatch (lua_State *L, Loop *lp, int idx, int on) {
+  lua_Integer n;
+  idx = lua_absindex(L, idx);
+  lua_getfield(L, idx, on ? "watch" : "unwatch");
+  lua_pushvalue(L, idx);
+  lua_pushinteger(L, lp->wake[1]);
+  lua_call(L, 2, 0);
+  pushuv(L, UV_CHANS);
+  lua_pushvalue(L, idx);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -3);
+  n = lua_tointeger(L, -1) + (on ? 1 : -1);
+  lua_pop(L, 1);
+  if (n > 0) lua_pushinteger(L, n);
+  else lua_pushnil(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+
+/* the running task starts or stops watching channel 1 */
+static void watch (lua_State *L, Loop *lp, int on) {
+  chanwatch(L, lp, 1, on);
+  lua_pushthread(L);
+  pushrecord(L, -1);
+  if (on) lua_pushvalue(L, 1);
+  else lua_pushnil(L);
+  lua_setfield(L, -2, "chan");
+  lua_pop(L, 2);
+}
+
+
+static int recvk (lua_State *L, int status, lua_KContext ctx) {
+  Loop *lp = getloop(L);
+  int ref;
+  (void)status;
+  if (tryrecv(L)) {
+    if (ctx) {
+      watch(L, lp, 0);
+    }
+    return 1;
+  }
+#if defined(l_noio)
+  (void)ref;
+  return luaL_error(L, "'asyncio.recv' is not supported on this platform");
+#else
+  ref = selfref(L, "recv");
+  if (!ctx) {
+    if (lp->wake[0] < 0) {  /* first channel wait: create the self-pipe */
+      if (pipe(lp->wake) != 0)
+        return luaL_error(L, "cannot create wake-up pipe: %s", strerror(errno));
+      setnonblock(lp->wake[0]);
+      setnonblock(lp->wake[1]);
+#if defined(l_useepoll)
+      {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u64 = 0;
+        ev.data.fd = lp->wake[0];
+        epoll_ctl(lp->epfd, EPOLL_CTL_ADD, lp->wake[0], &ev);
+      }
+#endif
+    }
+    lua_settop(L, 1);
+    watch(L, lp, 1);
+    if (tryrecv(L)) {  /* a value arrived before the watch took effect */
+      watch(L, lp, 0);
+      return 1;
+    }
+  }
+  if (lp->nchanwaits == lp->sizechanwaits)
+    lp->chanwaits = (int *)growarray(L, lp->chanwaits, &lp->sizechanwaits,
+                                     sizeof(int), 16);
+  lp->chanwaits[lp->nchanwaits++] = ref;
+  lua_settop(L, 1);
+  lua_pushlightuserdata(L, WAITING);
+  return lua_yieldk(L, 1, 1, recvk);
+#endif
+}
+
+static int async_recv (lua_State *L) {
+  luaL_checkany(L, 1);
+  return recvk(L, LUA_OK, 0);
+}
+
+
+/* status(task): "running", "done" or nil if it is not a task */
+static int async_status (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTHREAD);
+  if (!pushrecord(L, 1))
+    luaL_pushfail(L);
+  else {
+    lua_getfield(L, -1, "done");
+    lua_pushstring(L, lua_toboolean(L, -1) ? "done" : "running");
+  }
+  return 1;
+}
+
+/*
+** cancel(task): stop a parked task. Whatever it waits for is forgotten,
+** its pending to-be-closed variables are closed and it finishes with
+** (nil, "cancelled"), which is what awaiting it gives. Returns false if
+** the task had already finished.
+*/
+static int async_cancel (lua_State *L) {
+  Loop *lp = getloop(L);
+  lua_State *co;
+  int rec, ref, i, j;
+  luaL_checktype(L, 1, LUA_TTHREAD);
+  co = lua_tothread(L, 1);
+  lua_settop(L, 1);
+  if (!pushrecord(L, 1))
+    return luaL_argerror(L, 1, "not a task");
+  rec = 2;
+  if (lua_getfield(L, rec, "done") == LUA_TBOOLEAN) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  if (lua_status(co) != LUA_YIELD)
+    return luaL_error(L, "cannot cancel a running task");
+  lua_getfield(L, rec, "ref");
+  ref = (int)lua_tointeger(L, -1);
+  lua_settop(L, rec);
+  /* forget its waits; the loop skips ready entries set to LUA_NOREF */
+  for (i = 0; i < lp->nready; i++) {
+    Ready *r = &lp->ready[(lp->firstready + i) % lp->sizeready];
+    if (r->ref == ref) r->ref = LUA_NOREF;
+  }
+  droptimers(lp, ref);
+  for (i = 0; i < lp->sizefds; i++) {
+    FdWait *w = &lp->fds[i];
+    if (w->rref == ref) { w->rref = LUA_NOREF; lp->nfdwaits--; }
+    if (w->wref == ref) { w->wref = LUA_NOREF; lp->nfdwaits--; }
+  }
+  for (i = j = 0; i < lp->nchanwaits; i++) {
+    if (lp->chanwaits[i] != ref) lp->chanwaits[j++] = lp->chanwaits[i];
+  }
+  lp->nchanwaits = j;
+  if (lua_getfield(L, rec, "chan") != LUA_TNIL)
+    chanwatch(L, lp, -1, 0);
+  lua_pop(L, 1);
+  /* a task it awaits must not wake it */
+  pushuv(L, UV_TASKS);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (lua_getfield(L, -1, "joiners") == LUA_TTABLE) {
+      int n = (int)lua_rawlen(L, -1);
+      for (i = j = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+        if (lua_tointeger(L, -1) != ref) lua_rawseti(L, -2, j++);
+        else lua_pop(L, 1);
+      }
+      for (; j <= n; j++) {
+        lua_pushnil(L);
+        lua_rawseti(L, -2, j);
+      }
+    }
+    lua_pop(L, 2);
+  }
+  lua_settop(L, 1);
+  lua_closethread(co, L);
+  lua_settop(co, 0);
+  lua_pushnil(co);
+  lua_pushliteral(co, "cancelled");
+  finish(L, lp, co, 2, 1);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static int loop_gc (lua_State *L) {
+  Loop *lp = (Loop *)lua_touserdata(L, 1);
+#if !defined(l_noio)
+  if (lp->wake[1] >= 0) {  /* channels must not write to the closed pipe */
+    lua_getiuservalue(L, 1, UV_CHANS);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_Integer n = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      while (n-- > 0) {
+        lua_getfield(L, -1, "unwatch");
+        lua_pushvalue(L, -2);
+        lua_pushinteger(L, lp->wake[1]);
+        lua_call(L, 2, 0);
+      }
+    }
+    lua_pop(L, 1);
+  }
+  if (lp->epfd >= 0) close(lp->epfd);
+  if (lp->wake[0] >= 0) { close(lp->wake[0]); close(lp->wake[1]); }
+#endif
+  free(lp->timers);
+  free(lp->fds);
+  free(lp->ready);
+  free(lp->chanwaits);
+  memset(lp, 0, sizeof(Loop));
+  lp->epfd = lp->wake[0] = lp->wake[1] = -1;
+  return 0;
+}
+
+
+static const luaL_Reg async_funcs[] = {
+  {"spawn", async_spawn},
+  {"run", async_run},
+  {"sleep", async_sleep},
+  {"now", async_now},
+  {"recv", async_recv},
+  {"status", async_status},
+  {"cancel", async_cancel},
+#if !defined(l_noio)
+  {"readable", async_readable},
+  {"writable", async_writable},
+  {"read", async_read},
+  {"write", async_write},
+  {"close", async_close},
+  {"pipe", async_pipe},
+  {"listen", async_listen},
+  {"accept", async_accept},
+  {"connect", async_connect},
+#endif
+  {NULL, NULL}
+};
+
+
+static void createloop (lua_State *L) {
+  Loop *lp = (Loop *)lua_newuserdatauv(L, sizeof(Loop), 3);
+  memset(lp, 0, sizeof(Loop));
+  lp->epfd = lp->wake[0] = lp->wake[1] = -1;
+#if defined(l_useepoll)
+  lp->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (lp->epfd < 0)
+    luaL_error(L, "cannot create epoll instance: %s", strerror(errno));
+#endif
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, UV_REFS);
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, UV_CHANS);
+  lua_newtable(L);  /* task records, collected with their coroutines */
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_setiuservalue(L, -2, UV_TASKS);
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, loop_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, LOOPKEY);
+}
+
+
+LUAMOD_API int luaopen_asyncio (lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, LOOPKEY) != LUA_TUSERDATA)
+    createloop(L);
+  lua_pop(L, 1);
+  luaL_newlib(L, async_funcs);
+#if defined(l_useepoll)
+  lua_pushliteral(L, "epoll");
+#elif defined(l_noio)
+  lua_pushliteral(L, "timers");
+#else
+  lua_pushliteral(L, "poll");
+#endif
+  lua_setfield(L, -2, "backend");
+  lua_pushcfunction(L, async_spawn);  /* used to start 'async' functions */
+  lua_setfield(L, LUA_REGISTRYINDEX, SPAWNKEY);
+  return 1;
+}
@@ -1507,6 +1507,70 @@ LUALIB_API lua_State *(luaL_newstate) (void) {
 }
 
 
+/*
+** {======================================================
+** State cloning
+** =======================================================
+*/
+
+/*
+** 'luaL_clonestate' builds a new state by opening its libraries and
+** then copying into it, with 'lua_clonestate', everything reachable
+** from the registry of the source state. What the libraries created in
+** both states is matched rather than copied, so the cost is opening
+** the libraries plus copying what the template added to them.
+*/
+
+typedef struct CloneState {
+  lua_State *L;  /* source state */
+  int n;  /* number of values on top of 'L' to copy too */
+  void (*openlibs) (lua_State *L);
+} CloneState;
+
+
+static int doclone (lua_State *L1) {
+  CloneState *cs = (CloneState *)lua_touserdata(L1, 1);
+  lua_gc(L1, LUA_GCSTOP);
+  if (cs->openlibs)
+    cs->openlibs(L1);
+  lua_settop(L1, 0);
+  lua_clonestate(cs->L, L1, cs->n);
+  lua_gc(L1, LUA_GCRESTART);
+  return cs->n;
+}
+
+
+LUALIB_API lua_State *luaL_clonestate (lua_State *L, int n,
+                                       void (*openlibs) (lua_State *L)) {
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  lua_State *L1 = lua_newstate(f, ud, luaL_makeseed(L));
+  CloneState cs;
+  int top = lua_gettop(L);
+  if (l_unlikely(L1 == NULL)) {
+    lua_pushliteral(L, "not enough memory");
+    return NULL;
+  }
+  lua_atpanic(L1, &panic);
+  lua_setwarnf(L1, warnfon, L1);
+  cs.L = L;
+  cs.n = n;
+  cs.openlibs = openlibs;
+  lua_pushcfunction(L1, doclone);
+  lua_pushlightuserdata(L1, &cs);
+  if (lua_pcall(L1, 1, n, 0) != LUA_OK) {
+    const char *msg = lua_tostring(L1, -1);
+    lua_settop(L, top);
+    lua_pushstring(L, msg ? msg : "error cloning state");
+    lua_close(L1);
+    return NULL;
+  }
+  return L1;
+}
+
+/* }====================================================== */
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
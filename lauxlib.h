@@ -369,6 +369,26 @@ LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
  */
 LUALIB_API lua_State *(luaL_newstate) (void);
 
+/**
+ * @brief Creates a new state that is a copy of another one.
+ *
+ * Opens the libraries of the new state with 'openlibs' (which should be
+ * the function used for 'L') and copies into it the rest of what is
+ * reachable from the registry of 'L', plus the 'n' values on top of the
+ * stack of 'L', whose copies are left on the stack of the new state.
+ * Threads, tables with C finalizers and slice views cannot be copied, nor
+ * can full userdata, whose blocks may hold pointers into 'L', unless
+ * their metatable sets '__clone' to true (and has no '__gc'): then the
+ * block is copied byte for byte.
+ *
+ * @param L The state to copy.
+ * @param n Number of values on the stack of 'L' to copy too.
+ * @param openlibs Function that opens the libraries (or NULL).
+ * @return The new state, or NULL with an error message pushed onto 'L'.
+ */
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *L, int n,
+                                         void (*openlibs) (lua_State *L));
+
 /**
  * @brief Computes a seed for pseudo-random number generation.
  *
@@ -702,6 +722,19 @@ LUALIB_API void (luaL_pushresultsize) (luaL_Buffer *B, size_t sz);
  */
 LUALIB_API char *(luaL_buffinitsize) (lua_State *L, luaL_Buffer *B, size_t sz);
 
+/**
+ * @brief Unpacks binary data like string.unpack, reading directly from a C buffer.
+ *
+ * @param L The Lua state.
+ * @param fmt Format string (same options as string.unpack).
+ * @param data Start of the buffer.
+ * @param ld Length of the buffer.
+ * @param pos 0-based position to start reading at.
+ * @return Number of values pushed: the unpacked values followed by the 1-based position after the last byte read.
+ */
+LUALIB_API int (luaL_unpackbuff) (lua_State *L, const char *fmt,
+                                  const char *data, size_t ld, size_t pos);
+
 /* compatibility with old module system */
 #if defined(LUA_COMPAT_MODULE)
 //mod DifierLine
@@ -414,6 +414,65 @@ static int pushmode (lua_State *L, int oldmode) {
 }
 
 
+/*
+** 'collectgarbage("stats" [, after])': the collector records newer than
+** sequence number 'after', oldest first, as a list of tables. (This
+** option is not a 'lua_gc' one; records come from 'lua_gcstats'.)
+*/
+#define GCSTATSOPT	(-1)
+
+static void pushgcrecord (lua_State *L, const lua_GCStat *r) {
+  static const char *const kinds[] = {"incstep", "young", "atomic2gen",
+                                      "genfull", "fullinc"};
+  static const char *const types[LUA_NUMTYPES + 2] = {
+    "nil", "boolean", "lightuserdata", "number", "string", "table",
+    "function", "userdata", "thread", "struct", "pointer", "concept",
+    "namespace", "superstruct", "upvalue", "proto"};
+  int t;
+  lua_createtable(L, 0, 10);
+  lua_pushinteger(L, (lua_Integer)r->seq);
+  lua_setfield(L, -2, "seq");
+  lua_pushstring(L, kinds[r->kind]);
+  lua_setfield(L, -2, "kind");
+  lua_pushnumber(L, (lua_Number)r->nanos / 1e9);
+  lua_setfield(L, -2, "time");
+  lua_pushinteger(L, (lua_Integer)r->allocated);
+  lua_setfield(L, -2, "allocated");
+  lua_pushinteger(L, (lua_Integer)r->freed);
+  lua_setfield(L, -2, "freed");
+  lua_pushinteger(L, (lua_Integer)r->heap);
+  lua_setfield(L, -2, "heap");
+  lua_pushinteger(L, (lua_Integer)r->finalizers);
+  lua_setfield(L, -2, "finalizers");
+  lua_pushnumber(L, (lua_Number)r->finnanos / 1e9);
+  lua_setfield(L, -2, "fintime");
+  lua_newtable(L);
+  for (t = 0; t < LUA_NUMTYPES + 2; t++) {
+    if (r->swept[t] != 0) {
+      lua_pushinteger(L, (lua_Integer)r->swept[t]);
+      lua_setfield(L, -2, types[t]);
+    }
+  }
+  lua_setfield(L, -2, "swept");
+}
+
+static int pushgcstats (lua_State *L) {
+  lua_GCStat ar[16];
+  lua_Unsigned after = (lua_Unsigned)luaL_optinteger(L, 2, 0);
+  int n, i, k = 0;
+  lua_newtable(L);
+  do {  /* copy in chunks, continuing after the last record seen */
+    n = lua_gcstats(L, ar, 16, after);
+    for (i = 0; i < n; i++) {
+      pushgcrecord(L, &ar[i]);
+      lua_rawseti(L, -2, ++k);
+    }
+    if (n > 0) after = ar[n - 1].seq;
+  } while (n == 16);
+  return 1;
+}
+
+
 /*
 ** check whether call to 'lua_gc' was valid (not inside a finalizer)
 */
@@ -422,10 +481,12 @@ static int pushmode (lua_State *L, int oldmode) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", "param",NULL};
+    "isrunning", "generational", "incremental", "param", "bgfree", "stats",
+    "threadpool", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,LUA_GCPARAM};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC,LUA_GCPARAM, LUA_GCBGFREE, GCSTATSOPT,
+    LUA_GCTHREADPOOL};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -467,6 +528,21 @@ static int luaB_collectgarbage (lua_State *L) {
       int stepsize = (int)luaL_optinteger(L, 4, 0);
       return pushmode(L, lua_gc(L, o, pause, stepmul, stepsize));
     }
+    case GCSTATSOPT:
+      return pushgcstats(L);
+    case LUA_GCBGFREE: {
+      int res = lua_gc(L, o, lua_toboolean(L, 2));
+      checkvalres(res);  /* also when the thread cannot be started */
+      lua_pushboolean(L, res);
+      return 1;
+    }
+    case LUA_GCTHREADPOOL: {
+      lua_Integer limit = luaL_optinteger(L, 2, -1);
+      int res = lua_gc(L, o, (int)(limit > INT_MAX ? INT_MAX : limit));
+      checkvalres(res);
+      lua_pushinteger(L, res);
+      return 1;
+    }
     case LUA_GCPARAM: {
       static const char *const params[] = {
         "minormul", "majorminor", "minormajor",
@@ -2177,43 +2253,17 @@ static int do_file_test(const char *path, int op_type) {
 */
 static int async_start(lua_State *L) {
     int n = lua_gettop(L);
-    lua_State *co = lua_newthread(L);
-    lua_insert(L, 1); /* Move thread to bottom (stack: thread, arg1, arg2...) */
-
-    /* Get wrapper from registry */
-    lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
-    if (lua_isnil(L, -1)) {
+    /* tasks are run by the event loop of the 'async' library */
+    if (lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_SPAWN") != LUA_TFUNCTION) {
         lua_pop(L, 1);
-        /* Create wrapper if not exists (lazy init) */
-        if (luaL_dostring(L, "return function(f, ...) coroutine.yield(); return f(...) end") != LUA_OK) {
-            return lua_error(L);
-        }
-        lua_pushvalue(L, -1);
-        lua_setfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
+        luaL_requiref(L, LUA_ASYNCLIBNAME, luaopen_asyncio, 0);
+        lua_pop(L, 1);
+        lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_SPAWN");
     }
-    lua_xmove(L, co, 1);
-
-    /* Push function */
+    lua_insert(L, 1);
     lua_pushvalue(L, lua_upvalueindex(1));
-    lua_xmove(L, co, 1);
-
-    /* Move arguments */
-    lua_xmove(L, co, n);
-
-    int nres;
-    int status = lua_resume(co, L, n + 1, &nres);
-
-    if (status != LUA_YIELD) {
-        if (status != LUA_OK) {
-            lua_xmove(co, L, 1);
-            return lua_error(L);
-        }
-    }
-
-    if (nres > 0) {
-        lua_pop(co, nres);
-    }
-
+    lua_insert(L, 2);
+    lua_call(L, n + 1, 1);  /* spawn(f, ...) */
     return 1;
 }
 
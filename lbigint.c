@@ -1,13 +1,21 @@
+/*
+** $Id: lbigint.c $
+** Big integers
+** See Copyright Notice in lua.h
+*/
+
 #define lbigint_c
 #define LUA_CORE
 
 #include "lprefix.h"
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "lua.h"
+#include "lctype.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lgc.h"
@@ -17,369 +25,1156 @@
 #include "lvm.h"
 #include "ldebug.h"
 
-#define BIGINT_BASE_BITS 32
-#define BIGINT_BASE ((l_uint64)1 << BIGINT_BASE_BITS)
 
-TBigInt *luaB_new(lua_State *L, unsigned int len) {
-  size_t size = sizeof(TBigInt) + (len > 0 ? (len - 1) : 0) * sizeof(l_uint32);
-  GCObject *o = luaC_newobj(L, LUA_VNUMBIG, size);
-  TBigInt *b = gco2big(o);
-  b->len = len;
-  b->sign = 1;
-  memset(b->buff, 0, len * sizeof(l_uint32));
-  return b;
+/*
+** Big integers are kept in sign-magnitude form with 64-bit limbs, least
+** significant limb first. A value that fits in a lua_Integer is never a
+** big integer: every operation hands such results back as integers, so
+** an integer and a big integer are never equal.
+**
+** The arithmetic works on plain limb arrays ("mpn" functions, after
+** GMP). Operands are read in place (integers through a one-limb buffer
+** on the C stack) and all intermediate values live in a per-state
+** scratch area that grows on demand and is reused by later operations,
+** so an operation allocates only its result.
+*/
+
+typedef l_uint64 limb;
+
+#define LIMBBITS	64
+#define LIMBMAX		(~(limb)0)
+
+/* operand sizes (in limbs) where the faster algorithms take over */
+#define KARATSUBA_THRESHOLD	32
+#define DCRADIX_THRESHOLD	30
+
+/* largest power of 10 in a limb, and its number of digits */
+#define TEN19		((limb)10000000000000000000ULL)
+#define TEN19DIGITS	19
+
+/* limit for the size of a big integer, in limbs */
+#define MAXLIMBS	(MAX_SIZE / sizeof(limb) / 32)
+
+
+/*
+** {======================================================
+** Limb primitives
+** =======================================================
+*/
+
+#if defined(__SIZEOF_INT128__)
+
+typedef unsigned __int128 dlimb;
+
+/* returns the low limb of 'a * b' and stores the high limb in '*hi' */
+static limb mul64 (limb a, limb b, limb *hi) {
+  dlimb p = (dlimb)a * b;
+  *hi = (limb)(p >> LIMBBITS);
+  return (limb)p;
 }
 
-static void big_normalize(TBigInt *b) {
-  while (b->len > 0 && b->buff[b->len - 1] == 0) {
-    b->len--;
-  }
-  if (b->len == 0) b->sign = 1; /* Zero is always positive */
+/* '(u1:u0) / d', for 'u1 < d'; stores the remainder in '*r' */
+static limb div128 (limb u1, limb u0, limb d, limb *r) {
+  dlimb n = ((dlimb)u1 << LIMBBITS) | u0;
+  limb q = (limb)(n / d);
+  *r = u0 - q * d;
+  return q;
 }
 
-/* Copies src to dst (allocated). dst must be large enough. */
-static void big_copy(TBigInt *dst, const TBigInt *src) {
-  dst->sign = src->sign;
-  dst->len = src->len;
-  if (src->len > 0)
-    memcpy(dst->buff, src->buff, src->len * sizeof(l_uint32));
+#else
+
+static limb mul64 (limb a, limb b, limb *hi) {
+  limb a0 = a & 0xFFFFFFFFu, a1 = a >> 32;
+  limb b0 = b & 0xFFFFFFFFu, b1 = b >> 32;
+  limb p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+  limb mid = (p00 >> 32) + (p01 & 0xFFFFFFFFu) + (p10 & 0xFFFFFFFFu);
+  *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+  return (mid << 32) | (p00 & 0xFFFFFFFFu);
 }
 
-void luaB_fromint(lua_State *L, lua_Integer i, TValue *res) {
-  TBigInt *b = luaB_new(L, 2); /* 64-bit int fits in 2 32-bit limbs */
-  if (i < 0) {
-    b->sign = -1;
-    /* Handle min integer specially or just negate */
-    if (i == LUA_MININTEGER) {
-        /* -(-2^63) = 2^63. 0x8000...000 */
-        /* 2^63 in base 2^32 is: low=0, high=0x80000000 */
-        b->buff[0] = 0;
-        b->buff[1] = 0x80000000;
-        b->len = 2;
-        setbigvalue(L, res, b);
-        return;
-    }
-    i = -i;
-  } else {
-    b->sign = 1;
+/* 'd' must be normalized (top bit set); Hacker's Delight, divlu */
+static limb div128 (limb u1, limb u0, limb d, limb *r) {
+  const limb b = (limb)1 << 32;
+  limb dn1 = d >> 32, dn0 = d & 0xFFFFFFFFu;
+  limb un1 = u0 >> 32, un0 = u0 & 0xFFFFFFFFu;
+  limb q1 = u1 / dn1, rhat = u1 - q1 * dn1;
+  limb un21, q0;
+  while (q1 >= b || q1 * dn0 > b * rhat + un1) {
+    q1--; rhat += dn1;
+    if (rhat >= b) break;
   }
+  un21 = u1 * b + un1 - q1 * d;
+  q0 = un21 / dn1; rhat = un21 - q0 * dn1;
+  while (q0 >= b || q0 * dn0 > b * rhat + un0) {
+    q0--; rhat += dn1;
+    if (rhat >= b) break;
+  }
+  *r = un21 * b + un0 - q0 * d;
+  return q1 * b + q0;
+}
 
-  l_uint64 ui = (l_uint64)i;
-  b->buff[0] = (l_uint32)(ui & 0xFFFFFFFF);
-  b->buff[1] = (l_uint32)(ui >> 32);
-  big_normalize(b);
-  setbigvalue(L, res, b);
+#endif
+
+
+static int clz64 (limb x) {
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x & ((limb)1 << (LIMBBITS - 1)))) { x <<= 1; n++; }
+  return n;
+#endif
 }
 
-/* Helper: Get a BigInt view of a TValue.
-   If it's an integer, allocate a temporary BigInt, push it to stack, and return it.
-   Returns NULL if conversion fails.
-   'pushes' is incremented if a value is pushed to stack.
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Natural numbers on limb arrays
+** =======================================================
 */
-static TBigInt *to_bigint(lua_State *L, TValue *v, int *pushes) {
-  if (ttisbigint(v)) {
-    return bigvalue(v);
-  } else if (ttisinteger(v)) {
-    TBigInt *b = luaB_new(L, 2);
-    setbigvalue(L, s2v(L->top.p), b);
-    L->top.p++; /* anchor */
-    (*pushes)++;
 
-    lua_Integer i = ivalue(v);
-    if (i < 0) {
-      b->sign = -1;
-      if (i == LUA_MININTEGER) {
-        b->buff[0] = 0; b->buff[1] = 0x80000000; b->len = 2;
-        return b;
-      }
-      i = -i;
-    } else {
-      b->sign = 1;
-    }
-    b->buff[0] = (l_uint32)((l_uint64)i & 0xFFFFFFFF);
-    b->buff[1] = (l_uint32)((l_uint64)i >> 32);
-    big_normalize(b);
-    return b;
-  }
-  return NULL;
+/* number of significant limbs of 'a[0..n)' */
+static unsigned int mpn_len (const limb *a, unsigned int n) {
+  while (n > 0 && a[n - 1] == 0) n--;
+  return n;
 }
 
-/* Compare magnitudes. Returns -1 if |a| < |b|, 0 if equal, 1 if |a| > |b| */
-static int cmp_abs(const TBigInt *a, const TBigInt *b) {
-  if (a->len != b->len) return a->len < b->len ? -1 : 1;
-  for (int i = a->len - 1; i >= 0; i--) {
-    if (a->buff[i] != b->buff[i]) return a->buff[i] < b->buff[i] ? -1 : 1;
+
+static int mpn_cmp (const limb *a, unsigned int an,
+                    const limb *b, unsigned int bn) {
+  an = mpn_len(a, an);
+  bn = mpn_len(b, bn);
+  if (an != bn) return (an < bn) ? -1 : 1;
+  while (an-- > 0) {
+    if (a[an] != b[an]) return (a[an] < b[an]) ? -1 : 1;
   }
   return 0;
 }
 
-int luaB_compare(TValue *v1, TValue *v2) {
-  /* Assumes v1 and v2 are BigInt or Integer */
-  /* We can't easily use to_bigint here because we don't have L for allocation if needed.
-     But wait, if we are in luaB_compare, one of them MUST be BigInt (dispatch logic).
-     Actually we generally need L to allocate temporary bigints for comparison if mixed.
-     But we can do "virtual" comparison without allocation. */
-
-  int s1, s2;
-  unsigned int l1, l2;
-  l_uint32 buf1[2], buf2[2]; /* For integer conversion */
-  const l_uint32 *d1, *d2;
-
-  if (ttisbigint(v1)) {
-    TBigInt *b = bigvalue(v1);
-    s1 = b->sign; l1 = b->len; d1 = b->buff;
-  } else {
-    lua_Integer i = ivalue(v1);
-    if (i < 0) { s1 = -1; if (i!=LUA_MININTEGER) i = -i; } else s1 = 1;
-    if (i == 0) l1 = 0;
-    else if (i == LUA_MININTEGER) { buf1[0]=0; buf1[1]=0x80000000; l1=2; }
-    else {
-        buf1[0] = (l_uint32)i; buf1[1] = (l_uint32)(i>>32);
-        l1 = (buf1[1] != 0) ? 2 : 1;
-    }
-    d1 = buf1;
+
+static limb mpn_add_n (limb *r, const limb *a, const limb *b, unsigned int n) {
+  limb c = 0;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    limb s = a[i] + c;
+    c = (s < c);
+    s += b[i];
+    c += (s < b[i]);
+    r[i] = s;
   }
+  return c;
+}
 
-  if (ttisbigint(v2)) {
-    TBigInt *b = bigvalue(v2);
-    s2 = b->sign; l2 = b->len; d2 = b->buff;
-  } else {
-    lua_Integer i = ivalue(v2);
-    if (i < 0) { s2 = -1; if (i!=LUA_MININTEGER) i = -i; } else s2 = 1;
-    if (i == 0) l2 = 0;
-    else if (i == LUA_MININTEGER) { buf2[0]=0; buf2[1]=0x80000000; l2=2; }
-    else {
-        buf2[0] = (l_uint32)i; buf2[1] = (l_uint32)(i>>32);
-        l2 = (buf2[1] != 0) ? 2 : 1;
-    }
-    d2 = buf2;
+
+/* r = a + b, for 'an >= bn'; returns the carry */
+static limb mpn_add (limb *r, const limb *a, unsigned int an,
+                     const limb *b, unsigned int bn) {
+  limb c = mpn_add_n(r, a, b, bn);
+  unsigned int i;
+  for (i = bn; i < an; i++) {
+    limb s = a[i] + c;
+    c = (s < c);
+    r[i] = s;
   }
+  return c;
+}
 
-  if (s1 != s2) return s1 < s2 ? -1 : 1;
 
-  int cmp = 0;
-  if (l1 != l2) cmp = l1 < l2 ? -1 : 1;
-  else {
-    for (int i = l1 - 1; i >= 0; i--) {
-      if (d1[i] != d2[i]) { cmp = d1[i] < d2[i] ? -1 : 1; break; }
-    }
+static limb mpn_sub_n (limb *r, const limb *a, const limb *b, unsigned int n) {
+  limb c = 0;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    limb x = a[i], y = b[i];
+    limb d = x - y;
+    limb c1 = (x < y) | (d < c);
+    r[i] = d - c;
+    c = c1;
   }
+  return c;
+}
 
-  return s1 == 1 ? cmp : -cmp;
+
+/* r = a - b, for 'an >= bn'; returns the borrow */
+static limb mpn_sub (limb *r, const limb *a, unsigned int an,
+                     const limb *b, unsigned int bn) {
+  limb c = mpn_sub_n(r, a, b, bn);
+  unsigned int i;
+  for (i = bn; i < an; i++) {
+    limb x = a[i];
+    r[i] = x - c;
+    c = (x < c);
+  }
+  return c;
 }
 
-/* dst = |a| + |b| */
-static void add_abs(TBigInt *dst, const TBigInt *a, const TBigInt *b) {
-  unsigned int len = a->len > b->len ? a->len : b->len;
-  l_uint64 carry = 0;
-  for (unsigned int i = 0; i < len || carry; i++) {
-    l_uint64 sum = carry;
-    if (i < a->len) sum += a->buff[i];
-    if (i < b->len) sum += b->buff[i];
-    dst->buff[i] = (l_uint32)sum;
-    carry = sum >> 32;
+
+/* r = a * m; returns the carry limb */
+static limb mpn_mul_1 (limb *r, const limb *a, unsigned int n, limb m) {
+  limb c = 0;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    limb hi, lo = mul64(a[i], m, &hi);
+    lo += c;
+    hi += (lo < c);
+    r[i] = lo;
+    c = hi;
   }
-  dst->len = len + (carry ? 1 : 0);
-  if (dst->buff[dst->len-1] == 0 && dst->len > 0) big_normalize(dst); /* Should generally not happen in add unless 0 */
-  else {
-      /* Re-check len if carry caused extension */
-      if (dst->buff[len] != 0) dst->len = len + 1;
-      else dst->len = len;
+  return c;
+}
+
+
+/* r += a * m; returns the carry limb */
+static limb mpn_addmul_1 (limb *r, const limb *a, unsigned int n, limb m) {
+  limb c = 0;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    limb hi, lo = mul64(a[i], m, &hi);
+    lo += c;
+    hi += (lo < c);
+    lo += r[i];
+    hi += (lo < r[i]);
+    r[i] = lo;
+    c = hi;
   }
-  big_normalize(dst);
+  return c;
 }
 
-/* dst = |a| - |b|. Assumes |a| >= |b| */
-static void sub_abs(TBigInt *dst, const TBigInt *a, const TBigInt *b) {
-  long long borrow = 0;
-  for (unsigned int i = 0; i < a->len; i++) {
-    long long diff = (long long)a->buff[i] - borrow;
-    if (i < b->len) diff -= b->buff[i];
 
-    if (diff < 0) {
-      diff += BIGINT_BASE;
-      borrow = 1;
-    } else {
-      borrow = 0;
-    }
-    dst->buff[i] = (l_uint32)diff;
+/* r -= a * m; returns the borrow limb */
+static limb mpn_submul_1 (limb *r, const limb *a, unsigned int n, limb m) {
+  limb c = 0;
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    limb hi, lo = mul64(a[i], m, &hi);
+    limb x = r[i];
+    lo += c;
+    hi += (lo < c);
+    r[i] = x - lo;
+    c = hi + (x < lo);
   }
-  dst->len = a->len;
-  big_normalize(dst);
+  return c;
 }
 
-void luaB_add(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  int pushes = 0;
-  TBigInt *b1 = to_bigint(L, v1, &pushes);
-  TBigInt *b2 = to_bigint(L, v2, &pushes);
-
-  if (b1 && b2) {
-    unsigned int max_len = (b1->len > b2->len ? b1->len : b2->len) + 1;
-    TBigInt *r = luaB_new(L, max_len);
-
-    if (b1->sign == b2->sign) {
-      add_abs(r, b1, b2);
-      r->sign = b1->sign;
-    } else {
-      int cmp = cmp_abs(b1, b2);
-      if (cmp >= 0) {
-        sub_abs(r, b1, b2);
-        r->sign = b1->sign;
-      } else {
-        sub_abs(r, b2, b1);
-        r->sign = b2->sign;
-      }
+
+/* r[0..an+bn) = a * b; 'r' must not overlap the operands */
+static void mpn_mul_basecase (limb *r, const limb *a, unsigned int an,
+                              const limb *b, unsigned int bn) {
+  unsigned int j;
+  r[an] = mpn_mul_1(r, a, an, b[0]);
+  for (j = 1; j < bn; j++)
+    r[an + j] = mpn_addmul_1(r + j, a, an, b[j]);
+}
+
+
+/* d = |a - b| for 'a' with 'n' limbs and 'b' with 'bn <= n'; 1 if a < b */
+static int mpn_absdiff (limb *d, const limb *a, unsigned int n,
+                        const limb *b, unsigned int bn) {
+  if (mpn_cmp(a, n, b, bn) >= 0) {
+    mpn_sub(d, a, n, b, bn);
+    return 0;
+  }
+  else {  /* a < b, so the limbs of 'a' above 'bn' are zero */
+    mpn_sub_n(d, b, a, bn);
+    memset(d + bn, 0, (n - bn) * sizeof(limb));
+    return 1;
+  }
+}
+
+
+/* scratch needed by 'mpn_kara' and 'mpn_mul' for operands of 'n' limbs */
+#define karaws(n)	(8 * (size_t)(n) + 64)
+#define mulws(n)	(20 * (size_t)(n) + 256)
+
+
+/*
+** Karatsuba: r[0..2n) = a[0..n) * b[0..n). With a = a1*B^h + a0 and
+** b = b1*B^h + b0, the middle term is z0 + z2 - (a0 - a1)*(b0 - b1).
+*/
+static void mpn_kara (limb *r, const limb *a, const limb *b, unsigned int n,
+                      limb *ws) {
+  unsigned int h, l;
+  limb *da, *db, *t, *m;
+  int neg;
+  if (n < KARATSUBA_THRESHOLD) {
+    mpn_mul_basecase(r, a, n, b, n);
+    return;
+  }
+  h = (n + 1) / 2;  /* size of the low halves */
+  l = n - h;  /* size of the high halves (l <= h) */
+  da = ws; db = ws + h; t = ws + 2 * h; m = ws + 4 * h;
+  neg = mpn_absdiff(da, a, h, a + h, l) ^ mpn_absdiff(db, b, h, b + h, l);
+  mpn_kara(t, da, db, h, m);  /* t = |a0 - a1| * |b0 - b1| */
+  mpn_kara(r, a, b, h, m);  /* z0 */
+  mpn_kara(r + 2 * h, a + h, b + h, l, m);  /* z2 */
+  memcpy(m, r, 2 * h * sizeof(limb));
+  m[2 * h] = mpn_add(m, m, 2 * h, r + 2 * h, 2 * l);  /* m = z0 + z2 */
+  if (neg)
+    m[2 * h] += mpn_add_n(m, m, t, 2 * h);
+  else
+    m[2 * h] -= mpn_sub_n(m, m, t, 2 * h);
+  mpn_add(r + h, r + h, 2 * n - h, m, 2 * h + 1);
+}
+
+
+/* r[0..an+bn) = a * b, for 'an >= bn >= 1'; 'ws' has 'mulws(bn)' limbs */
+static void mpn_mul (limb *r, const limb *a, unsigned int an,
+                     const limb *b, unsigned int bn, limb *ws) {
+  if (bn < KARATSUBA_THRESHOLD)
+    mpn_mul_basecase(r, a, an, b, bn);
+  else if (an == bn)
+    mpn_kara(r, a, b, bn, ws);
+  else {  /* multiply 'bn'-limb chunks of 'a' by 'b' */
+    limb *t = ws, *ws2 = ws + 2 * (size_t)bn;
+    unsigned int i;
+    memset(r, 0, ((size_t)an + bn) * sizeof(limb));
+    for (i = 0; an - i >= bn; i += bn) {
+      mpn_kara(t, a + i, b, bn, ws2);
+      mpn_add(r + i, r + i, an + bn - i, t, 2 * bn);
+    }
+    if (i < an) {
+      unsigned int rest = an - i;
+      mpn_mul(t, b, bn, a + i, rest, ws2);
+      mpn_add(r + i, r + i, an + bn - i, t, bn + rest);
     }
-    setbigvalue(L, res, r);
-  } else {
-    setnilvalue(res);
   }
-  L->top.p -= pushes;
 }
 
-void luaB_sub(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  int pushes = 0;
-  TBigInt *b1 = to_bigint(L, v1, &pushes);
-  TBigInt *b2 = to_bigint(L, v2, &pushes);
-
-  if (b1 && b2) {
-    unsigned int max_len = (b1->len > b2->len ? b1->len : b2->len) + 1;
-    TBigInt *r = luaB_new(L, max_len);
-
-    if (b1->sign != b2->sign) {
-      add_abs(r, b1, b2);
-      r->sign = b1->sign;
-    } else {
-      int cmp = cmp_abs(b1, b2);
-      if (cmp >= 0) {
-        sub_abs(r, b1, b2);
-        r->sign = b1->sign;
-      } else {
-        sub_abs(r, b2, b1);
-        r->sign = -b1->sign;
-      }
+
+/* q = a / d, returns a % d; 'q' may be 'a' */
+static limb mpn_divrem_1 (limb *q, const limb *a, unsigned int n, limb d) {
+  int s = clz64(d);
+  limb r;
+  unsigned int i;
+  if (n == 0) return 0;
+  d <<= s;
+  if (s == 0) {
+    r = 0;
+    for (i = n; i-- > 0; )
+      q[i] = div128(r, a[i], d, &r);
+  }
+  else {
+    r = a[n - 1] >> (LIMBBITS - s);
+    for (i = n; i-- > 0; ) {
+      limb u = (a[i] << s) | (i > 0 ? a[i - 1] >> (LIMBBITS - s) : 0);
+      q[i] = div128(r, u, d, &r);
     }
-    setbigvalue(L, res, r);
-  } else {
-    setnilvalue(res);
   }
-  L->top.p -= pushes;
+  return r >> s;
 }
 
-void luaB_mul(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  int pushes = 0;
-  TBigInt *b1 = to_bigint(L, v1, &pushes);
-  TBigInt *b2 = to_bigint(L, v2, &pushes);
-
-  if (b1 && b2) {
-    if (b1->len == 0 || b2->len == 0) {
-        TBigInt *r = luaB_new(L, 0);
-        setbigvalue(L, res, r);
-        L->top.p -= pushes;
-        return;
+
+/* scratch needed by 'mpn_divrem' */
+#define divws(un,vn)	((size_t)(un) + (vn) + 1)
+
+
+/*
+** Knuth's algorithm D: q[0..un-vn] = u / v and r[0..vn) = u % v, for
+** 'un >= vn >= 2' and 'v[vn-1] != 0'. 'q' or 'r' may be NULL.
+*/
+static void mpn_divrem (limb *q, limb *r, const limb *u, unsigned int un,
+                        const limb *v, unsigned int vn, limb *ws) {
+  int s = clz64(v[vn - 1]);
+  limb *nv = ws, *nu = ws + vn;
+  limb v1, v0;
+  unsigned int i;
+  long j;
+  /* normalize so that the top limb of the divisor has its top bit set */
+  if (s == 0) {
+    memcpy(nv, v, vn * sizeof(limb));
+    memcpy(nu, u, un * sizeof(limb));
+    nu[un] = 0;
+  }
+  else {
+    for (i = vn - 1; i > 0; i--)
+      nv[i] = (v[i] << s) | (v[i - 1] >> (LIMBBITS - s));
+    nv[0] = v[0] << s;
+    nu[un] = u[un - 1] >> (LIMBBITS - s);
+    for (i = un - 1; i > 0; i--)
+      nu[i] = (u[i] << s) | (u[i - 1] >> (LIMBBITS - s));
+    nu[0] = u[0] << s;
+  }
+  v1 = nv[vn - 1];
+  v0 = nv[vn - 2];
+  for (j = (long)(un - vn); j >= 0; j--) {
+    limb u2 = nu[j + vn], u1 = nu[j + vn - 1], u0 = nu[j + vn - 2];
+    limb qhat, rhat, borrow;
+    int overflow = 0;
+    if (u2 >= v1) {  /* (u2 == v1) */
+      qhat = LIMBMAX;
+      rhat = u1 + v1;
+      overflow = (rhat < u1);
     }
-    unsigned int len = b1->len + b2->len;
-    TBigInt *r = luaB_new(L, len);
-
-    for (unsigned int i = 0; i < b1->len; i++) {
-      l_uint64 carry = 0;
-      for (unsigned int j = 0; j < b2->len; j++) {
-        l_uint64 tmp = (l_uint64)b1->buff[i] * b2->buff[j] + r->buff[i + j] + carry;
-        r->buff[i + j] = (l_uint32)tmp;
-        carry = tmp >> 32;
+    else
+      qhat = div128(u2, u1, v1, &rhat);
+    while (!overflow) {  /* qhat may be 2 too big */
+      limb hi, lo = mul64(qhat, v0, &hi);
+      if (hi > rhat || (hi == rhat && lo > u0)) {
+        qhat--;
+        rhat += v1;
+        overflow = (rhat < v1);
       }
-      r->buff[i + b2->len] = (l_uint32)carry;
+      else break;
     }
+    borrow = mpn_submul_1(nu + j, nv, vn, qhat);
+    if (nu[j + vn] < borrow) {  /* qhat was still 1 too big: add back */
+      qhat--;
+      nu[j + vn] += mpn_add_n(nu + j, nu + j, nv, vn) - borrow;
+    }
+    else
+      nu[j + vn] -= borrow;
+    if (q) q[j] = qhat;
+  }
+  if (r) {  /* unnormalize the remainder */
+    if (s == 0)
+      memcpy(r, nu, vn * sizeof(limb));
+    else {
+      for (i = 0; i < vn - 1; i++)
+        r[i] = (nu[i] >> s) | (nu[i + 1] << (LIMBBITS - s));
+      r[vn - 1] = nu[vn - 1] >> s;
+    }
+  }
+}
+
 
-    r->sign = b1->sign * b2->sign;
-    big_normalize(r);
-    setbigvalue(L, res, r);
-  } else {
-    setnilvalue(res);
+/*
+** q = a / b and r = a % b, with 'bn' significant limbs in 'b'; 'q' gets
+** 'an - bn + 1' limbs and 'r' gets 'bn' limbs. Either may be NULL.
+*/
+static void mpn_tdiv (limb *q, limb *r, const limb *a, unsigned int an,
+                      const limb *b, unsigned int bn, limb *ws) {
+  if (an < bn) {  /* quotient is 0 */
+    if (q) q[0] = 0;
+    if (r) {
+      memcpy(r, a, an * sizeof(limb));
+      memset(r + an, 0, (bn - an) * sizeof(limb));
+    }
   }
-  L->top.p -= pushes;
+  else if (bn == 1) {
+    limb rem = mpn_divrem_1(q ? q : ws, a, an, b[0]);
+    if (r) r[0] = rem;
+  }
+  else
+    mpn_divrem(q, r, a, an, b, bn, ws);
 }
 
-void luaB_tostring(lua_State *L, TValue *obj) {
-  if (!ttisbigint(obj)) return;
-  ptrdiff_t offset = savestack(L, obj); /* Save stack offset */
-  TBigInt *b = bigvalue(obj);
+/* }====================================================== */
 
-  if (b->len == 0) {
-    setsvalue(L, obj, luaS_newliteral(L, "0"));
-    return;
+
+/*
+** {======================================================
+** Values
+** =======================================================
+*/
+
+/* a number seen as sign and magnitude */
+typedef struct Num {
+  const limb *d;
+  unsigned int n;  /* significant limbs */
+  int neg;
+  limb buf;  /* magnitude of an integer */
+} Num;
+
+
+/* view 'v' as a Num; fails (returns 0) if it is not an integer */
+static int tonum (const TValue *v, Num *x) {
+  if (ttisbigint(v)) {
+    TBigInt *b = bigvalue(v);
+    x->d = b->buff;
+    x->n = b->len;
+    x->neg = (b->sign < 0);
+    return 1;
+  }
+  else if (ttisinteger(v)) {
+    lua_Integer i = ivalue(v);
+    x->neg = (i < 0);
+    x->buf = x->neg ? 0u - l_castS2U(i) : l_castS2U(i);
+    x->d = &x->buf;
+    x->n = (x->buf != 0);
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Per-state scratch area with room for at least 'n' limbs. Only the
+** entry points call it, once each, and carve their temporaries out of
+** it, since growing it moves it.
+*/
+static limb *scratch (lua_State *L, size_t n) {
+  global_State *g = G(L);
+  if (n > MAXLIMBS)
+    luaG_runerror(L, "big integer too large");
+  if (g->sizebigbuff < n) {
+    size_t newsize = g->sizebigbuff + g->sizebigbuff / 2;
+    if (newsize < n) newsize = n;
+    if (newsize < 64) newsize = 64;
+    g->bigbuff = luaM_reallocvector(L, g->bigbuff, g->sizebigbuff, newsize,
+                                    l_uint64);
+    g->sizebigbuff = newsize;
   }
+  return g->bigbuff;
+}
 
-  /* Convert to decimal string */
-  /* Estimate size: 10 digits per 32 bits is safe (2^32 approx 4e9) */
-  int estimated = b->len * 10 + 2;
-  char *buff = luaM_newvector(L, estimated, char);
-  int pos = estimated - 1;
-  buff[pos] = '\0';
 
-  /* Work on a copy since we modify it */
-  TBigInt *temp = luaB_new(L, b->len);
-  setbigvalue(L, s2v(L->top.p), temp); /* Anchor temp */
-  L->top.p++;
+TBigInt *luaB_new(lua_State *L, unsigned int len) {
+  GCObject *o = luaC_newobj(L, LUA_VNUMBIG, sizebigint(len));
+  TBigInt *b = gco2big(o);
+  b->len = len;
+  b->size = len;
+  b->sign = 1;
+  memset(b->buff, 0, len * sizeof(l_uint64));
+  return b;
+}
 
-  /* Reload b because allocation might have invalidated pointer if it triggered GC?
-     luaB_new uses luaC_newobj -> no GC check.
-     But let's be safe and reload 'b' from 'obj' which we can restore.
-  */
-  obj = s2v(restorestack(L, offset));
+
+/*
+** res = (-1)^neg * d[0..n), as an integer when it fits in one. 'd' is
+** an operand or lives in the scratch area, so 'scratch' has already
+** limited 'n' to MAXLIMBS.
+*/
+static void setnum (lua_State *L, TValue *res, int neg, const limb *d,
+                    unsigned int n) {
+  n = mpn_len(d, n);
+  if (n == 0) {
+    setivalue(res, 0);
+  }
+  else if (n == 1 && d[0] <= (neg ? l_castS2U(LUA_MININTEGER)
+                                   : l_castS2U(LUA_MAXINTEGER))) {
+    setivalue(res, neg ? l_castU2S(0u - d[0]) : l_castU2S(d[0]));
+  }
+  else {
+    TBigInt *b = luaB_new(L, n);
+    memcpy(b->buff, d, n * sizeof(limb));
+    b->sign = neg ? -1 : 1;
+    setbigvalue(L, res, b);
+  }
+}
+
+
+void luaB_fromint(lua_State *L, lua_Integer i, TValue *res) {
+  TBigInt *b = luaB_new(L, 1);
+  b->sign = (i < 0) ? -1 : 1;
+  b->buff[0] = (i < 0) ? 0u - l_castS2U(i) : l_castS2U(i);
+  b->len = (b->buff[0] != 0);
+  setbigvalue(L, res, b);
+}
+
+
+lua_Number luaB_bigtonumber(const TValue *obj) {
+  TBigInt *b;
+  lua_Number res = 0.0;
+  int i;
+  if (!ttisbigint(obj)) return 0.0;
   b = bigvalue(obj);
-  big_copy(temp, b);
-
-  while (temp->len > 0) {
-    /* Divide by 10, keep remainder */
-    l_uint64 rem = 0;
-    for (int i = temp->len - 1; i >= 0; i--) {
-      l_uint64 cur = temp->buff[i] + (rem << 32);
-      temp->buff[i] = (l_uint32)(cur / 10);
-      rem = cur % 10;
-    }
-    big_normalize(temp);
-    buff[--pos] = (char)('0' + rem);
+  for (i = (int)b->len - 1; i >= 0; i--)
+    res = res * l_mathop(18446744073709551616.0) + (lua_Number)b->buff[i];
+  return (b->sign < 0) ? -res : res;
+}
+
+
+static lua_Number tofloat (const TValue *v) {
+  if (ttisfloat(v)) return fltvalue(v);
+  else if (ttisinteger(v)) return cast_num(ivalue(v));
+  else return luaB_bigtonumber(v);
+}
+
+
+/* arithmetic when some operand is a float: the result is a float */
+static void floatarith (lua_State *L, int op, const TValue *v1,
+                        const TValue *v2, TValue *res) {
+  lua_Number a = tofloat(v1), b = tofloat(v2), r;
+  switch (op) {
+    case LUA_OPADD: r = luai_numadd(L, a, b); break;
+    case LUA_OPSUB: r = luai_numsub(L, a, b); break;
+    case LUA_OPMUL: r = luai_nummul(L, a, b); break;
+    case LUA_OPDIV: r = luai_numdiv(L, a, b); break;
+    case LUA_OPPOW: r = luai_numpow(L, a, b); break;
+    case LUA_OPIDIV: r = luai_numidiv(L, a, b); break;
+    case LUA_OPUNM: r = luai_numunm(L, a); break;
+    default: luai_nummod(L, a, b, r); break;  /* LUA_OPMOD */
   }
+  setfltvalue(res, r);
+}
 
-  if (b->sign < 0) buff[--pos] = '-';
 
-  TString *s = luaS_new(L, buff + pos);
-  obj = s2v(restorestack(L, offset));
-  setsvalue(L, obj, s);
+int luaB_compare(TValue *v1, TValue *v2) {
+  Num a, b;
+  int c;
+  if (!tonum(v1, &a) || !tonum(v2, &b)) {  /* some float */
+    lua_Number x = tofloat(v1), y = tofloat(v2);
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+  }
+  if (a.neg != b.neg) return a.neg ? -1 : 1;
+  c = mpn_cmp(a.d, a.n, b.d, b.n);
+  return a.neg ? -c : c;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Arithmetic
+** =======================================================
+*/
+
+/* res = a + b, where 'b' is negated when 'negb' */
+static void addsub (lua_State *L, const Num *a, const Num *b, int negb,
+                    TValue *res) {
+  int bneg = b->neg ^ negb;
+  const Num *x = a, *y = b;
+  int xneg = a->neg, yneg = bneg;
+  limb *r;
+  if (a->n < b->n) {  /* let 'x' be the longer one */
+    x = b; y = a;
+    xneg = bneg; yneg = a->neg;
+  }
+  r = scratch(L, (size_t)x->n + 1);
+  if (xneg == yneg) {
+    r[x->n] = mpn_add(r, x->d, x->n, y->d, y->n);
+    setnum(L, res, xneg, r, x->n + 1);
+  }
+  else if (mpn_cmp(x->d, x->n, y->d, y->n) >= 0) {
+    mpn_sub(r, x->d, x->n, y->d, y->n);
+    setnum(L, res, xneg, r, x->n);
+  }
+  else {  /* |x| < |y|, so both have the same length */
+    mpn_sub_n(r, y->d, x->d, x->n);
+    setnum(L, res, yneg, r, x->n);
+  }
+}
 
-  luaM_freearray(L, buff, estimated);
-  L->top.p--; /* Pop temp */
+
+void luaB_add(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
+  Num a, b;
+  if (!tonum(v1, &a) || !tonum(v2, &b))
+    floatarith(L, LUA_OPADD, v1, v2, res);
+  else
+    addsub(L, &a, &b, 0, res);
+}
+
+
+void luaB_sub(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
+  Num a, b;
+  if (!tonum(v1, &a) || !tonum(v2, &b))
+    floatarith(L, LUA_OPSUB, v1, v2, res);
+  else
+    addsub(L, &a, &b, 1, res);
+}
+
+
+void luaB_unm(lua_State *L, TValue *v, TValue *res) {
+  Num a;
+  if (!tonum(v, &a))
+    floatarith(L, LUA_OPUNM, v, v, res);
+  else
+    setnum(L, res, !a.neg, a.d, a.n);
 }
 
-/* Stubs for others */
+
+/* r[0..an+bn) = a * b, with the scratch it needs at 'ws' */
+static void mulnat (limb *r, const limb *a, unsigned int an,
+                    const limb *b, unsigned int bn, limb *ws) {
+  if (an < bn)
+    mpn_mul(r, b, bn, a, an, ws);
+  else
+    mpn_mul(r, a, an, b, bn, ws);
+}
+
+
+void luaB_mul(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
+  Num a, b;
+  if (!tonum(v1, &a) || !tonum(v2, &b))
+    floatarith(L, LUA_OPMUL, v1, v2, res);
+  else if (a.n == 0 || b.n == 0) {
+    setivalue(res, 0);
+  }
+  else {
+    size_t rn = (size_t)a.n + b.n;
+    limb *r = scratch(L, rn + mulws(a.n < b.n ? a.n : b.n));
+    mulnat(r, a.d, a.n, b.d, b.n, r + rn);
+    setnum(L, res, a.neg ^ b.neg, r, cast_uint(rn));
+  }
+}
+
+
 void luaB_div(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  luaG_runerror(L, "BigInt division not supported");
+  floatarith(L, LUA_OPDIV, v1, v2, res);
+}
+
+
+/*
+** Floor division and modulo. 'q' gets 'a.n - b.n + 2' limbs and 'r'
+** gets 'b.n' limbs; returns the signs of the results in 'qneg'/'rneg'.
+*/
+static void divmod (const Num *a, const Num *b, limb *q, limb *r,
+                    int *qneg, int *rneg, limb *ws) {
+  unsigned int qn = (a->n >= b->n) ? a->n - b->n + 1 : 1;
+  mpn_tdiv(q, r, a->d, a->n, b->d, b->n, ws);
+  q[qn] = 0;
+  *qneg = a->neg ^ b->neg;
+  *rneg = a->neg;
+  if (a->neg != b->neg && mpn_len(r, b->n) != 0) {
+    /* round the quotient down and move the remainder to the sign of 'b' */
+    limb one = 1;
+    mpn_add(q, q, qn + 1, &one, 1);
+    mpn_sub(r, b->d, b->n, r, b->n);
+    *rneg = b->neg;
+  }
+}
+
+
+static void intdivmod (lua_State *L, int op, TValue *v1, TValue *v2,
+                       TValue *res) {
+  Num a, b;
+  if (!tonum(v1, &a) || !tonum(v2, &b))
+    floatarith(L, op, v1, v2, res);
+  else if (b.n == 0)
+    luaG_runerror(L, (op == LUA_OPMOD) ? "attempt to perform 'n%%0'"
+                                        : "attempt to perform 'n//0'");
+  else {
+    size_t qn = (a.n >= b.n) ? (size_t)a.n - b.n + 2 : 2;
+    limb *q = scratch(L, qn + b.n + divws(a.n, b.n) + 1);
+    limb *r = q + qn;
+    int qneg, rneg;
+    divmod(&a, &b, q, r, &qneg, &rneg, r + b.n);
+    if (op == LUA_OPMOD)
+      setnum(L, res, rneg, r, b.n);
+    else
+      setnum(L, res, qneg, q, cast_uint(qn));
+  }
 }
 
+
+void luaB_idiv(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
+  intdivmod(L, LUA_OPIDIV, v1, v2, res);
+}
+
+
 void luaB_mod(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  luaG_runerror(L, "BigInt modulus not supported");
+  intdivmod(L, LUA_OPMOD, v1, v2, res);
 }
 
+
+/*
+** Exact power when the exponent is a non-negative integer; a float
+** power otherwise, as for integers.
+*/
 void luaB_pow(lua_State *L, TValue *v1, TValue *v2, TValue *res) {
-  luaG_runerror(L, "BigInt power not supported");
+  Num a;
+  lua_Integer e;
+  if (!tonum(v1, &a) || !ttisinteger(v2) || (e = ivalue(v2)) < 0)
+    floatarith(L, LUA_OPPOW, v1, v2, res);
+  else if (a.n == 0 || e == 0) {
+    setivalue(res, (e == 0) ? 1 : 0);
+  }
+  else {
+    size_t bits = (size_t)a.n * LIMBBITS - clz64(a.d[a.n - 1]);
+    size_t rn;
+    limb *x, *t, *ws;
+    unsigned int xn;
+    int i;
+    if (bits > 1 && (size_t)e > MAXLIMBS * LIMBBITS / (bits - 1))
+      luaG_runerror(L, "big integer too large");
+    rn = (bits * (size_t)e) / LIMBBITS + 2;
+    x = scratch(L, 3 * rn + mulws(rn));
+    t = x + rn;
+    ws = t + 2 * rn;
+    memcpy(x, a.d, a.n * sizeof(limb));
+    xn = a.n;
+    for (i = LIMBBITS - 2 - clz64((limb)e); i >= 0; i--) {  /* left to right */
+      mulnat(t, x, xn, x, xn, ws);
+      xn = mpn_len(t, 2 * xn);
+      if ((l_castS2U(e) >> i) & 1) {
+        mulnat(x, t, xn, a.d, a.n, ws);
+        xn = mpn_len(x, xn + a.n);
+      }
+      else
+        memcpy(x, t, xn * sizeof(limb));
+    }
+    setnum(L, res, a.neg && (e & 1), x, xn);
+  }
 }
 
-int luaB_tryconvert(lua_State *L, TValue *obj) {
-    return 0;
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Modular exponentiation
+** =======================================================
+*/
+
+/*
+** Montgomery product (CIOS): r = a * b / B^n mod m, for 'a, b < m'
+** and odd 'm'; 'minv' is -1/m mod B and 't' has 'n + 2' limbs.
+*/
+static void montmul (limb *r, const limb *a, const limb *b, const limb *m,
+                     unsigned int n, limb minv, limb *t) {
+  unsigned int i;
+  memset(t, 0, (n + 2) * sizeof(limb));
+  for (i = 0; i < n; i++) {
+    limb c = mpn_addmul_1(t, a, n, b[i]);
+    limb s = t[n] + c;
+    t[n + 1] = (s < c);
+    t[n] = s;
+    c = mpn_addmul_1(t, m, n, t[0] * minv);  /* makes t[0] zero */
+    s = t[n] + c;
+    t[n + 1] += (s < c);
+    t[n] = s;
+    memmove(t, t + 1, (n + 1) * sizeof(limb));
+    t[n + 1] = 0;
+  }
+  if (t[n] != 0 || mpn_cmp(t, n, m, n) >= 0)
+    mpn_sub_n(r, t, m, n);
+  else
+    memcpy(r, t, n * sizeof(limb));
 }
 
-lua_Number luaB_bigtonumber(const TValue *obj) {
-    if (!ttisbigint(obj)) return 0.0;
-    TBigInt *b = bigvalue(obj);
-    if (b->len == 0) return 0.0;
-
-    lua_Number res = 0.0;
-    /* Process from most significant limb */
-    for (int i = b->len - 1; i >= 0; i--) {
-        res = res * 4294967296.0 + (lua_Number)b->buff[i];
+
+#define WINBITS		4
+#define WINSIZE		(1 << WINBITS)
+
+/* bit 'i' of e[0..en) */
+#define ebit(e,i)	(((e)[(i) / LIMBBITS] >> ((i) % LIMBBITS)) & 1)
+
+
+/* r = b^e mod m for odd 'm' with 'n' limbs and 'b < m', 'e != 0' */
+static void powmod_odd (limb *r, const limb *b, const limb *e,
+                        unsigned int en, const limb *m, unsigned int n,
+                        limb *ws) {
+  limb *tab = ws;  /* b^0 .. b^15 in Montgomery form */
+  limb *x = tab + WINSIZE * (size_t)n;
+  limb *t = x + n;
+  limb *num = t + n + 2;  /* 2n + 1 limbs */
+  limb *dws = num + 2 * (size_t)n + 1;
+  limb inv = m[0], minv;
+  size_t i;
+  int k;
+  for (k = 0; k < 5; k++)  /* Newton iteration for 1/m mod B */
+    inv *= 2 - m[0] * inv;
+  minv = 0u - inv;
+  /* tab[0] = B^n mod m, tab[1] = b * B^n mod m */
+  memset(num, 0, n * sizeof(limb));
+  num[n] = 1;
+  mpn_tdiv(NULL, tab, num, n + 1, m, n, dws);
+  memset(num, 0, n * sizeof(limb));
+  memcpy(num + n, b, n * sizeof(limb));
+  mpn_tdiv(NULL, tab + n, num, 2 * n, m, n, dws);
+  for (k = 2; k < WINSIZE; k++)
+    montmul(tab + k * n, tab + (k - 1) * n, tab + n, m, n, minv, t);
+  /* fixed-window exponentiation from the top */
+  i = (size_t)en * LIMBBITS;
+  while (i > 0 && !ebit(e, i - 1)) i--;
+  i = (i + WINBITS - 1) / WINBITS * WINBITS;
+  memcpy(x, tab, n * sizeof(limb));
+  while (i > 0) {
+    unsigned int w = 0;
+    i -= WINBITS;
+    for (k = 0; k < WINBITS; k++) {
+      montmul(x, x, x, m, n, minv, t);
+      if (i + k < (size_t)en * LIMBBITS)
+        w |= (unsigned int)ebit(e, i + k) << k;
     }
+    if (w != 0)
+      montmul(x, x, tab + w * n, m, n, minv, t);
+  }
+  /* leave the Montgomery form */
+  memset(num, 0, n * sizeof(limb));
+  num[0] = 1;
+  montmul(r, x, num, m, n, minv, t);
+}
+
+
+/* r = b^e mod m for any 'm' with 'n' limbs and 'b < m', 'e != 0' */
+static void powmod_plain (limb *r, const limb *b, const limb *e,
+                          unsigned int en, const limb *m, unsigned int n,
+                          limb *ws) {
+  limb *t = ws;  /* 2n limbs */
+  limb *mws = t + 2 * (size_t)n;
+  limb *dws = mws + mulws(n);
+  size_t i = (size_t)en * LIMBBITS;
+  while (!ebit(e, i - 1)) i--;
+  memcpy(r, b, n * sizeof(limb));
+  while (--i > 0) {
+    mulnat(t, r, n, r, n, mws);
+    mpn_tdiv(NULL, r, t, 2 * n, m, n, dws);
+    if (ebit(e, i - 1)) {
+      mulnat(t, r, n, b, n, mws);
+      mpn_tdiv(NULL, r, t, 2 * n, m, n, dws);
+    }
+  }
+}
+
+
+void luaB_powmod(lua_State *L, TValue *v1, TValue *v2, TValue *v3,
+                 TValue *res) {
+  Num b, e, m;
+  size_t n;
+  limb *r, *bb, *ws;
+  if (!tonum(v1, &b) || !tonum(v2, &e) || !tonum(v3, &m))
+    luaG_runerror(L, "powmod arguments must be integers");
+  if (m.neg || m.n == 0)
+    luaG_runerror(L, "powmod modulus must be positive");
+  if (e.neg)
+    luaG_runerror(L, "powmod exponent must be non-negative");
+  n = m.n;
+  r = scratch(L, 2 * n + (b.n > n ? b.n : n) + 2 + divws(b.n, n) +
+                 (WINSIZE + 6) * n + 8 + mulws(n) + divws(2 * n, n));
+  bb = r + n;
+  ws = bb + n;
+  /* bb = b mod m, in [0, m) */
+  if (b.n >= n) {
+    mpn_tdiv(NULL, bb, b.d, b.n, m.d, m.n, ws);
+  }
+  else {
+    memcpy(bb, b.d, b.n * sizeof(limb));
+    memset(bb + b.n, 0, (n - b.n) * sizeof(limb));
+  }
+  if (b.neg && mpn_len(bb, cast_uint(n)) != 0)
+    mpn_sub(bb, m.d, m.n, bb, cast_uint(n));
+  if (m.n == 1 && m.d[0] == 1) {
+    setivalue(res, 0);
+  }
+  else if (e.n == 0) {
+    setivalue(res, 1);
+  }
+  else {
+    if (m.d[0] & 1)
+      powmod_odd(r, bb, e.d, e.n, m.d, cast_uint(n), ws);
+    else
+      powmod_plain(r, bb, e.d, e.n, m.d, cast_uint(n), ws);
+    setnum(L, res, 0, r, cast_uint(n));
+  }
+}
+
+/* }====================================================== */
 
-    if (b->sign < 0) res = -res;
-    return res;
+
+/*
+** {======================================================
+** Radix conversion
+** =======================================================
+*/
+
+/*
+** Powers 10^(19 * 2^k) used to split numbers in halves; 'pw[k]' has
+** 'pn[k]' limbs.
+*/
+typedef struct Powers {
+  limb *pw[40];
+  unsigned int pn[40];
+  int k;  /* index of the largest power */
+} Powers;
+
+
+/*
+** Compute powers up to the first whose square has more than 'n' limbs.
+** Returns the first free limb after them.
+*/
+static limb *mkpowers (Powers *P, unsigned int n, limb *ws, limb *mws) {
+  limb *p = ws;
+  int k = 0;
+  p[0] = TEN19;
+  P->pw[0] = p;
+  P->pn[0] = 1;
+  p += 1;
+  while (2 * P->pn[k] - 1 <= n) {
+    unsigned int pn = P->pn[k];
+    mulnat(p, P->pw[k], pn, P->pw[k], pn, mws);
+    P->pw[k + 1] = p;
+    P->pn[k + 1] = mpn_len(p, 2 * pn);
+    p += 2 * pn;
+    k++;
+  }
+  P->k = k;
+  return p;
+}
+
+
+/*
+** Write the digits of a[0..n) ending at 'end', padded with zeros to
+** 'width' digits (no padding when 'width' is 0); 'a' is destroyed.
+** Returns the start of the digits.
+*/
+static char *todec_base (char *end, limb *a, unsigned int n, size_t width) {
+  char *p = end;
+  n = mpn_len(a, n);
+  while (n > 0) {
+    limb r = mpn_divrem_1(a, a, n, TEN19);
+    int i;
+    n = mpn_len(a, n);
+    for (i = 0; i < TEN19DIGITS && (n > 0 || r != 0); i++) {
+      *--p = (char)('0' + r % 10);
+      r /= 10;
+    }
+    if (n > 0)
+      while (i++ < TEN19DIGITS) *--p = '0';
+  }
+  while ((size_t)(end - p) < width) *--p = '0';
+  return p;
 }
+
+
+/* digits of a[0..n) (which is below pw[k]^2), divide and conquer */
+static char *todec (char *end, limb *a, unsigned int n, const Powers *P,
+                    int k, size_t width, limb *ws) {
+  n = mpn_len(a, n);
+  while (k >= 0 && mpn_cmp(a, n, P->pw[k], P->pn[k]) < 0)
+    k--;  /* too small for this split */
+  if (k < 0 || n <= DCRADIX_THRESHOLD)
+    return todec_base(end, a, n, width);
+  else {
+    unsigned int pn = P->pn[k];
+    size_t lowdigits = (size_t)TEN19DIGITS << k;
+    unsigned int qn = n - pn + 1;
+    limb *q = ws, *r = q + qn;
+    mpn_tdiv(q, r, a, n, P->pw[k], pn, r + pn);
+    end = todec(end, r, pn, P, k - 1, lowdigits, r + pn);
+    return todec(end, q, qn, P, k - 1,
+                 (width > lowdigits) ? width - lowdigits : 0, r + pn);
+  }
+}
+
+
+void luaB_tostring(lua_State *L, TValue *obj) {
+  TBigInt *b = bigvalue(obj);
+  unsigned int n = b->len;
+  size_t ndigits = (size_t)n * 20 + 2;
+  size_t nchar = (ndigits + sizeof(limb) - 1) / sizeof(limb);
+  limb *a = scratch(L, nchar + 8 * (size_t)n + 64 + mulws(n) + 8 * n + 64);
+  char *end = (char *)a + nchar * sizeof(limb);
+  limb *pws = a + nchar;
+  limb *ws, *start;
+  Powers P;
+  char *p;
+  TString *s;
+  memcpy(pws, b->buff, n * sizeof(limb));  /* the number is destroyed */
+  start = pws;
+  pws += n;
+  if (n > DCRADIX_THRESHOLD) {
+    ws = mkpowers(&P, n, pws, pws + 4 * (size_t)n + 64);
+    p = todec(end, start, n, &P, P.k, 0, ws);
+  }
+  else
+    p = todec_base(end, start, n, 0);
+  if (b->sign < 0) *--p = '-';
+  s = luaS_newlstr(L, p, cast_sizet(end - p));
+  setsvalue(L, obj, s);
+}
+
+
+/* r = value of the decimal digits s[0..nd), with 'nd <= 19' */
+static limb chunkval (const char *s, size_t nd) {
+  limb v = 0;
+  while (nd-- > 0) v = v * 10 + (limb)(*s++ - '0');
+  return v;
+}
+
+
+/* r[0..rn) = value of s[0..nd); quadratic */
+static unsigned int fromdec_base (limb *r, const char *s, size_t nd) {
+  size_t first = nd % TEN19DIGITS;
+  unsigned int rn = 0;
+  if (first == 0) first = TEN19DIGITS;
+  r[0] = chunkval(s, first);
+  rn = (r[0] != 0);
+  for (s += first, nd -= first; nd > 0; s += TEN19DIGITS, nd -= TEN19DIGITS) {
+    limb c = mpn_mul_1(r, r, rn, TEN19);
+    limb lo = chunkval(s, TEN19DIGITS);
+    if (c != 0) r[rn++] = c;
+    if (rn == 0) { if (lo != 0) { r[0] = lo; rn = 1; } }
+    else if (mpn_add(r, r, rn, &lo, 1))
+      r[rn++] = 1;
+  }
+  return rn;
+}
+
+
+/* limbs needed for a number with 'nd' decimal digits */
+#define declimbs(nd)	((nd) / TEN19DIGITS + 2)
+
+
+/* r = value of s[0..nd), divide and conquer; returns its length */
+static unsigned int fromdec (limb *r, const char *s, size_t nd,
+                             const Powers *P, limb *ws) {
+  int k = P->k;
+  size_t lowdigits;
+  while (k >= 0 && ((size_t)TEN19DIGITS << k) >= nd) k--;
+  if (k < 0 || nd <= (size_t)DCRADIX_THRESHOLD * TEN19DIGITS)
+    return fromdec_base(r, s, nd);
+  else {
+    unsigned int hn, ln, pn = P->pn[k];
+    limb *hi = ws, *lo;
+    lowdigits = (size_t)TEN19DIGITS << k;
+    hn = fromdec(hi, s, nd - lowdigits, P, hi + declimbs(nd - lowdigits));
+    lo = hi + declimbs(nd - lowdigits);
+    ln = fromdec(lo, s + nd - lowdigits, lowdigits, P, lo + declimbs(lowdigits));
+    if (hn == 0) {
+      memcpy(r, lo, ln * sizeof(limb));
+      return ln;
+    }
+    mulnat(r, hi, hn, P->pw[k], pn, lo + declimbs(lowdigits));
+    memset(r + hn + pn, 0, sizeof(limb));
+    if (ln > 0)
+      mpn_add(r, r, hn + pn, lo, ln);
+    return mpn_len(r, hn + pn);
+  }
+}
+
+
+/*
+** Convert the numeral s[0..len) (optional sign, decimal or hexadecimal
+** digits, surrounding spaces) to an integer or big integer. Returns 0
+** if it is not such a numeral.
+*/
+int luaB_fromstring(lua_State *L, const char *s, size_t len, TValue *res) {
+  const char *e = s + len;
+  int neg = 0, hex = 0;
+  size_t nd;
+  limb *r;
+  unsigned int rn;
+  while (s < e && lisspace(cast_uchar(*s))) s++;
+  while (e > s && lisspace(cast_uchar(e[-1]))) e--;
+  if (s < e && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+  if (e - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    hex = 1;
+    s += 2;
+  }
+  if (s == e) return 0;
+  for (nd = 0; s + nd < e; nd++) {
+    if (!(hex ? lisxdigit(cast_uchar(s[nd])) : lisdigit(cast_uchar(s[nd]))))
+      return 0;
+  }
+  while (nd > 1 && *s == '0') { s++; nd--; }  /* skip leading zeros */
+  if (hex) {
+    size_t i;
+    rn = cast_uint(nd / 16 + 1);
+    r = scratch(L, rn);
+    memset(r, 0, rn * sizeof(limb));
+    for (i = 0; i < nd; i++) {
+      limb d = (limb)luaO_hexavalue(s[nd - 1 - i]);
+      r[i / 16] |= d << (4 * (i % 16));
+    }
+  }
+  else if (nd <= (size_t)DCRADIX_THRESHOLD * TEN19DIGITS) {
+    r = scratch(L, declimbs(nd));
+    rn = fromdec_base(r, s, nd);
+  }
+  else {
+    Powers P;
+    unsigned int n = cast_uint(declimbs(nd));
+    limb *ws;
+    r = scratch(L, 2 * (size_t)n + 8 * (size_t)n + 64 + mulws(n) +
+                   8 * declimbs(nd) + mulws(n));
+    ws = mkpowers(&P, n, r + n + 1, r + n + 1 + 4 * (size_t)n + 64);
+    rn = fromdec(r, s, nd, &P, ws + mulws(n));
+  }
+  setnum(L, res, neg, r, rn);
+  return 1;
+}
+
+/* }====================================================== */
@@ -1,3 +1,9 @@
+/*
+** $Id: lbigint.h $
+** Big integers
+** See Copyright Notice in lua.h
+*/
+
 #ifndef lbigint_h
 #define lbigint_h
 
@@ -5,12 +11,18 @@
 
 LUAI_FUNC TBigInt *luaB_new(lua_State *L, unsigned int len);
 LUAI_FUNC void luaB_fromint(lua_State *L, lua_Integer i, TValue *res);
+LUAI_FUNC int luaB_fromstring(lua_State *L, const char *s, size_t len,
+                              TValue *res);
 LUAI_FUNC void luaB_add(lua_State *L, TValue *v1, TValue *v2, TValue *res);
 LUAI_FUNC void luaB_sub(lua_State *L, TValue *v1, TValue *v2, TValue *res);
 LUAI_FUNC void luaB_mul(lua_State *L, TValue *v1, TValue *v2, TValue *res);
 LUAI_FUNC void luaB_div(lua_State *L, TValue *v1, TValue *v2, TValue *res);
+LUAI_FUNC void luaB_idiv(lua_State *L, TValue *v1, TValue *v2, TValue *res);
 LUAI_FUNC void luaB_mod(lua_State *L, TValue *v1, TValue *v2, TValue *res);
 LUAI_FUNC void luaB_pow(lua_State *L, TValue *v1, TValue *v2, TValue *res);
+LUAI_FUNC void luaB_unm(lua_State *L, TValue *v, TValue *res);
+LUAI_FUNC void luaB_powmod(lua_State *L, TValue *v1, TValue *v2, TValue *v3,
+                           TValue *res);
 LUAI_FUNC int luaB_compare(TValue *v1, TValue *v2);
 LUAI_FUNC void luaB_tostring(lua_State *L, TValue *obj);
 
@@ -13,6 +13,7 @@
 #include "lopcodes.h"
 #include "lgc.h"
 #include "ldebug.h"
+#include "lvm.h"
 #include "lopnames.h"
 #include <string.h>
 
@@ -95,6 +96,18 @@ static int bytecode_getcodecount (lua_State *L) {
   return 1;
 }
 
+/*
+** Stores instruction 'i' at 'pc'. If a debugger trap sits there, the
+** new instruction goes under the trap, which stays in place.
+*/
+static void putcode (Proto *p, int pc, Instruction i) {
+  if (p->bpcode != NULL && GET_OPCODE(p->code[pc]) == OP_BREAKPOINT) {
+    p->bpcode[pc] = i;
+    SET_OPCODE(i, OP_BREAKPOINT);
+  }
+  p->code[pc] = i;
+}
+
 /*
 ** 4. ByteCode.GetCode(proto, index)
 ** Returns the instruction at the given 1-based index as an integer.
@@ -108,7 +121,7 @@ static int bytecode_getcode (lua_State *L) {
   if (idx < 1 || idx > p->sizecode) {
     return luaL_error(L, "index out of range");
   }
-  Instruction i = p->code[idx - 1];
+  Instruction i = luaV_getinst(p, (int)idx - 1);
   lua_pushinteger(L, (lua_Integer)i);
   return 1;
 }
@@ -128,7 +141,7 @@ static int bytecode_setcode (lua_State *L) {
   if (idx < 1 || idx > p->sizecode) {
     return luaL_error(L, "index out of range");
   }
-  p->code[idx - 1] = (Instruction)inst;
+  putcode(p, (int)idx - 1, (Instruction)inst);
   return 0;
 }
 
@@ -352,7 +365,7 @@ static int bytecode_dump (lua_State *L) {
   luaL_addstring(&b, buf);
 
   for (i = 0; i < p->sizecode; i++) {
-    Instruction inst = p->code[i];
+    Instruction inst = luaV_getinst(p, i);
     OpCode op = GET_OPCODE(inst);
     enum OpMode mode = getOpMode(op);
     const char *name = (op < NUM_OPCODES && opnames[op]) ? opnames[op] : "UNKNOWN";
@@ -607,7 +620,7 @@ static int bytecode_getinstruction (lua_State *L) {
   if (idx < 1 || idx > p->sizecode) {
     return luaL_error(L, "instruction index out of range");
   }
-  Instruction i = p->code[idx - 1];
+  Instruction i = luaV_getinst(p, (int)idx - 1);
   decode_instruction(L, i);
   return 1;
 }
@@ -701,7 +714,7 @@ static int bytecode_setinstruction (lua_State *L) {
     }
   }
 
-  p->code[idx - 1] = i;
+  putcode(p, idx - 1, i);
   return 0;
 }
 
@@ -0,0 +1,570 @@
+/*
+** $Id: lclone.c $
+** Copying the contents of a state into another state
+** See Copyright Notice in lua.h
+*/
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lbigint.h"
+#include "lclone.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lslice.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** 'luaCL_clone' copies into state 'L' everything reachable from the
+** registry of state 'from', plus 'n' values from the top of its stack.
+** 'L' is meant to be a new state with its libraries already open, so
+** the objects of 'from' found at the same place in both registries
+** (library tables, their C functions, metatables, standard files, ...)
+** are not copied: they are matched with their counterparts in 'L'
+** ("seeded"), and the contents of matched tables are merged into them,
+** except for tables with finalizers, which own resources of their state
+** (such as '_CLIBS', with the handles of loaded C libraries).
+** Everything else is copied at the level of the internal structures:
+** tables are created with the sizes of their originals, prototypes are
+** duplicated array by array, strings are interned once, and upvalues
+** and prototypes shared in 'from' stay shared in 'L'.
+**
+** 'map' maps the address of each object of 'from' (as a light userdata)
+** to its counterpart in 'L'. It also holds upvalues and prototypes, so
+** it is never exposed. 'work' lists the pairs (original, copy) of the
+** objects created but not yet filled; filling an object creates its
+** children unfilled, so deep structures do not use C stack. Every new
+** object is stored in an anchored place (the stack, 'map', or an object
+** already anchored) before the next allocation, as an emergency
+** collection may run at any of them.
+*/
+
+
+/* slots used in the stack of 'L' */
+#define SLOTMAP		0
+#define SLOTWORK	1
+#define SLOTTMP		2	/* two temporaries */
+#define NSLOTS		4
+
+
+typedef struct CloneState {
+  lua_State *from;  /* source state */
+  lua_State *L;  /* destination state */
+  ptrdiff_t base;  /* first slot used in the stack of 'L' */
+  Table *map;
+  Table *work;
+  lua_Integer nwork;  /* number of entries in 'work' */
+} CloneState;
+
+
+#define slot(cs,i)	s2v(restorestack((cs)->L, (cs)->base) + (i))
+
+
+static void clonevalue (CloneState *cs, const TValue *o, TValue *res);
+
+
+/* get into 'res' the counterpart of object 'o'; return 0 if none */
+static int findcopy (CloneState *cs, void *o, TValue *res) {
+  TValue k;
+  const TValue *v;
+  setpvalue(&k, o);
+  v = luaH_get(cs->map, &k);
+  if (isempty(v))
+    return 0;
+  setobj(cs->L, res, v);
+  return 1;
+}
+
+
+/* register 'copy' (already anchored) as the counterpart of 'o' */
+static void addcopy (CloneState *cs, void *o, TValue *copy) {
+  TValue k;
+  setpvalue(&k, o);
+  luaH_set(cs->L, cs->map, &k, copy);
+  luaC_barrierback(cs->L, obj2gco(cs->map), copy);
+}
+
+
+/* queue 'copy' to be filled with the contents of 'o' */
+static void addwork (CloneState *cs, GCObject *o, TValue *copy) {
+  TValue k;
+  setpvalue(&k, o);
+  luaH_setint(cs->L, cs->work, ++cs->nwork, &k);
+  luaH_setint(cs->L, cs->work, ++cs->nwork, copy);
+  luaC_barrierback(cs->L, obj2gco(cs->work), copy);
+}
+
+
+/*
+** References (integer keys beyond LUA_RIDX_LAST) in the registry belong
+** to the C code that made them, so they are neither matched nor copied.
+*/
+static int isref (CloneState *cs, Table *t, const TValue *key) {
+  return (t == hvalue(&G(cs->L)->l_registry) && ttisinteger(key) &&
+          ivalue(key) > LUA_RIDX_LAST);
+}
+
+
+/*
+** Does metatable 'mt' (of 'from') set '__clone' to a true value? That
+** tells that the block of its userdata is plain data, with no pointers
+** into its state, so it can be copied byte for byte. The key is looked
+** for by content, as interning it would allocate in 'from'.
+*/
+static int isclonable (GCObject *o) {
+  Table *mt;
+  unsigned int i;
+  if (o == NULL || o->tt != LUA_VTABLE)
+    return 0;
+  mt = gco2t(o);
+  for (i = 0; i < sizenode(mt); i++) {
+    Node *n = gnode(mt, i);
+    if (keyisshrstr(n) && strcmp(getshrstr(keystrval(n)), "__clone") == 0)
+      return !l_isfalse(gval(n));
+  }
+  return 0;
+}
+
+
+/* create in 'res' the (unfilled) counterpart of object 'o' */
+static void newcopy (CloneState *cs, const TValue *o, TValue *res) {
+  lua_State *L = cs->L;
+  switch (ttypetag(o)) {
+    case LUA_VLNGSTR: {
+      TString *ts = tsvalue(o);
+      setsvalue(L, res, luaS_newlstr(L, getlngstr(ts), ts->u.lnglen));
+      addcopy(cs, ts, res);
+      return;  /* nothing to fill */
+    }
+    case LUA_VTABLE: {
+      Table *h = hvalue(o);
+      Table *t;
+      const TValue *gc = gfasttm(G(cs->from), h->metatable, TM_GC);
+      if (h->using_next != NULL)
+        luaG_runerror(L, "cannot clone a table using namespaces");
+      if (gc != NULL && (ttislcf(gc) || ttisCclosure(gc)))
+        luaG_runerror(L, "cannot clone a table with a C finalizer");
+      t = luaH_new(L);
+      t->type = h->type;
+      t->is_shared = h->is_shared;
+      sethvalue(L, res, t);
+      break;
+    }
+    case LUA_VLCL: {
+      LClosure *f = clLvalue(o);
+      if (f->p->vm_code_table != NULL)
+        luaG_runerror(L, "cannot clone a VM-protected function");
+      setclLvalue(L, res, luaF_newLclosure(L, f->nupvalues));
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *f = clCvalue(o);
+      CClosure *c = luaF_newCclosure(L, f->nupvalues);
+      int i;
+      c->f = f->f;
+      for (i = 0; i < c->nupvalues; i++)
+        setnilvalue(&c->upvalue[i]);
+      setclCvalue(L, res, c);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = uvalue(o);
+      Udata *c;
+      if (luaSL_isview(cs->from, u))
+        luaG_runerror(L, "cannot clone a slice view");
+      if (gfasttm(G(cs->from), u->metatable, TM_GC) != NULL)
+        luaG_runerror(L, "cannot clone a userdata with a finalizer");
+      if (!isclonable(u->metatable))  /* may point into 'from' */
+        luaG_runerror(L, "cannot clone a userdata without '__clone'");
+      c = luaS_newudata(L, u->len, u->nuvalue);
+      if (u->len > 0)
+        memcpy(getudatamem(c), getudatamem(u), u->len);
+      setuvalue(L, res, c);
+      break;
+    }
+    default:
+      luaG_runerror(L, "cannot clone a %s", ttypename(ttype(o)));
+  }
+  addcopy(cs, gcvalue(o), res);
+  addwork(cs, gcvalue(o), res);
+}
+
+
+/* set 'res' (an anchored place) to the counterpart of value 'o' */
+static void clonevalue (CloneState *cs, const TValue *o, TValue *res) {
+  lua_State *L = cs->L;
+  if (!iscollectable(o)) {
+    setobj(L, res, o);  /* nothing to copy */
+  }
+  else if (ttisshrstring(o)) {
+    TString *ts = tsvalue(o);
+    setsvalue(L, res, luaS_newlstr(L, getshrstr(ts), ts->shrlen));
+  }
+  else if (ttisbigint(o)) {
+    TBigInt *b = bigvalue(o);
+    TBigInt *c = luaB_new(L, b->len);
+    c->sign = b->sign;
+    if (b->len > 0)
+      memcpy(c->buff, b->buff, b->len * sizeof(l_uint64));
+    setbigvalue(L, res, c);
+  }
+  else if (!findcopy(cs, gcvalue(o), res))
+    newcopy(cs, o, res);
+}
+
+
+static TString *clonestring (CloneState *cs, TString *ts) {
+  TValue v;
+  TValue *res = slot(cs, SLOTTMP + 1);
+  setgcovalue(cs->L, &v, obj2gco(ts));
+  clonevalue(cs, &v, res);
+  return tsvalue(res);
+}
+
+
+/* return the counterpart of metatable 'mt' */
+static GCObject *clonemeta (CloneState *cs, GCObject *mt) {
+  TValue v;
+  TValue *res = slot(cs, SLOTTMP);
+  setgcovalue(cs->L, &v, mt);
+  clonevalue(cs, &v, res);
+  return gcvalue(res);
+}
+
+
+static void setmeta (CloneState *cs, GCObject *o, GCObject *mt,
+                     GCObject **dst) {
+  if (mt != NULL && *dst == NULL) {  /* keep metatables already set */
+    *dst = clonemeta(cs, mt);
+    luaC_objbarrier(cs->L, o, *dst);
+    luaC_checkfinalizer(cs->L, o, *dst);
+  }
+}
+
+
+static void setentry (CloneState *cs, Table *t, const TValue *key,
+                      const TValue *val) {
+  TValue *k = slot(cs, SLOTTMP);
+  TValue *v = slot(cs, SLOTTMP + 1);
+  clonevalue(cs, key, k);
+  clonevalue(cs, val, v);
+  luaH_set(cs->L, t, k, v);
+  luaC_barrierback(cs->L, obj2gco(t), v);
+}
+
+
+/*
+** Fill table 't' with the contents of 'h'. A new table gets the sizes of
+** its original, and its array part is copied in place; the contents of
+** a seeded table are merged into it.
+*/
+static void filltable (CloneState *cs, Table *h, Table *t) {
+  lua_State *L = cs->L;
+  unsigned int asize = luaH_realasize(h);
+  unsigned int hsize = allocsizenode(h);
+  unsigned int i;
+  if (t->alimit == 0 && isdummy(t)) {  /* empty? */
+    luaH_resize(L, t, asize, hsize);
+    for (i = 0; i < asize; i++) {
+      clonevalue(cs, &h->array[i], &t->array[i]);
+      luaC_barrierback(L, obj2gco(t), &t->array[i]);
+    }
+  }
+  else {
+    for (i = 0; i < asize; i++) {
+      TValue k;
+      setivalue(&k, i + 1);
+      if (!isempty(&h->array[i]) && !isref(cs, t, &k))
+        setentry(cs, t, &k, &h->array[i]);
+    }
+  }
+  for (i = 0; i < hsize; i++) {
+    Node *n = gnode(h, i);
+    if (!isempty(gval(n))) {
+      TValue k;
+      getnodekey(cs->from, &k, n);
+      if (!isref(cs, t, &k))
+        setentry(cs, t, &k, gval(n));
+    }
+  }
+  setmeta(cs, obj2gco(t), h->metatable, &t->metatable);
+  invalidateTMcache(t);
+}
+
+
+static Proto *cloneproto (CloneState *cs, Proto *f) {
+  lua_State *L = cs->L;
+  TValue *v = slot(cs, SLOTTMP);
+  Proto *p;
+  int i;
+  if (findcopy(cs, f, v))
+    return gco2p(gcvalue(v));
+  if (f->vm_code_table != NULL)
+    luaG_runerror(L, "cannot clone a VM-protected function");
+  p = luaF_newproto(L);
+  setgcovalue(L, v, obj2gco(p));
+  addcopy(cs, f, v);  /* anchors 'p' */
+  p->numparams = f->numparams;
+  p->flag = f->flag;
+  p->is_vararg = f->is_vararg;
+  p->maxstacksize = f->maxstacksize;
+  p->nodiscard = f->nodiscard;
+  p->difierline_mode = f->difierline_mode;
+  p->difierline_pad = f->difierline_pad;
+  p->difierline_magicnum = f->difierline_magicnum;
+  p->difierline_data = f->difierline_data;
+  p->bytecode_hash = f->bytecode_hash;
+  p->linedefined = f->linedefined;
+  p->lastlinedefined = f->lastlinedefined;
+  /* arrays without objects, or with them cleared for the collector */
+  p->code = luaM_newvectorchecked(L, f->sizecode, Instruction);
+  p->sizecode = f->sizecode;
+  for (i = 0; i < f->sizecode; i++)
+    p->code[i] = luaV_getinst(f, i);  /* never copy breakpoint traps */
+  p->k = luaM_newvectorchecked(L, f->sizek, TValue);
+  p->sizek = f->sizek;
+  for (i = 0; i < f->sizek; i++)
+    setnilvalue(&p->k[i]);
+  p->p = luaM_newvectorchecked(L, f->sizep, Proto *);
+  p->sizep = f->sizep;
+  for (i = 0; i < f->sizep; i++)
+    p->p[i] = NULL;
+  p->upvalues = luaM_newvectorchecked(L, f->sizeupvalues, Upvaldesc);
+  p->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    p->upvalues[i] = f->upvalues[i];
+    p->upvalues[i].name = NULL;
+  }
+  p->locvars = luaM_newvectorchecked(L, f->sizelocvars, LocVar);
+  p->sizelocvars = f->sizelocvars;
+  for (i = 0; i < f->sizelocvars; i++) {
+    p->locvars[i] = f->locvars[i];
+    p->locvars[i].varname = NULL;
+  }
+  p->lineinfo = luaM_newvectorchecked(L, f->sizelineinfo, ls_byte);
+  p->sizelineinfo = f->sizelineinfo;
+  if (f->sizelineinfo > 0)
+    memcpy(p->lineinfo, f->lineinfo, f->sizelineinfo * sizeof(ls_byte));
+  p->abslineinfo = luaM_newvectorchecked(L, f->sizeabslineinfo,
+                                         AbsLineInfo);
+  p->sizeabslineinfo = f->sizeabslineinfo;
+  if (f->sizeabslineinfo > 0)
+    memcpy(p->abslineinfo, f->abslineinfo,
+           f->sizeabslineinfo * sizeof(AbsLineInfo));
+  /* now the objects */
+  if (f->source != NULL) {
+    p->source = clonestring(cs, f->source);
+    luaC_objbarrier(L, p, p->source);
+  }
+  for (i = 0; i < f->sizek; i++) {
+    clonevalue(cs, &f->k[i], &p->k[i]);
+    luaC_barrier(L, p, &p->k[i]);
+  }
+  for (i = 0; i < f->sizeupvalues; i++) {
+    if (f->upvalues[i].name != NULL) {
+      p->upvalues[i].name = clonestring(cs, f->upvalues[i].name);
+      luaC_objbarrier(L, p, p->upvalues[i].name);
+    }
+  }
+  for (i = 0; i < f->sizelocvars; i++) {
+    if (f->locvars[i].varname != NULL) {
+      p->locvars[i].varname = clonestring(cs, f->locvars[i].varname);
+      luaC_objbarrier(L, p, p->locvars[i].varname);
+    }
+  }
+  for (i = 0; i < f->sizep; i++) {
+    p->p[i] = cloneproto(cs, f->p[i]);
+    luaC_objbarrier(L, p, p->p[i]);
+  }
+  return p;
+}
+
+
+/*
+** Upvalues are copied closed. One that is open in 'from' is still tied
+** to a live variable there; its copy gets the current value.
+*/
+static void fillLclosure (CloneState *cs, LClosure *f, LClosure *c) {
+  lua_State *L = cs->L;
+  int i;
+  c->p = cloneproto(cs, f->p);
+  luaC_objbarrier(L, c, c->p);
+  for (i = 0; i < c->nupvalues; i++) {
+    UpVal *uv = f->upvals[i];
+    TValue *v = slot(cs, SLOTTMP);
+    if (uv == NULL)
+      continue;
+    if (findcopy(cs, uv, v))  /* shared with a function already copied? */
+      c->upvals[i] = gco2upv(gcvalue(v));
+    else {
+      UpVal *nuv = gco2upv(luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal)));
+      nuv->v.p = &nuv->u.value;  /* make it closed */
+      setnilvalue(nuv->v.p);
+      c->upvals[i] = nuv;
+      setgcovalue(L, v, obj2gco(nuv));
+      addcopy(cs, uv, v);
+      clonevalue(cs, uv->v.p, nuv->v.p);
+      luaC_barrier(L, nuv, nuv->v.p);
+    }
+    luaC_objbarrier(L, c, c->upvals[i]);
+  }
+}
+
+
+static void fillCclosure (CloneState *cs, CClosure *f, CClosure *c) {
+  int i;
+  for (i = 0; i < c->nupvalues; i++) {
+    clonevalue(cs, &f->upvalue[i], &c->upvalue[i]);
+    luaC_barrier(cs->L, c, &c->upvalue[i]);
+  }
+}
+
+
+static void filludata (CloneState *cs, Udata *u, Udata *c) {
+  int i;
+  for (i = 0; i < c->nuvalue; i++) {
+    clonevalue(cs, &u->uv[i].uv, &c->uv[i].uv);
+    luaC_barrierback(cs->L, obj2gco(c), &c->uv[i].uv);
+  }
+  setmeta(cs, obj2gco(c), u->metatable, &c->metatable);
+}
+
+
+/* fill the copy in entry 'w' of the work list */
+static void fill (CloneState *cs, lua_Integer w) {
+  GCObject *o = cast(GCObject *, pvalue(luaH_getint(cs->work, w)));
+  GCObject *c = gcvalue(luaH_getint(cs->work, w + 1));
+  switch (o->tt) {
+    case LUA_VTABLE: filltable(cs, gco2t(o), gco2t(c)); break;
+    case LUA_VLCL: fillLclosure(cs, gco2lcl(o), gco2lcl(c)); break;
+    case LUA_VCCL: fillCclosure(cs, gco2ccl(o), gco2ccl(c)); break;
+    case LUA_VUSERDATA: filludata(cs, gco2u(o), gco2u(c)); break;
+    default: lua_assert(0);
+  }
+}
+
+
+static void seed (CloneState *cs, const TValue *s, const TValue *d);
+
+
+static void seedmeta (CloneState *cs, GCObject *s, GCObject *d) {
+  if (s != NULL && d != NULL) {
+    TValue vs, vd;
+    setgcovalue(cs->L, &vs, s);
+    setgcovalue(cs->L, &vd, d);
+    seed(cs, &vs, &vd);
+  }
+}
+
+
+/*
+** Match object 's' of 'from' with object 'd' of 'L', found at the same
+** place, and then the values found under the same keys (strings,
+** numbers and booleans) of both, and their metatables. Matched tables
+** are queued to get the contents of their originals merged into them.
+*/
+static void seed (CloneState *cs, const TValue *s, const TValue *d) {
+  TValue *v = slot(cs, SLOTTMP);
+  if (!iscollectable(s) || ttypetag(s) != ttypetag(d))
+    return;
+  switch (ttypetag(s)) {
+    case LUA_VCCL:
+      if (clCvalue(s)->f != clCvalue(d)->f)
+        return;
+      break;
+    case LUA_VTABLE: case LUA_VUSERDATA: case LUA_VTHREAD:
+      break;
+    default:
+      return;  /* not something libraries create */
+  }
+  if (findcopy(cs, gcvalue(s), v))
+    return;  /* already matched */
+  setobj(cs->L, v, d);
+  addcopy(cs, gcvalue(s), v);
+  if (ttistable(s)) {
+    Table *h = hvalue(s);
+    Table *t = hvalue(d);
+    unsigned int asize = luaH_realasize(h);
+    unsigned int hsize = allocsizenode(h);
+    unsigned int i;
+    if (gfasttm(G(cs->L), t->metatable, TM_GC) == NULL)
+      addwork(cs, gcvalue(s), v);  /* merge contents */
+    /* else it owns resources of its state (e.g. '_CLIBS'): keep it as is */
+    for (i = 0; i < asize; i++) {
+      TValue k;
+      setivalue(&k, i + 1);
+      if (!isref(cs, t, &k))
+        seed(cs, &h->array[i], luaH_getint(t, i + 1));
+    }
+    for (i = 0; i < hsize; i++) {
+      Node *n = gnode(h, i);
+      if (iscollectable(gval(n))) {
+        TValue k;
+        getnodekey(cs->from, &k, n);
+        if ((ttisshrstring(&k) || ttisnumber(&k) || ttisboolean(&k)) &&
+            !isref(cs, t, &k)) {
+          clonevalue(cs, &k, v);
+          seed(cs, gval(n), luaH_get(t, v));
+        }
+      }
+    }
+    seedmeta(cs, h->metatable, t->metatable);
+  }
+  else if (ttisfulluserdata(s))
+    seedmeta(cs, uvalue(s)->metatable, uvalue(d)->metatable);
+}
+
+
+void luaCL_clone (lua_State *from, lua_State *L, int n) {
+  CloneState cs;
+  StkId base;
+  lua_Integer w;
+  int i;
+  luaD_checkstack(L, NSLOTS + n);
+  cs.from = from;
+  cs.L = L;
+  cs.base = savestack(L, L->top.p);
+  cs.nwork = 0;
+  for (i = 0; i < NSLOTS + n; i++)
+    setnilvalue(s2v(L->top.p + i));
+  L->top.p += NSLOTS + n;
+  cs.map = luaH_new(L);
+  sethvalue(L, slot(&cs, SLOTMAP), cs.map);
+  cs.work = luaH_new(L);
+  sethvalue(L, slot(&cs, SLOTWORK), cs.work);
+  /* match what the libraries created in both states */
+  seed(&cs, &G(from)->l_registry, &G(L)->l_registry);
+  for (i = 0; i < LUA_NUMTYPES; i++) {  /* metatables for basic types */
+    GCObject *mt = G(from)->mt[i];
+    if (mt != NULL) {
+      if (G(L)->mt[i] != NULL)
+        seedmeta(&cs, mt, G(L)->mt[i]);
+      else
+        G(L)->mt[i] = clonemeta(&cs, mt);
+    }
+  }
+  /* copy the values, then fill everything created along the way */
+  for (i = 0; i < n; i++)
+    clonevalue(&cs, s2v(from->top.p - n + i), slot(&cs, NSLOTS + i));
+  for (w = 1; w < cs.nwork; w += 2)
+    fill(&cs, w);
+  base = restorestack(L, cs.base);
+  for (i = 0; i < n; i++)
+    setobjs2s(L, base + i, base + NSLOTS + i);
+  L->top.p = base + n;
+}
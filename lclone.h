@@ -0,0 +1,16 @@
+/*
+** $Id: lclone.h $
+** Copying the contents of a state into another state
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lclone_h
+#define lclone_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+LUAI_FUNC void luaCL_clone (lua_State *from, lua_State *L, int n);
+
+#endif
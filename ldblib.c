@@ -19,6 +19,7 @@
 #include "lauxlib.h"
 #include "lualib.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -29,8 +30,9 @@
 static const char *const HOOKKEY = "_HOOKKEY";
 
 /*
-** The breakpoint table at registry[BREAKPOINTKEY] maps threads to their current
-** hook function.
+** The breakpoint table at registry[BREAKPOINTKEY] maps "file:line" keys
+** to breakpoint entries (source, line, enabled, condition and its
+** compiled form 'condfn').
 */
 static const char *const BREAKPOINTKEY = "_BREAKPOINTKEY";
 
@@ -381,107 +383,200 @@ static int db_upvaluejoin (lua_State *L) {
 
 
 /*
-** Call hook function registered at hook table for the current
-** thread (if there is one)
+** Checks the stepping mode ('step', 'next', 'finish') in the debug
+** state. Returns the name of the event if execution should stop here
+** (resetting the mode), or NULL.
 */
-static void hookf (lua_State *L, lua_Debug *ar) {
-  static const char *const hooknames[] =
-    {"call", "return", "line", "count", "tail call"};
-  
+static const char *checkstep (lua_State *L) {
+  const char *event = NULL;
   int top = lua_gettop(L);
-
-  if (ar->event == LUA_HOOKLINE && ar->currentline >= 0) {
-    int should_stop = 0;
-    const char *stop_event = "breakpoint";
-
-    /* 1. Check for breakpoints */
-    if (lua_getfield(L, LUA_REGISTRYINDEX, BREAKPOINTKEY) == LUA_TTABLE) {
-      int bptable_idx = lua_gettop(L);
-      lua_getinfo(L, "S", ar);
-      const char *filename = get_filename(ar->source ? ar->source : "");
-      char key[512];
-      snprintf(key, sizeof(key), "%s:%d", filename, ar->currentline);
-      if (lua_getfield(L, bptable_idx, key) == LUA_TTABLE) {
-        int bp_idx = lua_gettop(L);
-        lua_getfield(L, bp_idx, "enabled");
-        if (lua_toboolean(L, -1)) {
-          lua_pop(L, 1); /* pop enabled */
-          if (lua_getfield(L, bp_idx, "condition") == LUA_TSTRING) {
-            const char *cond = lua_tostring(L, -1);
-            char buff[512];
-            if (strncmp(cond, "return ", 7) != 0) {
-              snprintf(buff, sizeof(buff), "return %s", cond);
-              cond = buff;
-            }
-            if (luaL_loadstring(L, cond) == LUA_OK) {
-              if (lua_pcall(L, 0, 1, 0) == LUA_OK) {
-                should_stop = lua_toboolean(L, -1);
-              }
-              lua_pop(L, 1); /* pop result/error */
-            } else {
-              lua_pop(L, 1); /* pop load error */
-            }
-          } else {
-            should_stop = 1; /* unconditional */
-            lua_pop(L, 1); /* pop non-string condition */
-          }
-        } else {
-          lua_pop(L, 1); /* pop disabled */
-        }
-      }
-    }
-    lua_settop(L, top);
-
-    /* 2. Check debug modes */
-    if (!should_stop) {
-      if (lua_getfield(L, LUA_REGISTRYINDEX, DEBUGSTATEKEY) == LUA_TTABLE) {
-        int state_idx = lua_gettop(L);
-        lua_getfield(L, state_idx, "mode");
-        int mode = (int)lua_tointeger(L, -1);
+  if (lua_getfield(L, LUA_REGISTRYINDEX, DEBUGSTATEKEY) == LUA_TTABLE) {
+    int state_idx = lua_gettop(L);
+    lua_getfield(L, state_idx, "mode");
+    int mode = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (mode != 0) {
+      int stop_by_mode = 0;
+      if (mode == 1) stop_by_mode = 1; /* step */
+      else if (mode == 2 || mode == 3) {
+        lua_getfield(L, state_idx, "target_level");
+        int target_level = (int)lua_tointeger(L, -1);
         lua_pop(L, 1);
-        if (mode != 0) {
-          int stop_by_mode = 0;
-          if (mode == 1) stop_by_mode = 1; /* step */
-          else if (mode == 2 || mode == 3) {
-            lua_getfield(L, state_idx, "target_level");
-            int target_level = (int)lua_tointeger(L, -1);
-            lua_pop(L, 1);
-            if (get_stack_level(L) <= target_level)
-              stop_by_mode = 1;
-          }
-          if (stop_by_mode) {
-            should_stop = 1;
-            stop_event = (mode == 1) ? "step" : (mode == 2 ? "next" : "finish");
-            lua_pushinteger(L, 0);
-            lua_setfield(L, state_idx, "mode");
-          }
-        }
+        if (get_stack_level(L) <= target_level)
+          stop_by_mode = 1;
+      }
+      if (stop_by_mode) {
+        event = (mode == 1) ? "step" : (mode == 2 ? "next" : "finish");
+        lua_pushinteger(L, 0);
+        lua_setfield(L, state_idx, "mode");
       }
     }
-    lua_settop(L, top);
+  }
+  lua_settop(L, top);
+  return event;
+}
+
+
+static void hookf (lua_State *L, lua_Debug *ar);
+
+
+/*
+** The line hook used for stepping is installed only while a stepping
+** command is pending. If the thread has no user hook, it is removed
+** again as soon as the mode goes back to 'run'.
+*/
+static void startstep (lua_State *L) {
+  lua_Hook hook = lua_gethook(L);
+  if (hook == NULL)
+    lua_sethook(L, hookf, LUA_MASKLINE, 0);
+  else if (hook == hookf && !(lua_gethookmask(L) & LUA_MASKLINE))
+    lua_sethook(L, hookf, lua_gethookmask(L) | LUA_MASKLINE,
+                lua_gethookcount(L));
+}
+
+
+static void stopstep (lua_State *L) {
+  int top = lua_gettop(L);
+  int userhook = 0;
+  if (lua_gethook(L) != hookf)
+    return;  /* not ours */
+  if (lua_getfield(L, LUA_REGISTRYINDEX, HOOKKEY) == LUA_TTABLE) {
+    lua_pushthread(L);
+    userhook = (lua_rawget(L, -2) == LUA_TFUNCTION);
+  }
+  lua_settop(L, top);
+  if (!userhook)
+    lua_sethook(L, NULL, 0, 0);
+}
+
+
+/*
+** Reports a stop to the output callback (or to 'stderr') and records
+** the stack level where it happened, for 'next' and 'finish'.
+*/
+static void debugstop (lua_State *L, lua_Debug *ar, const char *event) {
+  int top = lua_gettop(L);
+  if (lua_getfield(L, LUA_REGISTRYINDEX, DEBUGSTATEKEY) == LUA_TTABLE) {
+    lua_pushinteger(L, get_stack_level(L));
+    lua_setfield(L, -2, "break_level");
+  }
+  lua_pop(L, 1); /* pop DEBUGSTATEKEY table or nil */
+
+  lua_getinfo(L, "S", ar);
+  lua_getfield(L, LUA_REGISTRYINDEX, DEBUGOUTPUTKEY);
+  if (lua_isfunction(L, -1)) {
+    lua_pushstring(L, event);
+    lua_pushstring(L, ar->short_src);
+    lua_pushinteger(L, ar->currentline);
+    lua_pcall(L, 3, 0, 0);
+  } else {
+    fprintf(stderr, "Breakpoint (%s) at %s:%d\n", event, ar->short_src, ar->currentline);
+  }
+  lua_settop(L, top);
+  if (lua_getfield(L, LUA_REGISTRYINDEX, DEBUGSTATEKEY) == LUA_TTABLE &&
+      lua_getfield(L, -1, "mode") == LUA_TNUMBER && lua_tointeger(L, -1) == 0)
+    stopstep(L);  /* resumed running: no more line events needed */
+  lua_settop(L, top);
+}
+
 
-    if (should_stop) {
-      if (lua_getfield(L, LUA_REGISTRYINDEX, DEBUGSTATEKEY) == LUA_TTABLE) {
-        lua_pushinteger(L, get_stack_level(L));
-        lua_setfield(L, -2, "break_level");
+/*
+** Checks whether the breakpoint entry at index 'bp' should stop: it must
+** be enabled and its condition (compiled once, when the breakpoint was
+** set) must hold.
+*/
+static int checkbreak (lua_State *L, int bp) {
+  int stop = 0;
+  lua_getfield(L, bp, "enabled");
+  if (lua_toboolean(L, -1)) {
+    switch (lua_getfield(L, bp, "condfn")) {
+      case LUA_TFUNCTION: {
+        if (lua_pcall(L, 0, 1, 0) == LUA_OK)
+          stop = lua_toboolean(L, -1);
+        break;
       }
-      lua_pop(L, 1); /* pop DEBUGSTATEKEY table or nil */
-
-      lua_getinfo(L, "S", ar);
-      lua_getfield(L, LUA_REGISTRYINDEX, DEBUGOUTPUTKEY);
-      if (lua_isfunction(L, -1)) {
-        lua_pushstring(L, stop_event);
-        lua_pushstring(L, ar->short_src);
-        lua_pushinteger(L, ar->currentline);
-        lua_pcall(L, 3, 0, 0);
-      } else {
-        fprintf(stderr, "Breakpoint (%s) at %s:%d\n", stop_event, ar->short_src, ar->currentline);
+      case LUA_TNIL: stop = 1; break;  /* unconditional */
+      default: break;  /* condition did not compile */
+    }
+  }
+  return stop;
+}
+
+
+/*
+** Breakpoint hook, called by the VM when it executes a breakpoint trap
+** (in any thread).
+*/
+static void breakf (lua_State *L, lua_Debug *ar) {
+  int top = lua_gettop(L);
+  const char *event = NULL;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, BREAKPOINTKEY) == LUA_TTABLE) {
+    int bptable_idx = lua_gettop(L);
+    char key[512];
+    lua_getinfo(L, "S", ar);
+    snprintf(key, sizeof(key), "%s:%d",
+             get_filename(ar->source ? ar->source : ""), ar->currentline);
+    if (lua_getfield(L, bptable_idx, key) == LUA_TTABLE &&
+        checkbreak(L, lua_gettop(L)))
+      event = "breakpoint";
+  }
+  lua_settop(L, top);
+  if (event == NULL)
+    event = checkstep(L);
+  if (event != NULL)
+    debugstop(L, ar, event);
+}
+
+
+/*
+** Load notification: plants the enabled breakpoints in a newly loaded
+** function (on the top of the stack).
+*/
+static void loadf (lua_State *L) {
+  int top = lua_gettop(L);
+  if (!lua_checkstack(L, 6))
+    return;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, BREAKPOINTKEY) == LUA_TTABLE) {
+    int bptable_idx = lua_gettop(L);
+    lua_pushnil(L);
+    while (lua_next(L, bptable_idx)) {
+      lua_getfield(L, -1, "enabled");
+      lua_getfield(L, -2, "source");
+      lua_getfield(L, -3, "line");
+      if (lua_toboolean(L, -3) && lua_isstring(L, -2)) {
+        const char *source = lua_tostring(L, -2);
+        int line = (int)lua_tointeger(L, -1);
+        lua_pushvalue(L, top);
+        lua_setbreaktrap(L, source, line, 1, 1);
+        lua_pop(L, 1);
       }
+      lua_pop(L, 4);
     }
-    lua_settop(L, top);
   }
+  lua_settop(L, top);
+}
+
 
-  /* 4. Call user registered hook function */
+/*
+** Call hook function registered at hook table for the current
+** thread (if there is one). While stepping, line events also drive
+** the stepping commands; lines with a breakpoint trap are left to the
+** trap, which also checks the stepping mode.
+*/
+static void hookf (lua_State *L, lua_Debug *ar) {
+  static const char *const hooknames[] =
+    {"call", "return", "line", "count", "tail call"};
+  
+  int top = lua_gettop(L);
+
+  if (ar->event == LUA_HOOKLINE && ar->currentline >= 0 &&
+      GET_OPCODE(*(ar->i_ci->u.l.savedpc - 1)) != OP_BREAKPOINT) {
+    const char *event = checkstep(L);
+    if (event != NULL)
+      debugstop(L, ar, event);
+  }
+
+  /* Call user registered hook function */
   if (lua_getfield(L, LUA_REGISTRYINDEX, HOOKKEY) == LUA_TTABLE) {
     int hooktable_idx = lua_gettop(L);
     lua_pushthread(L);
@@ -635,13 +730,26 @@ static void ensure_debug_state (lua_State *L) {
   }
 }
 
+/*
+** Breakpoints are planted as traps in the code, so lines without one
+** run at full speed; no hook is needed unless a stepping command is
+** pending. 'breakf' is installed as the global breakpoint hook while
+** there is at least one breakpoint.
+*/
+static void sync_breakhook (lua_State *L, int bptable_idx) {
+  lua_pushnil(L);
+  if (lua_next(L, bptable_idx)) {
+    lua_pop(L, 2);
+    lua_setbreakhook(L, breakf, loadf);
+  }
+  else
+    lua_setbreakhook(L, NULL, NULL);
+}
+
 static int db_setbreakpoint (lua_State *L) {
   const char *source = luaL_checkstring(L, 1);
   int line = (int)luaL_checkinteger(L, 2);
   const char *condition = luaL_optstring(L, 3, NULL);
-  if (lua_gethook(L) == NULL) {
-    lua_sethook(L, hookf, LUA_MASKLINE, 0);
-  }
   lua_settop(L, 3);
   ensure_breakpoint_table(L); /* index 4 */
   const char *filename = get_filename(source);
@@ -660,11 +768,25 @@ static int db_setbreakpoint (lua_State *L) {
   if (condition) {
     lua_pushstring(L, condition);
     lua_setfield(L, 5, "condition");
+    /* compile the condition once; 'false' marks a broken condition */
+    if (strncmp(condition, "return ", 7) != 0)
+      lua_pushfstring(L, "return %s", condition);
+    else
+      lua_pushstring(L, condition);
+    if (luaL_loadbuffer(L, lua_tostring(L, -1), lua_rawlen(L, -1),
+                        condition) != LUA_OK) {
+      lua_pop(L, 1);  /* error message */
+      lua_pushboolean(L, 0);
+    }
+    lua_setfield(L, 5, "condfn");
+    lua_pop(L, 1);  /* source of the condition */
   }
   lua_pushboolean(L, exists);
   lua_setfield(L, 5, "exists");
   lua_pushvalue(L, 5);
   lua_setfield(L, 4, key);
+  lua_setbreaktrap(L, filename, line, 1, 0);
+  sync_breakhook(L, 4);
   lua_remove(L, 4);
   return 1;
 }
@@ -683,6 +805,8 @@ static int db_removebreakpoint (lua_State *L) {
   if (exists) {
     lua_pushnil(L);
     lua_setfield(L, 3, key);
+    lua_setbreaktrap(L, filename, line, 0, 0);
+    sync_breakhook(L, 3);
   }
   lua_pushboolean(L, exists);
   lua_remove(L, 3);
@@ -716,6 +840,8 @@ static int db_enablebreakpoint (lua_State *L) {
   if (lua_getfield(L, 4, key) == LUA_TTABLE) {
     lua_pushboolean(L, enable);
     lua_setfield(L, -2, "enabled");
+    /* a disabled breakpoint costs nothing: take its trap out */
+    lua_setbreaktrap(L, filename, line, enable, 0);
     lua_pushboolean(L, 1);
   } else {
     lua_pushboolean(L, 0);
@@ -729,12 +855,17 @@ static int db_clearbreakpoints (lua_State *L) {
   int count = 0;
   lua_pushnil(L);
   while (lua_next(L, -2)) {
+    lua_getfield(L, -1, "source");
+    lua_getfield(L, -2, "line");
+    if (lua_isstring(L, -2))
+      lua_setbreaktrap(L, lua_tostring(L, -2), (int)lua_tointeger(L, -1), 0, 0);
     count++;
-    lua_pop(L, 1);
+    lua_pop(L, 3);
   }
   lua_pop(L, 1);
   lua_newtable(L);
   lua_setfield(L, LUA_REGISTRYINDEX, BREAKPOINTKEY);
+  lua_setbreakhook(L, NULL, NULL);
   lua_pushinteger(L, count);
   return 1;
 }
@@ -744,6 +875,7 @@ static int db_continue (lua_State *L) {
   lua_pushinteger(L, 0);
   lua_setfield(L, -2, "mode");
   lua_pop(L, 1);
+  stopstep(L);
   lua_pushstring(L, "continue");
   return 1;
 }
@@ -753,6 +885,7 @@ static int db_step (lua_State *L) {
   lua_pushinteger(L, 1);
   lua_setfield(L, -2, "mode");
   lua_pop(L, 1);
+  startstep(L);
   lua_pushstring(L, "step");
   return 1;
 }
@@ -768,6 +901,7 @@ static int db_next (lua_State *L) {
   lua_pushinteger(L, break_level);
   lua_setfield(L, -2, "target_level");
   lua_pop(L, 1);
+  startstep(L);
   lua_pushstring(L, "next");
   return 1;
 }
@@ -783,6 +917,7 @@ static int db_finish (lua_State *L) {
   lua_pushinteger(L, break_level - 1);
   lua_setfield(L, -2, "target_level");
   lua_pop(L, 1);
+  startstep(L);
   lua_pushstring(L, "finish");
   return 1;
 }
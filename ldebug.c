@@ -21,8 +21,11 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lprofile.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -701,6 +704,16 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
 }
 
 
+/*
+** Name of the function called by instruction 'pc' of 'p' (NULL if
+** unknown); used by the sampling profiler to name sampled frames.
+*/
+const char *luaG_callname (lua_State *L, const Proto *p, int pc,
+                                         const char **name) {
+  return funcnamefromcode(L, p, pc, name);
+}
+
+
 /*
 ** Try to find a name for a function based on how it was called.
 */
@@ -1052,6 +1065,8 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   lu_byte mask = cast_byte(L->hookmask);
   const Proto *p = ci_func(ci)->p;
   int counthook;
+  if (l_unlikely(l_atomic_load(&G(L)->profpending)))  /* sampling profiler asked? */
+    luaR_sample(L, pc, 1);
   if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT))) {  /* no hooks? */
     ci->u.l.trap = 0;  /* don't need to stop again */
     return 0;  /* turn off 'trap' */
@@ -1091,3 +1106,162 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   return 1;  /* keep 'trap' on */
 }
 
+
+/*
+** {======================================================
+** Breakpoint traps
+** =======================================================
+**
+** A breakpoint is planted by replacing the opcode of an instruction
+** with OP_BREAKPOINT, keeping its operands, so code that reads an
+** instruction directly (EXTRAARG, the jump after a test, MMBIN looking
+** at the previous arithmetic instruction) still sees valid arguments.
+** The original instruction is kept in 'p->bpcode' and 'luaV_getinst'
+** looks through the trap, so the debug interface and the dumper keep
+** seeing the original code. Code without traps runs with no hook and
+** no 'trap' flag at all.
+*/
+
+
+/*
+** Plants a trap at instruction 'pc' of 'p'. Returns 1 if a new trap was
+** planted. Instructions that are never dispatched on their own
+** (EXTRAARG) or that run before the frame is ready (VARARGPREP) are
+** refused, as are prototypes whose code is not owned or is locked.
+*/
+int luaG_setbreak (lua_State *L, Proto *p, int pc) {
+  OpCode op;
+  if (pc < 0 || pc >= p->sizecode || (p->flag & (PF_FIXED | PF_LOCKED)))
+    return 0;
+  op = GET_OPCODE(p->code[pc]);
+  if (op == OP_BREAKPOINT || op == OP_EXTRAARG || op == OP_VARARGPREP)
+    return 0;
+  if (p->bpcode == NULL)
+    p->bpcode = luaM_newvector(L, p->sizecode, Instruction);
+  p->bpcode[pc] = p->code[pc];
+  SET_OPCODE(p->code[pc], OP_BREAKPOINT);
+  return 1;
+}
+
+
+/*
+** Removes the trap at instruction 'pc' of 'p', if there is one. The
+** saved copy is released when the last trap of 'p' is gone.
+*/
+int luaG_delbreak (lua_State *L, Proto *p, int pc) {
+  int i;
+  if (p->bpcode == NULL || pc < 0 || pc >= p->sizecode ||
+      GET_OPCODE(p->code[pc]) != OP_BREAKPOINT)
+    return 0;
+  p->code[pc] = p->bpcode[pc];
+  for (i = 0; i < p->sizecode; i++) {
+    if (GET_OPCODE(p->code[i]) == OP_BREAKPOINT)
+      return 1;  /* still has other traps */
+  }
+  luaM_freearray(L, p->bpcode, p->sizecode);
+  p->bpcode = NULL;
+  return 1;
+}
+
+
+/*
+** Executes a trap. 'pc' points to the instruction after the trap (as
+** 'savedpc' does). Calls the global breakpoint hook, if any, as a line
+** event, and returns the original instruction for the VM to execute.
+** Like 'luaG_traceexec', this is not "Protected" when called.
+*/
+Instruction luaG_breakpoint (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  const Proto *p = ci_func(ci)->p;
+  int npci = pcRel(pc, p);
+  Instruction orig;
+  if (l_unlikely(p->bpcode == NULL))
+    luaG_runerror(L, "invalid breakpoint trap");
+  orig = p->bpcode[npci];
+  if (G(L)->breakhook != NULL) {
+    ci->u.l.savedpc = pc;
+    if (!isIT(orig))  /* top not being used? */
+      L->top.p = ci->top.p;  /* correct top */
+    luaD_runhook(L, G(L)->breakhook, LUA_HOOKLINE,
+                 luaG_getfuncline(p, npci), 0, 0);
+    L->oldpc = npci;  /* a line hook must not report this line again */
+  }
+  return orig;
+}
+
+
+/* strip the directory part (and a leading '@') from a chunk name */
+static const char *chunkbasename (const char *source) {
+  const char *name = (*source == '@') ? source + 1 : source;
+  const char *sep;
+  if ((sep = strrchr(name, '/')) != NULL) name = sep + 1;
+  if ((sep = strrchr(name, '\\')) != NULL) name = sep + 1;
+  return name;
+}
+
+
+/*
+** Plants (or removes, if '!on') traps at the first instruction of
+** 'line' in 'p' and, if 'deep', in all its nested functions.
+*/
+static int breakproto (lua_State *L, Proto *p, int line, int on, int deep) {
+  int n = 0;
+  if (line >= p->linedefined &&
+      (p->lastlinedefined == 0 || line <= p->lastlinedefined)) {
+    int pc;
+    for (pc = 0; pc < p->sizecode; pc++) {
+      OpCode op = GET_OPCODE(luaV_getinst(p, pc));
+      if (op != OP_VARARGPREP && op != OP_EXTRAARG &&
+          luaG_getfuncline(p, pc) == line) {
+        n += on ? luaG_setbreak(L, p, pc) : luaG_delbreak(L, p, pc);
+        break;
+      }
+    }
+  }
+  if (deep) {
+    int i;
+    for (i = 0; i < p->sizep; i++)
+      n += breakproto(L, p->p[i], line, on, 1);
+  }
+  return n;
+}
+
+
+static int samesource (const Proto *p, const char *name) {
+  return (p->source != NULL &&
+          strcmp(chunkbasename(getstr(p->source)), name) == 0);
+}
+
+
+LUA_API int lua_setbreaktrap (lua_State *L, const char *source, int line,
+                              int on, int ontop) {
+  const char *name = chunkbasename(source);
+  int n = 0;
+  lua_lock(L);
+  if (ontop) {  /* only the function on top and its nested ones */
+    const TValue *o = s2v(L->top.p - 1);
+    api_checknelems(L, 1);
+    if (ttisLclosure(o) && samesource(clLvalue(o)->p, name))
+      n = breakproto(L, clLvalue(o)->p, line, on, 1);
+  }
+  else {  /* every live prototype */
+    GCObject *o;
+    for (o = G(L)->allgc; o != NULL; o = o->next) {
+      if (o->tt == LUA_VPROTO && samesource(gco2p(o), name))
+        n += breakproto(L, gco2p(o), line, on, 0);
+    }
+  }
+  lua_unlock(L);
+  return n;
+}
+
+
+LUA_API void lua_setbreakhook (lua_State *L, lua_Hook func,
+                               void (*onload) (lua_State *L)) {
+  lua_lock(L);
+  G(L)->breakhook = func;
+  G(L)->loadhook = onload;
+  lua_unlock(L);
+}
+
+/* }====================================================== */
@@ -60,6 +60,11 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC int luaG_traceexec (lua_State *L, const Instruction *pc);
 LUAI_FUNC int luaG_tracecall (lua_State *L);
+LUAI_FUNC const char *luaG_callname (lua_State *L, const Proto *p, int pc,
+                                                   const char **name);
+LUAI_FUNC int luaG_setbreak (lua_State *L, Proto *p, int pc);
+LUAI_FUNC int luaG_delbreak (lua_State *L, Proto *p, int pc);
+LUAI_FUNC Instruction luaG_breakpoint (lua_State *L, const Instruction *pc);
 
 
 #endif
@@ -491,7 +491,25 @@ void luaD_inctop (lua_State *L) {
  */
 void luaD_hook (lua_State *L, int event, int line,
                               int ftransfer, int ntransfer) {
-  lua_Hook hook = L->hook;
+  luaD_runhook(L, L->hook, event, line, ftransfer, ntransfer);
+}
+
+
+/**
+ * @brief Calls a given hook function for an event.
+ *
+ * Same protocol as 'luaD_hook' ('top' preserved, no nested hooks), but
+ * for hooks that are not the thread's own, such as the breakpoint hook.
+ *
+ * @param L The Lua state.
+ * @param hook The hook function (may be NULL).
+ * @param event The event type.
+ * @param line The current line number.
+ * @param ftransfer First index for transfer (for returns).
+ * @param ntransfer Number of values transferred (for returns).
+ */
+void luaD_runhook (lua_State *L, lua_Hook hook, int event, int line,
+                                 int ftransfer, int ntransfer) {
   if (hook && L->allowhook) {  /* make sure there is a hook */
     int mask = CIST_HOOKED;
     CallInfo *ci = L->ci;
@@ -1416,6 +1434,7 @@ TStatus luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top.p), L->errfunc);
+  luaZ_freedecrypt(L, z);
   luaZ_freebuffer(L, &p.buff);
   luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
   luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
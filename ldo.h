@@ -105,6 +105,19 @@ LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
 LUAI_FUNC void luaD_hook (lua_State *L, int event, int line,
                                         int fTransfer, int nTransfer);
 
+/**
+ * @brief Calls a given hook function (not necessarily 'L->hook').
+ *
+ * @param L The Lua state.
+ * @param hook The hook function.
+ * @param event The event code.
+ * @param line The current line.
+ * @param fTransfer Offset of first value transferred.
+ * @param nTransfer Number of values transferred.
+ */
+LUAI_FUNC void luaD_runhook (lua_State *L, lua_Hook hook, int event, int line,
+                                           int fTransfer, int nTransfer);
+
 /**
  * @brief Calls a hook for a function call.
  *
@@ -25,6 +25,7 @@
 #include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
+#include "lvm.h"
 
 #include "lobfuscate.h"
 
@@ -80,9 +81,28 @@ typedef struct {
   unsigned int obfuscate_seed;  /* 混淆随机种子 */
   const char *log_path;  /* 调试日志输出路径 */
   Buffer *cur_buf;
+  int64_t fixedtime;  /* timestamp to use instead of the clock (0 = clock) */
+  unsigned int rng;  /* state of 'dumprand' */
 } DumpState;
 
 
+/*
+** Dump timestamps and junk bytes come from 'dumptime' and 'dumprand'
+** rather than time() and rand(): with a fixed time the output is
+** reproducible, and dumps running on several threads do not share the
+** C library's random state.
+*/
+static int64_t dumptime (DumpState *D) {
+  return (D->fixedtime != 0) ? D->fixedtime : (int64_t)time(NULL);
+}
+
+
+static int dumprand (DumpState *D) {
+  D->rng = D->rng * 1103515245u + 12345u;
+  return (int)((D->rng >> 16) & 0x7fff);
+}
+
+
 /*
 ** All high-level dumps go through dumpVector; you can change it to
 ** change the endianness of the result
@@ -118,9 +138,9 @@ static void generateOpcodeMap(DumpState *D) {
   }
   
   /* 使用Fisher-Yates算法随机打乱映射表 */
-  srand((unsigned int)D->timestamp);
+  D->rng = (unsigned int)D->timestamp;
   for (i = NUM_OPCODES - 1; i > 0; i--) {
-    j = rand() % (i + 1);
+    j = dumprand(D) % (i + 1);
     /* 交换 */
     temp = D->opcode_map[i];
     D->opcode_map[i] = D->opcode_map[j];
@@ -289,7 +309,7 @@ static void dumpString (DumpState *D, const TString *s) {
     dumpSize(D, size + 1);
 
     /* 为每个字符串生成新的时间戳并写入 */
-    D->timestamp = time(NULL);
+    D->timestamp = dumptime(D);
     dumpVar(D, D->timestamp);  /* 写入该字符串专用的时间戳 */
     
     /* 生成字符串映射表（用于动态加密） */
@@ -370,7 +390,7 @@ static void dumpCode (DumpState *D, const Proto *f) {
   
   /* 应用OPcode映射表 */
   for (i = 0; i < orig_size; i++) {
-    Instruction inst = f->code[i];
+    Instruction inst = luaV_getinst(f, i);  /* never dump breakpoint traps */
     OpCode op = GET_OPCODE(inst);
     /* 使用映射表替换OPcode */
     SET_OPCODE(inst, D->opcode_map[op]);
@@ -492,18 +512,18 @@ static void dumpUpvalues (DumpState *D, const Proto *f) {
   dumpInt(D, anti_import_count);
   
   // 1. 使用随机化的 idx 值，不依赖连续性
-  srand((unsigned int)D->timestamp);
+  D->rng = (unsigned int)D->timestamp;
   for (i = 0; i < 15; i++) {
-    dumpByte(D, rand() % 2); // 随机 instack
-    dumpByte(D, rand() % 256); // 随机 idx，不连续
-    dumpByte(D, rand() % 3); // 随机 kind
+    dumpByte(D, dumprand(D) % 2); // 随机 instack
+    dumpByte(D, dumprand(D) % 256); // 随机 idx，不连续
+    dumpByte(D, dumprand(D) % 3); // 随机 kind
   }
   
   // 2. 添加加密的验证数据
   uint8_t validation_data[16];
   for (i = 0; i < 16; i++) {
     do {
-      validation_data[i] = (uint8_t)(rand() % 256);
+      validation_data[i] = (uint8_t)(dumprand(D) % 256);
     } while (validation_data[i] == 0);  // 确保不为0，避免加载时验证失败
   }
   // 使用时间戳加密验证数据
@@ -631,7 +651,7 @@ static void dumpSegmented(DumpState *D, const Proto *f) {
     dumpSize(D, off_debug);
 
     /* Original Meta Info */
-    D->timestamp = time(NULL);
+    D->timestamp = dumptime(D);
     dumpVar(D, D->timestamp);
 
     dumpByte(D, work_proto->numparams);
@@ -736,7 +756,7 @@ static void dumpHeader (DumpState *D) {
   dumpLiteral(D, LUA_SIGNATURE);
   
   // 使用时间戳生成随机版本号，保持高位与原版本号一致，低位随机
-  int random_version = (LUAC_VERSION & 0xF0) | ((unsigned int)time(NULL) % 0x10);
+  int random_version = (LUAC_VERSION & 0xF0) | ((unsigned int)dumptime(D) % 0x10);
   dumpByte(D, random_version);
   
   dumpByte(D, LUAC_FORMAT);
@@ -769,6 +789,8 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.obfuscate_seed = 0;
   D.log_path = NULL;  /* 不输出日志 */
   D.cur_buf = NULL;
+  D.fixedtime = 0;
+  D.rng = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpSegmented(&D, f);
@@ -786,7 +808,7 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
 ** @param data 写入器数据
 ** @param strip 是否剥离调试信息
 ** @param obfuscate_flags 混淆标志位（参见lobfuscate.h中的OBFUSCATE_*常量）
-** @param seed 随机种子（0表示使用时间作为种子）
+** @param seed 随机种子（0表示使用时间作为种子；非0时时间戳也固定，输出可复现）
 ** @param log_path 调试日志输出路径（NULL表示不输出日志）
 ** @return 成功返回0，失败返回错误码
 **
@@ -815,9 +837,178 @@ int luaU_dump_obfuscated(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.obfuscate_seed = (seed != 0) ? seed : (unsigned int)time(NULL);
   D.log_path = log_path;
   D.cur_buf = NULL;
+  D.fixedtime = seed;  /* a given seed also fixes the timestamps */
+  D.rng = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpSegmented(&D, f);
   return D.status;
 }
 
+
+
+/*
+** {======================================================
+** Plain format
+** =======================================================
+*/
+
+/*
+** The plain format is a direct image of the prototypes, meant for
+** caches that are read back by the same build (see 'package.cachepath'
+** in loadlib.c). It has none of the encryption and integrity data of
+** the format above, so it dumps and loads about as fast as memory can
+** be copied, and it offers no protection at all.
+*/
+
+#define dumpVarPlain(D,x)	dumpBlock(D,&(x),sizeof(x))
+
+
+static void dumpIntPlain (DumpState *D, int x) {
+  dumpVarPlain(D, x);
+}
+
+
+static void dumpStringPlain (DumpState *D, const TString *s) {
+  size_t size = (s == NULL) ? 0 : tsslen(s) + 1;
+  dumpVarPlain(D, size);
+  if (size > 0)
+    dumpBlock(D, getstr(s), size - 1);
+}
+
+
+static void dumpFunctionPlain (DumpState *D, const Proto *f,
+                               const TString *psource) {
+  int i;
+  if (f->difierline_mode & OBFUSCATE_VM_PROTECT) {  /* cannot be plain */
+    D->status = 1;
+    return;
+  }
+  if (D->strip || f->source == psource)
+    dumpStringPlain(D, NULL);
+  else
+    dumpStringPlain(D, f->source);
+  dumpIntPlain(D, f->linedefined);
+  dumpIntPlain(D, f->lastlinedefined);
+  dumpByte(D, f->numparams);
+  dumpByte(D, f->flag);
+  dumpByte(D, f->is_vararg);
+  dumpByte(D, f->maxstacksize);
+  dumpByte(D, f->nodiscard);
+  dumpVarPlain(D, f->difierline_mode);
+  dumpVarPlain(D, f->difierline_magicnum);
+  dumpVarPlain(D, f->difierline_data);
+  /* code */
+  dumpIntPlain(D, f->sizecode);
+  if (f->bpcode == NULL)
+    dumpVector(D, f->code, f->sizecode);
+  else {
+    for (i = 0; i < f->sizecode; i++) {
+      Instruction inst = luaV_getinst(f, i);  /* never dump breakpoint traps */
+      dumpVarPlain(D, inst);
+    }
+  }
+  /* constants */
+  dumpIntPlain(D, f->sizek);
+  for (i = 0; i < f->sizek; i++) {
+    const TValue *o = &f->k[i];
+    int tt = ttypetag(o);
+    dumpByte(D, tt);
+    switch (tt) {
+      case LUA_VNUMFLT: {
+        lua_Number n = fltvalue(o);
+        dumpVarPlain(D, n);
+        break;
+      }
+      case LUA_VNUMINT: {
+        lua_Integer n = ivalue(o);
+        dumpVarPlain(D, n);
+        break;
+      }
+      case LUA_VSHRSTR:
+      case LUA_VLNGSTR:
+        dumpStringPlain(D, tsvalue(o));
+        break;
+      default:
+        lua_assert(tt == LUA_VNIL || tt == LUA_VFALSE || tt == LUA_VTRUE);
+    }
+  }
+  /* upvalues */
+  dumpIntPlain(D, f->sizeupvalues);
+  for (i = 0; i < f->sizeupvalues; i++) {
+    dumpByte(D, f->upvalues[i].instack);
+    dumpByte(D, f->upvalues[i].idx);
+    dumpByte(D, f->upvalues[i].kind);
+  }
+  /* nested functions */
+  dumpIntPlain(D, f->sizep);
+  for (i = 0; i < f->sizep; i++)
+    dumpFunctionPlain(D, f->p[i], f->source);
+  /* debug information */
+  dumpIntPlain(D, D->strip ? 0 : f->sizelineinfo);
+  if (!D->strip)
+    dumpVector(D, f->lineinfo, f->sizelineinfo);
+  dumpIntPlain(D, D->strip ? 0 : f->sizeabslineinfo);
+  if (!D->strip)
+    dumpVector(D, f->abslineinfo, f->sizeabslineinfo);
+  dumpIntPlain(D, D->strip ? 0 : f->sizelocvars);
+  for (i = 0; !D->strip && i < f->sizelocvars; i++) {
+    dumpStringPlain(D, f->locvars[i].varname);
+    dumpIntPlain(D, f->locvars[i].startpc);
+    dumpIntPlain(D, f->locvars[i].endpc);
+  }
+  dumpIntPlain(D, D->strip ? 0 : f->sizeupvalues);
+  for (i = 0; !D->strip && i < f->sizeupvalues; i++)
+    dumpStringPlain(D, f->upvalues[i].name);
+}
+
+
+static void dumpHeaderPlain (DumpState *D) {
+  lua_Integer i = LUAC_INT;
+  lua_Number n = LUAC_NUM;
+  l_uint32 codeid = luaP_codeid();
+  dumpLiteral(D, LUA_SIGNATURE);
+  dumpByte(D, LUAC_VERSION);
+  dumpByte(D, LUAC_FORMAT_PLAIN);
+  dumpLiteral(D, LUAC_DATA);
+  dumpByte(D, sizeof(Instruction));
+  dumpByte(D, sizeof(lua_Integer));
+  dumpByte(D, sizeof(lua_Number));
+  dumpByte(D, NUM_OPCODES);
+  dumpVarPlain(D, codeid);
+  dumpVarPlain(D, i);
+  dumpVarPlain(D, n);
+}
+
+
+/*
+** dump Lua function as a plain (unprotected) chunk; the whole chunk is
+** built in memory and handed to the writer in one piece
+*/
+int luaU_dump_plain(lua_State *L, const Proto *f, lua_Writer w, void *data,
+                    int strip) {
+  DumpState D;
+  Buffer buf;
+  D.L = L;
+  D.writer = w;
+  D.data = data;
+  D.strip = strip;
+  D.status = 0;
+  D.timestamp = 0;
+  D.obfuscate_flags = 0;
+  D.obfuscate_seed = 0;
+  D.log_path = NULL;
+  D.fixedtime = 0;
+  D.rng = 0;
+  buf_init(L, &buf);
+  D.cur_buf = &buf;
+  dumpHeaderPlain(&D);
+  dumpByte(&D, f->sizeupvalues);
+  dumpFunctionPlain(&D, f, NULL);
+  D.cur_buf = NULL;
+  dumpBlock(&D, buf.data, buf.size);
+  buf_free(&buf);
+  return D.status;
+}
+
+/* }====================================================== */
@@ -23,6 +23,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lvm.h"
 
 
 /**
@@ -217,10 +218,9 @@ static void prepcallclosemth (lua_State *L, StkId level, TStatus status,
   	break;
   	
     case LUA_OK:
-          L->top.p = level + 1;  /* call will be at this level */
-      /* FALLTHROUGH */
-    
-        break;
+      L->top.p = level + 1;  /* call will be at this level */
+      errobj = &G(L)->nilvalue;  /* error object is nil */
+      break;
   default:  /* 'luaD_seterrorobj' will set top to level + 2 */
     errobj = s2v(level + 1);  /* error object goes after 'uv' */
     luaD_seterrorobj(L, status, level + 1);  /* set error object */
@@ -361,6 +361,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->source = NULL;
   f->is_sleeping = 0;
   f->call_queue = NULL;
+  f->vm_code_table = NULL;
+  f->bpcode = NULL;
   return f;
 }
 
@@ -394,6 +396,8 @@ lu_mem luaF_protosize (Proto *p) {
  */
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->bpcode)
+    luaM_freearray(L, f->bpcode, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
@@ -530,7 +534,7 @@ int luaF_callqueuepop (lua_State *L, CallQueue *q, int *nargs, TValue *args) {
 uint64_t luaF_hashcode (const Proto *p) {
   uint64_t h = 0xCBF29CE484222325ULL;
   for (int i = 0; i < p->sizecode; i++) {
-    Instruction inst = p->code[i];
+    Instruction inst = luaV_getinst(p, i);  /* ignore breakpoint traps */
     h ^= inst;
     h *= 0x100000001B3ULL;
   }
@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "lua.h"
@@ -25,6 +26,7 @@
 #include "lsuper.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lprofile.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -117,6 +119,51 @@ void lgc_vmp_hook_point(void) {
 
 static void reallymarkobject (global_State *g, GCObject *o);
 static lu_mem atomic (lua_State *L);
+
+
+/*
+** {======================================================
+** Telemetry
+** =======================================================
+*/
+
+#if defined(CLOCK_MONOTONIC) || defined(LUA_USE_POSIX)
+static lua_Unsigned gcclock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (lua_Unsigned)ts.tv_sec * 1000000000u + (lua_Unsigned)ts.tv_nsec;
+}
+#else
+#define gcclock()	((lua_Unsigned)clock() * (1000000000u / CLOCKS_PER_SEC))
+#endif
+
+
+/*
+** Close a record for a collection of the given kind that started at
+** 't0', moving the counters gathered since the previous one into it.
+*/
+static void gcrecord (global_State *g, int kind, lua_Unsigned t0) {
+  GCStats *st = &g->gcstats;
+  lua_GCStat *r = &st->ring[st->n % LUAI_GCSTATS];
+  lua_Unsigned heap = cast(lua_Unsigned, gettotalbytes(g));
+  r->seq = ++st->n;
+  r->kind = kind;
+  r->nanos = gcclock() - t0;
+  r->allocated = (st->heap0 > st->heap) ? st->heap0 - st->heap : 0;
+  r->freed = (st->heap0 > heap) ? st->heap0 - heap : 0;
+  r->heap = st->heap = heap;
+  r->finalizers = st->finalizers;
+  r->finnanos = st->finnanos;
+  memcpy(r->swept, st->swept, sizeof(st->swept));
+  st->finalizers = st->finnanos = 0;
+  memset(st->swept, 0, sizeof(st->swept));
+}
+
+/* start timing a collection */
+#define gcstart(g,t0) \
+  ((g)->gcstats.heap0 = cast(lua_Unsigned, gettotalbytes(g)), t0 = gcclock())
+
+/* }====================================================== */
 static void entersweep (lua_State *L);
 
 
@@ -420,6 +467,28 @@ static void markmt (global_State *g) {
   int i;
   for (i=0; i < LUA_NUMTAGS; i++)
     markobjectN(g, g->mt[i]);
+  markobjectN(g, g->slicemt);
+  markobjectN(g, g->sliceviews);
+}
+
+
+/**
+ * @brief Mark prototypes of samples still waiting in the profiler ring.
+ *
+ * @param g The global state.
+ */
+static void markprofiler (global_State *g) {
+  Profiler *pf = g->profiler;
+  if (pf != NULL) {
+    unsigned int mask = pf->size - 1;
+    unsigned int i = atomic_load(&pf->tail);
+    unsigned int head = atomic_load(&pf->head);
+    for (; i != head; i++) {
+      ProfEntry *e = &pf->ring[i & mask];
+      if (e->kind == PROF_LUA)
+        markobject(g, e->u.p);
+    }
+  }
 }
 
 
@@ -980,6 +1049,7 @@ static void freeupval (lua_State *L, UpVal *uv) {
  * @param o The object.
  */
 static void freeobj (lua_State *L, GCObject *o) {
+  G(L)->gcstats.swept[novariant(o->tt)]++;
   switch (o->tt) {
     case LUA_VPROTO:
       luaF_freeproto(L, gco2p(o));
@@ -1050,7 +1120,7 @@ static void freeobj (lua_State *L, GCObject *o) {
     }
     case LUA_VNUMBIG: {
       TBigInt *b = gco2big(o);
-      luaM_freemem(L, b, sizeof(TBigInt) + (b->len > 0 ? (b->len - 1) : 0) * sizeof(l_uint32));
+      luaM_freemem(L, b, sizebigint(b->size));
       break;
     }
     default: lua_assert(0);
@@ -1058,6 +1128,17 @@ static void freeobj (lua_State *L, GCObject *o) {
 }
 
 
+/*
+** While sweeping, blocks of dead objects may go to the background freeing
+** thread (see 'luaM_setbgfree'). Emergency collections free in place, as
+** their caller is about to retry an allocation.
+*/
+#define startdeferfree(g) \
+	((g)->gcdeferfree = ((g)->bgfree != NULL && !(g)->gcemergency))
+#define enddeferfree(L,g) \
+	{ if ((g)->gcdeferfree) { (g)->gcdeferfree = 0; luaM_flushbgfree(L, 0); } }
+
+
 /**
  * @brief Sweep at most 'countin' elements from a list of GCObjects.
  *
@@ -1078,6 +1159,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
   int ow = otherwhite(g);
   int i;
   int white = luaC_white(g);  /* current white */
+  startdeferfree(g);
   for (i = 0; *p != NULL && i < countin; i++) {
     GCObject *curr = *p;
     int marked = curr->marked;
@@ -1090,6 +1172,7 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, int countin,
       p = &curr->next;  /* go to next element */
     }
   }
+  enddeferfree(L, g);
   if (countout)
     *countout = i;  /* number of elements traversed */
   return (*p == NULL) ? NULL : p;
@@ -1178,6 +1261,7 @@ static void GCTM (lua_State *L) {
   global_State *g = G(L);
   const TValue *tm;
   TValue v;
+  lua_Unsigned t0;
   lua_assert(!g->gcemergency);
   setgcovalue(L, &v, udata2finalize(g));
   tm = luaT_gettmbyobj(L, &v, TM_GC);
@@ -1190,7 +1274,10 @@ static void GCTM (lua_State *L) {
     setobj2s(L, L->top.p++, tm);  /* push finalizer... */
     setobj2s(L, L->top.p++, &v);  /* ... and its argument */
     L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
+    t0 = gcclock();
     status = luaD_pcall(L, dothecall, NULL, savestack(L, L->top.p - 2), 0);
+    g->gcstats.finnanos += gcclock() - t0;
+    g->gcstats.finalizers++;
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
     L->allowhook = oldah;  /* restore hooks */
     g->gcstp = oldgcstp;  /* restore state */
@@ -1377,6 +1464,7 @@ static void setpause (global_State *g) {
 static void sweep2old (lua_State *L, GCObject **p) {
   GCObject *curr;
   global_State *g = G(L);
+  startdeferfree(g);
   while ((curr = *p) != NULL) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(isdead(g, curr));
@@ -1396,6 +1484,7 @@ static void sweep2old (lua_State *L, GCObject **p) {
       p = &curr->next;  /* go to next element */
     }
   }
+  enddeferfree(L, g);
 }
 
 
@@ -1431,6 +1520,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
   };
   int white = luaC_white(g);
   GCObject *curr;
+  startdeferfree(g);
   while ((curr = *p) != limit) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       lua_assert(!isold(curr) && isdead(g, curr));
@@ -1450,6 +1540,7 @@ static GCObject **sweepgen (lua_State *L, global_State *g, GCObject **p,
       p = &curr->next;  /* go to next element */
     }
   }
+  enddeferfree(L, g);
   return p;
 }
 
@@ -1561,6 +1652,7 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 static void finishgencycle (lua_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
+  luaE_trimthreadpool(L);  /* dead threads not reused */
   g->gcstate = GCSpropagate;  /* skip restart */
   if (!g->gcemergency)
     callallpendingfinalizers(L);
@@ -1579,7 +1671,9 @@ static void finishgencycle (lua_State *L, global_State *g) {
 static void youngcollection (lua_State *L, global_State *g) {
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lua_Unsigned t0;
   lua_assert(g->gcstate == GCSpropagate);
+  gcstart(g, t0);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
     g->firstold1 = NULL;  /* no more OLD1 objects (for now) */
@@ -1608,6 +1702,7 @@ static void youngcollection (lua_State *L, global_State *g) {
 
   sweepgen(L, g, &g->tobefnz, NULL, &dummy);
   finishgencycle(L, g);
+  gcrecord(g, LUA_GCSYOUNG, t0);
 }
 
 
@@ -1667,11 +1762,14 @@ static void setminordebt (global_State *g) {
  */
 static lu_mem entergen (lua_State *L, global_State *g) {
   lu_mem numobjs;
+  lua_Unsigned t0;
+  gcstart(g, t0);
   luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
   numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
   atomic2gen(L, g);
   setminordebt(g);  /* set debt assuming next cycle will be minor */
+  gcrecord(g, LUA_GCSATOMIC2GEN, t0);
   return numobjs;
 }
 
@@ -1754,6 +1852,8 @@ static lu_mem fullgen (lua_State *L, global_State *g) {
 static void stepgenfull (lua_State *L, global_State *g) {
   lu_mem newatomic;  /* count of traversed objects */
   lu_mem lastatomic = g->lastatomic;  /* count from last collection */
+  lua_Unsigned t0;
+  gcstart(g, t0);
   if (g->gckind == KGC_GENH)  /* still in generational mode? */
     enterinc(g);  /* enter incremental mode */
   luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
@@ -1769,6 +1869,7 @@ static void stepgenfull (lua_State *L, global_State *g) {
     setpause(g);
     g->lastatomic = newatomic;
   }
+  gcrecord(g, LUA_GCSGENFULL, t0);
 }
 
 
@@ -1904,6 +2005,7 @@ static lu_mem atomic (lua_State *L) {
   /* registry and global metatables may be changed by API */
   markvalue(g, &g->l_registry);
   markmt(g);  /* mark global metatables */
+  markprofiler(g);  /* prototypes of pending samples */
   work += propagateall(g);  /* empties 'gray' list */
   /* remark occasional upvalues of (maybe) dead threads */
   work += remarkupvals(g);
@@ -2008,6 +2110,7 @@ static lu_mem singlestep (lua_State *L) {
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
       luaM_poolgc(L);  /* 回收内存池缓存 */
+      luaE_trimthreadpool(L);  /* and the dead threads not reused */
       g->gcstate = GCScallfin;
       work = 0;
       break;
@@ -2062,6 +2165,8 @@ static void incstep (lua_State *L, global_State *g) {
   l_mem stepsize = (g->gcstepsize <= log2maxs(l_mem))
                  ? ((cast(l_mem, 1) << g->gcstepsize) / WORK2MEM) * stepmul
                  : MAX_LMEM;  /* overflow; keep maximum value */
+  lua_Unsigned t0;
+  gcstart(g, t0);
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -2072,6 +2177,7 @@ static void incstep (lua_State *L, global_State *g) {
     debt = (debt / stepmul) * WORK2MEM;  /* convert 'work units' to bytes */
     luaE_setdebt(g, debt);
   }
+  gcrecord(g, LUA_GCSINCSTEP, t0);
 }
 
 /**
@@ -2109,6 +2215,8 @@ void luaC_step (lua_State *L) {
  * @param g The global state.
  */
 static void fullinc (lua_State *L, global_State *g) {
+  lua_Unsigned t0;
+  gcstart(g, t0);
   if (keepinvariant(g))  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   /* finish any pending sweep phase to start a new cycle */
@@ -2120,6 +2228,7 @@ static void fullinc (lua_State *L, global_State *g) {
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
   setpause(g);
+  gcrecord(g, LUA_GCSFULLINC, t0);
 }
 
 
@@ -2139,6 +2248,7 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   else
     fullgen(L, g);
   luaM_poolgc(L);  /* 回收内存池缓存 */
+  luaE_freethreadpool(L);  /* and the dead threads kept for reuse */
   g->gcemergency = 0;
   l_mutex_unlock(&g->lock);
 }
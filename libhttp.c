@@ -8,7 +8,9 @@
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#include "lthread.h"
 
+#include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -43,6 +45,10 @@
   #include <fcntl.h>
   #include <sys/time.h>
   #include <errno.h>
+  #include <netinet/tcp.h>
+  #if defined(__linux__)
+    #include <sys/epoll.h>
+  #endif
 
   #define L_SOCKET int
   #define L_INVALID_SOCKET -1
@@ -55,6 +61,20 @@
 
 #define L_HTTP_SOCKET "http.socket"
 
+/* Idle keep-alive connections kept by the client */
+#if !defined(HTTP_POOLSIZE)
+#define HTTP_POOLSIZE 16
+#endif
+
+/* Limits on the head of a message */
+#define HTTP_MAXHEAD (64 * 1024)
+#define HTTP_MAXHEADERS 64
+
+/* Default limit on the body of a request served by server:serve */
+#if !defined(HTTP_MAXBODY)
+#define HTTP_MAXBODY (8 * 1024 * 1024)
+#endif
+
 typedef struct {
     L_SOCKET sock;
 } l_socket_ud;
@@ -138,6 +158,266 @@ static int parse_url(const char *url, char *host, size_t host_len, int *port, ch
     return 1;
 }
 
+/*
+** Incremental HTTP/1.x message parsing. Data is read into one growing
+** buffer; the parser records offsets into it instead of copying, so a
+** message only gets copied when it is handed to Lua.
+*/
+#if !defined(_WIN32)
+
+typedef struct {
+    char *p;
+    size_t len, size;
+    size_t scanned;  /* bytes already searched for the end of the head */
+} l_httpbuf;
+
+typedef struct {
+    size_t name, namelen, value, valuelen;  /* offsets into the buffer */
+} l_httphdr;
+
+typedef struct {
+    int status;                 /* status code of a response */
+    size_t method, methodlen;   /* request line of a request */
+    size_t target, targetlen;
+    size_t headlen;             /* bytes up to and including the empty line */
+    long long clen;             /* Content-Length, or -1 */
+    int chunked;                /* Transfer-Encoding: chunked */
+    int close;                  /* connection ends after this message */
+    size_t bodylen;             /* decoded body length, once complete */
+    int extra;                  /* bytes follow the message */
+    int nheaders;
+    l_httphdr headers[HTTP_MAXHEADERS];
+} l_httpmsg;
+
+/* state of in-place chunked decoding */
+typedef struct {
+    size_t in, out;  /* read and write positions in the buffer */
+    size_t left;     /* bytes left in the current chunk */
+    int state;       /* 0: size line, 1: data, 2: CRLF, 3: trailers */
+} l_dechunk;
+
+static int l_httpbuf_reserve(l_httpbuf *b, size_t extra) {
+    if (b->size - b->len < extra) {
+        size_t nsize = b->size ? b->size : 16384;
+        while (nsize - b->len < extra) nsize *= 2;
+        char *np = (char *)realloc(b->p, nsize);
+        if (np == NULL) return 0;
+        b->p = np;
+        b->size = nsize;
+    }
+    return 1;
+}
+
+/* drops the first 'n' bytes of the buffer */
+static void l_httpbuf_consume(l_httpbuf *b, size_t n) {
+    if (n < b->len) memmove(b->p, b->p + n, b->len - n);
+    b->len = (n < b->len) ? b->len - n : 0;
+    b->scanned = 0;
+}
+
+static int l_ieq(const char *p, size_t len, const char *lit) {
+    size_t n = strlen(lit);
+    return len == n && strncasecmp(p, lit, n) == 0;
+}
+
+/* does 'p' contain the token 'tok' (case-insensitive)? */
+static int l_hastoken(const char *p, size_t len, const char *tok) {
+    size_t n = strlen(tok);
+    size_t i;
+    for (i = 0; i + n <= len; i++) {
+        if (strncasecmp(p + i, tok, n) == 0) return 1;
+    }
+    return 0;
+}
+
+/* do user-supplied request headers ask to close the connection? */
+static int l_hasclose(const char *h, size_t len) {
+    const char *end = h + len;
+    while (h < end) {
+        const char *nl = memchr(h, '\n', end - h);
+        size_t n = (nl ? nl : end) - h;
+        if (n > 11 && strncasecmp(h, "connection:", 11) == 0 &&
+            l_hastoken(h + 11, n - 11, "close"))
+            return 1;
+        h += n + 1;
+    }
+    return 0;
+}
+
+/*
+** Parses the head of a request or response once it is complete.
+** Returns 1 when done, 0 if more data is needed and -1 if malformed.
+*/
+static int l_parse_head(l_httpbuf *b, l_httpmsg *m, int isrequest) {
+    size_t start = b->scanned > 3 ? b->scanned - 3 : 0;
+    char *p = b->p, *end, *line, *nl;
+    int minor;
+    end = NULL;
+    if (b->len >= 4) {
+        char *q = p + start;
+        while ((q = memchr(q, '\r', p + b->len - q)) != NULL) {
+            if (p + b->len - q >= 4 && memcmp(q, "\r\n\r\n", 4) == 0) {
+                end = q;
+                break;
+            }
+            if (p + b->len - q < 4) break;
+            q++;
+        }
+    }
+    if (end == NULL) {
+        b->scanned = b->len;
+        return b->len > HTTP_MAXHEAD ? -1 : 0;
+    }
+    m->headlen = (size_t)(end - p) + 4;
+    m->clen = -1;
+    m->chunked = m->close = 0;
+    m->status = 0;
+    m->nheaders = 0;
+    m->bodylen = 0;
+    m->extra = 0;
+    /* start line */
+    nl = memchr(p, '\r', end - p + 1);
+    if (nl[1] != '\n') return -1;  /* bare CR */
+    if (isrequest) {
+        char *sp1 = memchr(p, ' ', nl - p);
+        char *sp2 = sp1 ? memchr(sp1 + 1, ' ', nl - sp1 - 1) : NULL;
+        if (sp2 == NULL || nl - sp2 != 9 || strncmp(sp2 + 1, "HTTP/1.", 7) != 0)
+            return -1;
+        m->method = 0;
+        m->methodlen = (size_t)(sp1 - p);
+        m->target = (size_t)(sp1 + 1 - p);
+        m->targetlen = (size_t)(sp2 - sp1 - 1);
+        minor = sp2[8] - '0';
+    }
+    else {
+        if (nl - p < 12 || strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ')
+            return -1;
+        minor = p[7] - '0';
+        m->status = atoi(p + 9);
+    }
+    m->close = (minor == 0);  /* HTTP/1.0 closes unless told otherwise */
+    /* header lines */
+    for (line = nl + 2; line < end + 2; line = nl + 2) {
+        char *colon, *v, *ve;
+        nl = memchr(line, '\r', end + 2 - line);
+        if (nl == NULL || nl[1] != '\n') return -1;  /* bare CR */
+        colon = memchr(line, ':', nl - line);
+        if (colon == NULL) return -1;
+        v = colon + 1;
+        while (v < nl && (*v == ' ' || *v == '\t')) v++;
+        ve = nl;
+        while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t')) ve--;
+        if (m->nheaders < HTTP_MAXHEADERS) {
+            l_httphdr *h = &m->headers[m->nheaders++];
+            h->name = (size_t)(line - p);
+            h->namelen = (size_t)(colon - line);
+            h->value = (size_t)(v - p);
+            h->valuelen = (size_t)(ve - v);
+        }
+        if (l_ieq(line, colon - line, "content-length"))
+            m->clen = strtoll(v, NULL, 10);
+        else if (l_ieq(line, colon - line, "transfer-encoding"))
+            m->chunked = l_hastoken(v, ve - v, "chunked");
+        else if (l_ieq(line, colon - line, "connection")) {
+            if (l_hastoken(v, ve - v, "close")) m->close = 1;
+            else if (l_hastoken(v, ve - v, "keep-alive")) m->close = 0;
+        }
+    }
+    if (m->clen < -1) return -1;
+    if (m->chunked) m->clen = -1;
+    else if (isrequest && m->clen < 0) m->clen = 0;  /* requests need a length */
+    return 1;
+}
+
+static int l_hexval(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = tolower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/*
+** Decodes as much of a chunked body as is available, compacting the
+** data in place. Returns 1 at the end of the body, 0 if more data is
+** needed and -1 if malformed.
+*/
+static int l_dechunk_step(char *p, size_t len, l_dechunk *d) {
+    for (;;) {
+        switch (d->state) {
+            case 0: {  /* chunk-size [; extensions] CRLF */
+                char *nl = memchr(p + d->in, '\n', len - d->in);
+                const char *q = p + d->in;
+                size_t sz = 0;
+                int v, digits = 0;
+                if (nl == NULL) return (len - d->in > 1024) ? -1 : 0;
+                while ((v = l_hexval((unsigned char)*q)) >= 0) {
+                    if (++digits > 15) return -1;
+                    sz = sz * 16 + (size_t)v;
+                    q++;
+                }
+                if (digits == 0) return -1;
+                d->in = (size_t)(nl - p) + 1;
+                d->left = sz;
+                d->state = sz ? 1 : 3;
+                break;
+            }
+            case 1: {  /* chunk data */
+                size_t n = len - d->in;
+                if (n > d->left) n = d->left;
+                if (n == 0) return 0;
+                if (d->out != d->in) memmove(p + d->out, p + d->in, n);
+                d->out += n;
+                d->in += n;
+                d->left -= n;
+                if (d->left == 0) d->state = 2;
+                break;
+            }
+            case 2: {  /* CRLF after the data */
+                if (len - d->in < 2) return 0;
+                if (p[d->in] != '\r' || p[d->in + 1] != '\n') return -1;
+                d->in += 2;
+                d->state = 0;
+                break;
+            }
+            default: {  /* trailer lines up to an empty one */
+                char *nl = memchr(p + d->in, '\n', len - d->in);
+                size_t n;
+                if (nl == NULL) return 0;
+                n = (size_t)(nl - (p + d->in));
+                d->in += n + 1;
+                if (n == 0 || (n == 1 && nl[-1] == '\r')) return 1;
+                break;
+            }
+        }
+    }
+}
+
+/* pushes a table with the headers of 'm', names in lower case */
+static void l_push_headers(lua_State *L, l_httpbuf *b, l_httpmsg *m) {
+    int i;
+    lua_createtable(L, 0, m->nheaders);
+    for (i = 0; i < m->nheaders; i++) {
+        l_httphdr *h = &m->headers[i];
+        char name[128];
+        size_t j, n = h->namelen < sizeof(name) ? h->namelen : sizeof(name);
+        for (j = 0; j < n; j++) name[j] = (char)tolower((unsigned char)b->p[h->name + j]);
+        lua_pushlstring(L, name, n);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, -3) == LUA_TSTRING) {  /* repeated: join values */
+            lua_pushliteral(L, ", ");
+            lua_pushlstring(L, b->p + h->value, h->valuelen);
+            lua_concat(L, 3);
+        }
+        else {
+            lua_pop(L, 1);
+            lua_pushlstring(L, b->p + h->value, h->valuelen);
+        }
+        lua_rawset(L, -3);
+    }
+}
+
+#endif
+
 /*
 ** Existing HTTP Request Implementation (Client High-Level)
 */
@@ -234,6 +514,181 @@ static int http_request(lua_State *L, const char *method) {
 
 #elif defined(__ANDROID__) || defined(__linux__) || defined(__APPLE__) || defined(__EMSCRIPTEN__)
 
+/*
+** Client side. Requests go out as HTTP/1.1 over connections kept in a
+** small per-host pool; responses are read into one growing buffer and
+** parsed in place, so the body reaches Lua with a single copy.
+*/
+
+#define L_HTTP_POOL "_HTTP_POOL"
+
+typedef struct {
+    char host[256];
+    int port;
+    int fd;
+} l_pooled_conn;
+
+typedef struct {
+    l_mutex_t lock;  /* pools are shared by every thread of the state */
+    int n;
+    l_pooled_conn conns[HTTP_POOLSIZE];  /* idle connections, oldest first */
+} l_http_pool;
+
+static l_http_pool *l_get_pool(lua_State *L) {
+    l_http_pool *pool;
+    lua_getfield(L, LUA_REGISTRYINDEX, L_HTTP_POOL);
+    pool = (l_http_pool *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return pool;
+}
+
+/* Is an idle connection still usable? It must have nothing to read yet. */
+static int l_conn_alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* Takes the most recently used idle connection to host:port, or -1. */
+static int l_pool_take(l_http_pool *pool, const char *host, int port) {
+    int fd = -1;
+    if (pool == NULL) return -1;
+    l_mutex_lock(&pool->lock);
+    while (fd < 0) {
+        int i;
+        for (i = pool->n - 1; i >= 0; i--) {
+            if (pool->conns[i].port == port && strcmp(pool->conns[i].host, host) == 0)
+                break;
+        }
+        if (i < 0) break;
+        fd = pool->conns[i].fd;
+        memmove(&pool->conns[i], &pool->conns[i + 1], (pool->n - i - 1) * sizeof(l_pooled_conn));
+        pool->n--;
+        if (!l_conn_alive(fd)) {  /* closed by the server meanwhile */
+            close(fd);
+            fd = -1;
+        }
+    }
+    l_mutex_unlock(&pool->lock);
+    return fd;
+}
+
+static void l_pool_put(l_http_pool *pool, const char *host, int port, int fd) {
+    l_pooled_conn *c;
+    if (pool == NULL || strlen(host) >= sizeof(c->host)) {
+        close(fd);
+        return;
+    }
+    l_mutex_lock(&pool->lock);
+    if (pool->n == HTTP_POOLSIZE) {  /* evict the oldest */
+        close(pool->conns[0].fd);
+        memmove(&pool->conns[0], &pool->conns[1], (HTTP_POOLSIZE - 1) * sizeof(l_pooled_conn));
+        pool->n--;
+    }
+    c = &pool->conns[pool->n++];
+    strcpy(c->host, host);
+    c->port = port;
+    c->fd = fd;
+    l_mutex_unlock(&pool->lock);
+}
+
+static int l_pool_gc(lua_State *L) {
+    l_http_pool *pool = (l_http_pool *)lua_touserdata(L, 1);
+    int i;
+    for (i = 0; i < pool->n; i++)
+        close(pool->conns[i].fd);
+    pool->n = 0;
+    l_mutex_destroy(&pool->lock);
+    return 0;
+}
+
+static int l_http_connect(lua_State *L, const char *host, int port) {
+    struct sockaddr_in serv_addr;
+    int one = 1;
+    if (!l_resolve_addr(L, host, port, &serv_addr))
+        return -1;  /* error already pushed */
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Socket creation failed");
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        close(sockfd);
+        lua_pushnil(L);
+        lua_pushstring(L, "Connection failed");
+        return -1;
+    }
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sockfd;
+}
+
+static int l_send_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+/*
+** Reads one response from 'fd' into 'b'. Returns 1 when complete, 0 if
+** the connection was closed before any byte arrived (a stale keep-alive
+** connection) and -1 on errors.
+*/
+static int l_read_response(int fd, l_httpbuf *b, l_httpmsg *m, int head) {
+    l_dechunk dc;
+    int state = 0;  /* 0: head, 1: body */
+    memset(&dc, 0, sizeof(dc));
+    b->len = 0;
+    b->scanned = 0;
+    for (;;) {
+        if (state == 0) {
+            int r = l_parse_head(b, m, 0);
+            if (r < 0) return -1;
+            if (r > 0) {
+                state = 1;
+                dc.in = dc.out = m->headlen;
+                if (head || m->status == 204 || m->status == 304 || m->status / 100 == 1)
+                    m->clen = 0, m->chunked = 0;
+            }
+        }
+        if (state == 1) {
+            if (m->chunked) {
+                int r = l_dechunk_step(b->p, b->len, &dc);
+                if (r < 0) return -1;
+                if (r > 0) {
+                    m->bodylen = dc.out - m->headlen;
+                    m->extra = b->len > dc.in;
+                    return 1;
+                }
+            }
+            else if (m->clen >= 0 && b->len - m->headlen >= (size_t)m->clen) {
+                m->bodylen = (size_t)m->clen;
+                m->extra = b->len > m->headlen + m->bodylen;
+                return 1;
+            }
+        }
+        if (!l_httpbuf_reserve(b, 16384)) return -1;
+        ssize_t n = recv(fd, b->p + b->len, b->size - b->len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0 && state == 1 && !m->chunked && m->clen < 0) {
+                m->bodylen = b->len - m->headlen;  /* delimited by close */
+                m->close = 1;
+                return 1;
+            }
+            return (n == 0 && b->len == 0) ? 0 : -1;
+        }
+        b->len += (size_t)n;
+    }
+}
+
 static int http_request(lua_State *L, const char *method) {
     const char *url = luaL_checkstring(L, 1);
     const char *body = NULL;
@@ -264,112 +719,69 @@ static int http_request(lua_State *L, const char *method) {
         return 2;
     }
 
-    struct sockaddr_in serv_addr;
-    if (!l_resolve_addr(L, host, port, &serv_addr)) {
-        return 2; /* Error already pushed */
-    }
-
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        lua_pushnil(L);
-        lua_pushstring(L, "Socket creation failed");
-        return 2;
-    }
-
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        close(sockfd);
-        lua_pushnil(L);
-        lua_pushstring(L, "Connection failed");
-        return 2;
-    }
-
     /* Construct HTTP Request */
-    luaL_Buffer req;
-    luaL_buffinit(L, &req);
-    luaL_addstring(&req, method);
-    luaL_addstring(&req, " ");
-    luaL_addstring(&req, path);
-    luaL_addstring(&req, " HTTP/1.0\r\n");
-    luaL_addstring(&req, "Host: ");
-    luaL_addstring(&req, host);
-    luaL_addstring(&req, "\r\n");
-    luaL_addstring(&req, "User-Agent: LuaHTTPClient/1.0\r\n");
-    luaL_addstring(&req, "Connection: close\r\n");
-
+    int keepalive = !(headers && l_hasclose(headers, strlen(headers)));
+    char head[1536];
+    int hlen = snprintf(head, sizeof(head),
+        "%s %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: LuaHTTPClient/1.1\r\n%s",
+        method, path, host, keepalive ? "" : "Connection: close\r\n");
     if (body) {
-        char len_str[32];
-        snprintf(len_str, sizeof(len_str), "%lu", (unsigned long)body_len);
-        luaL_addstring(&req, "Content-Length: ");
-        luaL_addstring(&req, len_str);
-        luaL_addstring(&req, "\r\n");
+        hlen += snprintf(head + hlen, sizeof(head) - hlen, "Content-Length: %lu\r\n",
+                         (unsigned long)body_len);
     }
-
-    if (headers) {
+    luaL_Buffer req;
+    luaL_buffinit(L, &req);
+    luaL_addlstring(&req, head, hlen);
+    if (headers && *headers) {
         luaL_addstring(&req, headers);
         if (headers[strlen(headers)-1] != '\n') {
             luaL_addstring(&req, "\r\n");
         }
     }
-
     luaL_addstring(&req, "\r\n");
     if (body) {
         luaL_addlstring(&req, body, body_len);
     }
-
     luaL_pushresult(&req);
-    const char *req_str = lua_tostring(L, -1);
-    size_t req_len = lua_rawlen(L, -1);
-
-    ssize_t sent = 0;
-    while (sent < req_len) {
-        ssize_t n = send(sockfd, req_str + sent, req_len - sent, 0);
-        if (n < 0) {
-            close(sockfd);
-            lua_pushnil(L);
-            lua_pushstring(L, "Send failed");
+    size_t req_len;
+    const char *req_str = lua_tolstring(L, -1, &req_len);
+
+    l_http_pool *pool = l_get_pool(L);
+    l_httpbuf buf = {NULL, 0, 0, 0};
+    l_httpmsg msg;
+    int sockfd, r, attempt;
+    for (attempt = 0; ; attempt++) {
+        int reused = 0;
+        sockfd = keepalive ? l_pool_take(pool, host, port) : -1;
+        if (sockfd >= 0) reused = 1;
+        else if ((sockfd = l_http_connect(L, host, port)) < 0) {
+            free(buf.p);
             return 2;
         }
-        sent += n;
-    }
-    lua_pop(L, 1); /* pop request string */
-
-    /* Read Response */
-    luaL_Buffer resp;
-    luaL_buffinit(L, &resp);
-    char buffer[4096];
-    ssize_t n;
-    while ((n = recv(sockfd, buffer, sizeof(buffer), 0)) > 0) {
-        luaL_addlstring(&resp, buffer, n);
-    }
-    close(sockfd);
-
-    luaL_pushresult(&resp);
-    const char *full_resp = lua_tostring(L, -1);
-    size_t full_len = lua_rawlen(L, -1);
-
-    /* Parse Status Code */
-    int status_code = 0;
-    const char *status_line_end = strstr(full_resp, "\r\n");
-    if (status_line_end) {
-        const char *p = full_resp;
-        while (p < status_line_end && *p != ' ') p++;
-        if (p < status_line_end) {
-            status_code = atoi(p + 1);
+        if (!l_send_all(sockfd, req_str, req_len))
+            r = 0;
+        else
+            r = l_read_response(sockfd, &buf, &msg, strcmp(method, "HEAD") == 0);
+        if (r > 0) break;
+        close(sockfd);
+        if (!reused || attempt > 0) {  /* only stale pooled connections are retried */
+            free(buf.p);
+            lua_pushnil(L);
+            lua_pushstring(L, r == 0 ? "Connection closed" : "Invalid response");
+            return 2;
         }
     }
 
-    /* Find Body */
-    const char *body_start = strstr(full_resp, "\r\n\r\n");
-    if (body_start) {
-        body_start += 4;
-        lua_pushinteger(L, status_code);
-        lua_pushlstring(L, body_start, full_len - (body_start - full_resp));
-    } else {
-        lua_pushinteger(L, status_code);
-        lua_pushlstring(L, "", 0);
-    }
+    if (keepalive && !msg.close && !msg.extra)
+        l_pool_put(pool, host, port, sockfd);
+    else
+        close(sockfd);
 
-    return 2;
+    lua_pushinteger(L, msg.status);
+    lua_pushlstring(L, buf.p + msg.headlen, msg.bodylen);
+    l_push_headers(L, &buf, &msg);
+    free(buf.p);
+    return 3;
 }
 
 #else
@@ -623,9 +1035,30 @@ static int l_socket_getsockname(lua_State *L) {
     return 2;
 }
 
-/* Constructor: http.server(port) */
+/*
+** Constructor: http.server(port [, backlog | options])
+** options: backlog (default SOMAXCONN), host (default "*") and reuseport,
+** which lets several threads each listen on the same port.
+*/
 static int l_http_server(lua_State *L) {
     int port = (int)luaL_checkinteger(L, 1);
+    int backlog = SOMAXCONN;
+    int reuseport = 0;
+    const char *host = "*";
+
+    if (lua_isinteger(L, 2)) {
+        backlog = (int)lua_tointeger(L, 2);
+    } else if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "backlog");
+        backlog = (int)luaL_optinteger(L, -1, backlog);
+        lua_getfield(L, 2, "reuseport");
+        reuseport = lua_toboolean(L, -1);
+        lua_getfield(L, 2, "host");
+        host = luaL_optstring(L, -1, host);
+        lua_pop(L, 3);
+    } else {
+        luaL_argexpected(L, lua_isnoneornil(L, 2), 2, "integer or table");
+    }
 
     L_SOCKET sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd == L_INVALID_SOCKET) {
@@ -636,12 +1069,31 @@ static int l_http_server(lua_State *L) {
 
     int opt = 1;
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+    if (reuseport) {
+#if defined(SO_REUSEPORT)
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (const char *)&opt, sizeof(opt)) < 0) {
+            l_closesocket(sockfd);
+            lua_pushnil(L);
+            lua_pushstring(L, "SO_REUSEPORT failed");
+            return 2;
+        }
+#else
+        l_closesocket(sockfd);
+        lua_pushnil(L);
+        lua_pushstring(L, "SO_REUSEPORT not supported on this platform");
+        return 2;
+#endif
+    }
 
     struct sockaddr_in serv_addr;
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
     serv_addr.sin_addr.s_addr = INADDR_ANY;
     serv_addr.sin_port = htons(port);
+    if (strcmp(host, "*") != 0 && !l_resolve_addr(L, host, port, &serv_addr)) {
+        l_closesocket(sockfd);
+        return 2;
+    }
 
     if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
         l_closesocket(sockfd);
@@ -650,7 +1102,7 @@ static int l_http_server(lua_State *L) {
         return 2;
     }
 
-    if (listen(sockfd, 5) < 0) {
+    if (listen(sockfd, backlog) < 0) {
         l_closesocket(sockfd);
         lua_pushnil(L);
         lua_pushstring(L, "Listen failed");
@@ -665,6 +1117,309 @@ static int l_http_server(lua_State *L) {
     return 1;
 }
 
+/*
+** server:serve(handler [, maxrequests | options])
+** Serves HTTP/1.1 on a listening socket from an edge-triggered epoll
+** loop: new connections are accepted until the queue is drained, and
+** every complete request read from a connection (pipelined ones
+** included) is passed to handler(request), which returns status, body
+** and optionally a table of headers. Connections are kept alive unless
+** the client asks otherwise. Returns the number of requests served
+** after 'maxrequests' of them (runs forever without it).
+** options: max (same as 'maxrequests') and maxbody, the largest request
+** body accepted (default HTTP_MAXBODY); longer ones are answered with
+** 413 and their connection is closed without calling the handler.
+*/
+#if defined(__linux__)
+
+#define L_HTTP_SERVELOOP "http.serveloop"
+
+typedef struct {
+    l_httpbuf in;
+    l_httpbuf out;
+    size_t outoff;   /* bytes of 'out' already sent */
+    int closing;     /* close once 'out' is flushed */
+    l_dechunk dc;    /* chunked request body in progress */
+    int inbody;      /* head parsed, waiting for the body */
+    l_httpmsg msg;
+} l_httpconn;
+
+typedef struct {
+    int epfd;
+    int nconns;
+    l_httpconn **conns;  /* indexed by descriptor */
+} l_serveloop;
+
+static void l_conn_free(l_serveloop *sl, int fd) {
+    l_httpconn *c = sl->conns[fd];
+    if (c) {
+        free(c->in.p);
+        free(c->out.p);
+        free(c);
+        sl->conns[fd] = NULL;
+        close(fd);
+    }
+}
+
+static void l_serveloop_free(l_serveloop *sl) {
+    int i;
+    for (i = 0; i < sl->nconns; i++) l_conn_free(sl, i);
+    free(sl->conns);
+    sl->conns = NULL;
+    sl->nconns = 0;
+    if (sl->epfd >= 0) close(sl->epfd);
+    sl->epfd = -1;
+}
+
+static int l_serveloop_gc(lua_State *L) {
+    l_serveloop_free((l_serveloop *)lua_touserdata(L, 1));
+    return 0;
+}
+
+static const char *l_reason(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 413: return "Payload Too Large";
+        case 500: return "Internal Server Error";
+        default: return "Unknown";
+    }
+}
+
+static int l_out_add(l_httpbuf *b, const char *s, size_t len) {
+    if (!l_httpbuf_reserve(b, len)) return 0;
+    memcpy(b->p + b->len, s, len);
+    b->len += len;
+    return 1;
+}
+
+/* calls the handler (at 'hidx') for the request in 'c' and queues the answer */
+static int l_serve_request(lua_State *L, int hidx, l_httpconn *c) {
+    l_httpmsg *m = &c->msg;
+    char *p = c->in.p;
+    lua_pushvalue(L, hidx);
+    lua_createtable(L, 0, 4);
+    lua_pushlstring(L, p + m->method, m->methodlen);
+    lua_setfield(L, -2, "method");
+    lua_pushlstring(L, p + m->target, m->targetlen);
+    lua_setfield(L, -2, "path");
+    l_push_headers(L, &c->in, m);
+    lua_setfield(L, -2, "headers");
+    lua_pushlstring(L, p + m->headlen, m->bodylen);
+    lua_setfield(L, -2, "body");
+    lua_call(L, 1, 3);
+
+    int status = (int)luaL_optinteger(L, -3, 200);
+    size_t blen = 0;
+    const char *body = luaL_optlstring(L, -2, "", &blen);
+    char head[256];
+    int hlen = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %lu\r\n%s",
+                        status, l_reason(status), (unsigned long)blen,
+                        m->close ? "Connection: close\r\n" : "");
+    int ok = l_out_add(&c->out, head, (size_t)hlen);
+    if (lua_istable(L, -1)) {
+        lua_pushnil(L);
+        while (ok && lua_next(L, -2)) {
+            size_t kl, vl;
+            const char *k, *v;
+            lua_pushvalue(L, -2);  /* do not convert the key in place */
+            k = lua_tolstring(L, -1, &kl);
+            v = lua_tolstring(L, -2, &vl);
+            if (k && v) {
+                ok = l_out_add(&c->out, k, kl) && l_out_add(&c->out, ": ", 2) &&
+                     l_out_add(&c->out, v, vl) && l_out_add(&c->out, "\r\n", 2);
+            }
+            lua_pop(L, 2);
+        }
+    }
+    ok = ok && l_out_add(&c->out, "\r\n", 2) && l_out_add(&c->out, body, blen);
+    lua_pop(L, 3);
+    if (m->close) c->closing = 1;
+    return ok;
+}
+
+/* refuses the request in 'c' and closes its connection once answered */
+static int l_conn_refuse(l_httpconn *c, int status) {
+    char head[128];
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n"
+                        "Connection: close\r\n\r\n", status, l_reason(status));
+    c->closing = 1;
+    return l_out_add(&c->out, head, (size_t)hlen);
+}
+
+/* sends what is queued; returns 0 if the connection should be dropped */
+static int l_conn_flush(l_serveloop *sl, int fd, l_httpconn *c) {
+    while (c->outoff < c->out.len) {
+        ssize_t n = send(fd, c->out.p + c->outoff, c->out.len - c->outoff, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                ev.data.fd = fd;
+                epoll_ctl(sl->epfd, EPOLL_CTL_MOD, fd, &ev);
+                return 1;
+            }
+            return 0;
+        }
+        c->outoff += (size_t)n;
+    }
+    c->out.len = c->outoff = 0;
+    return !c->closing;
+}
+
+/* parses and serves the complete requests buffered in 'c' */
+static int l_conn_process(lua_State *L, int hidx, l_httpconn *c,
+                          lua_Integer *served, lua_Integer max,
+                          size_t maxbody) {
+    while (!c->closing && (max <= 0 || *served < max)) {
+        l_httpmsg *m = &c->msg;
+        if (!c->inbody) {
+            int r = l_parse_head(&c->in, m, 1);
+            if (r < 0) return 0;
+            if (r == 0) return 1;
+            if (m->clen > 0 && (unsigned long long)m->clen > maxbody)
+                return l_conn_refuse(c, 413);
+            c->inbody = 1;
+            memset(&c->dc, 0, sizeof(c->dc));
+            c->dc.in = c->dc.out = m->headlen;
+        }
+        size_t total;
+        if (m->chunked) {
+            int r = l_dechunk_step(c->in.p, c->in.len, &c->dc);
+            if (r < 0) return 0;
+            if (c->dc.out - m->headlen > maxbody) return l_conn_refuse(c, 413);
+            if (r == 0) return 1;
+            m->bodylen = c->dc.out - m->headlen;
+            total = c->dc.in;
+        } else {
+            if (c->in.len - m->headlen < (size_t)m->clen) return 1;
+            m->bodylen = (size_t)m->clen;
+            total = m->headlen + m->bodylen;
+        }
+        if (!l_serve_request(L, hidx, c)) return 0;
+        (*served)++;
+        c->inbody = 0;
+        l_httpbuf_consume(&c->in, total);
+    }
+    return 1;
+}
+
+static int l_socket_serve(lua_State *L) {
+    l_socket_ud *server = l_check_socket(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    lua_Integer max = 0;
+    lua_Integer maxbody = HTTP_MAXBODY;
+    lua_Integer served = 0;
+    int lfd = server->sock;
+    struct epoll_event ev, evs[256];
+
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "max");
+        max = luaL_optinteger(L, -1, max);
+        lua_getfield(L, 3, "maxbody");
+        maxbody = luaL_optinteger(L, -1, maxbody);
+        lua_pop(L, 2);
+        luaL_argcheck(L, maxbody >= 0, 3, "maxbody must not be negative");
+    } else {
+        max = luaL_optinteger(L, 3, max);
+    }
+    if (lfd == L_INVALID_SOCKET) return luaL_error(L, "Socket closed");
+    lua_settop(L, 3);
+    l_serveloop *sl = (l_serveloop *)lua_newuserdata(L, sizeof(l_serveloop));
+    sl->epfd = -1;
+    sl->nconns = 0;
+    sl->conns = NULL;
+    luaL_setmetatable(L, L_HTTP_SERVELOOP);
+    sl->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sl->epfd < 0) return luaL_error(L, "epoll_create1 failed: %s", strerror(errno));
+    fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL, 0) | O_NONBLOCK);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = lfd;
+    if (epoll_ctl(sl->epfd, EPOLL_CTL_ADD, lfd, &ev) < 0)
+        return luaL_error(L, "cannot watch the listening socket: %s", strerror(errno));
+
+    while (max <= 0 || served < max) {
+        int i, n = epoll_wait(sl->epfd, evs, 256, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return luaL_error(L, "epoll_wait failed: %s", strerror(errno));
+        }
+        for (i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+            if (fd == lfd) {  /* edge-triggered: accept until the queue is empty */
+                for (;;) {
+                    int one = 1;
+                    int cfd = accept(lfd, NULL, NULL);
+                    if (cfd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) continue;
+                        break;  /* EAGAIN, or out of descriptors until some close */
+                    }
+                    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL, 0) | O_NONBLOCK);
+                    fcntl(cfd, F_SETFD, FD_CLOEXEC);
+                    if (cfd >= sl->nconns) {
+                        int nsize = sl->nconns ? sl->nconns : 64;
+                        while (nsize <= cfd) nsize *= 2;
+                        l_httpconn **nc = (l_httpconn **)realloc(sl->conns, nsize * sizeof(l_httpconn *));
+                        if (nc == NULL) { close(cfd); continue; }
+                        memset(nc + sl->nconns, 0, (nsize - sl->nconns) * sizeof(l_httpconn *));
+                        sl->conns = nc;
+                        sl->nconns = nsize;
+                    }
+                    l_httpconn *c = (l_httpconn *)calloc(1, sizeof(l_httpconn));
+                    if (c == NULL) { close(cfd); continue; }
+                    sl->conns[cfd] = c;
+                    setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+                    ev.data.fd = cfd;
+                    if (epoll_ctl(sl->epfd, EPOLL_CTL_ADD, cfd, &ev) < 0)
+                        l_conn_free(sl, cfd);
+                }
+                continue;
+            }
+            if (fd >= sl->nconns || sl->conns[fd] == NULL) continue;
+            l_httpconn *c = sl->conns[fd];
+            int alive = 1, eof = 0;
+            if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                for (;;) {  /* edge-triggered: read until it would block */
+                    if (!l_httpbuf_reserve(&c->in, 16384)) { alive = 0; break; }
+                    ssize_t r = recv(fd, c->in.p + c->in.len, c->in.size - c->in.len, 0);
+                    if (r > 0) { c->in.len += (size_t)r; continue; }
+                    if (r == 0) eof = 1;
+                    else if (errno == EINTR) continue;
+                    else if (errno != EAGAIN && errno != EWOULDBLOCK) alive = 0;
+                    break;
+                }
+                if (alive) alive = l_conn_process(L, 2, c, &served, max,
+                                                  (size_t)maxbody);
+            }
+            if (alive && c->out.len > c->outoff) alive = l_conn_flush(sl, fd, c);
+            else if (alive && c->closing) alive = 0;
+            if (!alive || (eof && c->out.len == c->outoff))
+                l_conn_free(sl, fd);
+        }
+    }
+    l_serveloop_free(sl);  /* answers still queued are dropped with their connections */
+    lua_pushinteger(L, served);
+    return 1;
+}
+
+#else
+
+static int l_socket_serve(lua_State *L) {
+    return luaL_error(L, "server:serve requires epoll (Linux)");
+}
+
+#endif
+
 /* Constructor: http.client(host, port) */
 static int l_http_socket_new(lua_State *L) {
     L_SOCKET sockfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -737,6 +1492,7 @@ static const luaL_Reg socket_methods[] = {
     {"shutdown", l_socket_shutdown},
     {"getsockname", l_socket_getsockname},
     {"settimeout", l_socket_settimeout},
+    {"serve", l_socket_serve},
     {"__gc", l_socket_close},
     {NULL, NULL}
 };
@@ -750,6 +1506,27 @@ LUAMOD_API int luaopen_http(lua_State *L) {
     luaL_setfuncs(L, socket_methods, 0);
     lua_pop(L, 1);
 
+#if defined(__linux__)
+    luaL_newmetatable(L, L_HTTP_SERVELOOP);
+    lua_pushcfunction(L, l_serveloop_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+#endif
+
+#if !defined(_WIN32) && (defined(__ANDROID__) || defined(__linux__) || defined(__APPLE__) || defined(__EMSCRIPTEN__))
+    if (lua_getfield(L, LUA_REGISTRYINDEX, L_HTTP_POOL) != LUA_TUSERDATA) {
+        l_http_pool *pool = (l_http_pool *)lua_newuserdatauv(L, sizeof(l_http_pool), 0);
+        pool->n = 0;
+        l_mutex_init(&pool->lock);
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, l_pool_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, L_HTTP_POOL);
+    }
+    lua_pop(L, 1);
+#endif
+
     luaL_newlib(L, httplib);
     return 1;
 }
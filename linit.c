@@ -28,6 +28,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
@@ -102,6 +103,7 @@ static const luaL_Reg stdlibs[] = {
   {LUA_STRUCTLIBNAME, luaopen_struct},
   {"bit32", luaopen_bit},
   {"thread", luaopen_thread},
+  {LUA_ASYNCLIBNAME, luaopen_asyncio},
   {"http", luaopen_http},
   {LUA_FSLIBNAME, luaopen_fs},
   {"vmprotect", luaopen_vmprotect},
@@ -109,6 +111,7 @@ static const luaL_Reg stdlibs[] = {
   {"ByteCode", luaopen_ByteCode},
   {"wasm3", luaopen_wasm3},
   {LUA_LEXERLIBNAME, luaopen_lexer},
+  {LUA_PROFLIBNAME, luaopen_profiler},
 
 #ifndef _WIN32
   {LUA_SMGRNAME, luaopen_smgr},
@@ -174,6 +177,7 @@ static const luaL_Reg loadedlibs[] = {
   {LUA_STRUCTLIBNAME, luaopen_struct},
   {"bit32", luaopen_bit},
   {"thread", luaopen_thread},
+  {LUA_ASYNCLIBNAME, luaopen_asyncio},
   {"http", luaopen_http},
   {LUA_FSLIBNAME, luaopen_fs},
   {"vmprotect", luaopen_vmprotect},
@@ -181,6 +185,7 @@ static const luaL_Reg loadedlibs[] = {
   {"ByteCode", luaopen_ByteCode},
   {"wasm3", luaopen_wasm3},
   {LUA_LEXERLIBNAME, luaopen_lexer},
+  {LUA_PROFLIBNAME, luaopen_profiler},
 
 #ifndef _WIN32
   {LUA_SMGRNAME, luaopen_smgr},
@@ -212,3 +217,70 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
   }
 }
 
+
+/*
+** Libraries that 'luaL_openlazylibs' opens at once (those of standard
+** Lua); the rest of 'loadedlibs' is opened on first use.
+*/
+static const char *const eagerlibs[] = {
+  LUA_GNAME, LUA_LOADLIBNAME, LUA_COLIBNAME, LUA_TABLIBNAME, LUA_IOLIBNAME,
+  LUA_OSLIBNAME, LUA_STRLIBNAME, LUA_UTF8LIBNAME, LUA_MATHLIBNAME,
+  LUA_DBLIBNAME, NULL
+};
+
+
+static int iseager (const char *name) {
+  const char *const *e;
+  for (e = eagerlibs; *e != NULL; e++)
+    if (strcmp(*e, name) == 0) return 1;
+  return 0;
+}
+
+
+/*
+** '__index' of the global table: open the library named by a missing
+** global and return it. (Libraries already opened have their globals.)
+*/
+static int lazylib (lua_State *L) {
+  const char *name;
+  const luaL_Reg *lib;
+  if (lua_type(L, 2) != LUA_TSTRING)
+    return 0;  /* do not convert numeric keys in place */
+  name = lua_tostring(L, 2);
+  for (lib = loadedlibs; lib->func; lib++) {
+    if (strcmp(lib->name, name) == 0 && !iseager(lib->name)) {
+      luaL_requiref(L, lib->name, lib->func, 1);  /* also sets the global */
+      return 1;
+    }
+  }
+  return 0;  /* a plain missing global */
+}
+
+
+LUALIB_API void luaL_openlazylibs (lua_State *L) {
+  const luaL_Reg *lib;
+  lua_pushglobaltable(L);
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  for (lib = loadedlibs; lib->func; lib++) {
+    int taken = (lua_getfield(L, -2, lib->name) != LUA_TNIL);
+    lua_pop(L, 1);
+    if (iseager(lib->name) || taken) {  /* (a placeholder would hide it) */
+      luaL_requiref(L, lib->name, lib->func, 1);
+      lua_pop(L, 1);  /* remove lib */
+    }
+    else {  /* let 'require' find it */
+      lua_pushcfunction(L, lib->func);
+      lua_setfield(L, -2, lib->name);
+    }
+  }
+  lua_pop(L, 1);  /* remove PRELOAD table */
+  if (!lua_getmetatable(L, -1)) {  /* base library did not set one? */
+    lua_createtable(L, 0, 1);
+    lua_pushvalue(L, -1);
+    lua_setmetatable(L, -3);
+  }
+  lua_pushcfunction(L, lazylib);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 2);  /* remove metatable and global table */
+}
+
@@ -16,7 +16,7 @@
 #define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
 
 
-static const void *const disptab[NUM_OPCODES] = {
+static const void *const disptab[NUM_OPCODES + 1] = {
 
 #if 0
 ** you can update the following list with this command:
@@ -57,8 +57,8 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_BANDK,
 &&L_OP_BORK,
 &&L_OP_BXORK,
-&&L_OP_SHRI,
 &&L_OP_SHLI,
+&&L_OP_SHRI,
 &&L_OP_ADD,
 &&L_OP_SUB,
 &&L_OP_MUL,
@@ -139,6 +139,7 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_ASYNCWRAP,
 &&L_OP_GENERICWRAP,
 &&L_OP_CHECKTYPE,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_BREAKPOINT
 
 };
@@ -1086,6 +1086,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
 
   luaZ_resetbuffer(ls->buff);
   for (;;) {
+    ls->tokpos = ls->curpos;  /* token starts here unless it is blank */
     switch (ls->current) {
       case '\n': case '\r': {  /* line breaks */
         inclinenumber(ls);
@@ -16,7 +16,9 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#include "lapi.h"
 #include "llex.h"
+#include "lmem.h"
 #include "lzio.h"
 #include "lstring.h"
 #include "lstate.h"
@@ -39,6 +41,599 @@ static const char *getS (lua_State *L, void *ud, size_t *size) {
   return ls->s;
 }
 
+
+/*
+** {======================================================
+** Token buffer
+** =======================================================
+*/
+
+/*
+** The token stream is kept in a userdata holding parallel arrays, so
+** lexing a file creates no table per token. Semantic values live in a
+** Lua array (first uservalue) shared by every buffer derived from the
+** same stream; offsets refer to the source string (second uservalue).
+** Indexing a buffer with an integer builds a plain token table on demand
+** ({token, line, type, value}), so code written for token tables keeps
+** working; such a table is a copy, changes go back with 'tokens[i] = t'.
+*/
+
+#define TOKENBUF	"lexer.tokens"
+
+#define TB_VALUES	1	/* uservalue: array of semantic values */
+#define TB_SOURCE	2	/* uservalue: source string (or nil) */
+
+typedef struct TokenBuf {
+  int n;  /* number of tokens */
+  int size;  /* size of the arrays */
+  size_t *pos;  /* offset of the token in the source (start of the block) */
+  int *tok;  /* token ids */
+  int *line;  /* line numbers */
+  int *val;  /* index into the value array (0 = no value) */
+  unsigned int *len;  /* length of the token in the source (0 = none) */
+} TokenBuf;
+
+/* the arrays share one block; bytes per token */
+#define TB_ENTRY	(sizeof(size_t) + 3 * sizeof(int) + sizeof(unsigned int))
+
+
+/* one token, detached from any buffer */
+typedef struct TokRec {
+  int tok, line, val;
+  size_t pos;
+  unsigned int len;
+} TokRec;
+
+
+static int hasvalue (int tk) {
+  return (tk == TK_NAME || tk == TK_STRING || tk == TK_INTERPSTRING ||
+          tk == TK_RAWSTRING || tk == TK_INT || tk == TK_FLT);
+}
+
+
+/*
+** Push the type string of a token ("'if'", "<name>", ...), the same
+** string 'luaX_token2str' gives while lexing.
+*/
+static void pushtype (lua_State *L, int token) {
+  LexState dummy_ls;
+  int top = lua_gettop(L);
+  const char *str;
+  memset(&dummy_ls, 0, sizeof(LexState));
+  dummy_ls.L = L;
+  str = luaX_token2str(&dummy_ls, token);
+  if (lua_gettop(L) == top)  /* returned but did not push? */
+    lua_pushstring(L, str);
+}
+
+
+static void tb_layout (TokenBuf *b, char *block, int size) {
+  b->pos = (size_t *)block;
+  b->tok = (int *)(b->pos + size);
+  b->line = b->tok + size;
+  b->val = b->line + size;
+  b->len = (unsigned int *)(b->val + size);
+}
+
+
+/* make room for 'extra' more tokens */
+static void tb_grow (lua_State *L, TokenBuf *b, int extra) {
+  int need = b->n + extra;
+  if (need > b->size) {
+    TokenBuf old = *b;
+    int newsize = (b->size < 16) ? 16 : b->size;
+    while (newsize < need) {
+      if (newsize > INT_MAX / 2 || (size_t)newsize * 2 > MAX_SIZET / TB_ENTRY)
+        luaL_error(L, "token buffer overflow");
+      newsize *= 2;
+    }
+    tb_layout(b, luaM_newvector(L, (size_t)newsize * TB_ENTRY, char), newsize);
+    if (old.size > 0) {
+      memcpy(b->pos, old.pos, old.n * sizeof(size_t));
+      memcpy(b->tok, old.tok, old.n * sizeof(int));
+      memcpy(b->line, old.line, old.n * sizeof(int));
+      memcpy(b->val, old.val, old.n * sizeof(int));
+      memcpy(b->len, old.len, old.n * sizeof(unsigned int));
+      luaM_freearray(L, (char *)old.pos, (size_t)old.size * TB_ENTRY);
+    }
+    b->size = newsize;
+  }
+}
+
+
+/*
+** Create a buffer with room for 'size' tokens. It shares the values and
+** source of the buffer at index 'from' (if not 0); otherwise it gets a
+** new value array and no source.
+*/
+static TokenBuf *newtokenbuf (lua_State *L, int size, int from) {
+  TokenBuf *b;
+  if (from != 0) from = lua_absindex(L, from);
+  b = (TokenBuf *)lua_newuserdatauv(L, sizeof(TokenBuf), 2);
+  memset(b, 0, sizeof(TokenBuf));
+  luaL_setmetatable(L, TOKENBUF);
+  if (from != 0) {
+    lua_getiuservalue(L, from, TB_VALUES);
+    lua_setiuservalue(L, -2, TB_VALUES);
+    lua_getiuservalue(L, from, TB_SOURCE);
+    lua_setiuservalue(L, -2, TB_SOURCE);
+  }
+  else {
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, TB_VALUES);
+  }
+  tb_grow(L, b, size);
+  return b;
+}
+
+
+static void tb_get (const TokenBuf *b, int i, TokRec *r) {
+  r->tok = b->tok[i]; r->line = b->line[i]; r->val = b->val[i];
+  r->pos = b->pos[i]; r->len = b->len[i];
+}
+
+
+static void tb_put (TokenBuf *b, int i, const TokRec *r) {
+  b->tok[i] = r->tok; b->line[i] = r->line; b->val[i] = r->val;
+  b->pos[i] = r->pos; b->len[i] = r->len;
+}
+
+
+/* move tokens [from, n) to start at 'to' (0-based) */
+static void tb_move (TokenBuf *b, int from, int to) {
+  size_t m = (size_t)(b->n - from);
+  memmove(b->tok + to, b->tok + from, m * sizeof(int));
+  memmove(b->line + to, b->line + from, m * sizeof(int));
+  memmove(b->val + to, b->val + from, m * sizeof(int));
+  memmove(b->pos + to, b->pos + from, m * sizeof(size_t));
+  memmove(b->len + to, b->len + from, m * sizeof(unsigned int));
+}
+
+
+/* append the value on the top of the stack to the value array of the
+   buffer at 'bidx' and return its index (0 for nil); pops the value */
+static int tb_addvalue (lua_State *L, int bidx) {
+  int v;
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  lua_getiuservalue(L, bidx, TB_VALUES);
+  v = (int)lua_rawlen(L, -1) + 1;
+  lua_rotate(L, -2, 1);
+  lua_rawseti(L, -2, v);
+  lua_pop(L, 1);
+  return v;
+}
+
+
+/* push the value of token 'i' (0-based) of the buffer at 'bidx' */
+static void tb_pushvalue (lua_State *L, const TokenBuf *b, int bidx, int i) {
+  if (b->val[i] == 0)
+    lua_pushnil(L);
+  else {
+    lua_getiuservalue(L, bidx, TB_VALUES);
+    lua_rawgeti(L, -1, b->val[i]);
+    lua_remove(L, -2);
+  }
+}
+
+
+/* push the table view of token 'i' (0-based) */
+static void tb_pushview (lua_State *L, const TokenBuf *b, int bidx, int i) {
+  lua_createtable(L, 0, 4);
+  lua_pushinteger(L, b->tok[i]);
+  lua_setfield(L, -2, "token");
+  lua_pushinteger(L, b->line[i]);
+  lua_setfield(L, -2, "line");
+  pushtype(L, b->tok[i]);
+  lua_setfield(L, -2, "type");
+  if (b->val[i] != 0) {
+    tb_pushvalue(L, b, bidx, i);
+    lua_setfield(L, -2, "value");
+  }
+}
+
+
+/*
+** Read the token table at 'idx' into 'r', adding its value to the
+** buffer at 'bidx'. 'i' is only used in error messages.
+*/
+static void tb_fromtable (lua_State *L, int idx, int bidx, int i, TokRec *r) {
+  idx = lua_absindex(L, idx);
+  if (!lua_istable(L, idx))
+    luaL_error(L, "expected a table at index %d of the token list", i);
+  lua_getfield(L, idx, "token");
+  if (!lua_isinteger(L, -1))
+    luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
+  r->tok = (int)lua_tointeger(L, -1);
+  lua_getfield(L, idx, "line");
+  r->line = (int)lua_tointeger(L, -1);
+  lua_pop(L, 2);
+  lua_getfield(L, idx, "value");
+  r->val = tb_addvalue(L, bidx);
+  r->pos = 0;
+  r->len = 0;
+}
+
+
+static TokenBuf *checktokenbuf (lua_State *L, int arg) {
+  return (TokenBuf *)luaL_checkudata(L, arg, TOKENBUF);
+}
+
+
+/* convert a 1-based index, accepting 1..n+extra */
+static int tb_index (lua_State *L, const TokenBuf *b, int arg, int extra) {
+  lua_Integer i = luaL_checkinteger(L, arg);
+  luaL_argcheck(L, 1 <= i && i <= (lua_Integer)b->n + extra, arg,
+                "token index out of range");
+  return (int)i - 1;
+}
+
+
+static int tb_gc (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  if (b->size > 0)
+    luaM_freearray(L, (char *)b->pos, (size_t)b->size * TB_ENTRY);
+  memset(b, 0, sizeof(TokenBuf));
+  return 0;
+}
+
+
+static int tb_len (lua_State *L) {
+  lua_pushinteger(L, checktokenbuf(L, 1)->n);
+  return 1;
+}
+
+
+static int tb_index_mm (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (1 <= i && i <= b->n)
+      tb_pushview(L, b, 1, (int)i - 1);
+    else
+      lua_pushnil(L);
+  }
+  else {
+    lua_pushvalue(L, 2);
+    lua_rawget(L, lua_upvalueindex(1));  /* method */
+  }
+  return 1;
+}
+
+
+/*
+** tokens[i] = t replaces a token, tokens[#tokens + 1] = t appends one
+** and tokens[#tokens] = nil drops the last one.
+*/
+static int tb_newindex (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  int i = tb_index(L, b, 2, 1);
+  TokRec r;
+  if (lua_isnil(L, 3)) {
+    luaL_argcheck(L, i == b->n - 1, 2, "only the last token can be removed");
+    b->n--;
+    return 0;
+  }
+  if (i == b->n)
+    tb_grow(L, b, 1);
+  tb_fromtable(L, 3, 1, i + 1, &r);
+  tb_put(b, i, &r);
+  if (i == b->n)
+    b->n++;
+  return 0;
+}
+
+
+static int tb_next (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  lua_Integer i = luaL_optinteger(L, 2, 0) + 1;
+  if (i > b->n)
+    return 0;
+  lua_pushinteger(L, i);
+  tb_pushview(L, b, 1, (int)i - 1);
+  return 2;
+}
+
+
+static int tb_pairs (lua_State *L) {
+  checktokenbuf(L, 1);
+  lua_pushcfunction(L, tb_next);
+  lua_pushvalue(L, 1);
+  lua_pushinteger(L, 0);
+  return 3;
+}
+
+
+static int tb_tostring (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  lua_pushfstring(L, "lexer.tokens (%d): %p", b->n, (void *)b);
+  return 1;
+}
+
+
+static int tb_token (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  lua_pushinteger(L, b->tok[tb_index(L, b, 2, 0)]);
+  return 1;
+}
+
+
+static int tb_line (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  lua_pushinteger(L, b->line[tb_index(L, b, 2, 0)]);
+  return 1;
+}
+
+
+static int tb_type (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  pushtype(L, b->tok[tb_index(L, b, 2, 0)]);
+  return 1;
+}
+
+
+static int tb_value (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  tb_pushvalue(L, b, 1, tb_index(L, b, 2, 0));
+  return 1;
+}
+
+
+/* tokens:span(i) -> first and last byte of the token in the source */
+static int tb_span (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  int i = tb_index(L, b, 2, 0);
+  if (b->len[i] == 0)
+    return 0;  /* token was not lexed from the source */
+  lua_pushinteger(L, (lua_Integer)b->pos[i] + 1);
+  lua_pushinteger(L, (lua_Integer)(b->pos[i] + b->len[i]));
+  return 2;
+}
+
+
+/* tokens:text(i) -> source text of the token */
+static int tb_text (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  int i = tb_index(L, b, 2, 0);
+  size_t l;
+  const char *s;
+  lua_getiuservalue(L, 1, TB_SOURCE);
+  s = lua_tolstring(L, -1, &l);
+  if (s == NULL || b->len[i] == 0 || b->pos[i] + b->len[i] > l)
+    return 0;
+  lua_pushlstring(L, s + b->pos[i], b->len[i]);
+  return 1;
+}
+
+
+static int tb_source (lua_State *L) {
+  checktokenbuf(L, 1);
+  lua_getiuservalue(L, 1, TB_SOURCE);
+  return 1;
+}
+
+
+/* tokens:totable() -> array of token tables */
+static int tb_totable (lua_State *L) {
+  TokenBuf *b = checktokenbuf(L, 1);
+  int i;
+  lua_createtable(L, b->n, 0);
+  for (i = 0; i < b->n; i++) {
+    tb_pushview(L, b, 1, i);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+
+static const luaL_Reg tb_methods[] = {
+  {"token", tb_token},
+  {"line", tb_line},
+  {"type", tb_type},
+  {"value", tb_value},
+  {"span", tb_span},
+  {"text", tb_text},
+  {"source", tb_source},
+  {"totable", tb_totable},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg tb_metamethods[] = {
+  {"__len", tb_len},
+  {"__newindex", tb_newindex},
+  {"__pairs", tb_pairs},
+  {"__tostring", tb_tostring},
+  {"__gc", tb_gc},
+  {NULL, NULL}
+};
+
+
+static void createtokenmeta (lua_State *L) {
+  luaL_newmetatable(L, TOKENBUF);
+  luaL_setfuncs(L, tb_metamethods, 0);
+  luaL_newlib(L, tb_methods);
+  lua_pushcclosure(L, tb_index_mm, 1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
+
+
+/*
+** Token lists accepted by the library functions: a token buffer or a
+** table of token tables. Buffers are read straight from their arrays.
+*/
+typedef struct TokList {
+  TokenBuf *b;  /* token buffer, or NULL for a table */
+  int idx;  /* stack index of the list */
+} TokList;
+
+
+static void checktoklist (lua_State *L, int arg, TokList *tl) {
+  tl->b = (TokenBuf *)luaL_testudata(L, arg, TOKENBUF);
+  if (tl->b == NULL)
+    luaL_checktype(L, arg, LUA_TTABLE);
+  tl->idx = lua_absindex(L, arg);
+}
+
+
+static int tl_len (lua_State *L, const TokList *tl) {
+  return (tl->b) ? tl->b->n : (int)luaL_len(L, tl->idx);
+}
+
+
+/* token id of element 'i'; malformed table elements are errors */
+static int tl_token (lua_State *L, const TokList *tl, int i) {
+  int tk;
+  if (tl->b)
+    return tl->b->tok[i - 1];
+  lua_rawgeti(L, tl->idx, i);
+  if (!lua_istable(L, -1))
+    return luaL_error(L, "expected a table at index %d of the token list", i);
+  lua_getfield(L, -1, "token");
+  if (!lua_isinteger(L, -1))
+    return luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
+  tk = (int)lua_tointeger(L, -1);
+  lua_pop(L, 2);
+  return tk;
+}
+
+
+/* token id of element 'i', or -1 if it is not a well-formed token */
+static int tl_peek (lua_State *L, const TokList *tl, int i) {
+  int tk = -1;
+  if (tl->b)
+    return tl->b->tok[i - 1];
+  if (lua_rawgeti(L, tl->idx, i) == LUA_TTABLE) {
+    lua_getfield(L, -1, "token");
+    if (lua_isinteger(L, -1))
+      tk = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return tk;
+}
+
+
+static int tl_line (lua_State *L, const TokList *tl, int i) {
+  int line = 0;
+  if (tl->b)
+    return tl->b->line[i - 1];
+  if (lua_rawgeti(L, tl->idx, i) == LUA_TTABLE) {
+    lua_getfield(L, -1, "line");
+    line = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return line;
+}
+
+
+static void tl_pushvalue (lua_State *L, const TokList *tl, int i) {
+  if (tl->b)
+    tb_pushvalue(L, tl->b, tl->idx, i - 1);
+  else {
+    if (lua_rawgeti(L, tl->idx, i) == LUA_TTABLE)
+      lua_getfield(L, -1, "value");
+    else
+      lua_pushnil(L);
+    lua_remove(L, -2);
+  }
+}
+
+
+static void tl_pushtype (lua_State *L, const TokList *tl, int i) {
+  if (tl->b)
+    pushtype(L, tl->b->tok[i - 1]);
+  else {
+    if (lua_rawgeti(L, tl->idx, i) == LUA_TTABLE)
+      lua_getfield(L, -1, "type");
+    else
+      lua_pushnil(L);
+    lua_remove(L, -2);
+  }
+}
+
+
+/* push element 'i' as a table (a view for buffers) */
+static void tl_push (lua_State *L, const TokList *tl, int i) {
+  if (tl->b)
+    tb_pushview(L, tl->b, tl->idx, i - 1);
+  else
+    lua_rawgeti(L, tl->idx, i);
+}
+
+
+/*
+** Read element 'i' of 'tl' into 'r' for storing in the buffer at 'bidx'.
+** Values are re-added unless both share the same value array.
+*/
+static void tl_record (lua_State *L, const TokList *tl, int i, int bidx,
+                       TokRec *r) {
+  if (tl->b) {
+    int shared;
+    tb_get(tl->b, i - 1, r);
+    lua_getiuservalue(L, tl->idx, TB_VALUES);
+    lua_getiuservalue(L, bidx, TB_VALUES);
+    shared = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+    if (!shared) {
+      tb_pushvalue(L, tl->b, tl->idx, i - 1);
+      r->val = tb_addvalue(L, bidx);
+      r->len = 0;  /* span refers to another source */
+    }
+  }
+  else {
+    lua_rawgeti(L, tl->idx, i);
+    tb_fromtable(L, -1, bidx, i, r);
+    lua_pop(L, 1);
+  }
+}
+
+
+/*
+** Lists built by the library: a buffer sharing the values of the input
+** buffer, or a table when the input is a table.
+*/
+typedef struct TokOut {
+  TokenBuf *b;  /* output buffer, or NULL for a table */
+  int n;  /* number of elements */
+} TokOut;
+
+
+/* push a new empty list of the same kind as 'src' */
+static void out_new (lua_State *L, TokOut *o, const TokList *src) {
+  o->n = 0;
+  if (src->b)
+    o->b = newtokenbuf(L, 0, src->idx);
+  else {
+    o->b = NULL;
+    lua_newtable(L);
+  }
+}
+
+
+/* append element 'i' of 'src' to the list at 'oidx' */
+static void out_add (lua_State *L, TokOut *o, int oidx, const TokList *src,
+                     int i) {
+  if (o->b) {
+    TokRec r;
+    tb_grow(L, o->b, 1);
+    tb_get(src->b, i - 1, &r);
+    tb_put(o->b, o->n++, &r);
+    o->b->n = o->n;
+  }
+  else {
+    tl_push(L, src, i);
+    lua_rawseti(L, oidx, ++o->n);
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** Lexer state structure to pass to pcall
 */
@@ -48,6 +643,10 @@ typedef struct {
   TString *source;
 } PCallLexState;
 
+/*
+** Lex the code (argument 2) into a token buffer. Name and string values
+** are stored once in the value array however often they occur.
+*/
 static int protected_lex(lua_State *L) {
     PCallLexState *pls = (PCallLexState *)lua_touserdata(L, 1);
     LexState lexstate;
@@ -64,10 +663,17 @@ static int protected_lex(lua_State *L) {
     /* Call the lexer initialization */
     luaX_setinput(L, &lexstate, pls->z, pls->source, firstchar);
 
-    lua_newtable(L); /* Result array table */
-    int i = 1;
+    lua_newtable(L);  /* value -> index, to share repeated strings */
+    int seen_idx = lua_gettop(L);
+
+    TokenBuf *b = newtokenbuf(L, 64, 0);
+    int buf_idx = lua_gettop(L);
+    lua_pushvalue(L, 2);
+    lua_setiuservalue(L, buf_idx, TB_SOURCE);
+    lua_getiuservalue(L, buf_idx, TB_VALUES);
+    int values_idx = lua_gettop(L);
+    int nvalues = 0;
 
-    int array_idx = lua_gettop(L);
     while (1) {
         luaX_next(&lexstate);
         int token = lexstate.t.token;
@@ -75,45 +681,45 @@ static int protected_lex(lua_State *L) {
             break;
         }
 
-        lua_createtable(L, 0, 4); /* Sub-table for this token */
-        int token_tbl_idx = lua_gettop(L);
-
-        /* token integer */
-        lua_pushinteger(L, token);
-        lua_setfield(L, token_tbl_idx, "token");
-
-        /* line number */
-        lua_pushinteger(L, lexstate.linenumber);
-        lua_setfield(L, token_tbl_idx, "line");
-
-        /* token string representation */
-        const char *tok_str = luaX_token2str(&lexstate, token);
-        if (tok_str) {
-            lua_pushstring(L, tok_str);
-            lua_setfield(L, token_tbl_idx, "type");
-        }
-        /* luaX_token2str might push string onto the stack via luaO_pushfstring */
-        lua_settop(L, token_tbl_idx);
+        tb_grow(L, b, 1);
+        int i = b->n++;
+        b->tok[i] = token;
+        b->line[i] = lexstate.linenumber;
+        b->pos[i] = (size_t)lexstate.tokpos;
+        b->len[i] = (unsigned int)(lexstate.curpos - lexstate.tokpos);
+        b->val[i] = 0;
 
         /* semantic info based on token */
         if (token == TK_NAME || token == TK_STRING || token == TK_INTERPSTRING || token == TK_RAWSTRING) {
-            if (lexstate.t.seminfo.ts) {
-                lua_pushstring(L, getstr(lexstate.t.seminfo.ts));
-                lua_setfield(L, token_tbl_idx, "value");
+            TString *ts = lexstate.t.seminfo.ts;
+            if (ts) {
+                setsvalue2s(L, L->top.p, ts);
+                api_incr_top(L);
+                if (lua_rawget(L, seen_idx) == LUA_TNUMBER) {
+                    b->val[i] = (int)lua_tointeger(L, -1);
+                } else {
+                    b->val[i] = ++nvalues;
+                    setsvalue2s(L, L->top.p, ts);
+                    api_incr_top(L);
+                    lua_pushinteger(L, nvalues);
+                    lua_rawset(L, seen_idx);
+                    setsvalue2s(L, L->top.p, ts);
+                    api_incr_top(L);
+                    lua_rawseti(L, values_idx, nvalues);
+                }
+                lua_pop(L, 1);
             }
         } else if (token == TK_INT) {
             lua_pushinteger(L, lexstate.t.seminfo.i);
-            lua_setfield(L, token_tbl_idx, "value");
+            lua_rawseti(L, values_idx, b->val[i] = ++nvalues);
         } else if (token == TK_FLT) {
             lua_pushnumber(L, lexstate.t.seminfo.r);
-            lua_setfield(L, token_tbl_idx, "value");
+            lua_rawseti(L, values_idx, b->val[i] = ++nvalues);
         }
-
-        /* Add token to the result array */
-        lua_rawseti(L, array_idx, i++);
     }
 
-    return 1; /* Return the array table */
+    lua_settop(L, buf_idx);
+    return 1; /* Return the token buffer */
 }
 
 static int lexer_lex(lua_State *L) {
@@ -143,8 +749,9 @@ static int lexer_lex(lua_State *L) {
     /* Push light userdata and C function to call in protected mode */
     lua_pushcfunction(L, protected_lex);
     lua_pushlightuserdata(L, &pls);
+    lua_pushvalue(L, 1);
 
-    int status = lua_pcall(L, 1, 1, 0);
+    int status = lua_pcall(L, 2, 1, 0);
 
     /* Clean up buffers whether it failed or succeeded */
     luaZ_freebuffer(L, &buff);
@@ -154,7 +761,7 @@ static int lexer_lex(lua_State *L) {
         return lua_error(L);
     }
 
-    /* Move the result table below the anchored source string, then pop the source string */
+    /* Move the result below the anchored source string, then pop the source string */
     lua_insert(L, -2);
     lua_pop(L, 1);
 
@@ -175,25 +782,7 @@ static int lexer_token2str(lua_State *L) {
         lua_pushstring(L, s);
     } else {
         /* reserved words and other tokens */
-        /* We use luaX_token2str with a dummy LexState to get the string representation.
-           Some tokens cause luaX_token2str to push the string onto the stack,
-           while others just return a const char*. We handle both cases using lua_gettop. */
-        LexState dummy_ls;
-        memset(&dummy_ls, 0, sizeof(LexState));
-        dummy_ls.L = L;
-
-        int top = lua_gettop(L);
-        const char *str = luaX_token2str(&dummy_ls, token);
-        if (str) {
-            if (lua_gettop(L) == top) {
-                /* luaX_token2str returned a string but didn't push it */
-                lua_pushstring(L, str);
-            }
-            return 1;
-        } else {
-            lua_pushnil(L);
-            return 1;
-        }
+        pushtype(L, token);
     }
     return 1;
 }
@@ -347,25 +936,16 @@ static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
 }
 
 static int lexer_reconstruct(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     luaL_Buffer b;
     luaL_buffinit(L, &b);
 
-    int len = luaL_len(L, 1);
+    int len = tl_len(L, &tl);
     int last_token = 0;
 
     for (int i = 1; i <= len; i++) {
-        lua_rawgeti(L, 1, i);
-        if (!lua_istable(L, -1)) {
-            return luaL_error(L, "expected a table at index %d of the token list", i);
-        }
-
-        lua_getfield(L, -1, "token");
-        if (!lua_isinteger(L, -1)) {
-            return luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
-        }
-        int token = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int token = tl_token(L, &tl, i);
 
         /* Add space between identifiers/keywords/numbers to prevent syntax errors */
         if (i > 1) {
@@ -376,8 +956,8 @@ static int lexer_reconstruct(lua_State *L) {
             }
         }
 
-        if (token == TK_NAME || token == TK_STRING || token == TK_INTERPSTRING || token == TK_RAWSTRING || token == TK_INT || token == TK_FLT) {
-            lua_getfield(L, -1, "value");
+        if (hasvalue(token)) {
+            tl_pushvalue(L, &tl, i);
             if (lua_isstring(L, -1) || lua_isnumber(L, -1)) {
                 if (token == TK_STRING || token == TK_RAWSTRING || token == TK_INTERPSTRING) {
                     /* Use luaO_pushfstring with %q to properly escape */
@@ -418,7 +998,6 @@ static int lexer_reconstruct(lua_State *L) {
         }
 
         last_token = token;
-        lua_pop(L, 1); /* pop token table */
     }
 
     luaL_pushresult(&b);
@@ -428,48 +1007,29 @@ static int lexer_reconstruct(lua_State *L) {
 
 
 static int lexer_find_match(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int start_idx = luaL_checkinteger(L, 2);
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
 
     if (start_idx < 1 || start_idx > num_tokens) {
         lua_pushnil(L);
         return 1;
     }
 
-    lua_rawgeti(L, 1, start_idx);
-    if (!lua_istable(L, -1)) {
-        return luaL_error(L, "expected a table at index %d of the token list", start_idx);
-    }
-    lua_getfield(L, -1, "token");
-    if (!lua_isinteger(L, -1)) {
-        return luaL_error(L, "expected an integer 'token' field at index %d of the token list", start_idx);
-    }
-    int start_tk = lua_tointeger(L, -1);
-    lua_pop(L, 2);
+    int start_tk = tl_token(L, &tl, start_idx);
 
     int target_tk = -1;
     int is_block = 0;
 
     if (start_tk == TK_WHILE || start_tk == TK_FOR) {
         for (int i = start_idx + 1; i <= num_tokens; i++) {
-            lua_rawgeti(L, 1, i);
-            if (!lua_istable(L, -1)) {
-                return luaL_error(L, "expected a table at index %d of the token list", i);
-            }
-            lua_getfield(L, -1, "token");
-            if (!lua_isinteger(L, -1)) {
-                return luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
-            }
-            int tk = lua_tointeger(L, -1);
-            lua_pop(L, 1);
+            int tk = tl_token(L, &tl, i);
             if (tk == TK_DO) {
                 start_idx = i;
                 start_tk = TK_DO;
-                lua_pop(L, 1);
                 break;
             }
-            lua_pop(L, 1);
         }
     }
 
@@ -492,16 +1052,7 @@ static int lexer_find_match(lua_State *L) {
 
     int depth = 1;
     for (int i = start_idx + 1; i <= num_tokens; i++) {
-        lua_rawgeti(L, 1, i);
-        if (!lua_istable(L, -1)) {
-            return luaL_error(L, "expected a table at index %d of the token list", i);
-        }
-        lua_getfield(L, -1, "token");
-        if (!lua_isinteger(L, -1)) {
-            return luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
-        }
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int tk = tl_token(L, &tl, i);
 
         if (is_block) {
             if (tk == TK_IF || tk == TK_FUNCTION || tk == TK_DO || tk == TK_SWITCH || tk == TK_TRY || tk == TK_REPEAT) {
@@ -518,21 +1069,32 @@ static int lexer_find_match(lua_State *L) {
         }
 
         if (depth == 0) {
-            lua_pop(L, 1);
             lua_pushinteger(L, i);
             return 1;
         }
-
-        lua_pop(L, 1);
     }
 
     lua_pushnil(L);
     return 1;
 }
 
+/* push the type of node opened by token 'tk', without quotes */
+static void pushnodetype (lua_State *L, int tk) {
+    size_t len;
+    const char *ttype;
+    pushtype(L, tk);
+    ttype = lua_tolstring(L, -1, &len);
+    if (len >= 2 && ttype[0] == '\'' && ttype[len-1] == '\'') {
+        lua_pushlstring(L, ttype + 1, len - 2);
+        lua_remove(L, -2);
+    }
+}
+
 static int lexer_build_tree(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
-    int num_tokens = luaL_len(L, 1);
+    TokList tl;
+    checktoklist(L, 1, &tl);
+    lua_settop(L, 1);
+    int num_tokens = tl_len(L, &tl);
 
     lua_createtable(L, 0, 2); /* root node -> stack 2 */
     lua_pushstring(L, "root");
@@ -547,17 +1109,8 @@ static int lexer_build_tree(lua_State *L) {
     int stack_len = 1;
 
     for (int i = 1; i <= num_tokens; i++) {
-        lua_rawgeti(L, 1, i); /* t -> stack 5 */
-        if (!lua_istable(L, 5)) {
-            return luaL_error(L, "expected a table at index %d of the token list", i);
-        }
-
-        lua_getfield(L, 5, "token");
-        if (!lua_isinteger(L, -1)) {
-            return luaL_error(L, "expected an integer 'token' field at index %d of the token list", i);
-        }
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int tk = tl_token(L, &tl, i);
+        tl_push(L, &tl, i); /* t -> stack 5 */
 
         /* current = stack[#stack] -> stack 6 */
         lua_rawgeti(L, 4, stack_len);
@@ -568,36 +1121,16 @@ static int lexer_build_tree(lua_State *L) {
         int is_closer = (tk == TK_END || tk == TK_UNTIL || tk == ')' || tk == ']' || tk == '}');
         int is_opener = (tk == TK_FUNCTION || tk == TK_IF || tk == TK_WHILE || tk == TK_FOR || tk == TK_REPEAT || tk == TK_SWITCH || tk == TK_TRY || tk == '(' || tk == '[' || tk == '{');
 
-        if (tk == TK_DO) {
-            /* get current type -> stack 8 */
-            lua_getfield(L, 6, "type");
-            const char *ctype = lua_tostring(L, -1);
-            lua_pop(L, 1);
-
+        if (tk == TK_DO || is_opener) {
             lua_createtable(L, 0, 2); /* new_node -> stack 8 */
 
-            lua_getfield(L, 5, "type"); /* t.type -> stack 9 */
-            if (lua_isstring(L, 9)) {
-                size_t len;
-                const char *ttype = lua_tolstring(L, 9, &len);
-                if (len >= 2 && ttype[0] == '\'' && ttype[len-1] == '\'') {
-                    lua_pushlstring(L, ttype + 1, len - 2);
-                } else {
-                    lua_pushstring(L, ttype);
-                }
-            } else {
-                lua_pushstring(L, "");
-            }
+            pushnodetype(L, tk);
             lua_setfield(L, 8, "type");
-            lua_pop(L, 1); /* pop t.type */
 
             lua_newtable(L); /* new_node.elements -> stack 9 */
             lua_pushvalue(L, 5); /* push t */
             lua_rawseti(L, 9, 1);
-            lua_pushvalue(L, 9);
             lua_setfield(L, 8, "elements");
-            /* new_node.elements is still at stack 9, we pop it */
-            lua_pop(L, 1);
 
             /* insert new_node into current.elements */
             int elen = luaL_len(L, 7);
@@ -606,10 +1139,7 @@ static int lexer_build_tree(lua_State *L) {
 
             /* insert new_node into stack */
             stack_len++;
-            lua_pushvalue(L, 8); /* push new_node */
-            lua_rawseti(L, 4, stack_len);
-
-            lua_pop(L, 1); /* pop new_node */
+            lua_rawseti(L, 4, stack_len); /* pops new_node */
 
         } else if (is_closer) {
             /* table.insert(current.elements, t) */
@@ -625,15 +1155,17 @@ static int lexer_build_tree(lua_State *L) {
 
                 lua_getfield(L, 6, "type"); /* stack 8 */
                 const char *ctype = lua_tostring(L, 8);
+                int was_do = (ctype && strcmp(ctype, "do") == 0);
                 lua_pop(L, 1);
 
-                if (ctype && strcmp(ctype, "do") == 0 && stack_len > 1) {
+                if (was_do && stack_len > 1) {
                     lua_rawgeti(L, 4, stack_len); /* stack 8 */
                     lua_getfield(L, 8, "type"); /* stack 9 */
                     const char *ptype = lua_tostring(L, 9);
+                    int loop = (ptype && (strcmp(ptype, "while") == 0 || strcmp(ptype, "for") == 0));
                     lua_pop(L, 2); /* pop ptype and current */
 
-                    if (ptype && (strcmp(ptype, "while") == 0 || strcmp(ptype, "for") == 0)) {
+                    if (loop) {
                         lua_pushnil(L);
                         lua_rawseti(L, 4, stack_len);
                         stack_len--;
@@ -641,42 +1173,6 @@ static int lexer_build_tree(lua_State *L) {
                 }
             }
 
-        } else if (is_opener) {
-            lua_createtable(L, 0, 2); /* new_node -> stack 8 */
-
-            lua_getfield(L, 5, "type"); /* t.type -> stack 9 */
-            if (lua_isstring(L, 9)) {
-                size_t len;
-                const char *ttype = lua_tolstring(L, 9, &len);
-                if (len >= 2 && ttype[0] == '\'' && ttype[len-1] == '\'') {
-                    lua_pushlstring(L, ttype + 1, len - 2);
-                } else {
-                    lua_pushstring(L, ttype);
-                }
-            } else {
-                lua_pushstring(L, "");
-            }
-            lua_setfield(L, 8, "type");
-            lua_pop(L, 1); /* pop t.type */
-
-            lua_newtable(L); /* new_node.elements -> stack 9 */
-            lua_pushvalue(L, 5); /* push t */
-            lua_rawseti(L, 9, 1);
-            lua_pushvalue(L, 9);
-            lua_setfield(L, 8, "elements");
-            lua_pop(L, 1); /* pop new_node.elements */
-
-            /* insert new_node into current.elements */
-            int elen = luaL_len(L, 7);
-            lua_pushvalue(L, 8); /* push new_node */
-            lua_rawseti(L, 7, elen + 1);
-
-            /* insert new_node into stack */
-            stack_len++;
-            lua_pushvalue(L, 8); /* push new_node */
-            lua_rawseti(L, 4, stack_len);
-
-            lua_pop(L, 1); /* pop new_node */
         } else {
             /* table.insert(current.elements, t) */
             int elen = luaL_len(L, 7);
@@ -727,8 +1223,24 @@ static int lexer_flatten_tree(lua_State *L) {
 }
 
 
+/*
+** Token id whose type string is 'type', or -1. Lets buffers be searched
+** by type without building a string per token.
+*/
+static int type2token (lua_State *L, const char *type) {
+    for (int tk = 1; tk <= TK_RAWSTRING; tk++) {
+        int found;
+        pushtype(L, tk);
+        found = (strcmp(lua_tostring(L, -1), type) == 0);
+        lua_pop(L, 1);
+        if (found) return tk;
+    }
+    return -1;
+}
+
 static int lexer_find_tokens(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int is_str = lua_type(L, 2) == LUA_TSTRING;
     int is_int = lua_type(L, 2) == LUA_TNUMBER;
 
@@ -741,9 +1253,23 @@ static int lexer_find_tokens(lua_State *L) {
 
     lua_newtable(L);
     int out_idx = lua_gettop(L);
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
     int match_count = 1;
 
+    if (tl.b) {
+        const int *tok = tl.b->tok;
+        if (is_str) {
+            target_token = type2token(L, target_type);
+        }
+        for (int i = 0; i < num_tokens; i++) {
+            if (tok[i] == target_token) {
+                lua_pushinteger(L, i + 1);
+                lua_rawseti(L, out_idx, match_count++);
+            }
+        }
+        return 1;
+    }
+
     for (int i = 1; i <= num_tokens; i++) {
         lua_rawgeti(L, 1, i);
         if (!lua_istable(L, -1)) {
@@ -776,27 +1302,66 @@ static int lexer_find_tokens(lua_State *L) {
     return 1;
 }
 
+/*
+** Replace tokens [s, e] (1-based) of the buffer at 'bidx' by the 'm'
+** tokens of list 'rep' (or by the single token table at 'single' when it
+** is not 0). The replacement is read completely before the buffer moves,
+** so it may be the buffer itself.
+*/
+static void tb_splice (lua_State *L, int bidx, int s, int e,
+                       const TokList *rep, int single) {
+    TokenBuf *b = (TokenBuf *)lua_touserdata(L, bidx);
+    int m = single ? 1 : tl_len(L, rep);
+    TokRec *recs = (TokRec *)lua_newuserdatauv(L, sizeof(TokRec) * (m > 0 ? m : 1), 0);
+    if (single) {
+        tb_fromtable(L, single, bidx, 1, &recs[0]);
+    } else {
+        for (int i = 0; i < m; i++) {
+            tl_record(L, rep, i + 1, bidx, &recs[i]);
+        }
+    }
+    int removed = e - s + 1;
+    if (m > removed) {
+        tb_grow(L, b, m - removed);
+    }
+    tb_move(b, e, s - 1 + m);
+    b->n += m - removed;
+    for (int i = 0; i < m; i++) {
+        tb_put(b, s - 1 + i, &recs[i]);
+    }
+    lua_pop(L, 1);  /* recs */
+}
+
 static int lexer_insert_tokens(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int index = luaL_checkinteger(L, 2);
-    luaL_checktype(L, 3, LUA_TTABLE);
+    TokList rep;
+    checktoklist(L, 3, &rep);
 
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
     if (index < 1) index = 1;
     if (index > num_tokens + 1) index = num_tokens + 1;
 
     int is_single_token = 0;
-    lua_getfield(L, 3, "token");
-    if (!lua_isnil(L, -1)) {
-        is_single_token = 1;
+    if (rep.b == NULL) {
+        lua_getfield(L, 3, "token");
+        if (!lua_isnil(L, -1)) {
+            is_single_token = 1;
+        }
+        lua_pop(L, 1);
+    }
+
+    if (tl.b) {
+        tb_splice(L, 1, index, index - 1, &rep, is_single_token ? 3 : 0);
+        return 0;
     }
-    lua_pop(L, 1);
 
     int shift_amount = 0;
     if (is_single_token) {
         shift_amount = 1;
     } else {
-        shift_amount = luaL_len(L, 3);
+        shift_amount = tl_len(L, &rep);
     }
 
     /* Shift existing tokens right */
@@ -811,7 +1376,7 @@ static int lexer_insert_tokens(lua_State *L) {
         lua_rawseti(L, 1, index);
     } else {
         for (int i = 1; i <= shift_amount; i++) {
-            lua_rawgeti(L, 3, i);
+            tl_push(L, &rep, i);
             lua_rawseti(L, 1, index + i - 1);
         }
     }
@@ -820,11 +1385,12 @@ static int lexer_insert_tokens(lua_State *L) {
 }
 
 static int lexer_remove_tokens(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int index = luaL_checkinteger(L, 2);
     int count = luaL_optinteger(L, 3, 1);
 
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
     if (index < 1 || index > num_tokens || count <= 0) {
         return 0;
     }
@@ -833,6 +1399,12 @@ static int lexer_remove_tokens(lua_State *L) {
         count = num_tokens - index + 1;
     }
 
+    if (tl.b) {
+        tb_move(tl.b, index - 1 + count, index - 1);
+        tl.b->n -= count;
+        return 0;
+    }
+
     /* Shift remaining tokens left */
     for (int i = index + count; i <= num_tokens; i++) {
         lua_rawgeti(L, 1, i);
@@ -849,35 +1421,30 @@ static int lexer_remove_tokens(lua_State *L) {
 }
 
 static int lexer_split_statements(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
-    int num_tokens = luaL_len(L, 1);
+    TokList tl;
+    checktoklist(L, 1, &tl);
+    int num_tokens = tl_len(L, &tl);
 
     lua_newtable(L); /* result array of arrays */
     int result_idx = lua_gettop(L);
     int stmt_count = 1;
 
-    lua_newtable(L); /* current statement */
+    TokOut cur;
+    out_new(L, &cur, &tl); /* current statement */
     int current_stmt_idx = lua_gettop(L);
-    int current_len = 0;
 
     int braces = 0;
     int last_line = -1;
     int expects_continuation = 0;
 
     for (int i = 1; i <= num_tokens; i++) {
-        lua_rawgeti(L, 1, i);
-        int tok_idx = lua_gettop(L);
-        if (!lua_istable(L, tok_idx)) {
+        if (tl.b == NULL && lua_rawgeti(L, 1, i) != LUA_TTABLE) {
             return luaL_error(L, "expected a table at index %d of the token list", i);
         }
+        if (tl.b == NULL) lua_pop(L, 1);
 
-        lua_getfield(L, tok_idx, "token");
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 1);
-
-        lua_getfield(L, tok_idx, "line");
-        int line = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int tk = tl_peek(L, &tl, i);
+        int line = tl_line(L, &tl, i);
 
         if (tk == '(' || tk == '[' || tk == '{' || tk == TK_DO || tk == TK_THEN || tk == TK_REPEAT || tk == TK_FUNCTION) {
             braces++;
@@ -886,33 +1453,28 @@ static int lexer_split_statements(lua_State *L) {
         }
 
         /* if the previous token expected a continuation and we are on a new line, it suppresses splitting */
-        if (braces == 0 && current_len > 0 && last_line != -1 && line > last_line && !expects_continuation) {
+        if (braces == 0 && cur.n > 0 && last_line != -1 && line > last_line && !expects_continuation) {
             /* do not split if the new line token is `else`, `elseif`, `end`, etc. because they belong to previous block structures */
             if (tk != TK_ELSE && tk != TK_ELSEIF && tk != TK_END && tk != TK_UNTIL && tk != TK_CATCH && tk != TK_FINALLY) {
                 lua_pushvalue(L, current_stmt_idx);
                 lua_rawseti(L, result_idx, stmt_count++);
-                lua_newtable(L);
+                out_new(L, &cur, &tl);
                 lua_replace(L, current_stmt_idx);
-                current_len = 0;
             }
         }
 
         if (tk == ';') {
-            if (current_len > 0) {
+            if (cur.n > 0) {
                 lua_pushvalue(L, current_stmt_idx);
                 lua_rawseti(L, result_idx, stmt_count++);
 
-                lua_newtable(L);
+                out_new(L, &cur, &tl);
                 lua_replace(L, current_stmt_idx);
-                current_len = 0;
             }
-            lua_pop(L, 1); /* pop token */
             continue;
         }
 
-        current_len++;
-        lua_pushvalue(L, tok_idx);
-        lua_rawseti(L, current_stmt_idx, current_len);
+        out_add(L, &cur, current_stmt_idx, &tl, i);
 
         if (tk == ',' || tk == '+' || tk == '-' || tk == '*' || tk == '/' || tk == TK_CONCAT || tk == '=' || tk == TK_AND || tk == TK_OR || tk == TK_NOT || tk == TK_LOCAL || tk == TK_RETURN) {
             expects_continuation = 1;
@@ -921,10 +1483,9 @@ static int lexer_split_statements(lua_State *L) {
         }
 
         last_line = line;
-        lua_pop(L, 1); /* pop token */
     }
 
-    if (current_len > 0) {
+    if (cur.n > 0) {
         lua_pushvalue(L, current_stmt_idx);
         lua_rawseti(L, result_idx, stmt_count++);
     }
@@ -934,18 +1495,16 @@ static int lexer_split_statements(lua_State *L) {
 }
 
 static int lexer_parse_local(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
-    int num_tokens = luaL_len(L, 1);
+    TokList tl;
+    checktoklist(L, 1, &tl);
+    int num_tokens = tl_len(L, &tl);
 
     if (num_tokens < 2) {
         lua_pushnil(L);
         return 1;
     }
 
-    lua_rawgeti(L, 1, 1);
-    lua_getfield(L, -1, "token");
-    int first_tk = lua_tointeger(L, -1);
-    lua_pop(L, 2);
+    int first_tk = tl_peek(L, &tl, 1);
 
     if (first_tk != TK_LOCAL) {
         lua_pushnil(L);
@@ -953,10 +1512,7 @@ static int lexer_parse_local(lua_State *L) {
     }
 
     /* check if it's local function */
-    lua_rawgeti(L, 1, 2);
-    lua_getfield(L, -1, "token");
-    int second_tk = lua_tointeger(L, -1);
-    lua_pop(L, 2);
+    int second_tk = tl_peek(L, &tl, 2);
 
     if (second_tk == TK_FUNCTION) {
         lua_pushnil(L);
@@ -967,38 +1523,27 @@ static int lexer_parse_local(lua_State *L) {
     int names_idx = lua_gettop(L);
     int name_count = 1;
 
-    lua_newtable(L); /* return table of remaining statement (the assignments) */
+    TokOut stmt;
+    out_new(L, &stmt, &tl); /* remaining statement (the assignments) */
     int stmt_idx = lua_gettop(L);
-    int stmt_len = 0;
 
     int in_names = 1;
 
     for (int i = 2; i <= num_tokens; i++) {
-        lua_rawgeti(L, 1, i);
-        int tok_idx = lua_gettop(L);
-
-        lua_getfield(L, tok_idx, "token");
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int tk = tl_peek(L, &tl, i);
 
         if (in_names) {
             if (tk == TK_NAME) {
-                lua_getfield(L, tok_idx, "value");
+                tl_pushvalue(L, &tl, i);
                 lua_rawseti(L, names_idx, name_count++);
             } else if (tk == '=') {
                 in_names = 0;
                 /* include '=' in remainder */
-                stmt_len++;
-                lua_pushvalue(L, tok_idx);
-                lua_rawseti(L, stmt_idx, stmt_len);
+                out_add(L, &stmt, stmt_idx, &tl, i);
             }
         } else {
-            stmt_len++;
-            lua_pushvalue(L, tok_idx);
-            lua_rawseti(L, stmt_idx, stmt_len);
+            out_add(L, &stmt, stmt_idx, &tl, i);
         }
-
-        lua_pop(L, 1); /* pop token */
     }
 
     return 2;
@@ -1007,43 +1552,22 @@ static int lexer_parse_local(lua_State *L) {
 #include "llexer_compiler.h"
 
 static int lexer_find_label(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     const char *label_name = luaL_checkstring(L, 2);
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
 
     for (int i = 1; i <= num_tokens - 2; i++) {
-        lua_rawgeti(L, 1, i);
-        if (lua_istable(L, -1)) {
-            lua_getfield(L, -1, "token");
-            if (lua_isinteger(L, -1) && lua_tointeger(L, -1) == TK_DBCOLON) {
-                /* check next token */
-                lua_rawgeti(L, 1, i + 1);
-                if (lua_istable(L, -1)) {
-                    lua_getfield(L, -1, "token");
-                    if (lua_isinteger(L, -1) && lua_tointeger(L, -1) == TK_NAME) {
-                        lua_getfield(L, -2, "value");
-                        if (lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), label_name) == 0) {
-                            lua_rawgeti(L, 1, i + 2);
-                            if (lua_istable(L, -1)) {
-                                lua_getfield(L, -1, "token");
-                                if (lua_isinteger(L, -1) && lua_tointeger(L, -1) == TK_DBCOLON) {
-                                    lua_pushinteger(L, i);
-                                    return 1;
-                                }
-                                lua_pop(L, 2);
-                            } else {
-                                lua_pop(L, 1);
-                            }
-                        }
-                        lua_pop(L, 1); /* pop value */
-                    }
-                    lua_pop(L, 1); /* pop token */
-                }
-                lua_pop(L, 1); /* pop table at i+1 */
+        if (tl_peek(L, &tl, i) == TK_DBCOLON && tl_peek(L, &tl, i + 1) == TK_NAME) {
+            int found;
+            tl_pushvalue(L, &tl, i + 1);
+            found = (lua_type(L, -1) == LUA_TSTRING && strcmp(lua_tostring(L, -1), label_name) == 0);
+            lua_pop(L, 1);
+            if (found && tl_peek(L, &tl, i + 2) == TK_DBCOLON) {
+                lua_pushinteger(L, i);
+                return 1;
             }
-            lua_pop(L, 1); /* pop token */
         }
-        lua_pop(L, 1); /* pop table at i */
     }
 
     lua_pushnil(L);
@@ -1051,9 +1575,10 @@ static int lexer_find_label(lua_State *L) {
 }
 
 static int lexer_get_block_bounds(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int target_idx = luaL_checkinteger(L, 2);
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
 
     if (target_idx < 1 || target_idx > num_tokens) {
         return 0;
@@ -1064,12 +1589,8 @@ static int lexer_get_block_bounds(lua_State *L) {
     int min_width = num_tokens + 1;
 
     for (int i = 1; i <= target_idx; i++) {
-        lua_rawgeti(L, 1, i);
-        if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; }
-        lua_getfield(L, -1, "token");
-        if (!lua_isinteger(L, -1)) { lua_pop(L, 2); continue; }
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 2);
+        int tk = tl_peek(L, &tl, i);
+        if (tk < 0) continue;
 
         int is_opener = (tk == TK_FUNCTION || tk == TK_IF || tk == TK_WHILE || tk == TK_FOR || tk == TK_REPEAT || tk == TK_DO || tk == '{' || tk == '[' || tk == '(');
         if (!is_opener) continue;
@@ -1093,12 +1614,8 @@ static int lexer_get_block_bounds(lua_State *L) {
 
         int found_end = -1;
         for (int j = i + 1; j <= num_tokens; j++) {
-            lua_rawgeti(L, 1, j);
-            if (!lua_istable(L, -1)) { lua_pop(L, 1); continue; }
-            lua_getfield(L, -1, "token");
-            if (!lua_isinteger(L, -1)) { lua_pop(L, 2); continue; }
-            int inner_tk = lua_tointeger(L, -1);
-            lua_pop(L, 2);
+            int inner_tk = tl_peek(L, &tl, j);
+            if (inner_tk < 0) continue;
 
             if (is_block) {
                 if (inner_tk == TK_IF || inner_tk == TK_FUNCTION || inner_tk == TK_DO || inner_tk == TK_SWITCH || inner_tk == TK_TRY || inner_tk == TK_REPEAT || inner_tk == TK_WHILE || inner_tk == TK_FOR) {
@@ -1142,38 +1659,42 @@ static int lexer_get_block_bounds(lua_State *L) {
 }
 
 static int lexer_extract_tokens(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int start_idx = luaL_checkinteger(L, 2);
     int end_idx = luaL_checkinteger(L, 3);
 
-    int num_tokens = luaL_len(L, 1);
+    int num_tokens = tl_len(L, &tl);
     if (start_idx < 1) start_idx = 1;
     if (end_idx > num_tokens) end_idx = num_tokens;
 
-    lua_newtable(L); /* result array */
+    TokOut res;
+    out_new(L, &res, &tl); /* result list */
     int res_idx = lua_gettop(L);
 
     if (start_idx > end_idx || start_idx > num_tokens) {
-        return 1; /* return empty table */
+        return 1; /* return empty list */
     }
 
-    int count = 1;
+    if (res.b) {
+        tb_grow(L, res.b, end_idx - start_idx + 1);
+    }
     for (int i = start_idx; i <= end_idx; i++) {
-        lua_rawgeti(L, 1, i);
-        lua_rawseti(L, res_idx, count++);
+        out_add(L, &res, res_idx, &tl, i);
     }
 
     return 1;
 }
 
 static int lexer_replace_tokens(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl, rep;
+    checktoklist(L, 1, &tl);
     int start_idx = luaL_checkinteger(L, 2);
     int end_idx = luaL_checkinteger(L, 3);
-    luaL_checktype(L, 4, LUA_TTABLE);
+    checktoklist(L, 4, &rep);
 
-    int num_tokens = luaL_len(L, 1);
-    int rep_len = luaL_len(L, 4);
+    int num_tokens = tl_len(L, &tl);
+    int rep_len = tl_len(L, &rep);
 
     if (start_idx < 1) start_idx = 1;
     if (end_idx > num_tokens) end_idx = num_tokens;
@@ -1181,6 +1702,11 @@ static int lexer_replace_tokens(lua_State *L) {
     if (start_idx > num_tokens + 1) start_idx = num_tokens + 1;
     if (end_idx < start_idx - 1) end_idx = start_idx - 1;
 
+    if (tl.b) {
+        tb_splice(L, 1, start_idx, end_idx, &rep, 0);
+        return 0;
+    }
+
     int removed = end_idx - start_idx + 1;
     int shift = rep_len - removed;
 
@@ -1205,7 +1731,7 @@ static int lexer_replace_tokens(lua_State *L) {
 
     /* Insert replacement tokens */
     for (int i = 1; i <= rep_len; i++) {
-        lua_rawgeti(L, 4, i);
+        tl_push(L, &rep, i);
         lua_rawseti(L, 1, start_idx + i - 1);
     }
 
@@ -1213,7 +1739,8 @@ static int lexer_replace_tokens(lua_State *L) {
 }
 
 static int lexer_split_sequence(lua_State *L) {
-    luaL_checktype(L, 1, LUA_TTABLE);
+    TokList tl;
+    checktoklist(L, 1, &tl);
     int is_str = lua_type(L, 2) == LUA_TSTRING;
     int is_int = lua_type(L, 2) == LUA_TNUMBER;
 
@@ -1224,29 +1751,32 @@ static int lexer_split_sequence(lua_State *L) {
     int target_token = is_int ? lua_tointeger(L, 2) : 0;
     const char *target_type = is_str ? lua_tostring(L, 2) : NULL;
 
-    int num_tokens = luaL_len(L, 1);
+    if (is_str && tl.b) {
+        /* buffers compare ids only */
+        target_token = type2token(L, target_type);
+        is_str = 0;
+        is_int = 1;
+    }
+
+    int num_tokens = tl_len(L, &tl);
 
     lua_newtable(L); /* result array of arrays */
     int res_idx = lua_gettop(L);
     int count = 1;
 
-    lua_newtable(L); /* current sequence */
+    TokOut curr;
+    out_new(L, &curr, &tl); /* current sequence */
     int curr_idx = lua_gettop(L);
-    int curr_len = 0;
 
     int braces = 0;
 
     for (int i = 1; i <= num_tokens; i++) {
-        lua_rawgeti(L, 1, i);
-        int tok_idx = lua_gettop(L);
-
-        if (!lua_istable(L, tok_idx)) {
+        if (tl.b == NULL && lua_rawgeti(L, 1, i) != LUA_TTABLE) {
             return luaL_error(L, "expected a table at index %d of the token list", i);
         }
+        if (tl.b == NULL) lua_pop(L, 1);
 
-        lua_getfield(L, tok_idx, "token");
-        int tk = lua_tointeger(L, -1);
-        lua_pop(L, 1);
+        int tk = tl_peek(L, &tl, i);
 
         if (tk == '(' || tk == '[' || tk == '{') {
             braces++;
@@ -1259,7 +1789,7 @@ static int lexer_split_sequence(lua_State *L) {
             if (is_int && tk == target_token) {
                 match = 1;
             } else if (is_str) {
-                lua_getfield(L, tok_idx, "type");
+                tl_pushtype(L, &tl, i);
                 if (lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), target_type) == 0) {
                     match = 1;
                 }
@@ -1272,16 +1802,11 @@ static int lexer_split_sequence(lua_State *L) {
             lua_pushvalue(L, curr_idx);
             lua_rawseti(L, res_idx, count++);
 
-            lua_newtable(L);
+            out_new(L, &curr, &tl);
             lua_replace(L, curr_idx);
-            curr_len = 0;
         } else {
-            curr_len++;
-            lua_pushvalue(L, tok_idx);
-            lua_rawseti(L, curr_idx, curr_len);
+            out_add(L, &curr, curr_idx, &tl, i);
         }
-
-        lua_pop(L, 1); /* pop token */
     }
 
     /* push last sequence */
@@ -1426,6 +1951,7 @@ static int lexer_call(lua_State *L) {
   lua_setfield(L, -2, #tk)
 
 LUAMOD_API int luaopen_lexer(lua_State *L) {
+    createtokenmeta(L);
     luaL_newlib(L, lexer_lib);
 
     /* set metatable for __call */
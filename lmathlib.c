@@ -206,6 +206,46 @@ static int math_rad (lua_State *L) {
 }
 
 
+/*
+** Converts an integral number or an integer numeral of any size to an
+** integer, or to a big integer when it does not fit in one.
+*/
+static int math_bigint (lua_State *L) {
+  size_t len;
+  const char *s;
+  if (lua_type(L, 1) == LUA_TNUMBER) {
+    lua_Number n;
+    char buff[DBL_MAX_10_EXP + 8];
+    lua_pushvalue(L, 1);
+    s = lua_tolstring(L, -1, &len);  /* big integers print as numerals */
+    if (lua_isinteger(L, 1) || lua_stringtobig(L, s, len)) {
+      lua_settop(L, 1);  /* already an integer */
+      return 1;
+    }
+    n = lua_tonumber(L, 1);
+    luaL_argcheck(L, l_mathop(floor)(n) == n && n - n == 0, 1,
+                  "number has no integer representation");
+    len = (size_t)l_sprintf(buff, sizeof(buff), "%.0f", (double)n);
+    lua_stringtobig(L, buff, len);
+  }
+  else {
+    s = luaL_checklstring(L, 1, &len);
+    luaL_argcheck(L, lua_stringtobig(L, s, len), 1, "not an integer numeral");
+  }
+  return 1;
+}
+
+
+static int math_powmod (lua_State *L) {
+  luaL_checknumber(L, 1);
+  luaL_checknumber(L, 2);
+  luaL_checknumber(L, 3);
+  lua_settop(L, 3);
+  lua_powmod(L);
+  return 1;
+}
+
+
 static int math_min (lua_State *L) {
   int n = lua_gettop(L);  /* number of arguments */
   int imin = 1;  /* index of current minimum value */
@@ -928,6 +968,8 @@ static const luaL_Reg mathlib[] = {
   {"type", math_type},
   {"array", math_array},
   {"toexpr", math_toexpr},
+  {"bigint", math_bigint},
+  {"powmod", math_powmod},
 #if defined(LUA_COMPAT_MATHLIB)
   {"atan2", math_atan},
   {"cosh",   math_cosh},
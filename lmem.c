@@ -13,6 +13,7 @@
 
 
 #include <stddef.h>
+#include <stdlib.h>
 
 #include "lua.h"
 
@@ -168,6 +169,157 @@ l_noret luaM_toobig (lua_State *L) {
 }
 
 
+/*
+** {=======================================================
+** Background freeing
+** ========================================================
+*/
+
+/*
+** While sweeping with 'gcdeferfree' set, freed blocks are collected in
+** batches and queued for a helper thread, which returns them to the
+** allocator. The collector only pays for unlinking dead objects. The
+** batches themselves come from the C library, as the Lua allocator is
+** what is being bypassed.
+*/
+
+#if !defined(LUAI_BGFREEBATCH)
+#define LUAI_BGFREEBATCH	1024
+#endif
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  int n;
+  struct { void *block; size_t size; } b[LUAI_BGFREEBATCH];
+} FreeBatch;
+
+typedef struct BgFree {
+  l_mutex_t lock;
+  l_cond_t work;  /* signaled when batches are queued or on stop */
+  l_cond_t idle;  /* signaled when the queue is drained */
+  FreeBatch *cur;  /* batch being filled by the collector */
+  FreeBatch *queue;  /* batches waiting for the helper */
+  int busy;  /* helper is freeing a batch */
+  int stop;
+  lua_Alloc frealloc;
+  void *ud;
+  l_thread_t thread;
+} BgFree;
+
+
+static void *bgfreeworker (void *arg) {
+  BgFree *bf = (BgFree *)arg;
+  l_mutex_lock(&bf->lock);
+  for (;;) {
+    FreeBatch *b;
+    while (bf->queue == NULL && !bf->stop)
+      l_cond_wait(&bf->work, &bf->lock);
+    if (bf->queue == NULL)
+      break;  /* stopped, and nothing left to free */
+    b = bf->queue;
+    bf->queue = NULL;
+    bf->busy = 1;
+    l_mutex_unlock(&bf->lock);
+    while (b != NULL) {
+      FreeBatch *next = b->next;
+      int i;
+      for (i = 0; i < b->n; i++)
+        (*bf->frealloc)(bf->ud, b->b[i].block, b->b[i].size, 0);
+      free(b);
+      b = next;
+    }
+    l_mutex_lock(&bf->lock);
+    bf->busy = 0;
+    if (bf->queue == NULL)
+      l_cond_broadcast(&bf->idle);
+  }
+  l_mutex_unlock(&bf->lock);
+  return NULL;
+}
+
+
+void luaM_flushbgfree (lua_State *L, int wait) {
+  BgFree *bf = G(L)->bgfree;
+  if (bf == NULL) return;
+  l_mutex_lock(&bf->lock);
+  if (bf->cur != NULL && bf->cur->n > 0) {
+    bf->cur->next = bf->queue;  /* order does not matter */
+    bf->queue = bf->cur;
+    bf->cur = NULL;
+    l_cond_signal(&bf->work);
+  }
+  if (wait) {
+    while (bf->queue != NULL || bf->busy)
+      l_cond_wait(&bf->idle, &bf->lock);
+  }
+  l_mutex_unlock(&bf->lock);
+}
+
+
+static void deferfree (lua_State *L, void *block, size_t osize) {
+  global_State *g = G(L);
+  BgFree *bf = g->bgfree;
+  FreeBatch *b = bf->cur;
+  if (b == NULL) {
+    b = (FreeBatch *)malloc(sizeof(FreeBatch));
+    if (b == NULL) {  /* no room for a batch: free it here */
+      callfrealloc(g, block, osize, 0);
+      return;
+    }
+    b->n = 0;
+    b->next = NULL;
+    bf->cur = b;
+  }
+  b->b[b->n].block = block;
+  b->b[b->n].size = osize;
+  if (++b->n == LUAI_BGFREEBATCH)
+    luaM_flushbgfree(L, 0);
+}
+
+
+int luaM_setbgfree (lua_State *L, int on) {
+  global_State *g = G(L);
+  BgFree *bf = g->bgfree;
+  int old = (bf != NULL);
+  if (on && bf == NULL) {
+    bf = (BgFree *)malloc(sizeof(BgFree));
+    if (bf == NULL) return -1;
+    l_mutex_init(&bf->lock);
+    l_cond_init(&bf->work);
+    l_cond_init(&bf->idle);
+    bf->cur = bf->queue = NULL;
+    bf->busy = bf->stop = 0;
+    bf->frealloc = g->frealloc;
+    bf->ud = g->ud;
+    if (l_thread_create(&bf->thread, bgfreeworker, bf) != 0) {
+      l_cond_destroy(&bf->idle);
+      l_cond_destroy(&bf->work);
+      l_mutex_destroy(&bf->lock);
+      free(bf);
+      return -1;
+    }
+    g->bgfree = bf;
+  }
+  else if (!on && bf != NULL) {
+    luaM_flushbgfree(L, 0);
+    l_mutex_lock(&bf->lock);
+    bf->stop = 1;
+    l_cond_signal(&bf->work);
+    l_mutex_unlock(&bf->lock);
+    l_thread_join(bf->thread, NULL);  /* helper drains the queue first */
+    g->bgfree = NULL;
+    g->gcdeferfree = 0;
+    l_cond_destroy(&bf->idle);
+    l_cond_destroy(&bf->work);
+    l_mutex_destroy(&bf->lock);
+    free(bf);
+  }
+  return old;
+}
+
+/* }======================================================= */
+
+
 /**
  * @brief Frees a memory block.
  *
@@ -178,7 +330,10 @@ l_noret luaM_toobig (lua_State *L) {
 void luaM_free_ (lua_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   lua_assert((osize == 0) == (block == NULL));
-  callfrealloc(g, block, osize, 0);
+  if (g->gcdeferfree && block != NULL)
+    deferfree(L, block, osize);
+  else
+    callfrealloc(g, block, osize, 0);
   l_atomic_sub(&g->GCdebt, osize);
 }
 
@@ -192,6 +347,7 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
+    luaM_flushbgfree(L, 1);  /* ...including what is freed in background */
     return callfrealloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
@@ -239,6 +239,27 @@ LUAI_FUNC void luaM_poolinit (lua_State *L);
  */
 LUAI_FUNC void luaM_poolshutdown (lua_State *L);
 
+/**
+ * @brief Starts or stops freeing swept objects in a background thread.
+ *
+ * While on, the sweep phases only unlink dead objects; their memory is
+ * handed in batches to a helper thread that calls the allocator. The
+ * allocator must then be thread-safe.
+ *
+ * @param L The Lua state.
+ * @param on Whether to free in the background.
+ * @return The previous setting, or -1 if the thread cannot be started.
+ */
+LUAI_FUNC int luaM_setbgfree (lua_State *L, int on);
+
+/**
+ * @brief Hands the blocks collected so far to the background thread.
+ *
+ * @param L The Lua state.
+ * @param wait Whether to wait until everything handed over is freed.
+ */
+LUAI_FUNC void luaM_flushbgfree (lua_State *L, int wait);
+
 /* not to be called directly */
 /**
  * @brief Internal reallocation function.
@@ -17,6 +17,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "lua.h"
 
@@ -543,14 +545,261 @@ static int checkload (lua_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Bytecode cache for Lua modules
+** =======================================================
+*/
+
+/*
+** When 'package.cachepath' names a directory, 'searcher_Lua' keeps
+** there the dumped bytecode of each module it compiles. A cache file
+** is a CacheHeader, the source file name and the function dumped in
+** the plain format ('lua_dump_plain').
+** It is used only if the header matches the source file (size,
+** modification time and a hash of its text) and this very build;
+** anything else falls back to compiling the source and rewriting the
+** entry. Entries are written to a temporary file and renamed, so
+** concurrent processes never see half-written files.
+*/
+
+#if !defined(LUA_CACHEPATH_VAR)
+#define LUA_CACHEPATH_VAR	"LUA_CACHEPATH"
+#endif
+
+#define CACHE_MAGIC	"LXCACHE1"
+
+/*
+** Identifies the builds that can share cache entries: same release and
+** same instruction set. (The loader also checks the instruction set
+** recorded in each plain chunk.)
+*/
+#define cachebuild(b)	\
+  snprintf(b, sizeof(b), "%s %08x", LUA_RELEASE, lua_bytecodeid())
+
+#if defined(LUA_USE_POSIX)
+#include <unistd.h>
+#define cache_procid()	((unsigned long)getpid())
+#elif defined(_WIN32)
+#include <process.h>
+#define cache_procid()	((unsigned long)_getpid())
+#else
+#define cache_procid()	((unsigned long)time(NULL))
+#endif
+
+
+typedef struct CacheHeader {
+  char magic[sizeof(CACHE_MAGIC)];
+  char build[64];
+  unsigned long long size;  /* size of the source file */
+  long long mtime;  /* modification time of the source file */
+  unsigned long long hash;  /* hash of the source text */
+  unsigned long long dumphash;  /* hash of the dumped chunk */
+  unsigned long pathlen;  /* length of the source file name that follows */
+} CacheHeader;
+
+
+/* FNV-1a, taking 8 bytes at a time */
+static unsigned long long cachehash_ (unsigned long long h,
+                                      const char *s, size_t l) {
+  for (; l >= 8; s += 8, l -= 8) {
+    unsigned long long w;
+    memcpy(&w, s, 8);
+    h = (h ^ w) * 1099511628211ULL;
+    h ^= h >> 29;
+  }
+  for (; l > 0; s++, l--)
+    h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+  return h;
+}
+
+#define cachehash(s,l)	cachehash_(14695981039346656037ULL, s, l)
+
+
+static void cacheheader (CacheHeader *h, const struct stat *st,
+                         unsigned long long hash, const char *filename) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  cachebuild(h->build);
+  h->size = (unsigned long long)st->st_size;
+  h->mtime = (long long)st->st_mtime;
+  h->hash = hash;
+  h->pathlen = (unsigned long)strlen(filename);
+}
+
+
+/*
+** Read the whole file 'filename'; returns a malloc'ed buffer or NULL.
+*/
+static char *readsource (const char *filename, size_t size) {
+  FILE *f = fopen(filename, "rb");
+  char *buff;
+  if (f == NULL) return NULL;
+  buff = (char *)malloc(size + 1);
+  if (buff != NULL && fread(buff, 1, size, f) != size) {
+    free(buff);
+    buff = NULL;
+  }
+  fclose(f);
+  return buff;
+}
+
+
+/*
+** Try to load the entry 'cname' for source 'filename'. On success
+** pushes the function and returns 1; otherwise returns 0 and leaves
+** the stack unchanged.
+*/
+static int readcache (lua_State *L, const char *cname, const char *filename,
+                      const CacheHeader *expected) {
+  CacheHeader h;
+  FILE *f = fopen(cname, "rb");
+  char *buff = NULL;
+  unsigned long long dumphash;
+  long total, n;
+  int ok = 0;
+  if (f == NULL) return 0;
+  if (fread(&h, sizeof(h), 1, f) == 1 &&
+      (dumphash = h.dumphash, h.dumphash = 0,
+       memcmp(&h, expected, sizeof(h)) == 0) &&
+      fseek(f, 0, SEEK_END) == 0 && (total = ftell(f)) > 0 &&
+      (n = total - (long)sizeof(h)) > (long)h.pathlen &&
+      fseek(f, (long)sizeof(h), SEEK_SET) == 0 &&
+      (buff = (char *)malloc(n)) != NULL &&
+      fread(buff, 1, n, f) == (size_t)n &&
+      memcmp(buff, filename, h.pathlen) == 0 &&
+      cachehash(buff + h.pathlen, n - h.pathlen) == dumphash) {
+    const char *chunkname = lua_pushfstring(L, "@%s", filename);
+    if (luaL_loadbufferx(L, buff + h.pathlen, n - h.pathlen,
+                         chunkname, "b") == LUA_OK) {
+      lua_remove(L, -2);  /* remove chunk name */
+      ok = 1;
+    }
+    else
+      lua_pop(L, 2);  /* stale or damaged entry; remove error and name */
+  }
+  free(buff);
+  fclose(f);
+  return ok;
+}
+
+
+typedef struct CacheWriter {
+  FILE *f;
+  unsigned long long hash;  /* running hash of what was written */
+} CacheWriter;
+
+
+/*
+** 'lua_dump_plain' hands the chunk over in one piece, so the running
+** hash equals the one 'readcache' computes over the whole chunk.
+*/
+static int cachewriter (lua_State *L, const void *p, size_t sz, void *ud) {
+  CacheWriter *w = (CacheWriter *)ud;
+  (void)L;
+  w->hash = cachehash_(w->hash, (const char *)p, sz);
+  return (fwrite(p, 1, sz, w->f) != sz);
+}
+
+
+/*
+** Dump the function on the top of the stack into entry 'cname'.
+** Failures are silent: the cache is only an optimization.
+*/
+static void writecache (lua_State *L, const char *cname, const char *filename,
+                        CacheHeader *h) {
+  char tmpname[32];
+  const char *tname;
+  CacheWriter w;
+  int err;
+  snprintf(tmpname, sizeof(tmpname), ".%lu.%p.tmp", cache_procid(),
+                                     (void *)L);
+  tname = lua_pushfstring(L, "%s%s", cname, tmpname);
+  w.f = fopen(tname, "wb");
+  if (w.f == NULL) {
+    lua_pop(L, 1);
+    return;
+  }
+  w.hash = cachehash(NULL, 0);
+  err = (fwrite(h, sizeof(*h), 1, w.f) != 1);
+  err = err || (fwrite(filename, 1, h->pathlen, w.f) != h->pathlen);
+  lua_pushvalue(L, -2);  /* function to dump */
+  err = err || (lua_dump_plain(L, cachewriter, &w, 0) != 0);
+  lua_pop(L, 1);
+  if (!err) {  /* complete the header */
+    h->dumphash = w.hash;
+    err = (fseek(w.f, 0, SEEK_SET) != 0 ||
+           fwrite(h, sizeof(*h), 1, w.f) != 1);
+  }
+  err = (fclose(w.f) != 0) || err;
+  if (!err && rename(tname, cname) != 0) {
+    remove(cname);  /* some systems do not rename over existing files */
+    err = (rename(tname, cname) != 0);
+  }
+  if (err) remove(tname);
+  lua_pop(L, 1);  /* remove temporary name */
+}
+
+
+/*
+** Load 'filename' through the cache in directory 'cachepath'. Same
+** results as 'luaL_loadfile'. Encrypted and precompiled files are
+** loaded directly: the former must not be stored decrypted and the
+** latter gain nothing.
+*/
+static int loadcached (lua_State *L, const char *filename,
+                       const char *cachepath) {
+  struct stat st;
+  CacheHeader h;
+  char *src;
+  char key[24];
+  const char *cname;
+  int status;
+  if (stat(filename, &st) != 0 ||
+      (src = readsource(filename, (size_t)st.st_size)) == NULL)
+    return luaL_loadfile(L, filename);
+  if ((st.st_size >= 9 && memcmp(src, "Nirithy==", 9) == 0) ||
+      (st.st_size > 0 && src[0] == LUA_SIGNATURE[0])) {
+    free(src);
+    return luaL_loadfile(L, filename);
+  }
+  cacheheader(&h, &st, cachehash(src, (size_t)st.st_size), filename);
+  free(src);
+  snprintf(key, sizeof(key), "%016llx",
+           cachehash(filename, h.pathlen) ^ cachehash(h.build,
+                                                      strlen(h.build)));
+  cname = lua_pushfstring(L, "%s" LUA_DIRSEP "%s.luac", cachepath, key);
+  if (readcache(L, cname, filename, &h)) {
+    lua_remove(L, -2);  /* remove cache name */
+    return LUA_OK;
+  }
+  status = luaL_loadfile(L, filename);
+  if (status == LUA_OK && !lua_iscfunction(L, -1))
+    writecache(L, cname, filename, &h);
+  lua_remove(L, -2);  /* remove cache name */
+  return status;
+}
+
+
 static int searcher_Lua (lua_State *L) {
   const char *filename;
+  const char *cachepath;
   const char *name = luaL_checkstring(L, 1);
   filename = findfile(L, name, "path", LUA_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
+  lua_getfield(L, lua_upvalueindex(1), "cachepath");
+  cachepath = lua_tostring(L, -1);
+  if (cachepath != NULL && *cachepath != '\0') {
+    int status = loadcached(L, filename, cachepath);
+    lua_remove(L, -2);  /* remove 'cachepath' */
+    return checkload(L, (status == LUA_OK), filename);
+  }
+  lua_pop(L, 1);  /* remove 'cachepath' */
   return checkload(L, (luaL_loadfile(L, filename) == LUA_OK), filename);
 }
 
+/* }====================================================== */
+
 
 /*
 ** Try to find a load function for module 'modname' at file 'filename'.
@@ -858,12 +1107,136 @@ static int ll_seeall (lua_State *L) {
 /* }=========================================== */
 
 
+/*
+** {======================================================
+** Module bundles ('luac -j')
+** =======================================================
+*/
+
+static unsigned long long getbundleint (const unsigned char *b, int n) {
+  unsigned long long x = 0;
+  while (n-- > 0)
+    x = (x << 8) | b[n];
+  return x;
+}
+
+
+/*
+** Loader installed in 'package.preload' for each module of a bundle.
+** Upvalues: bundle file name, chunk offset, chunk size.
+*/
+static int bundleloader (lua_State *L) {
+  const char *filename = lua_tostring(L, lua_upvalueindex(1));
+  lua_Integer offset = lua_tointeger(L, lua_upvalueindex(2));
+  size_t size = (size_t)lua_tointeger(L, lua_upvalueindex(3));
+  const char *name = luaL_checkstring(L, 1);
+  FILE *f = fopen(filename, "rb");
+  char *buff;
+  int status;
+  if (f == NULL)
+    return luaL_error(L, "cannot open bundle %s", filename);
+  buff = (char *)malloc(size > 0 ? size : 1);
+  if (buff == NULL || fseek(f, (long)offset, SEEK_SET) != 0 ||
+      fread(buff, 1, size, f) != size) {
+    free(buff);
+    fclose(f);
+    return luaL_error(L, "cannot read module '%s' from bundle %s",
+                         name, filename);
+  }
+  fclose(f);
+  status = luaL_loadbufferx(L, buff, size,
+                            lua_pushfstring(L, "@%s", name), "b");
+  free(buff);
+  if (status != LUA_OK)
+    return lua_error(L);
+  lua_pushvalue(L, 1);  /* 1st argument to module: its name */
+  lua_pushvalue(L, lua_upvalueindex(1));  /* 2nd: the bundle */
+  lua_call(L, 2, 1);
+  return 1;
+}
+
+
+/*
+** package.loadbundle(filename): read the index of a bundle and install
+** a 'package.preload' loader for each of its modules. Chunks are read
+** only when their module is required. The whole index is checked
+** before any loader is installed, so a corrupted bundle installs none.
+** Returns the list of names.
+*/
+static int ll_loadbundle (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  const size_t siglen = sizeof(LUA_BUNDLE_SIGNATURE) - 1;
+  unsigned char head[sizeof(LUA_BUNDLE_SIGNATURE) - 1 + 8];
+  unsigned long long i, count, fsize, minoffset;
+  long indexend;
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, filename);
+  if (fseek(f, 0, SEEK_END) != 0 || (long)(fsize = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0 ||
+      fread(head, 1, sizeof(head), f) != sizeof(head) ||
+      memcmp(head, LUA_BUNDLE_SIGNATURE, siglen) != 0 ||
+      getbundleint(head + siglen, 4) != LUA_BUNDLE_VERSION) {
+    fclose(f);
+    return luaL_error(L, "%s is not a module bundle", filename);
+  }
+  count = getbundleint(head + siglen + 4, 4);
+  /* each entry takes at least 20 bytes (name length, offset, size) */
+  if (count > (fsize - sizeof(head)) / 20) {
+    fclose(f);
+    return luaL_error(L, "corrupted bundle %s", filename);
+  }
+  lua_createtable(L, (int)count, 0);  /* names */
+  lua_createtable(L, (int)count, 0);  /* their loaders */
+  minoffset = fsize;
+  for (i = 0; i < count; i++) {
+    unsigned char b[16];
+    unsigned long long len, offset, size;
+    char *name;
+    if (fread(b, 1, 4, f) != 4 || (len = getbundleint(b, 4)) > fsize ||
+        (name = (char *)lua_newuserdatauv(L, (size_t)len + 1, 0)) == NULL ||
+        fread(name, 1, (size_t)len, f) != len ||
+        fread(b, 1, 16, f) != 16 ||
+        (offset = getbundleint(b, 8)) > fsize ||
+        (size = getbundleint(b + 8, 8)) > fsize - offset) {
+      fclose(f);
+      return luaL_error(L, "corrupted bundle %s", filename);
+    }
+    if (offset < minoffset) minoffset = offset;
+    lua_pushlstring(L, name, (size_t)len);
+    lua_remove(L, -2);  /* remove name buffer */
+    lua_rawseti(L, -3, (lua_Integer)i + 1);  /* add name to the list */
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, (lua_Integer)offset);
+    lua_pushinteger(L, (lua_Integer)size);
+    lua_pushcclosure(L, bundleloader, 3);
+    lua_rawseti(L, -2, (lua_Integer)i + 1);
+  }
+  indexend = ftell(f);
+  fclose(f);
+  if (count > 0 && (indexend < 0 || minoffset < (unsigned long long)indexend))
+    return luaL_error(L, "corrupted bundle %s", filename);  /* chunk in index */
+  luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+  for (i = 1; i <= count; i++) {
+    lua_rawgeti(L, -3, (lua_Integer)i);  /* name */
+    lua_rawgeti(L, -3, (lua_Integer)i);  /* loader */
+    lua_setfield(L, -3, lua_tostring(L, -2));  /* preload[name] = loader */
+    lua_pop(L, 1);  /* remove name */
+  }
+  lua_pop(L, 2);  /* remove preload table and loaders */
+  return 1;  /* return list of names */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg pk_funcs[] = {
   {"loadlib", ll_loadlib},
 #if defined(LUA_COMPAT_MODULE)
         {"seeall", ll_seeall},
 #endif
   {"searchpath", ll_searchpath},
+  {"loadbundle", ll_loadbundle},
   /* placeholders */
   {"preload", NULL},
   {"cpath", NULL},
@@ -917,6 +1290,18 @@ static void createclibstable (lua_State *L) {
 }
 
 
+/*
+** package.cachepath is off unless the environment sets it
+*/
+static void setcachepath (lua_State *L) {
+  const char *path = getenv(LUA_CACHEPATH_VAR);
+  if (path != NULL && !noenv(L)) {
+    lua_pushstring(L, path);
+    lua_setfield(L, -2, "cachepath");
+  }
+}
+
+
 LUAMOD_API int luaopen_package (lua_State *L) {
   createclibstable(L);
   luaL_newlib(L, pk_funcs);  /* create 'package' table */
@@ -924,6 +1309,7 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set paths */
   setpath(L, "path", LUA_PATH_VAR, LUA_PATH_DEFAULT);
   setpath(L, "cpath", LUA_CPATH_VAR, LUA_CPATH_DEFAULT);
+  setcachepath(L);
   /* store config information */
   lua_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
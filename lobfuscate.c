@@ -22,6 +22,7 @@
 #include "lopcodes.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "lprofile.h"
 #include "ltm.h"
 #include "ldebug.h"
 #include "ldo.h"
@@ -32,6 +33,7 @@
 #include "lstring.h"
 #include "lclass.h"
 #include "lthread.h"
+#include "lslice.h"
 #include <math.h>
 
 /* 全局日志文件指针 - 由 luaO_flatten 设置 */
@@ -3599,6 +3601,8 @@ int luaO_executeVM (lua_State *L, Proto *f) {
 
   while (pc < vm->size) {
     base = ci->func.p + 1;
+    if (l_unlikely(l_atomic_load(&G(L)->profpending)))  /* sampling profiler asked? */
+      luaR_sample(L, f->code + pc, 0);
     VMInstruction decrypted = decryptVMInst(vm->code[pc], vm->encrypt_key, pc);
     int vm_op = VM_GET_OP(decrypted), a = VM_GET_A(decrypted), b = VM_GET_B(decrypted), c = VM_GET_C(decrypted), flags = VM_GET_FLAGS(decrypted);
     int64_t bx = VM_GET_Bx(decrypted);
@@ -3765,9 +3769,9 @@ int luaO_executeVM (lua_State *L, Proto *f) {
       }
       case OP_SETUPVAL: { if (b < cl->nupvalues) { UpVal *uv = cl->upvals[b]; setobj(L, uv->v.p, s2v(base + a)); luaC_barrier(L, uv, s2v(base + a)); } break; }
       case OP_GETTABLE: { const TValue *slot; if (luaV_fastget(L, s2v(base + b), s2v(base + c), slot, luaH_get)) { setobj2s(L, base + a, slot); } else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishget(L, s2v(base + b), s2v(base + c), base + a, slot); break; } break; }
-      case OP_SETTABLE: { const TValue *slot; TValue *rc = (flags) ? k + c : s2v(base + c); if (luaV_fastget(L, s2v(base + a), s2v(base + b), slot, luaH_get)) { luaV_finishfastset(L, s2v(base + a), slot, rc); } else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishset(L, s2v(base + a), s2v(base + b), rc, slot); break; } break; }
+      case OP_SETTABLE: { const TValue *slot; TValue *rc = (flags) ? k + c : s2v(base + c); if (luaV_fastget(L, s2v(base + a), s2v(base + b), slot, luaH_get) && !hvalue(s2v(base + a))->viewed) { luaV_finishfastset(L, s2v(base + a), slot, rc); } else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishset(L, s2v(base + a), s2v(base + b), rc, slot); break; } break; }
       case OP_GETI: { const TValue *slot; if (luaV_fastgeti(L, s2v(base + b), c, slot)) { setobj2s(L, base + a, slot); } else { TValue key; setivalue(&key, c); ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishget(L, s2v(base + b), &key, base + a, slot); break; } break; }
-      case OP_SETI: { const TValue *slot; TValue *rc = (flags) ? k + c : s2v(base + c); if (luaV_fastgeti(L, s2v(base + a), b, slot)) { luaV_finishfastset(L, s2v(base + a), slot, rc); } else { TValue key; setivalue(&key, b); ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishset(L, s2v(base + a), &key, rc, slot); break; } break; }
+      case OP_SETI: { const TValue *slot; TValue *rc = (flags) ? k + c : s2v(base + c); if (luaV_fastgeti(L, s2v(base + a), b, slot) && !hvalue(s2v(base + a))->viewed) { luaV_finishfastset(L, s2v(base + a), slot, rc); } else { TValue key; setivalue(&key, b); ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishset(L, s2v(base + a), &key, rc, slot); break; } break; }
       case OP_GETFIELD: { const TValue *slot; TValue *rc = k + c; if (luaV_fastget(L, s2v(base + b), tsvalue(rc), slot, luaH_getshortstr)) { setobj2s(L, base + a, slot); } else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishget(L, s2v(base + b), rc, base + a, slot); break; } break; }
       case OP_SETFIELD: { const TValue *slot; TValue *rb = k + b, *rc = (flags) ? k + c : s2v(base + c); if (luaV_fastget(L, s2v(base + a), tsvalue(rb), slot, luaH_getshortstr)) { luaV_finishfastset(L, s2v(base + a), slot, rc); } else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaV_finishset(L, s2v(base + a), rb, rc, slot); break; } break; }
       case OP_NEWTABLE: { ci->u.l.savedpc = (const Instruction *)(f->code + pc); int asize = c; if (flags) { pc++; if (pc < vm->size) { VMInstruction next_inst = decryptVMInst(vm->code[pc], vm->encrypt_key, pc); asize += (unsigned int)(VM_GET_Bx(next_inst)) * (MAXARG_C + 1); } } L->top.p = base + a + 1; Table *t_ = luaH_new(L); sethvalue2s(L, base + a, t_); if (b || asize) { int hsize = (b > 0) ? (1u << (b - 1)) : 0; luaH_resize(L, t_, asize, hsize); } break; }
@@ -3823,7 +3827,7 @@ int luaO_executeVM (lua_State *L, Proto *f) {
       case OP_IS: { TValue *ra = s2v(base + a); TValue *rb = k + b; const char *typename_expected = getstr(tsvalue(rb)); const char *typename_actual; const TValue *tm = luaT_gettmbyobj(L, ra, TM_TYPE); if (!notm(tm) && ttisstring(tm)) typename_actual = getstr(tsvalue(tm)); else typename_actual = luaT_objtypename(L, ra); if ((strcmp(typename_actual, typename_expected) == 0) != flags) pc++; break; }
       case OP_TESTNIL: { TValue *rb = s2v(base + b); if (ttisnil(rb) != flags) pc++; break; }
       case OP_IN: { StkId ra = base + a; TValue *va = s2v(base + b); TValue *vb = s2v(base + c); if (ttisstring(va) && ttisstring(vb)) { const char *s1 = getstr(tsvalue(va)); const char *s2 = getstr(tsvalue(vb)); size_t l1 = tsslen(tsvalue(va)); size_t l2 = tsslen(tsvalue(vb)); int found = 0; if (l1 <= l2) { size_t i; for (i = 0; i <= l2 - l1; i++) { if (memcmp(s2 + i, s1, l1) == 0) { found = 1; break; } } } if (found) setbtvalue(s2v(ra)); else setbfvalue(s2v(ra)); } else { if (l_unlikely(!ttistable(vb))) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } const TValue *res = luaH_get(hvalue(vb), va); if (!ttisnil(res)) setbtvalue(s2v(ra)); else setbfvalue(s2v(ra)); } break; }
-      case OP_SLICE: { StkId ra = base + a; StkId base_reg = base + b; TValue *src_table = s2v(base_reg); TValue *start_val = s2v(base_reg + 1); TValue *end_val = s2v(base_reg + 2); TValue *step_val = s2v(base_reg + 3); Table *t; Table *result_t; lua_Integer tlen; lua_Integer start_idx, end_idx, step; lua_Integer result_idx; if (l_unlikely(!ttistable(src_table))) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } t = hvalue(src_table); tlen = luaH_getn(t); if (ttisnil(start_val)) start_idx = 1; else if (ttisinteger(start_val)) start_idx = ivalue(start_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (ttisnil(end_val)) end_idx = tlen; else if (ttisinteger(end_val)) end_idx = ivalue(end_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (ttisnil(step_val)) step = 1; else if (ttisinteger(step_val)) step = ivalue(step_val); else { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (step == 0) { ci->u.l.savedpc = (const Instruction *)(f->code + pc); return 1; } if (start_idx < 0) start_idx = tlen + start_idx + 1; if (end_idx < 0) end_idx = tlen + end_idx + 1; if (step > 0) { if (start_idx < 1) start_idx = 1; if (end_idx > tlen) end_idx = tlen; } else { if (start_idx > tlen) start_idx = tlen; if (end_idx < 1) end_idx = 1; } L->top.p = ra + 1; result_t = luaH_new(L); sethvalue2s(L, ra, result_t); result_idx = 1; if (step > 0) { lua_Integer idx; for (idx = start_idx; idx <= end_idx; idx += step) { const TValue *val = luaH_getint(t, idx); if (!ttisnil(val)) { TValue temp; setobj(L, &temp, val); luaH_setint(L, result_t, result_idx, &temp); } result_idx++; } } else { lua_Integer idx; for (idx = start_idx; idx >= end_idx; idx += step) { const TValue *val = luaH_getint(t, idx); if (!ttisnil(val)) { TValue temp; setobj(L, &temp, val); luaH_setint(L, result_t, result_idx, &temp); } result_idx++; } } checkGC(L, ra + 1); break; }
+      case OP_SLICE: { StkId ra = base + a; ci->u.l.savedpc = (const Instruction *)(f->code + pc); L->top.p = ci->top.p; luaSL_slice(L, ra, s2v(base + b)); checkGC(L, ra + 1); break; }
       case OP_NEWCLASS: { TString *classname = tsvalue(&k[bx]); ci->u.l.savedpc = (const Instruction *)(f->code + pc); luaC_newclass(L, classname); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p--; checkGC(L, base + a + 1); break; }
       case OP_INHERIT: { TValue *rb = s2v(base + b); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + a)); L->top.p++; setobj2s(L, L->top.p, rb); L->top.p++; luaC_inherit(L, -2, -1); L->top.p -= 2; break; }
       case OP_GETSUPER: { TString *key = tsvalue(&k[c]); ci->u.l.savedpc = (const Instruction *)(f->code + pc); setobj2s(L, L->top.p, s2v(base + b)); L->top.p++; luaC_super(L, -1, key); setobj2s(L, base + a, s2v(L->top.p - 1)); L->top.p -= 2; break; }
@@ -167,15 +167,16 @@ static lua_Number numarith (lua_State *L, int op, lua_Number v1,
  */
 int luaO_rawarith (lua_State *L, int op, const TValue *p1, const TValue *p2,
                    TValue *res) {
-  if (ttisbigint(p1) || ttisbigint(p2)) {
+  if ((ttisbigint(p1) || ttisbigint(p2)) && ttisnumber(p1) && ttisnumber(p2)) {
     switch (op) {
       case LUA_OPADD: luaB_add(L, (TValue*)p1, (TValue*)p2, res); return 1;
       case LUA_OPSUB: luaB_sub(L, (TValue*)p1, (TValue*)p2, res); return 1;
       case LUA_OPMUL: luaB_mul(L, (TValue*)p1, (TValue*)p2, res); return 1;
       case LUA_OPDIV: luaB_div(L, (TValue*)p1, (TValue*)p2, res); return 1;
-      case LUA_OPIDIV: luaB_div(L, (TValue*)p1, (TValue*)p2, res); return 1;
+      case LUA_OPIDIV: luaB_idiv(L, (TValue*)p1, (TValue*)p2, res); return 1;
       case LUA_OPMOD: luaB_mod(L, (TValue*)p1, (TValue*)p2, res); return 1;
       case LUA_OPPOW: luaB_pow(L, (TValue*)p1, (TValue*)p2, res); return 1;
+      case LUA_OPUNM: luaB_unm(L, (TValue*)p1, res); return 1;
       default: return 0;
     }
   }
@@ -398,11 +398,16 @@ typedef struct GCObject {
  */
 typedef struct TBigInt {
   CommonHeader;
-  unsigned int len;  /**< Number of limbs. */
   int sign;          /**< 1 or -1. */
-  l_uint32 buff[1];  /**< Limbs (little endian). */
+  unsigned int len;  /**< Number of significant limbs. */
+  unsigned int size; /**< Number of allocated limbs. */
+  l_uint64 buff[1];  /**< Limbs (little endian). */
 } TBigInt;
 
+/* size of a big integer with 'n' limbs */
+#define sizebigint(n)	(offsetof(TBigInt, buff) + \
+	((n) > 0 ? (n) : 1) * sizeof(l_uint64))
+
 #define gco2big(o)	check_exp((o)->tt == LUA_VNUMBIG, (TBigInt*)(o))
 
 LUAI_FUNC lua_Number luaB_bigtonumber (const TValue *obj);
@@ -760,6 +765,7 @@ typedef struct Proto {
   int is_sleeping; /**< Sleep status. */
   CallQueue *call_queue; /**< Call queue for sleep/wake. */
   struct VMCodeTable *vm_code_table;  /**< VM protection code table pointer. */
+  Instruction *bpcode;  /**< Original instructions under breakpoint traps (or NULL). */
 } Proto;
 
 /* }======================================================= */
@@ -947,9 +953,12 @@ typedef struct Namespace {
 typedef struct SuperStruct {
   CommonHeader;
   TString *name; /**< SuperStruct name. */
-  unsigned int nsize; /**< Size. */
+  unsigned int nsize; /**< Number of entries in 'data'. */
   unsigned int ncapacity; /**< Capacity. */
-  TValue *data; /**< Data. */
+  unsigned int ndead; /**< Deleted entries still in 'data' (hashed only). */
+  lu_byte lsizeindex; /**< log2 of the size of 'index'. */
+  TValue *data; /**< Key-value entries. */
+  unsigned int *index; /**< Hash index into 'data', or NULL while sorted. */
 } SuperStruct;
 
 #define gco2superstruct(o)	check_exp((o)->tt == LUA_VSUPERSTRUCT, &((cast_u(o) - offsetof(SuperStruct, next))->superstruct))
@@ -1035,6 +1044,7 @@ typedef struct Table {
   GCObject *gclist; /**< Garbage collector list. */
   lu_byte type;    /**< Custom type flag. */
   lu_byte is_shared; /**< Lock enablement flag. */
+  lu_byte viewed;  /**< Slice views of this table may be alive. */
   l_rwlock_t lock; /**< Lock for thread safety. */
   struct Namespace *using_next; /**< Used namespaces. */
 } Table;
@@ -11,6 +11,7 @@
 
 
 #include "lopcodes.h"
+#include "lopnames.h"
 
 
 #define opmode(mm,ot,it,t,a,m)  \
@@ -168,3 +169,22 @@ int luaP_isIT (Instruction i) {
   }
 }
 
+
+
+/*
+** Identifies the instruction set: a hash (FNV-1a) of the names and
+** modes of all opcodes, in opcode order. Plain chunks record it, so
+** that they are only loaded by builds that decode them the same way.
+*/
+l_uint32 luaP_codeid (void) {
+  l_uint32 h = 2166136261u;
+  int op;
+  for (op = 0; op < NUM_OPCODES; op++) {
+    const char *s = opnames[op];
+    do {  /* name, including its '\0' */
+      h = (h ^ cast_byte(*s)) * 16777619u;
+    } while (*s++ != '\0');
+    h = (h ^ luaP_opmodes[op]) * 16777619u;
+  }
+  return h;
+}
@@ -420,6 +420,16 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 #define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
 
 
+/*
+** Debugger trap patched over an instruction by 'luaG_setbreak'. Only
+** the opcode is replaced; the original instruction is kept in
+** 'Proto.bpcode'. It lives past NUM_OPCODES because it is never
+** serialized (dumps always carry the original instruction), so the
+** opcode maps of the binary format are unchanged.
+*/
+#define OP_BREAKPOINT	((OpCode)NUM_OPCODES)
+
+
 
 /*================================================================
   Notes:
@@ -513,6 +523,7 @@ LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 
 LUAI_FUNC int luaP_isOT (Instruction i);
 LUAI_FUNC int luaP_isIT (Instruction i);
+LUAI_FUNC l_uint32 luaP_codeid (void);
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
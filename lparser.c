@@ -272,8 +272,8 @@ static SoftKWDef soft_keywords[] = {
 /* 哈希表（存储软关键字定义的指针） */
 static SoftKWDef *softkw_hashtable[SOFTKW_HASH_SIZE];
 
-/* 标记哈希表是否已初始化 */
-static int softkw_initialized = 0;
+/* 标记哈希表是否已初始化（多个线程可能同时解析，见 luac -j） */
+static _Atomic int softkw_initialized = 0;
 
 
 /*
@@ -295,14 +295,17 @@ static unsigned int softkw_hash (const char *s) {
 /*
 ** 初始化软关键字哈希表
 ** 说明：
-**   在第一次使用前自动调用，构建哈希表以加速查找
+**   在第一次使用前自动调用，构建哈希表以加速查找。
+**   先在局部表中构建再整体复制，并发初始化的线程写入的内容完全相同，
+**   读者只会看到完整的表。
 */
 static void softkw_init (void) {
+  SoftKWDef *table[SOFTKW_HASH_SIZE];
   if (softkw_initialized) return;
   
   /* 清空哈希表 */
   for (int i = 0; i < SOFTKW_HASH_SIZE; i++) {
-    softkw_hashtable[i] = NULL;
+    table[i] = NULL;
   }
   
   /* 计算每个软关键字的哈希值并插入哈希表 */
@@ -310,12 +313,13 @@ static void softkw_init (void) {
     soft_keywords[i].hash = softkw_hash(soft_keywords[i].name);
     /* 使用开放寻址法处理冲突 */
     unsigned int idx = soft_keywords[i].hash % SOFTKW_HASH_SIZE;
-    while (softkw_hashtable[idx] != NULL) {
+    while (table[idx] != NULL) {
       idx = (idx + 1) % SOFTKW_HASH_SIZE;
     }
-    softkw_hashtable[idx] = &soft_keywords[i];
+    table[idx] = &soft_keywords[i];
   }
   
+  memcpy(softkw_hashtable, table, sizeof(table));
   softkw_initialized = 1;
 }
 
@@ -1621,6 +1625,43 @@ static void sliceexpr (LexState *ls, expdesc *v) {
 }
 
 
+/*
+** 解析切片中 start 之后的部分: ':' [end] [':' [step]] ']'
+** 词法分析器把 '::' 读作一个 token (TK_DBCOLON)，因此 '::' [step] ']'
+** 表示省略 end，如 t[::-1]
+** end 和 step 放入接下来的两个寄存器
+**
+** @param ls 词法分析器状态
+** @return 1 表示给出了 step
+*/
+static int slicerest (LexState *ls) {
+  FuncState *fs = ls->fs;
+  expdesc e;
+  int has_step;
+  if (testnext(ls, TK_DBCOLON)) {  /* '::': 省略 end，后面是 step */
+    init_exp(&e, VNIL, 0);
+    luaK_exp2nextreg(fs, &e);
+    has_step = 1;
+  }
+  else {
+    checknext(ls, ':');
+    if (ls->t.token == ']' || ls->t.token == ':')
+      init_exp(&e, VNIL, 0);  /* 省略 end，使用 nil 表示 #t */
+    else
+      expr(ls, &e);
+    luaK_exp2nextreg(fs, &e);  /* end */
+    has_step = testnext(ls, ':');
+  }
+  if (has_step && ls->t.token != ']')
+    expr(ls, &e);
+  else
+    init_exp(&e, VNIL, 0);  /* 省略 step，使用 nil 表示 1 */
+  luaK_exp2nextreg(fs, &e);  /* step */
+  checknext(ls, ']');
+  return has_step;
+}
+
+
 /*
 ** 处理索引或切片语法: t[exp] 或 t[start:end:step]
 ** 首先解析第一个表达式或检测 ':'，然后决定是普通索引还是切片
@@ -1634,50 +1675,21 @@ static int yindex_or_slice (LexState *ls, expdesc *v) {
   
   luaX_next(ls);  /* skip the '[' */
   
-  /* 检查是否是切片语法: 第一个 token 是 ':' */
-  if (ls->t.token == ':') {
+  /* 检查是否是切片语法: 第一个 token 是 ':' 或 '::' */
+  if (ls->t.token == ':' || ls->t.token == TK_DBCOLON) {
     /* 这是切片语法: [:end] 或 [::step] 等形式 */
+    expdesc start_exp;
+    int base, has_step;
     
     /* 将源表放入寄存器 */
     luaK_exp2nextreg(fs, v);
-    int base = v->u.info;
-    
-    expdesc start_exp, end_exp, step_exp;
-    int has_step = 0;
+    base = v->u.info;
     
     /* start 省略，使用 nil */
     init_exp(&start_exp, VNIL, 0);
     luaK_exp2nextreg(fs, &start_exp);
     
-    /* 跳过第一个 ':' */
-    luaX_next(ls);
-    
-    /* 解析 end */
-    if (ls->t.token == ']' || ls->t.token == ':') {
-      init_exp(&end_exp, VNIL, 0);
-    }
-    else {
-      expr(ls, &end_exp);
-    }
-    luaK_exp2nextreg(fs, &end_exp);
-    
-    /* 检查是否有 step */
-    if (testnext(ls, ':')) {
-      has_step = 1;
-      if (ls->t.token == ']') {
-        init_exp(&step_exp, VNIL, 0);
-      }
-      else {
-        expr(ls, &step_exp);
-      }
-      luaK_exp2nextreg(fs, &step_exp);
-    }
-    else {
-      init_exp(&step_exp, VNIL, 0);
-      luaK_exp2nextreg(fs, &step_exp);
-    }
-    
-    checknext(ls, ']');
+    has_step = slicerest(ls);
     
     luaK_codeABC(fs, OP_SLICE, base, base, has_step);
     fs->freereg = base + 1;
@@ -1697,49 +1709,19 @@ static int yindex_or_slice (LexState *ls, expdesc *v) {
   expdesc key;
   expr(ls, &key);
   
-  /* 检查表达式后面是否跟着 ':' */
-  if (ls->t.token == ':') {
+  /* 检查表达式后面是否跟着 ':' 或 '::' */
+  if (ls->t.token == ':' || ls->t.token == TK_DBCOLON) {
     /* 这是切片语法: [start:end] 或 [start:end:step] */
+    int base, has_step;
     
     /* 将源表移动到下一个连续寄存器位置（切片需要连续的寄存器布局） */
     luaK_exp2nextreg(fs, v);
-    int base = v->u.info;
+    base = v->u.info;
     
     /* 将 start 表达式放入下一个寄存器 */
     luaK_exp2nextreg(fs, &key);
     
-    expdesc end_exp, step_exp;
-    int has_step = 0;
-    
-    /* 跳过 ':' */
-    luaX_next(ls);
-    
-    /* 解析 end */
-    if (ls->t.token == ']' || ls->t.token == ':') {
-      init_exp(&end_exp, VNIL, 0);
-    }
-    else {
-      expr(ls, &end_exp);
-    }
-    luaK_exp2nextreg(fs, &end_exp);
-    
-    /* 检查是否有 step */
-    if (testnext(ls, ':')) {
-      has_step = 1;
-      if (ls->t.token == ']') {
-        init_exp(&step_exp, VNIL, 0);
-      }
-      else {
-        expr(ls, &step_exp);
-      }
-      luaK_exp2nextreg(fs, &step_exp);
-    }
-    else {
-      init_exp(&step_exp, VNIL, 0);
-      luaK_exp2nextreg(fs, &step_exp);
-    }
-    
-    checknext(ls, ']');
+    has_step = slicerest(ls);
     
     luaK_codeABC(fs, OP_SLICE, base, base, has_step);
     fs->freereg = base + 1;
@@ -4907,11 +4889,10 @@ static BinOpr subexpr (LexState *ls, expdesc *v, int limit) {
   if (uop != OPR_NOUNOPR) {  /* prefix (unary) operator? */
     int line = ls->linenumber;
     luaX_next(ls);  /* skip operator */
-    subexpr(ls, v, UNARY_PRIORITY);
     if (uop == OPR_AWAIT) {
         FuncState *fs = ls->fs;
         expdesc f;
-        /* Get coroutine.yield */
+        /* Get coroutine.yield; it must sit below the operand */
         singlevaraux(fs, luaS_newliteral(ls->L, "coroutine"), &f, 1);
         if (f.k == VVOID) {
             expdesc key;
@@ -4927,13 +4908,14 @@ static BinOpr subexpr (LexState *ls, expdesc *v, int limit) {
         luaK_exp2nextreg(fs, &f);
         int func_reg = f.u.info;
 
+        subexpr(ls, v, UNARY_PRIORITY);
         luaK_exp2nextreg(fs, v);
-        int arg_reg = v->u.info;
 
         init_exp(v, VCALL, luaK_codeABC(fs, OP_CALL, func_reg, 2, 2));
         fs->freereg = func_reg + 1;
         luaK_fixline(fs, line);
     } else {
+        subexpr(ls, v, UNARY_PRIORITY);
         luaK_prefix(ls->fs, uop, v, line);
     }
   }
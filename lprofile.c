@@ -0,0 +1,616 @@
+/*
+** $Id: lprofile.c $
+** Sampling profiler
+*/
+
+#define lprofile_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lprofile.h"
+#include "lstate.h"
+#include "lthread.h"
+#include "lvm.h"
+
+#if defined(LUA_USE_POSIX)
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+
+/*
+** {======================================================
+** Sampling (VM side)
+** =======================================================
+**
+** A timer (SIGPROF or a sampler thread) only asks for a sample: it sets
+** the atomic 'profpending' and touches nothing else, as the thread being
+** sampled may be changing its CallInfo list at the same time. The VM
+** polls the flag on returns and backward jumps (see 'checkprof' in
+** lvm.c) and at the top of the protected VM loop; then the thread
+** samples itself through 'luaG_traceexec', which calls 'luaR_sample' to
+** copy the CallInfo chain to the ring.
+*/
+
+
+/*
+** Asks for a sample. Called from a signal handler or another OS thread,
+** so it only stores the flag.
+*/
+void luaR_request (global_State *g) {
+  l_atomic_store(&g->profpending, 1);
+}
+
+
+/*
+** Records the CallInfo chain of 'L' (innermost first). 'pc' points to
+** the instruction about to run in the current (Lua) function. When the
+** ring gets half full and 'canflush', the profiler's flush function is
+** run as a hook to drain it.
+*/
+void luaR_sample (lua_State *L, const Instruction *pc, int canflush) {
+  global_State *g = G(L);
+  Profiler *pf = g->profiler;
+  unsigned int head, tail, mask, room, w;
+  int n = 0;
+  CallInfo *ci;
+  l_atomic_store(&g->profpending, 0);
+  if (pf == NULL)
+    return;  /* profiler stopped while a sample was pending */
+  head = atomic_load_explicit(&pf->head, memory_order_relaxed);
+  tail = atomic_load_explicit(&pf->tail, memory_order_acquire);
+  mask = pf->size - 1;
+  room = pf->size - (head - tail);
+  w = head + 1;  /* first frame goes after the header */
+  for (ci = L->ci; ci != &L->base_ci && n < pf->maxdepth; ci = ci->previous) {
+    ProfEntry *e;
+    if (cast(unsigned int, n) + 2 > room) {  /* no room for frame + header? */
+      atomic_fetch_add(&pf->ndropped, 1);
+      return;
+    }
+    e = &pf->ring[w++ & mask];
+    if (isLua(ci)) {
+      Proto *p = ci_func(ci)->p;
+      e->kind = PROF_LUA;
+      e->u.p = p;
+      e->pc = (ci == L->ci) ? cast_int(pc - p->code)
+                            : pcRel(ci->u.l.savedpc, p);
+    }
+    else {
+      const TValue *f = s2v(ci->func.p);
+      e->kind = PROF_C;
+      e->u.f = ttislcf(f) ? fvalue(f)
+             : ttisCclosure(f) ? clCvalue(f)->f : NULL;
+    }
+    n++;
+  }
+  if (n == 0)
+    return;
+  pf->ring[head & mask].kind = PROF_HEAD;
+  pf->ring[head & mask].pc = n;
+  pf->ring[head & mask].flags = (L != g->mainthread) ? PROF_COROUTINE : 0;
+  atomic_store_explicit(&pf->head, head + n + 1, memory_order_release);
+  atomic_fetch_add(&pf->nsamples, 1);
+  if (canflush && pf->flush != NULL && L->allowhook &&
+      (head + n + 1 - tail) >= pf->size / 2) {
+    const Proto *p = ci_func(L->ci)->p;
+    L->ci->u.l.savedpc = pc + 1;  /* as for a line hook */
+    if (!isIT(luaV_getinst(p, cast_int(pc - p->code))))
+      L->top.p = L->ci->top.p;  /* correct top */
+    luaD_runhook(L, pf->flush, LUA_HOOKCOUNT, -1, 0, 0);
+  }
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Library
+** =======================================================
+*/
+
+#define PROFKEY		"_PROFILER"
+#define PROFMT		"profiler.state"
+
+#define MODE_SIGNAL	0
+#define MODE_THREAD	1
+
+/*
+** A sampler thread is the default: SIGPROF is bound to the kernel tick
+** (often 250 Hz) and interrupts system calls of the whole process.
+*/
+#define DEFAULTMODE	MODE_THREAD
+
+
+/**
+ * @brief Profiler userdata: the core state, its timer and the ring.
+ * User values: 1 = folded stacks -> count, 2 = "src:line" -> count.
+ */
+typedef struct ProfState {
+  Profiler pf;  /**< Core state (pointed to by 'g->profiler'). */
+  global_State *g;  /**< Profiled state. */
+  int active;  /**< Timer running. */
+  int mode;  /**< MODE_SIGNAL or MODE_THREAD. */
+  int hz;  /**< Sampling frequency. */
+  int stop;  /**< Sampler thread must exit. */
+  l_thread_t thread;  /**< Sampler thread (MODE_THREAD). */
+  l_mutex_t mtx;
+  l_cond_t cond;
+  ProfEntry ring[1];  /**< Sample ring ('pf.size' entries). */
+} ProfState;
+
+
+#if defined(LUA_USE_POSIX)
+
+/* state sampled by SIGPROF (one per process) */
+static global_State *volatile sigtarget = NULL;
+static struct sigaction oldaction;
+
+static void profsignal (int sig) {
+  global_State *g = sigtarget;
+  (void)sig;
+  if (g != NULL)
+    luaR_request(g);
+}
+
+
+static int startsignal (ProfState *ps) {
+  struct sigaction sa;
+  struct itimerval it;
+  long usec = 1000000L / ps->hz;
+  if (sigtarget != NULL)
+    return 0;  /* timer already in use by another state */
+  sigtarget = ps->g;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = profsignal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, &oldaction);
+  it.it_interval.tv_sec = usec / 1000000L;
+  it.it_interval.tv_usec = usec % 1000000L;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL) != 0) {
+    sigaction(SIGPROF, &oldaction, NULL);
+    sigtarget = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+
+static void stopsignal (void) {
+  struct itimerval it;
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  sigaction(SIGPROF, &oldaction, NULL);
+  sigtarget = NULL;
+}
+
+#endif
+
+
+static void *samplerthread (void *arg) {
+  ProfState *ps = (ProfState *)arg;
+  long ms = 1000L / ps->hz;
+  if (ms < 1) ms = 1;
+  l_mutex_lock(&ps->mtx);
+  while (!ps->stop) {
+    if (l_cond_wait_timeout(&ps->cond, &ps->mtx, ms) == LTHREAD_TIMEDOUT &&
+        !ps->stop)
+      luaR_request(ps->g);
+  }
+  l_mutex_unlock(&ps->mtx);
+  return NULL;
+}
+
+
+static int starttimer (ProfState *ps) {
+#if defined(LUA_USE_POSIX)
+  if (ps->mode == MODE_SIGNAL)
+    return startsignal(ps);
+#endif
+  ps->stop = 0;
+  l_mutex_init(&ps->mtx);
+  l_cond_init(&ps->cond);
+  if (l_thread_create(&ps->thread, samplerthread, ps) != 0) {
+    l_cond_destroy(&ps->cond);
+    l_mutex_destroy(&ps->mtx);
+    return 0;
+  }
+  return 1;
+}
+
+
+static void stoptimer (ProfState *ps) {
+#if defined(LUA_USE_POSIX)
+  if (ps->mode == MODE_SIGNAL) {
+    stopsignal();
+    return;
+  }
+#endif
+  l_mutex_lock(&ps->mtx);
+  ps->stop = 1;
+  l_cond_signal(&ps->cond);
+  l_mutex_unlock(&ps->mtx);
+  l_thread_join(ps->thread, NULL);
+  l_cond_destroy(&ps->cond);
+  l_mutex_destroy(&ps->mtx);
+}
+
+
+/*
+** Detaches the profiler from the state. Until then the collector keeps
+** alive the prototypes referenced by the ring.
+*/
+static void detach (lua_State *L, ProfState *ps) {
+  lua_lock(L);
+  if (ps->g->profiler == &ps->pf)
+    ps->g->profiler = NULL;
+  l_atomic_store(&ps->g->profpending, 0);
+  lua_unlock(L);
+}
+
+
+/*
+** Adds 's' to the buffer replacing ';' (the frame separator of folded
+** stacks).
+*/
+static void addclean (luaL_Buffer *b, const char *s) {
+  for (; *s; s++)
+    luaL_addchar(b, (*s == ';') ? ',' : *s);
+}
+
+
+/*
+** Adds the label of frame 'e' to the folded stack. Its name comes from
+** the instruction that called it in 'caller', when that is a Lua frame.
+*/
+static void addlabel (lua_State *L, luaL_Buffer *b, const ProfEntry *e,
+                      const ProfEntry *caller) {
+  const char *name = NULL;
+  if (caller != NULL && caller->kind == PROF_LUA &&
+      luaG_callname(L, caller->u.p, caller->pc, &name) == NULL)
+    name = NULL;
+  if (e->kind == PROF_LUA) {
+    const Proto *p = e->u.p;
+    char src[LUA_IDSIZE];
+    char line[32];
+    if (p->source)
+      luaO_chunkid(src, getstr(p->source), tsslen(p->source));
+    else
+      strcpy(src, "?");
+    if (p->linedefined == 0) {
+      luaL_addstring(b, "main chunk (");
+      addclean(b, src);
+      luaL_addchar(b, ')');
+    }
+    else {
+      addclean(b, name ? name : "function");
+      luaL_addstring(b, " (");
+      addclean(b, src);
+      snprintf(line, sizeof(line), ":%d)", p->linedefined);
+      luaL_addstring(b, line);
+    }
+  }
+  else {
+    addclean(b, name ? name : "?");
+    luaL_addstring(b, " [C]");
+  }
+}
+
+
+/* t[key] = t[key] + 1, for the key on the top (which is popped) */
+static void bump (lua_State *L, int t) {
+  lua_Integer n;
+  lua_pushvalue(L, -1);
+  lua_rawget(L, t);
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  lua_pushinteger(L, n + 1);
+  lua_rawset(L, t);
+}
+
+
+/*
+** Moves the samples in the ring into the tables of the profiler at
+** 'ud'. 'tail' only moves at the end, so the collector keeps every
+** prototype in use here alive.
+*/
+static void drain (lua_State *L, int ud) {
+  ProfState *ps = (ProfState *)lua_touserdata(L, ud);
+  Profiler *pf = &ps->pf;
+  unsigned int mask = pf->size - 1;
+  unsigned int tail = atomic_load_explicit(&pf->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&pf->head, memory_order_acquire);
+  int folded, lines;
+  luaL_Buffer b;
+  if (tail == head)
+    return;
+  lua_getiuservalue(L, ud, 1);
+  folded = lua_gettop(L);
+  lua_getiuservalue(L, ud, 2);
+  lines = lua_gettop(L);
+  luaL_buffinit(L, &b);  /* 'luaL_pushresult' leaves it ready for reuse */
+  while (tail != head) {
+    const ProfEntry *h = &pf->ring[tail & mask];
+    int n = h->pc;
+    int k;
+    if (h->flags & PROF_COROUTINE)
+      luaL_addstring(&b, "(coroutine);");
+    for (k = n - 1; k >= 0; k--) {  /* outermost frame first */
+      const ProfEntry *e = &pf->ring[(tail + 1 + k) & mask];
+      const ProfEntry *caller = (k + 1 < n)
+                              ? &pf->ring[(tail + 2 + k) & mask] : NULL;
+      addlabel(L, &b, e, caller);
+      if (k > 0) luaL_addchar(&b, ';');
+    }
+    luaL_pushresult(&b);
+    bump(L, folded);
+    for (k = 0; k < n; k++) {  /* line of the innermost Lua frame */
+      const ProfEntry *e = &pf->ring[(tail + 1 + k) & mask];
+      if (e->kind == PROF_LUA) {
+        const Proto *p = e->u.p;
+        char src[LUA_IDSIZE];
+        if (p->source)
+          luaO_chunkid(src, getstr(p->source), tsslen(p->source));
+        else
+          strcpy(src, "?");
+        lua_pushfstring(L, "%s:%d", src, luaG_getfuncline(p, e->pc));
+        bump(L, lines);
+        break;
+      }
+    }
+    tail += n + 1;
+  }
+  lua_settop(L, folded - 1);
+  atomic_store_explicit(&pf->tail, tail, memory_order_release);
+}
+
+
+/* flush function of the core: drains the ring from inside the VM */
+static void flushhook (lua_State *L, lua_Debug *ar) {
+  (void)ar;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY) == LUA_TUSERDATA)
+    drain(L, lua_gettop(L));
+  lua_pop(L, 1);
+}
+
+
+/* get the current profiler (drained), or NULL */
+static ProfState *getprof (lua_State *L) {
+  ProfState *ps;
+  lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY);
+  ps = (ProfState *)luaL_testudata(L, -1, PROFMT);
+  if (ps != NULL)
+    drain(L, lua_gettop(L));
+  else
+    lua_pop(L, 1);
+  return ps;  /* userdata (if any) stays on the stack */
+}
+
+
+static int optfield (lua_State *L, const char *k, int def) {
+  int n = def;
+  if (lua_getfield(L, 1, k) != LUA_TNIL) {
+    lua_Integer v = luaL_checkinteger(L, -1);
+    n = (v < 1) ? 1 : (v > 1000000) ? 1000000 : (int)v;
+  }
+  lua_pop(L, 1);
+  return n;
+}
+
+
+/*
+** profiler.start([opts]): opts.hz (default 1000), opts.mode ("thread"
+** or, on POSIX systems, "signal"), opts.depth (frames per sample, default 128) and
+** opts.buffer (ring entries, default 32768).
+*/
+static int prof_start (lua_State *L) {
+  static const char *const modes[] = {"signal", "thread", NULL};
+  int hz = 1000, depth = 128, buffer = 1 << 15, mode = DEFAULTMODE;
+  unsigned int size = 256;
+  ProfState *ps;
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    hz = optfield(L, "hz", hz);
+    depth = optfield(L, "depth", depth);
+    buffer = optfield(L, "buffer", buffer);
+    if (lua_getfield(L, 1, "mode") != LUA_TNIL)
+      mode = luaL_checkoption(L, -1, NULL, modes);
+    lua_pop(L, 1);
+  }
+#if !defined(LUA_USE_POSIX)
+  if (mode == MODE_SIGNAL)
+    return luaL_error(L, "signal sampling not supported on this platform");
+#endif
+  if (G(L)->profiler != NULL)
+    return luaL_error(L, "profiler already running");
+  while (size < (unsigned int)buffer && size < (1u << 24))
+    size <<= 1;
+  if (size < (unsigned int)depth + 1)
+    depth = (int)size - 1;
+  ps = (ProfState *)lua_newuserdatauv(L,
+         offsetof(ProfState, ring) + size * sizeof(ProfEntry), 2);
+  memset(ps, 0, offsetof(ProfState, ring));
+  ps->pf.ring = ps->ring;
+  ps->pf.size = size;
+  atomic_init(&ps->pf.head, 0);
+  atomic_init(&ps->pf.tail, 0);
+  atomic_init(&ps->pf.nsamples, 0);
+  atomic_init(&ps->pf.ndropped, 0);
+  ps->pf.maxdepth = depth;
+  ps->pf.flush = flushhook;
+  ps->g = G(L);
+  ps->mode = mode;
+  ps->hz = hz;
+  luaL_setmetatable(L, PROFMT);
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 1);
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 2);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, PROFKEY);
+  lua_lock(L);
+  G(L)->profiler = &ps->pf;
+  lua_unlock(L);
+  ps->active = 1;
+  if (!starttimer(ps)) {
+    ps->active = 0;
+    detach(L, ps);
+    return luaL_error(L, "cannot start sampling timer");
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+/* profiler.stop(): stops sampling; returns the number of samples */
+static int prof_stop (lua_State *L) {
+  ProfState *ps = getprof(L);
+  if (ps == NULL)
+    return 0;
+  if (ps->active) {
+    stoptimer(ps);
+    ps->active = 0;
+    drain(L, lua_gettop(L));  /* samples taken while stopping */
+    detach(L, ps);
+  }
+  lua_pushinteger(L, l_castU2S(atomic_load(&ps->pf.nsamples)));
+  return 1;
+}
+
+
+static int prof_running (lua_State *L) {
+  lua_pushboolean(L, G(L)->profiler != NULL);
+  return 1;
+}
+
+
+/*
+** profiler.folded(): the samples as folded stacks ("a;b;c count" per
+** line), the input format of flamegraph tools.
+*/
+static int prof_folded (lua_State *L) {
+  luaL_Buffer b;
+  int ud, i, n = 0;
+  if (getprof(L) == NULL) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  ud = lua_gettop(L);
+  lua_getiuservalue(L, ud, 1);
+  lua_newtable(L);  /* lines of the result */
+  lua_pushnil(L);
+  while (lua_next(L, ud + 1)) {
+    lua_pushfstring(L, "%s %I\n", lua_tostring(L, -2),
+                       (LUAI_UACINT)lua_tointeger(L, -1));
+    lua_rawseti(L, ud + 2, ++n);
+    lua_pop(L, 1);
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, ud + 2, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+
+/* profiler.lines(): table "source:line" -> hits (innermost Lua frame) */
+static int prof_lines (lua_State *L) {
+  if (getprof(L) == NULL) {
+    lua_newtable(L);
+    return 1;
+  }
+  lua_getiuservalue(L, -1, 2);
+  return 1;
+}
+
+
+static int prof_stats (lua_State *L) {
+  ProfState *ps = getprof(L);
+  lua_createtable(L, 0, 4);
+  if (ps != NULL) {
+    lua_pushinteger(L, l_castU2S(atomic_load(&ps->pf.nsamples)));
+    lua_setfield(L, -2, "samples");
+    lua_pushinteger(L, l_castU2S(atomic_load(&ps->pf.ndropped)));
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, ps->hz);
+    lua_setfield(L, -2, "hz");
+    lua_pushstring(L, ps->mode == MODE_SIGNAL ? "signal" : "thread");
+    lua_setfield(L, -2, "mode");
+  }
+  return 1;
+}
+
+
+/* profiler.reset(): discards collected samples */
+static int prof_reset (lua_State *L) {
+  ProfState *ps = getprof(L);
+  if (ps != NULL) {
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 2);
+    atomic_store(&ps->pf.nsamples, 0);
+    atomic_store(&ps->pf.ndropped, 0);
+  }
+  return 0;
+}
+
+
+static int prof_gc (lua_State *L) {
+  ProfState *ps = (ProfState *)luaL_checkudata(L, 1, PROFMT);
+  if (ps->active) {  /* state closing while sampling */
+    stoptimer(ps);
+    ps->active = 0;
+    detach(L, ps);
+  }
+  return 0;
+}
+
+
+static const luaL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"running", prof_running},
+  {"folded", prof_folded},
+  {"lines", prof_lines},
+  {"stats", prof_stats},
+  {"reset", prof_reset},
+  {NULL, NULL}
+};
+
+
+/**
+ * @brief Registers the profiler library.
+ *
+ * @param L The Lua state.
+ * @return 1 (the library table).
+ */
+int luaopen_profiler (lua_State *L) {
+  luaL_newlib(L, prof_funcs);
+  if (luaL_newmetatable(L, PROFMT)) {
+    lua_pushcfunction(L, prof_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);
+  return 1;
+}
+
+/* }====================================================== */
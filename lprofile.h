@@ -0,0 +1,61 @@
+/*
+** $Id: lprofile.h $
+** Sampling profiler
+*/
+
+#ifndef lprofile_h
+#define lprofile_h
+
+#include "lua.h"
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* kinds of ring entries */
+#define PROF_HEAD	0	/* start of a sample; 'pc' = number of frames */
+#define PROF_LUA	1	/* Lua frame: 'u.p' and 'pc' */
+#define PROF_C		2	/* C frame: 'u.f' (NULL if unknown) */
+
+/* flags of a PROF_HEAD entry */
+#define PROF_COROUTINE	1	/* sample taken inside a coroutine */
+
+
+/**
+ * @brief One slot of the sample ring. A sample is a PROF_HEAD entry
+ * followed by its frames, innermost first.
+ */
+typedef struct ProfEntry {
+  union {
+    Proto *p;  /**< Function prototype (PROF_LUA). */
+    lua_CFunction f;  /**< C function (PROF_C). */
+  } u;
+  int pc;  /**< Current pc (PROF_LUA) or number of frames (PROF_HEAD). */
+  lu_byte kind;  /**< PROF_HEAD, PROF_LUA or PROF_C. */
+  lu_byte flags;  /**< PROF_COROUTINE (PROF_HEAD only). */
+} ProfEntry;
+
+
+/**
+ * @brief State of the sampling profiler.
+ *
+ * The ring is single-producer/single-consumer: the VM writes samples
+ * (always holding the state lock) and only moves 'head'; the reader
+ * only moves 'tail'. The collector keeps alive the prototypes of samples
+ * still in the ring.
+ */
+typedef struct Profiler {
+  ProfEntry *ring;  /**< Sample ring ('size' entries). */
+  unsigned int size;  /**< Ring size (a power of 2). */
+  _Atomic unsigned int head;  /**< Next slot to write (producer). */
+  _Atomic unsigned int tail;  /**< Next slot to read (consumer). */
+  _Atomic unsigned long nsamples;  /**< Samples written to the ring. */
+  _Atomic unsigned long ndropped;  /**< Samples lost because the ring was full. */
+  int maxdepth;  /**< Maximum number of frames kept per sample. */
+  lua_Hook flush;  /**< Drains the ring; run as a hook when it is half full. */
+} Profiler;
+
+
+LUAI_FUNC void luaR_request (global_State *g);
+LUAI_FUNC void luaR_sample (lua_State *L, const Instruction *pc, int canflush);
+
+#endif
@@ -0,0 +1,515 @@
+/*
+** $Id: lslice.c $
+** Slices and copy-on-write slice views
+** See Copyright Notice in lua.h
+*/
+
+#define lslice_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldebug.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lslice.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** The slice syntax always gives a new table. A view ('table.view',
+** 'lua_sliceview') is a full userdata whose single user value is the
+** source table. Element 'k' of
+** the view is 'source[first + (k - 1) * step]', so creating a view costs
+** the same for any length. The first write to the view, or the first
+** write to the source while the view is alive, replaces the user value
+** with a private copy ("materializes" the view); from then on the view
+** behaves like the table the slice used to return.
+**
+** A source with live views has its 'viewed' flag set. Every store into
+** a table checks that flag (luaSL_checkviews) and, when it is set, copies
+** out all views of the table before the store happens. The views of each
+** source are kept in 'g->sliceviews', a weak-keyed table mapping the
+** source to a weak-keyed set of its views, so neither side keeps the
+** other alive.
+*/
+
+typedef struct SliceView {
+  lua_Integer first;  /**< Source index of element 1. */
+  lua_Integer step;  /**< Distance between elements in the source. */
+  lua_Integer len;  /**< Number of elements. */
+  int own;  /**< User value is a private copy, not the source. */
+} SliceView;
+
+
+#define viewof(u)	((SliceView *)getudatamem(u))
+#define viewsrc(u)	(&(u)->uv[0].uv)
+
+
+/*
+** {======================================================
+** Bounds
+** =======================================================
+*/
+
+static lua_Integer sliceindex (lua_State *L, const TValue *o,
+                               lua_Integer def, const char *what) {
+  lua_Integer n;
+  if (ttisnil(o))
+    return def;
+  else if (ttisinteger(o))
+    return ivalue(o);
+  else if (ttisfloat(o)) {
+    if (!luaV_flttointeger(fltvalue(o), &n, F2Ieq))
+      luaG_runerror(L, "slice %s must be integer", what);
+    return n;
+  }
+  luaG_runerror(L, "slice %s must be integer or nil", what);
+  return 0;  /* not reached */
+}
+
+
+/*
+** Read the bounds 'oi:oj:ost' of a slice. A reversed slice runs from the
+** end by default.
+*/
+static void getbounds (lua_State *L, const TValue *oi, const TValue *oj,
+                       const TValue *ost, lua_Integer *i, lua_Integer *j,
+                       lua_Integer *st) {
+  *st = sliceindex(L, ost, 1, "step");
+  *i = sliceindex(L, oi, (*st > 0) ? 1 : -1, "start index");
+  *j = sliceindex(L, oj, (*st > 0) ? -1 : 1, "end index");
+}
+
+
+/*
+** Resolve the bounds 'i:j:st' of a slice of a sequence with 'len'
+** elements. Returns how many elements the slice selects; the first of
+** them goes to '*first'. Both ends are inclusive and negative indices
+** count from the end.
+*/
+static lua_Integer slicerange (lua_State *L, lua_Integer len, lua_Integer i,
+                               lua_Integer j, lua_Integer st,
+                               lua_Integer *first) {
+  if (st == 0)
+    luaG_runerror(L, "slice step cannot be 0");
+  if (i < 0) i = intop(+, len + 1, i);
+  if (j < 0) j = intop(+, len + 1, j);
+  *first = i;
+  if (st > 0) {
+    if (i < 1) *first = i = 1;
+    if (j > len) j = len;
+    if (i > j) return 0;
+    return l_castU2S((l_castS2U(j) - l_castS2U(i)) / l_castS2U(st)) + 1;
+  }
+  else {
+    if (i > len) *first = i = len;
+    if (j < 1) j = 1;
+    if (i < j) return 0;
+    return l_castU2S((l_castS2U(i) - l_castS2U(j)) / (0u - l_castS2U(st))) + 1;
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Views
+** =======================================================
+*/
+
+static int view_index (lua_State *L) {
+  lua_settop(L, 2);
+  lua_gettable(L, 1);  /* served by 'luaSL_get' */
+  return 1;
+}
+
+
+static int view_newindex (lua_State *L) {
+  lua_settop(L, 3);
+  lua_settable(L, 1);  /* served by 'luaSL_set' */
+  return 0;
+}
+
+
+static int view_len (lua_State *L) {
+  SliceView *v = (SliceView *)lua_touserdata(L, 1);
+  if (v->own) {
+    lua_getiuservalue(L, 1, 1);
+    lua_pushinteger(L, l_castU2S(lua_rawlen(L, -1)));
+  }
+  else
+    lua_pushinteger(L, v->len);
+  return 1;
+}
+
+
+static int view_next (lua_State *L) {
+  SliceView *v = (SliceView *)lua_touserdata(L, 1);
+  lua_settop(L, 2);
+  lua_getiuservalue(L, 1, 1);
+  if (v->own) {  /* iterate the copy */
+    lua_pushvalue(L, 2);
+    if (lua_next(L, 3))
+      return 2;
+  }
+  else {
+    lua_Integer k = lua_isnil(L, 2) ? 0 : lua_tointeger(L, 2);
+    while (++k <= v->len) {
+      if (lua_rawgeti(L, 3, v->first + (k - 1) * v->step) != LUA_TNIL) {
+        lua_pushinteger(L, k);
+        lua_insert(L, -2);
+        return 2;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+
+static int view_pairs (lua_State *L) {
+  lua_pushcfunction(L, view_next);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+
+static void setcfield (lua_State *L, Table *t, TString *key,
+                       lua_CFunction f) {
+  TValue k, v;
+  setsvalue(L, &k, key);
+  setfvalue(&v, f);
+  luaH_set(L, t, &k, &v);
+}
+
+
+/*
+** Metatable shared by all views. Its node vector is allocated before
+** the keys are created, so none of the stores below can trigger a
+** collection while a key is unanchored.
+*/
+static GCObject *viewmeta (lua_State *L) {
+  global_State *g = G(L);
+  if (g->slicemt == NULL) {
+    Table *mt = luaH_new(L);
+    TValue k, v;
+    g->slicemt = mt;  /* the collector marks it from now on */
+    luaH_resize(L, mt, 0, 8);
+    setcfield(L, mt, g->tmname[TM_INDEX], view_index);
+    setcfield(L, mt, g->tmname[TM_NEWINDEX], view_newindex);
+    setcfield(L, mt, g->tmname[TM_LEN], view_len);
+    setcfield(L, mt, luaS_newliteral(L, "__pairs"), view_pairs);
+    setsvalue(L, &k, luaS_newliteral(L, "__name"));
+    setbtvalue(&v);
+    luaH_set(L, mt, &k, &v);  /* anchor the key first */
+    setsvalue(L, &v, luaS_newliteral(L, "slice"));
+    luaH_set(L, mt, &k, &v);
+    invalidateTMcache(mt);
+  }
+  return obj2gco(g->slicemt);
+}
+
+
+/*
+** New table with weak keys, anchored at the top of the stack. All of
+** them share the metatable of 'g->sliceviews'.
+*/
+static Table *newweak (lua_State *L) {
+  global_State *g = G(L);
+  Table *t = luaH_new(L);
+  sethvalue2s(L, L->top.p, t);
+  L->top.p++;  /* assume EXTRA_STACK */
+  if (g->sliceviews != NULL)
+    t->metatable = g->sliceviews->metatable;
+  else {
+    Table *mt = luaH_new(L);
+    TValue k, v;
+    t->metatable = obj2gco(mt);  /* anchors 'mt' */
+    luaH_resize(L, mt, 0, 1);
+    setsvalue(L, &k, g->tmname[TM_MODE]);
+    setsvalue(L, &v, luaS_newliteral(L, "k"));
+    luaH_set(L, mt, &k, &v);
+    invalidateTMcache(mt);
+  }
+  return t;
+}
+
+/* }====================================================== */
+
+
+/*
+** Replace the source of view 'u' with a copy of the elements it shows.
+** 'lock' tells whether the source still has to be locked for reading
+** (it is already locked when the copy happens on behalf of a store
+** into the source).
+*/
+static void materialize (lua_State *L, Udata *u, int lock) {
+  SliceView *v = viewof(u);
+  Table *src = hvalue(viewsrc(u));
+  Table *copy = luaH_new(L);
+  lua_Integer k;
+  sethvalue2s(L, L->top.p, copy);
+  L->top.p++;  /* assume EXTRA_STACK */
+  if (v->len > 0)
+    luaH_resize(L, copy, cast_uint(v->len), 0);
+  if (lock && src->is_shared) l_rwlock_rdlock(&src->lock);
+  for (k = 0; k < v->len; k++) {
+    const TValue *o = luaH_getint(src, v->first + k * v->step);
+    if (!isempty(o)) {
+      setobj2t(L, &copy->array[k], o);
+      luaC_barrierback(L, obj2gco(copy), o);
+    }
+  }
+  if (lock && src->is_shared) l_rwlock_unlock(&src->lock);
+  sethvalue(L, viewsrc(u), copy);
+  luaC_objbarrier(L, u, copy);
+  v->own = 1;
+  L->top.p--;
+}
+
+
+/*
+** Record 'u' as a view of 't'. The set of views of 't' is created on
+** the first view.
+*/
+static void addview (lua_State *L, Table *t, Udata *u) {
+  global_State *g = G(L);
+  Table *views;
+  const TValue *slot;
+  TValue k, v;
+  if (g->sliceviews == NULL) {
+    g->sliceviews = newweak(L);
+    L->top.p--;  /* 'g' anchors it now */
+  }
+  sethvalue(L, &k, t);
+  slot = luaH_get(g->sliceviews, &k);
+  if (!isempty(slot))
+    views = hvalue(slot);
+  else {
+    views = newweak(L);
+    sethvalue(L, &v, views);
+    luaH_set(L, g->sliceviews, &k, &v);
+    luaC_barrierback(L, obj2gco(g->sliceviews), &v);
+    L->top.p--;
+  }
+  setuvalue(L, &k, u);
+  setbtvalue(&v);
+  luaH_set(L, views, &k, &v);
+  luaC_barrierback(L, obj2gco(views), &k);
+  t->viewed = 1;
+}
+
+
+/*
+** Put in 'ra' a new table (or, if 'view', a view) with the 'n' elements
+** 't[first]', 't[first + step]', ... Trailing nils are left out, so that
+** the length of a view is the border its copy will have.
+*/
+static void slicetable (lua_State *L, StkId ra, Table *t, lua_Integer first,
+                        lua_Integer step, lua_Integer n, int view) {
+  while (n > 0 && isempty(luaH_getint(t, first + (n - 1) * step)))
+    n--;
+  if (n <= 1)
+    step = 1;  /* avoid overflows computing unused positions */
+  if (!view) {
+    Table *res = luaH_new(L);
+    lua_Integer k;
+    sethvalue2s(L, L->top.p, res);
+    L->top.p++;  /* assume EXTRA_STACK; 'ra' may still hold the source */
+    if (n > 0)
+      luaH_resize(L, res, cast_uint(n), 0);
+    for (k = 0; k < n; k++) {
+      const TValue *o = luaH_getint(t, first + k * step);
+      if (!isempty(o)) {
+        setobj2t(L, &res->array[k], o);
+        luaC_barrierback(L, obj2gco(res), o);
+      }
+    }
+  }
+  else {
+    Udata *u = luaS_newudata(L, sizeof(SliceView), 1);
+    SliceView *v = viewof(u);
+    setuvalue(L, s2v(L->top.p), u);
+    L->top.p++;  /* assume EXTRA_STACK */
+    v->first = first;
+    v->step = step;
+    v->len = n;
+    v->own = 0;
+    sethvalue(L, viewsrc(u), t);
+    u->metatable = viewmeta(L);
+    addview(L, t, u);
+  }
+  setobj2s(L, ra, s2v(L->top.p - 1));
+  L->top.p--;
+}
+
+
+/*
+** Put in 'ra' the slice 'i:j:st' of table or view 'o', as a new table or
+** (if 'view') as a view. A slice of a view composes with it.
+*/
+static void slice (lua_State *L, StkId ra, const TValue *o, lua_Integer i,
+                   lua_Integer j, lua_Integer st, int view) {
+  lua_Integer first, n;
+  if (ttistable(o)) {
+    Table *t = hvalue(o);
+    n = slicerange(L, l_castU2S(luaH_getn(t)), i, j, st, &first);
+    slicetable(L, ra, t, first, st, n, view);
+  }
+  else if (ttisfulluserdata(o) && luaSL_isview(L, uvalue(o))) {
+    Udata *u = uvalue(o);
+    SliceView *v = viewof(u);
+    if (v->own) {  /* slice its copy */
+      Table *t = hvalue(viewsrc(u));
+      n = slicerange(L, l_castU2S(luaH_getn(t)), i, j, st, &first);
+      slicetable(L, ra, t, first, st, n, view);
+    }
+    else {  /* compose with the view */
+      n = slicerange(L, v->len, i, j, st, &first);
+      if (n > 0)
+        first = v->first + (first - 1) * v->step;
+      slicetable(L, ra, hvalue(viewsrc(u)), first,
+                 (n > 1) ? st * v->step : 1, n, view);
+    }
+  }
+  else
+    luaG_typeerror(L, o, "slice");
+}
+
+/* }====================================================== */
+
+
+static void slicestring (lua_State *L, StkId ra, const TValue *rb,
+                         lua_Integer i, lua_Integer j, lua_Integer st) {
+  TString *ts = tsvalue(rb);
+  const char *s = getstr(ts);
+  lua_Integer first, step = st;
+  lua_Integer n = slicerange(L, l_castU2S(tsslen(ts)), i, j, st, &first);
+  TString *res;
+  if (n == l_castU2S(tsslen(ts)) && step == 1)
+    res = ts;  /* the whole string */
+  else if (n == 0)
+    res = luaS_newliteral(L, "");
+  else if (step == 1)
+    res = luaS_newlstr(L, s + first - 1, cast_sizet(n));
+  else {
+    char buff[LUAI_MAXSHORTLEN];
+    char *p = buff;
+    lua_Integer k;
+    if (n > LUAI_MAXSHORTLEN) {
+      res = luaS_createlngstrobj(L, cast_sizet(n));
+      p = res->contents;
+    }
+    for (k = 0; k < n; k++)
+      p[k] = s[first - 1 + k * step];
+    if (p == buff)
+      res = luaS_newlstr(L, buff, cast_sizet(n));
+  }
+  setsvalue2s(L, ra, res);
+}
+
+
+/*
+** R[A] := R[B][R[B+1]:R[B+2]:R[B+3]] ('rb' is R[B]). Tables and views
+** give a new table and strings give a string.
+*/
+void luaSL_slice (lua_State *L, StkId ra, const TValue *rb) {
+  lua_Integer i, j, st;
+  getbounds(L, rb + 1, rb + 2, rb + 3, &i, &j, &st);
+  if (ttisstring(rb))
+    slicestring(L, ra, rb, i, j, st);
+  else
+    slice(L, ra, rb, i, j, st, 0);
+}
+
+
+/*
+** Put in 'ra' a view of the slice 'oi:oj:ost' of table or view 'o'.
+*/
+void luaSL_view (lua_State *L, StkId ra, const TValue *o, const TValue *oi,
+                 const TValue *oj, const TValue *ost) {
+  lua_Integer i, j, st;
+  getbounds(L, oi, oj, ost, &i, &j, &st);
+  slice(L, ra, o, i, j, st, 1);
+}
+
+
+/*
+** Copy out every view of 't'; called before a store into 't'.
+*/
+void luaSL_detach (lua_State *L, Table *t) {
+  global_State *g = G(L);
+  t->viewed = 0;
+  if (g->sliceviews != NULL) {
+    TValue k;
+    const TValue *slot;
+    sethvalue(L, &k, t);
+    slot = luaH_get(g->sliceviews, &k);
+    if (!isempty(slot)) {
+      Table *views = hvalue(slot);
+      unsigned int i;
+      for (i = 0; i < cast_uint(sizenode(views)); i++) {
+        Node *n = gnode(views, i);
+        if (!isempty(gval(n)) && keytt(n) == ctb(LUA_VUSERDATA)) {
+          Udata *u = gco2u(keyval(n).gc);
+          if (!viewof(u)->own)
+            materialize(L, u, 0);
+        }
+      }
+      slot = luaH_get(g->sliceviews, &k);
+      setnilvalue(cast(TValue *, slot));
+    }
+  }
+}
+
+
+void luaSL_get (lua_State *L, Udata *u, const TValue *key, StkId val) {
+  SliceView *v = viewof(u);
+  Table *h = hvalue(viewsrc(u));
+  const TValue *res;
+  if (h->is_shared) l_rwlock_rdlock(&h->lock);
+  if (v->own)
+    res = luaH_get(h, key);
+  else {
+    lua_Integer k;
+    if (ttisinteger(key))
+      k = ivalue(key);
+    else if (!(ttisfloat(key) &&
+               luaV_flttointeger(fltvalue(key), &k, F2Ieq)))
+      k = 0;
+    if (l_castS2U(k) - 1u < l_castS2U(v->len))
+      res = luaH_getint(h, v->first + (k - 1) * v->step);
+    else
+      res = NULL;
+  }
+  if (res == NULL || isempty(res))
+    setnilvalue(s2v(val));
+  else
+    setobj2s(L, val, res);
+  if (h->is_shared) l_rwlock_unlock(&h->lock);
+}
+
+
+void luaSL_set (lua_State *L, Udata *u, const TValue *key, TValue *val) {
+  Table *h;
+  if (!viewof(u)->own)
+    materialize(L, u, 1);
+  h = hvalue(viewsrc(u));
+  if (h->is_shared) l_rwlock_wrlock(&h->lock);
+  luaH_set(L, h, key, val);
+  invalidateTMcache(h);
+  luaC_barrierback(L, obj2gco(h), val);
+  if (h->is_shared) l_rwlock_unlock(&h->lock);
+}
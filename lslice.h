@@ -0,0 +1,31 @@
+/*
+** $Id: lslice.h $
+** Slices and copy-on-write slice views
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lslice_h
+#define lslice_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/* is 'u' a slice view? */
+#define luaSL_isview(L,u) \
+	((u)->metatable != NULL && (u)->metatable == cast(GCObject *, G(L)->slicemt))
+
+/* copy out the views of 't' before it is modified */
+#define luaSL_checkviews(L,t) \
+	{ if (l_unlikely((t)->viewed)) luaSL_detach(L, t); }
+
+
+LUAI_FUNC void luaSL_slice (lua_State *L, StkId ra, const TValue *rb);
+LUAI_FUNC void luaSL_view (lua_State *L, StkId ra, const TValue *o,
+                           const TValue *oi, const TValue *oj,
+                           const TValue *ost);
+LUAI_FUNC void luaSL_detach (lua_State *L, Table *t);
+LUAI_FUNC void luaSL_get (lua_State *L, Udata *u, const TValue *key, StkId val);
+LUAI_FUNC void luaSL_set (lua_State *L, Udata *u, const TValue *key, TValue *val);
+
+#endif
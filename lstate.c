@@ -203,23 +203,19 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 
 
 /**
- * @brief Initializes the stack for a new thread.
+ * @brief Clears the (already allocated) stack of a thread and sets its first CallInfo.
  *
- * @param L1 The new thread.
- * @param L The existing thread (used for memory allocation).
+ * @param L1 The thread.
  */
-static void stack_init (lua_State *L1, lua_State *L) {
+static void stack_reset (lua_State *L1) {
   int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
   L1->tbclist.p = L1->stack.p;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
-    setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
+  for (i = 0; i < stacksize(L1) + EXTRA_STACK; i++)
+    setnilvalue(s2v(L1->stack.p + i));  /* erase stack */
   L1->top.p = L1->stack.p;
-  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
-  /* initialize first ci */
+  /* initialize first ci (keeping the list after it) */
   ci = &L1->base_ci;
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = CIST_C;
   ci->func.p = L1->top.p;
   ci->u.c.k = NULL;
@@ -231,6 +227,21 @@ static void stack_init (lua_State *L1, lua_State *L) {
 }
 
 
+/**
+ * @brief Initializes the stack for a new thread.
+ *
+ * @param L1 The new thread.
+ * @param L The existing thread (used for memory allocation).
+ */
+static void stack_init (lua_State *L1, lua_State *L) {
+  /* initialize stack array */
+  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+  L1->base_ci.next = NULL;
+  stack_reset(L1);
+}
+
+
 /**
  * @brief Frees the stack of a thread.
  *
@@ -318,6 +329,8 @@ static void preinit_thread (lua_State *L, global_State *g) {
  */
 static void close_state (lua_State *L) {
   global_State *g = G(L);
+  luaM_setbgfree(L, 0);  /* free everything from here on */
+  g->maxthreadpool = 0;  /* do not keep dead threads either */
   if (!completestate(g))  /* closing a partially built state? */
     luaC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -329,6 +342,8 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaM_freearray(L, g->bigbuff, g->sizebigbuff);
+  luaE_freethreadpool(L);
   luaM_poolshutdown(L);  /* shutdown memory pool */
   l_mutex_destroy(&g->lock);
   freestack(L);
@@ -337,6 +352,134 @@ static void close_state (lua_State *L) {
 }
 
 
+/**
+ * @brief Takes a thread from the pool of dead threads, if there is one.
+ *
+ * The thread goes back into 'allgc' with its stack and CallInfo list as
+ * they were left by 'poolthread'.
+ *
+ * @param L The Lua state.
+ * @return The thread, or NULL if the pool is empty.
+ */
+static lua_State *reusethread (lua_State *L) {
+  global_State *g = G(L);
+  lua_State *L1;
+  l_mutex_lock(&g->lock);
+  L1 = g->threadpool;
+  if (L1 != NULL) {
+    g->threadpool = L1->twups;  /* pooled threads are chained by 'twups' */
+    g->nthreadpool--;
+    if (g->nthreadpool < g->lowthreadpool)
+      g->lowthreadpool = g->nthreadpool;
+    L1->marked = luaC_white(g);
+    L1->next = g->allgc;
+    g->allgc = obj2gco(L1);
+  }
+  l_mutex_unlock(&g->lock);
+  return L1;
+}
+
+
+/**
+ * @brief Keeps a dead thread for reuse instead of freeing it.
+ *
+ * Only threads whose stack stayed small are kept; their CallInfo lists
+ * are trimmed with 'luaE_shrinkCI'. The memory stays counted as in use.
+ *
+ * @param L The Lua state.
+ * @param L1 The dead thread (its upvalues already closed).
+ * @return 1 if the thread was pooled, 0 if it must be freed.
+ */
+static int poolthread (lua_State *L, lua_State *L1) {
+  global_State *g = G(L);
+  int pooled = 0;
+  if (L1->stack.p == NULL || stacksize(L1) > LUAI_MAXPOOLSTACK)
+    return 0;
+  l_mutex_lock(&g->lock);
+  if (g->nthreadpool < g->maxthreadpool) {
+    L1->ci = &L1->base_ci;
+    luaE_shrinkCI(L1);
+    L1->twups = g->threadpool;
+    g->threadpool = L1;
+    g->nthreadpool++;
+    pooled = 1;
+  }
+  l_mutex_unlock(&g->lock);
+  return pooled;
+}
+
+
+/**
+ * @brief Frees pooled threads until at most 'n' are left.
+ *
+ * @param L The Lua state.
+ * @param n Number of threads to keep.
+ */
+static void trimthreadpool (lua_State *L, int n) {
+  global_State *g = G(L);
+  l_mutex_lock(&g->lock);
+  while (g->nthreadpool > n) {
+    lua_State *L1 = g->threadpool;
+    g->threadpool = L1->twups;
+    g->nthreadpool--;
+    freestack(L1);
+    luaM_free(L, fromstate(L1));
+  }
+  if (g->lowthreadpool > n)
+    g->lowthreadpool = n;
+  l_mutex_unlock(&g->lock);
+}
+
+
+/**
+ * @brief Frees all threads kept for reuse (done by full and emergency collections).
+ *
+ * @param L The Lua state.
+ */
+void luaE_freethreadpool (lua_State *L) {
+  trimthreadpool(L, 0);
+}
+
+
+/**
+ * @brief Frees the pooled threads that were not needed since the last trim.
+ *
+ * Called at the end of each incremental cycle. 'lowthreadpool' is the
+ * smallest size the pool had during the cycle; that many threads were
+ * never taken, so a steady coroutine workload keeps its pool while an
+ * unused one drains in one cycle.
+ *
+ * @param L The Lua state.
+ */
+void luaE_trimthreadpool (lua_State *L) {
+  global_State *g = G(L);
+  l_mutex_lock(&g->lock);
+  trimthreadpool(L, g->nthreadpool - g->lowthreadpool);
+  g->lowthreadpool = g->nthreadpool;
+  l_mutex_unlock(&g->lock);
+}
+
+
+/**
+ * @brief Sets the maximum number of dead threads kept for reuse.
+ *
+ * Threads over the new limit are freed at once.
+ *
+ * @param L The Lua state.
+ * @param limit The new limit (0 disables the pool; negative keeps the current one).
+ * @return The previous limit.
+ */
+int luaE_setthreadpool (lua_State *L, int limit) {
+  global_State *g = G(L);
+  int old = g->maxthreadpool;
+  if (limit >= 0) {
+    g->maxthreadpool = limit;
+    trimthreadpool(L, limit);
+  }
+  return old;
+}
+
+
 /**
  * @brief Creates a new thread (coroutine).
  *
@@ -347,15 +490,29 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   global_State *g = G(L);
   GCObject *o;
   lua_State *L1;
+  int reused;
   lua_lock(L);
   luaC_checkGC(L);
-  /* create new thread */
-  o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
-  L1 = gco2th(o);
+  L1 = reusethread(L);
+  reused = (L1 != NULL);
+  if (!reused) {  /* create new thread */
+    o = luaC_newobjdt(L, LUA_TTHREAD, sizeof(LX), offsetof(LX, l));
+    L1 = gco2th(o);
+  }
   /* anchor it on L stack */
   setthvalue2s(L, L->top.p, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
+  if (reused) {  /* keep its stack and CallInfo list */
+    StkId stack = L1->stack.p;
+    StkId last = L1->stack_last.p;
+    unsigned short nci = L1->nci;
+    preinit_thread(L1, g);
+    L1->stack.p = stack;
+    L1->stack_last.p = last;
+    L1->nci = nci;
+  }
+  else
+    preinit_thread(L1, g);
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
@@ -364,7 +521,10 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (reused)
+    stack_reset(L1);  /* reuse old stack */
+  else
+    stack_init(L1, L);  /* init stack */
   lua_unlock(L);
   return L1;
 }
@@ -381,6 +541,8 @@ void luaE_freethread (lua_State *L, lua_State *L1) {
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
+  if (poolthread(L, L1))
+    return;  /* kept for 'lua_newthread' */
   freestack(L1);
   luaM_free(L, l);
 }
@@ -479,6 +641,7 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcdeferfree = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -496,7 +659,21 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   setgcparam(g->genmajormul, LUAI_GENMAJORMUL);
   g->genminormul = LUAI_GENMINORMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+  g->slicemt = NULL;
+  g->sliceviews = NULL;
+  g->bigbuff = NULL;
+  g->sizebigbuff = 0;
+  g->bgfree = NULL;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->threadpool = NULL;
+  g->nthreadpool = 0;
+  g->lowthreadpool = 0;
+  g->maxthreadpool = LUAI_THREADPOOL;
   g->vm_code_list = NULL;  /* initialize VM code list */
+  g->breakhook = NULL;
+  g->loadhook = NULL;
+  g->profiler = NULL;
+  l_atomic_store(&g->profpending, 0);
   luaM_poolinit(L);  /* initialize memory pool */
   l_mutex_init(&g->lock);
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
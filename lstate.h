@@ -148,6 +148,22 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
 
 
+/*
+** Dead threads are kept for reuse by 'lua_newthread' (at most
+** LUAI_THREADPOOL of them by default), provided their stacks did not
+** grow beyond LUAI_MAXPOOLSTACK slots. Each incremental cycle frees the
+** threads that stayed in the pool for the whole cycle; full collections
+** free them all.
+*/
+#if !defined(LUAI_THREADPOOL)
+#define LUAI_THREADPOOL		256
+#endif
+
+#if !defined(LUAI_MAXPOOLSTACK)
+#define LUAI_MAXPOOLSTACK	(8*BASIC_STACK_SIZE)
+#endif
+
+
 /**
  * @name GC Kinds
  * @{
@@ -298,6 +314,28 @@ typedef struct {
   l_mutex_t lock;                    /**< Lock for memory pool access. */
 } MemPoolArena;
 
+/*
+** Number of collector records kept for 'lua_gcstats' (a ring; older
+** records are overwritten).
+*/
+#if !defined(LUAI_GCSTATS)
+#define LUAI_GCSTATS	64
+#endif
+
+/**
+ * @brief Collector telemetry: the record ring and the counters that go
+ * into the next record.
+ */
+typedef struct GCStats {
+  lua_GCStat ring[LUAI_GCSTATS];  /**< Latest records. */
+  lua_Unsigned n;  /**< Records made so far; next goes to 'n % LUAI_GCSTATS'. */
+  lua_Unsigned heap;  /**< Heap size at the end of the last record. */
+  lua_Unsigned heap0;  /**< Heap size when the current record started. */
+  lua_Unsigned finalizers;  /**< Finalizers called since the last record. */
+  lua_Unsigned finnanos;  /**< Time spent in them. */
+  lua_Unsigned swept[LUA_NUMTYPES + 2];  /**< Objects freed, by type. */
+} GCStats;
+
 /**
  * @brief Global state structure.
  *
@@ -324,6 +362,7 @@ typedef struct global_State {
   lu_byte genmajormul;  /**< Control for major generational collections. */
   lu_byte gcstp;  /**< Control whether GC is running. */
   lu_byte gcemergency;  /**< True if this is an emergency collection. */
+  lu_byte gcdeferfree;  /**< Sweeping: hand freed blocks to 'bgfree'. */
   lu_byte gcpause;  /**< Size of pause between successive GCs. */
   lu_byte gcstepmul;  /**< GC "speed". */
   lu_byte gcstepsize;  /**< (log2 of) GC granularity. */
@@ -351,6 +390,16 @@ typedef struct global_State {
   TString *memerrmsg;  /**< Message for memory-allocation errors. */
   TString *tmname[TM_N];  /**< Array with tag-method names. */
   struct GCObject *mt[LUA_NUMTYPES];  /**< Metatables for basic types. */
+  struct Table *slicemt;  /**< Metatable shared by slice views. */
+  struct Table *sliceviews;  /**< Slice views of each viewed table. */
+  l_uint64 *bigbuff;  /**< Scratch limbs for big integer arithmetic. */
+  size_t sizebigbuff;  /**< Size of 'bigbuff', in limbs. */
+  struct BgFree *bgfree;  /**< Background freeing thread, or NULL. */
+  GCStats gcstats;  /**< Collector telemetry. */
+  struct lua_State *threadpool;  /**< Dead threads kept for reuse. */
+  int nthreadpool;  /**< Number of threads in 'threadpool'. */
+  int maxthreadpool;  /**< Limit for 'nthreadpool'. */
+  int lowthreadpool;  /**< Smallest 'nthreadpool' since the last trim. */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /**< Cache for strings in API. */
   lua_WarnFunction warnf;  /**< Warning function. */
   void *ud_warn;         /**< Auxiliary data to 'warnf'. */
@@ -358,6 +407,12 @@ typedef struct global_State {
   MemPoolArena mempool;  /**< Memory pool manager. */
   /* VM protection code table list */
   struct VMCodeTable *vm_code_list;  /**< VM protection code table list head. */
+  /* debugger support */
+  lua_Hook breakhook;  /**< Called when a breakpoint trap is hit. */
+  void (*loadhook) (lua_State *L);  /**< Called after a chunk is loaded (closure on top). */
+  /* sampling profiler */
+  struct Profiler *profiler;  /**< Active sampling profiler (or NULL). */
+  l_atomic profpending;  /**< A sample was requested (set by samplers). */
 } global_State;
 
 
@@ -464,6 +519,9 @@ union GCUnion {
 
 LUAI_FUNC void luaE_setdebt (global_State *g, l_mem debt);
 LUAI_FUNC void luaE_freethread (lua_State *L, lua_State *L1);
+LUAI_FUNC int luaE_setthreadpool (lua_State *L, int limit);
+LUAI_FUNC void luaE_freethreadpool (lua_State *L);
+LUAI_FUNC void luaE_trimthreadpool (lua_State *L);
 LUAI_FUNC CallInfo *luaE_extendCI (lua_State *L);
 LUAI_FUNC void luaE_shrinkCI (lua_State *L);
 LUAI_FUNC void luaE_checkcstack (lua_State *L);
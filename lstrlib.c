@@ -1112,27 +1112,199 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
-static const char *lmemfind (const char *s1, size_t l1,
-                               const char *s2, size_t l2) {
-  if (l2 == 0) return s1;  /* empty strings are everywhere */
-  else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
-  else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= ct_diff2sz(init - s1);
-        s1 = init;
+/*
+** {======================================================
+** Plain substring search
+** =======================================================
+**
+** Candidates are found by comparing the first and the last byte of the
+** pattern at many positions at once (16 per step with SSE2), and only
+** the candidates are compared in full. That is fast on ordinary text
+** but quadratic on repetitive input, so the full comparisons are paid
+** for out of the bytes scanned; once they cost more than that, the
+** search switches to the Two-Way algorithm (Crochemore & Perrin, 1991),
+** which is linear in the worst case. A 'StrFinder' carries that state
+** across repeated searches for the same pattern.
+*/
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define LUA_FINDSSE2
+#endif
+
+/* comparison work allowed beyond the bytes scanned before Two-Way */
+#define FINDSLACK	1024
+
+typedef struct StrFinder {
+  const unsigned char *p;  /* pattern */
+  size_t lp;  /* pattern length */
+  size_t scanned;  /* bytes skipped by the filter */
+  size_t work;  /* bytes compared on filter candidates */
+  int twoway;  /* Two-Way tables are ready (and in use) */
+  size_t ms;  /* critical position */
+  size_t per;  /* period (or shift for non-periodic patterns) */
+  size_t mem0;  /* memory after a shift by 'per' (0 if non-periodic) */
+  size_t shift[256];  /* pattern length minus last position of a byte */
+} StrFinder;
+
+
+static void initfinder (StrFinder *f, const char *p, size_t lp) {
+  f->p = (const unsigned char *)p;
+  f->lp = lp;
+  f->scanned = f->work = 0;
+  f->twoway = 0;
+}
+
+
+/*
+** Maximal suffix of the pattern, for the byte order given by 'rev'.
+** Returns its position minus one and leaves its period in '*per'.
+*/
+static size_t maxsuffix (const unsigned char *n, size_t l, int rev,
+                         size_t *per) {
+  size_t ip = (size_t)-1, jp = 0, k = 1, p = 1;
+  while (jp + k < l) {
+    unsigned char a = n[ip + k], b = n[jp + k];
+    if (a == b) {
+      if (k == p) { jp += p; k = 1; }
+      else k++;
+    }
+    else if (rev ? (a < b) : (a > b)) {
+      jp += k; k = 1; p = jp - ip;
+    }
+    else {
+      ip = jp++; k = p = 1;
+    }
+  }
+  *per = p;
+  return ip;
+}
+
+
+static void preptwoway (StrFinder *f) {
+  const unsigned char *n = f->p;
+  size_t l = f->lp, i, p1, p2, ms1, ms2;
+  for (i = 0; i < 256; i++)
+    f->shift[i] = l;
+  for (i = 0; i < l; i++)
+    f->shift[n[i]] = l - i - 1;
+  ms1 = maxsuffix(n, l, 0, &p1);
+  ms2 = maxsuffix(n, l, 1, &p2);
+  if (ms2 + 1 > ms1 + 1) { f->ms = ms2; f->per = p2; }
+  else { f->ms = ms1; f->per = p1; }
+  if (memcmp(n, n + f->per, f->ms + 1) != 0) {  /* not periodic? */
+    f->mem0 = 0;
+    f->per = ((f->ms > l - f->ms - 1) ? f->ms : l - f->ms - 1) + 1;
+  }
+  else
+    f->mem0 = l - f->per;
+  f->twoway = 1;
+}
+
+
+static const char *twowayfind (StrFinder *f, const unsigned char *h,
+                               size_t hl) {
+  const unsigned char *n = f->p;
+  const unsigned char *z = h + hl;
+  size_t l = f->lp, ms = f->ms, mem = 0, k;
+  while ((size_t)(z - h) >= l) {
+    k = f->shift[h[l - 1]];  /* align the last byte first */
+    if (k) {
+      if (k < mem) k = mem;
+      h += k;
+      mem = 0;
+      continue;
+    }
+    /* compare the right half */
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < l && n[k] == h[k]; k++) ;
+    if (k < l) {
+      h += k - ms;
+      mem = 0;
+      continue;
+    }
+    /* compare the left half */
+    for (k = ms + 1; k > mem && n[k - 1] == h[k - 1]; k--) ;
+    if (k <= mem)
+      return (const char *)h;
+    h += f->per;
+    mem = f->mem0;
+  }
+  return NULL;
+}
+
+
+/* full comparison of a candidate, paid out of the scanned bytes */
+#define checkcandidate(f,c) \
+  ((f)->work += (f)->lp, memcmp((c) + 1, (f)->p + 1, (f)->lp - 2) == 0)
+
+#define overbudget(f)	((f)->work > (f)->scanned + FINDSLACK)
+
+
+/*
+** Find the pattern of 'f' in 's1[0..l1)'. Returns NULL if absent.
+*/
+static const char *findnext (StrFinder *f, const char *s1, size_t l1) {
+  const unsigned char *s = (const unsigned char *)s1;
+  size_t lp = f->lp, npos, i = 0;
+  unsigned char first, last;
+  if (lp == 0) return s1;  /* empty strings are everywhere */
+  else if (lp > l1) return NULL;  /* avoids a negative 'npos' */
+  else if (lp == 1) return (const char *)memchr(s1, *f->p, l1);
+  if (f->twoway)
+    return twowayfind(f, s, l1);
+  npos = l1 - lp + 1;  /* number of possible starting positions */
+  first = f->p[0];
+  last = f->p[lp - 1];
+#if defined(LUA_FINDSSE2)
+  {
+    const __m128i vf = _mm_set1_epi8((char)first);
+    const __m128i vl = _mm_set1_epi8((char)last);
+    for (; i + 16 <= npos; i += 16) {
+      __m128i bf = _mm_loadu_si128((const __m128i *)(s + i));
+      __m128i bl = _mm_loadu_si128((const __m128i *)(s + i + lp - 1));
+      unsigned int mask = (unsigned int)_mm_movemask_epi8(
+          _mm_and_si128(_mm_cmpeq_epi8(bf, vf), _mm_cmpeq_epi8(bl, vl)));
+      while (mask != 0) {
+        size_t c = i + (size_t)__builtin_ctz(mask);
+        if (checkcandidate(f, s + c))
+          return (const char *)(s + c);
+        mask &= mask - 1;
+      }
+      f->scanned += 16;
+      if (overbudget(f)) {
+        preptwoway(f);
+        return twowayfind(f, s + i + 16, l1 - i - 16);
       }
     }
-    return NULL;  /* not found */
   }
+#endif
+  while (i < npos) {
+    const unsigned char *c = (const unsigned char *)memchr(s + i, first,
+                                                           npos - i);
+    if (c == NULL)
+      break;
+    f->scanned += (size_t)(c - (s + i)) + 1;
+    if (c[lp - 1] == last && checkcandidate(f, c))
+      return (const char *)c;
+    i = (size_t)(c - s) + 1;
+    if (overbudget(f)) {
+      preptwoway(f);
+      return twowayfind(f, s + i, l1 - i);
+    }
+  }
+  return NULL;  /* not found */
+}
+
+
+static const char *lmemfind (const char *s1, size_t l1,
+                               const char *s2, size_t l2) {
+  StrFinder f;
+  initfinder(&f, s2, l2);
+  return findnext(&f, s1, l1);
 }
 
+/* }====================================================== */
+
 
 /*
 ** get information about the i-th capture. If there are no captures
@@ -1466,18 +1638,33 @@ static int str_gsub (lua_State *L) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
-  while (n < max_s) {
+  if (!anchor && lp > 0 && nospecials(p, lp)) {  /* plain pattern? */
+    StrFinder f;
     const char *e;
-    reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    initfinder(&f, p, lp);
+    while (n < max_s &&
+           (e = findnext(&f, src, ct_diff2sz(ms.src_end - src))) != NULL) {
       n++;
-      changed = add_value(&ms, &b, src, e, tr) | changed;
-      src = lastmatch = e;
+      luaL_addlstring(&b, src, ct_diff2sz(e - src));  /* part before it */
+      reprepstate(&ms);  /* no captures: values use the whole match */
+      changed = add_value(&ms, &b, e, e + lp, tr) | changed;
+      src = e + lp;
+    }
+  }
+  else {
+    while (n < max_s) {
+      const char *e;
+      reprepstate(&ms);  /* (re)prepare state for new match */
+      if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+        n++;
+        changed = add_value(&ms, &b, src, e, tr) | changed;
+        src = lastmatch = e;
+      }
+      else if (src < ms.src_end)  /* otherwise, skip one character */
+        luaL_addchar(&b, *src++);
+      else break;  /* end of subject */
+      if (anchor) break;
     }
-    else if (src < ms.src_end)  /* otherwise, skip one character */
-      luaL_addchar(&b, *src++);
-    else break;  /* end of subject */
-    if (anchor) break;
   }
   if (!changed)  /* no changes? */
     lua_pushvalue(L, 1);  /* return original string */
@@ -1497,91 +1684,52 @@ static int str_gsub (lua_State *L) {
 ** ============================================
 */
 
+/*
+** 'split(s [, sep])': the pieces of 's' between occurrences of 'sep'
+** (k separators give k + 1 pieces, some possibly empty), or its bytes
+** if 'sep' is empty. Separator positions are gathered in one search
+** pass, so the result table is created at its final size.
+*/
 static int str_split (lua_State *L) {
   size_t l, sep_l;
   const char *s = luaL_checklstring(L, 1, &l);
   const char *sep = luaL_optlstring(L, 2, "", &sep_l);
   const char *e = s + l;
-  int i = 1;
-  
-  lua_newtable(L);
-  
   if (sep_l == 0) {  /* empty separator: return characters */
+    int i = 1;
+    luaL_argcheck(L, l < (size_t)INT_MAX, 1, "string too long");
+    lua_createtable(L, (int)l, 0);
     while (s < e) {
       lua_pushlstring(L, s++, 1);
       lua_rawseti(L, -2, i++);
     }
   }
   else {
-    while (s < e) {
-      const char *p = lmemfind(s, e - s, sep, sep_l);
-      if (p == NULL) {
-        lua_pushlstring(L, s, e - s);
-        lua_rawseti(L, -2, i++);
-        break;
-      }
-      lua_pushlstring(L, s, p - s);
-      lua_rawseti(L, -2, i++);
-      s = p + sep_l;
-    }
-    if (s == e && l > 0) { /* trailing empty string if separator was at the end */
-        /* Logic check: if string is "a,b," and sep is ",", we want {"a", "b", ""} */
-        /* lmemfind returns pointer to start of sep. */
-        /* loop breaks when s >= e. */
-        /* If the last char was sep, then s will equal e after s = p + sep_l. */
-        /* But we need to check if the loop condition covers this. */
-        /* Actually, if s == e, it means we finished exactly at end. */
-        /* If original string ended with sep, we pushed the part before sep. */
-        /* Example: "a," split by ",". */
-        /* 1. lmemfind finds "," at offset 1. p points to ",". */
-        /* 2. push "a". i=2. s becomes "," + 1 = end. */
-        /* 3. loop terminates. */
-        /* We need to push empty string? Python's split("a,") -> ['a', '']. */
-        /* Lua's common implementations usually do this. */
-        
-        /* Let's refine the loop logic. */
+    StrFinder f;
+    luaL_Buffer b;  /* offsets of the separators */
+    const char *p = s;
+    const size_t *pos;
+    size_t n, i;
+    initfinder(&f, sep, sep_l);
+    luaL_buffinit(L, &b);
+    while ((p = findnext(&f, p, ct_diff2sz(e - p))) != NULL) {
+      size_t off = ct_diff2sz(p - s);
+      luaL_addlstring(&b, (const char *)&off, sizeof(off));
+      p += sep_l;
     }
+    n = luaL_bufflen(&b) / sizeof(size_t);
+    luaL_argcheck(L, n < (size_t)INT_MAX, 1, "too many pieces");
+    pos = (const size_t *)luaL_buffaddr(&b);  /* stays valid: no more adds */
+    lua_createtable(L, (int)n + 1, 0);
+    p = s;
+    for (i = 0; i < n; i++) {
+      lua_pushlstring(L, p, ct_diff2sz((s + pos[i]) - p));
+      lua_rawseti(L, -2, (lua_Integer)i + 1);
+      p = s + pos[i] + sep_l;
+    }
+    lua_pushlstring(L, p, ct_diff2sz(e - p));  /* last piece */
+    lua_rawseti(L, -2, (lua_Integer)n + 1);
   }
-  
-  /* Re-implementation for correct behavior matching common split */
-  if (sep_l > 0) {
-      /* Reset stack and table */
-      lua_pop(L, 1); 
-      lua_newtable(L);
-      i = 1;
-      s = lua_tostring(L, 1); /* reset s */
-      
-      while (s < e) {
-        const char *p = lmemfind(s, e - s, sep, sep_l);
-        if (p == NULL) {
-          lua_pushlstring(L, s, e - s);
-          lua_rawseti(L, -2, i++);
-          s = e; /* done */
-        } else {
-          lua_pushlstring(L, s, p - s);
-          lua_rawseti(L, -2, i++);
-          s = p + sep_l;
-        }
-      }
-      /* If the string ended with separator, push empty string */
-      /* Check original string length to avoid pushing "" for empty string input if desired, 
-         but "split" usually returns {""} for "" input with any separator. */
-      if (l == 0) {
-          lua_pushliteral(L, "");
-          lua_rawseti(L, -2, 1);
-      }
-      else if (s == e) { 
-          /* If s reached e exactly after a separator, it means last part is empty. */
-          /* We need to know if the last operation was a separator skip. */
-          /* Compare s with previous pointer? */
-          /* Easier way: check if original string ends with separator */
-          if (l >= sep_l && memcmp(e - sep_l, sep, sep_l) == 0) {
-              lua_pushliteral(L, "");
-              lua_rawseti(L, -2, i);
-          }
-      }
-  }
-  
   return 1;
 }
 
@@ -2117,27 +2265,28 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
-static int str_format (lua_State *L) {
-  int top = lua_gettop(L);
-  int arg = 1;
+/*
+** Format the arguments in 'arg + 1 .. top' according to the format
+** string at 'arg', adding the result to 'b'. ('top' is taken before
+** the buffer pushes anything.)
+*/
+static void addformat (lua_State *L, luaL_Buffer *b, int arg, int top) {
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
   const char *flags;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
   while (strfrmt < strfrmt_end) {
     if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
+      luaL_addchar(b, *strfrmt++);
     else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
+      luaL_addchar(b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format ('%...') */
       unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
+      char *buff = luaL_prepbuffsize(b, maxitem);  /* to put result */
       int nb = 0;  /* number of bytes in result */
       if (++arg > top)
-        return luaL_argerror(L, arg, "no value");
+        luaL_argerror(L, arg, "no value");
       strfrmt = getformat(L, strfrmt, form);
       switch (*strfrmt++) {
         case 'c': {
@@ -2168,7 +2317,7 @@ static int str_format (lua_State *L) {
           break;
         case 'f':
           maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
+          buff = luaL_prepbuffsize(b, maxitem);
           /* FALLTHROUGH */
         case 'e': case 'E': case 'g': case 'G': {
           lua_Number n = luaL_checknumber(L, arg);
@@ -2189,21 +2338,21 @@ static int str_format (lua_State *L) {
         }
         case 'q': {
           if (form[2] != '\0')  /* modifiers? */
-            return luaL_error(L, "说明符 '%%q' 不能有修饰符");
-          addliteral(L, &b, arg);
+            luaL_error(L, "说明符 '%%q' 不能有修饰符");
+          addliteral(L, b, arg);
           break;
         }
         case 's': {
           size_t l;
           const char *s = luaL_tolstring(L, arg, &l);
           if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
+            luaL_addvalue(b);  /* keep entire string */
           else {
             luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
             checkformat(L, form, L_FMTFLAGSC, 1);
             if (strchr(form, '.') == NULL && l >= 100) {
               /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
+              luaL_addvalue(b);  /* keep entire string */
             }
             else {  /* format the string into 'buff' */
               nb = l_sprintf(buff, maxitem, form, s);
@@ -2213,13 +2362,21 @@ static int str_format (lua_State *L) {
           break;
         }
         default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "无效的转换 '%s' 到 'format'", form);
+          luaL_error(L, "无效的转换 '%s' 到 'format'", form);
         }
       }
       lua_assert(cast_uint(nb) < maxitem);
-      luaL_addsize(&b, cast_uint(nb));
+      luaL_addsize(b, cast_uint(nb));
     }
   }
+}
+
+
+static int str_format (lua_State *L) {
+  int top = lua_gettop(L);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, 1, top);
   luaL_pushresult(&b);
   return 1;
 }
@@ -2227,6 +2384,238 @@ static int str_format (lua_State *L) {
 /* }=========================================== */
 
 
+/*
+** {===========================================
+** STRING BUILDER
+** ============================================
+*/
+
+/*
+** A 'string.builder' is a growable byte buffer in a userdata. Unlike a
+** luaL_Buffer it outlives the call that fills it, so a loop can append
+** to one builder and 'reset' it without giving its memory back.
+*/
+
+#define BUILDER		"string.builder"
+
+typedef struct StrBuilder {
+  char *b;  /* contents (not zero-terminated) */
+  size_t n;  /* number of bytes in use */
+  size_t size;  /* number of bytes allocated */
+} StrBuilder;
+
+
+#define checkbuilder(L)		((StrBuilder *)luaL_checkudata(L, 1, BUILDER))
+
+
+/* grow 'sb' to at least 'newsize' bytes */
+static void resizebuilder (lua_State *L, StrBuilder *sb, size_t newsize) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  char *temp = (char *)allocf(ud, sb->b, sb->size, newsize);
+  if (l_unlikely(temp == NULL && newsize > 0)) {  /* allocation error? */
+    lua_pushliteral(L, "not enough memory");
+    lua_error(L);  /* raise a memory error */
+  }
+  sb->b = temp;
+  sb->size = newsize;
+}
+
+
+/*
+** Return room for 'sz' more bytes at the end of 'sb', growing it by
+** half its size (as luaL_Buffer does) when it is full.
+*/
+static char *prepbuilder (lua_State *L, StrBuilder *sb, size_t sz) {
+  if (sb->size - sb->n < sz) {
+    size_t newsize = sb->size;
+    if (l_unlikely(sz >= MAX_SIZET - sb->n))
+      luaL_error(L, "resulting string too large");
+    if (newsize <= MAX_SIZET / 3 * 2)
+      newsize += (newsize >> 1);
+    if (newsize < sb->n + sz)
+      newsize = sb->n + sz;
+    resizebuilder(L, sb, newsize);
+  }
+  return sb->b + sb->n;
+}
+
+
+static void addtobuilder (lua_State *L, StrBuilder *sb, const char *s,
+                          size_t l) {
+  if (l > 0) {
+    memcpy(prepbuilder(L, sb, l), s, l);
+    sb->n += l;
+  }
+}
+
+
+/*
+** Append the value at 'arg'. Strings, numbers and builders are copied
+** in place; other values go through 'tostring'.
+*/
+static void addvaluetobuilder (lua_State *L, StrBuilder *sb, int arg) {
+  switch (lua_type(L, arg)) {
+    case LUA_TSTRING: {
+      size_t l;
+      const char *s = lua_tolstring(L, arg, &l);
+      addtobuilder(L, sb, s, l);
+      return;
+    }
+    case LUA_TNUMBER: {
+      char *buff = prepbuilder(L, sb, LUA_N2SBUFFSZ);
+      unsigned len = lua_numbertocstring(L, arg, buff);
+      if (len > 0) {
+        sb->n += len - 1;  /* (without the final zero) */
+        return;
+      }
+      break;  /* big integer */
+    }
+    case LUA_TUSERDATA: {
+      StrBuilder *other = (StrBuilder *)luaL_testudata(L, arg, BUILDER);
+      if (other != NULL) {
+        size_t l = other->n;
+        char *buff = prepbuilder(L, sb, l);  /* may move 'other->b' too */
+        if (l > 0) memcpy(buff, other->b, l);
+        sb->n += l;
+        return;
+      }
+      break;
+    }
+    default: break;
+  }
+  {
+    size_t l;
+    const char *s = luaL_tolstring(L, arg, &l);
+    addtobuilder(L, sb, s, l);
+    lua_pop(L, 1);
+  }
+}
+
+
+static int builder_new (lua_State *L) {
+  lua_Integer cap = luaL_optinteger(L, 1, 0);
+  StrBuilder *sb;
+  luaL_argcheck(L, cap >= 0, 1, "negative capacity");
+  sb = (StrBuilder *)lua_newuserdatauv(L, sizeof(StrBuilder), 0);
+  sb->b = NULL;
+  sb->n = sb->size = 0;
+  luaL_setmetatable(L, BUILDER);
+  if (cap > 0)
+    resizebuilder(L, sb, (size_t)cap);
+  return 1;
+}
+
+
+static int builder_add (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  int top = lua_gettop(L);
+  int i;
+  for (i = 2; i <= top; i++)
+    addvaluetobuilder(L, sb, i);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int builder_addf (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  int top = lua_gettop(L);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, 2, top);
+  addtobuilder(L, sb, luaL_buffaddr(&b), luaL_bufflen(&b));
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int builder_rep (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  size_t l, lsep;
+  const char *s = luaL_checklstring(L, 2, &l);
+  lua_Integer n = luaL_checkinteger(L, 3);
+  const char *sep = luaL_optlstring(L, 4, "", &lsep);
+  if (n > 0 && (l | lsep) != 0) {  /* anything to add? */
+    char *p;
+    if (l_unlikely(l + lsep < l || l + lsep > MAX_SIZET / (size_t)n))
+      return luaL_error(L, "resulting string too large");
+    p = prepbuilder(L, sb, (size_t)n * (l + lsep) - lsep);
+    while (n-- > 1) {
+      memcpy(p, s, l * sizeof(char)); p += l;
+      if (lsep > 0) {
+        memcpy(p, sep, lsep * sizeof(char)); p += lsep;
+      }
+    }
+    memcpy(p, s, l * sizeof(char)); p += l;
+    sb->n = ct_diff2sz(p - sb->b);
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int builder_reset (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  sb->n = 0;  /* keep the memory for the next round */
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int builder_len (lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)checkbuilder(L)->n);
+  return 1;
+}
+
+
+static int builder_tostring (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  lua_pushlstring(L, sb->b, sb->n);
+  return 1;
+}
+
+
+static int builder_gc (lua_State *L) {
+  StrBuilder *sb = checkbuilder(L);
+  resizebuilder(L, sb, 0);
+  sb->n = 0;
+  return 0;
+}
+
+
+static const luaL_Reg builder_methods[] = {
+  {"add", builder_add},
+  {"addf", builder_addf},
+  {"rep", builder_rep},
+  {"reset", builder_reset},
+  {"len", builder_len},
+  {"tostring", builder_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg builder_meta[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__len", builder_len},
+  {"__tostring", builder_tostring},
+  {"__gc", builder_gc},
+  {"__close", builder_gc},
+  {NULL, NULL}
+};
+
+
+static void createbuildermeta (lua_State *L) {
+  luaL_newmetatable(L, BUILDER);
+  luaL_setfuncs(L, builder_meta, 0);
+  luaL_newlib(L, builder_methods);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+}
+
+/* }=========================================== */
+
+
 /*
 ** {===========================================
 ** PACK/UNPACK
@@ -2612,12 +3001,16 @@ static lua_Integer unpackint (lua_State *L, const char *str,
 }
 
 
-static int str_unpack (lua_State *L) {
+/*
+** Unpack 'data' (of length 'ld') from 0-based position 'pos' according
+** to 'fmt', as 'string.unpack' does. Pushes the values plus the (1-based)
+** position after the last byte read and returns how many values it
+** pushed. Lets other libraries unpack memory they own without first
+** copying it into a string.
+*/
+LUALIB_API int luaL_unpackbuff (lua_State *L, const char *fmt,
+                                const char *data, size_t ld, size_t pos) {
   Header h;
-  const char *fmt = luaL_checkstring(L, 1);
-  size_t ld;
-  const char *data = luaL_checklstring(L, 2, &ld);
-  size_t pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
   int n = 0;  /* number of results */
   luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
   initheader(L, &h);
@@ -2687,6 +3080,15 @@ static int str_unpack (lua_State *L) {
   return n + 1;
 }
 
+
+static int str_unpack (lua_State *L) {
+  const char *fmt = luaL_checkstring(L, 1);
+  size_t ld;
+  const char *data = luaL_checklstring(L, 2, &ld);
+  size_t pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
+  return luaL_unpackbuff(L, fmt, data, ld, pos);
+}
+
 /* }=========================================== */
 
 /**
@@ -2736,6 +3138,7 @@ static int str_file (lua_State *L) {
 static const luaL_Reg strlib[] = {
   {"aes_decrypt", str_aes_decrypt},
   {"aes_encrypt", str_aes_encrypt},
+  {"builder", builder_new},
   {"byte", str_byte},
   {"char", str_char},
   {"contains", str_contains},
@@ -2792,6 +3195,7 @@ static void createmetatable (lua_State *L) {
 LUAMOD_API int luaopen_string (lua_State *L) {
   luaL_newlib(L, strlib);
   createmetatable(L);
+  createbuildermeta(L);
   return 1;
 }
 
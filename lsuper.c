@@ -15,6 +15,20 @@
 #include "lvm.h"
 #include "ldebug.h"
 
+/*
+** A SuperStruct keeps its entries in 'data' as key-value pairs. Small
+** ones keep them sorted by key and use binary search. Once there are
+** more than LUAI_SUPERHASHMIN entries, 'data' becomes an insertion-ordered
+** array with an open-addressing hash 'index' over it (entry position
+** plus one, 0 for free slots). Deleting a hashed entry only clears its
+** value, so traversal can continue from it; dead entries are squeezed
+** out when 'data' next needs to grow.
+*/
+
+#define entrykey(ss,i)	(&(ss)->data[(i) * 2])
+#define entryval(ss,i)	(&(ss)->data[(i) * 2 + 1])
+#define sizeindex(ss)	(1u << (ss)->lsizeindex)
+
 static int super_compare(const TValue *k1, const TValue *k2) {
   int t1 = ttype(k1);
   int t2 = ttype(k2);
@@ -36,7 +50,16 @@ static int super_compare(const TValue *k1, const TValue *k2) {
         return (n1 < n2) ? -1 : (n1 > n2 ? 1 : 0);
     }
     case LUA_TSTRING: {
-        return strcmp(getstr(tsvalue(k1)), getstr(tsvalue(k2)));
+        TString *s1 = tsvalue(k1);
+        TString *s2 = tsvalue(k2);
+        size_t l1, l2;
+        int res;
+        if (s1 == s2) return 0;  /* short strings are interned */
+        l1 = tsslen(s1);
+        l2 = tsslen(s2);
+        res = memcmp(getstr(s1), getstr(s2), (l1 < l2) ? l1 : l2);
+        if (res != 0) return res;
+        return (l1 < l2) ? -1 : (l1 > l2 ? 1 : 0);
     }
     default: {
         if (iscollectable(k1)) {
@@ -48,10 +71,120 @@ static int super_compare(const TValue *k1, const TValue *k2) {
   return 0;
 }
 
+static int super_equal(const TValue *k1, const TValue *k2) {
+  if (ttisshrstring(k1) && ttisshrstring(k2))
+    return tsvalue(k1) == tsvalue(k2);
+  return super_compare(k1, k2) == 0;
+}
+
+/* hash consistent with 'super_compare': equal numbers hash alike */
+static unsigned int super_hash(const TValue *k) {
+  switch (ttype(k)) {
+    case LUA_TSTRING: {
+      TString *ts = tsvalue(k);
+      return strisshr(ts) ? ts->hash : luaS_hashlongstr(ts);
+    }
+    case LUA_TNUMBER: {
+      lua_Number n = 0;
+      l_uint64 u = 0;
+      if (ttisinteger(k)) n = cast_num(ivalue(k));
+      else tonumber(k, &n);
+      n += 0;  /* -0.0 hashes like 0.0 */
+      memcpy(&u, &n, sizeof(n) < sizeof(u) ? sizeof(n) : sizeof(u));
+      return cast_uint(u ^ (u >> 32));
+    }
+    case LUA_TBOOLEAN: return ttistrue(k) ? 2 : 1;
+    default:
+      return iscollectable(k) ? point2uint(gcvalue(k)) : cast_uint(ttype(k));
+  }
+}
+
+/* first slot to probe for hash 'h' (Fibonacci hashing) */
+#define firstslot(ss,h)	(((h) * 2654435769u) >> (32 - (ss)->lsizeindex))
+
+/*
+** Finds 'key' in the index. Returns its entry position, or -1 with the
+** free slot where it would go in '*slot'.
+*/
+static int hashfind(SuperStruct *ss, const TValue *key, unsigned int *slot) {
+  unsigned int mask = sizeindex(ss) - 1;
+  unsigned int i = firstslot(ss, super_hash(key));
+  for (;;) {
+    unsigned int e = ss->index[i];
+    if (e == 0) {
+      if (slot) *slot = i;
+      return -1;
+    }
+    if (super_equal(key, entrykey(ss, e - 1)))
+      return cast_int(e - 1);
+    i = (i + 1) & mask;
+  }
+}
+
+static int sortedfind(SuperStruct *ss, const TValue *key, int *pos) {
+  int left = 0;
+  int right = ss->nsize - 1;
+  while (left <= right) {
+    int mid = left + (right - left) / 2;
+    int cmp = super_compare(key, entrykey(ss, mid));
+    if (cmp == 0) return mid;
+    if (cmp < 0) right = mid - 1;
+    else left = mid + 1;
+  }
+  if (pos) *pos = left;
+  return -1;
+}
+
+/*
+** Drops dead entries (keeping the order of the others) and rebuilds the
+** index with room for 'n' entries at a load factor of at most 1/2.
+*/
+static void rehash(lua_State *L, SuperStruct *ss, unsigned int n) {
+  unsigned int i, j, mask;
+  unsigned int *index;
+  lu_byte lsize = 4;
+  while ((1u << lsize) < 2 * n) lsize++;
+  index = luaM_newvector(L, 1u << lsize, unsigned int);
+  if (ss->ndead > 0) {
+    for (i = j = 0; i < ss->nsize; i++) {
+      if (!ttisnil(entryval(ss, i))) {
+        if (i != j) {
+          setobj2t(L, entrykey(ss, j), entrykey(ss, i));
+          setobj2t(L, entryval(ss, j), entryval(ss, i));
+        }
+        j++;
+      }
+    }
+    ss->nsize = j;
+    ss->ndead = 0;
+  }
+  if (ss->index)
+    luaM_freearray(L, ss->index, sizeindex(ss));
+  ss->index = index;
+  ss->lsizeindex = lsize;
+  memset(ss->index, 0, sizeof(unsigned int) << lsize);
+  mask = sizeindex(ss) - 1;
+  for (i = 0; i < ss->nsize; i++) {
+    unsigned int s = firstslot(ss, super_hash(entrykey(ss, i)));
+    while (ss->index[s] != 0) s = (s + 1) & mask;
+    ss->index[s] = i + 1;
+  }
+}
+
+static void growdata(lua_State *L, SuperStruct *ss) {
+  unsigned int oldcapacity = ss->ncapacity;
+  unsigned int newcapacity = oldcapacity > 0 ? oldcapacity * 2 : 4;
+  ss->data = luaM_reallocvector(L, ss->data, oldcapacity * 2, newcapacity * 2, TValue);
+  ss->ncapacity = newcapacity;
+}
+
 SuperStruct *luaS_newsuperstruct (lua_State *L, TString *name, unsigned int size) {
   SuperStruct *ss = (SuperStruct *)luaC_newobj(L, LUA_TSUPERSTRUCT, sizeof(SuperStruct));
   ss->name = name;
   ss->nsize = 0;
+  ss->ndead = 0;
+  ss->lsizeindex = 0;
+  ss->index = NULL;
   ss->ncapacity = size > 0 ? size : 4;
   ss->data = luaM_newvector(L, ss->ncapacity * 2, TValue);
   return ss;
@@ -60,76 +193,99 @@ SuperStruct *luaS_newsuperstruct (lua_State *L, TString *name, unsigned int size
 void luaS_freesuperstruct (lua_State *L, SuperStruct *ss) {
   if (ss->data)
     luaM_freearray(L, ss->data, ss->ncapacity * 2);
+  if (ss->index)
+    luaM_freearray(L, ss->index, sizeindex(ss));
   luaM_free(L, ss);
 }
 
+static void hashset (lua_State *L, SuperStruct *ss, TValue *key, TValue *val) {
+  unsigned int slot;
+  int e = hashfind(ss, key, &slot);
+  if (e >= 0) {
+    TValue *v = entryval(ss, e);
+    if (ttisnil(val)) {
+      if (!ttisnil(v)) ss->ndead++;  /* keep the key for traversals */
+    }
+    else if (ttisnil(v))
+      ss->ndead--;  /* revived */
+    setobj2t(L, v, val);
+    return;
+  }
+  if (ttisnil(val)) return;
+  if (ss->nsize >= ss->ncapacity) {
+    if (ss->ndead > ss->nsize / 4) {  /* reclaim dead entries */
+      rehash(L, ss, ss->nsize - ss->ndead + 1);
+      hashfind(ss, key, &slot);
+    }
+    else
+      growdata(L, ss);
+  }
+  if (2 * (ss->nsize + 1) > sizeindex(ss)) {
+    rehash(L, ss, ss->ncapacity);
+    hashfind(ss, key, &slot);
+  }
+  setobj2t(L, entrykey(ss, ss->nsize), key);
+  setobj2t(L, entryval(ss, ss->nsize), val);
+  ss->index[slot] = ++ss->nsize;
+}
+
 void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *val) {
   int left = 0;
-  int right = ss->nsize - 1;
-  int mid;
-  int cmp;
-
-  if (ss->data) {
-    while (left <= right) {
-      mid = left + (right - left) / 2;
-      TValue *k = &ss->data[mid * 2];
-      cmp = super_compare(key, k);
-      if (cmp == 0) {
-        /* Found */
-        if (ttisnil(val)) {
-           /* Delete by shifting */
-           int nmove = ss->nsize - 1 - mid;
-           if (nmove > 0) {
-              memmove(&ss->data[mid * 2], &ss->data[(mid + 1) * 2], nmove * 2 * sizeof(TValue));
-           }
-           ss->nsize--;
-           /* Optional: shrink capacity if too small? */
-        } else {
-           setobj2t(L, &ss->data[mid * 2 + 1], val);
-        }
-        return;
-      }
-      if (cmp < 0) {
-        right = mid - 1;
-      } else {
-        left = mid + 1;
+  int i;
+  luaC_barrier(L, ss, key);
+  luaC_barrier(L, ss, val);
+  if (ss->index) {
+    hashset(L, ss, key, val);
+    return;
+  }
+  i = sortedfind(ss, key, &left);
+  if (i >= 0) {
+    if (ttisnil(val)) {
+      /* Delete by shifting */
+      int nmove = ss->nsize - 1 - i;
+      if (nmove > 0) {
+        memmove(entrykey(ss, i), entrykey(ss, i + 1), nmove * 2 * sizeof(TValue));
       }
+      ss->nsize--;
+    } else {
+      setobj2t(L, entryval(ss, i), val);
     }
+    return;
   }
 
   /* Not found, insert at 'left' */
   if (ttisnil(val)) return;
 
-  if (ss->nsize >= ss->ncapacity) {
-    unsigned int oldcapacity = ss->ncapacity;
-    unsigned int newcapacity = oldcapacity > 0 ? oldcapacity * 2 : 4;
-    ss->data = luaM_reallocvector(L, ss->data, oldcapacity * 2, newcapacity * 2, TValue);
-    ss->ncapacity = newcapacity;
+  if (ss->nsize >= LUAI_SUPERHASHMIN) {  /* switch to a hash index */
+    rehash(L, ss, ss->ncapacity);
+    hashset(L, ss, key, val);
+    return;
   }
 
+  if (ss->nsize >= ss->ncapacity)
+    growdata(L, ss);
+
   /* Shift to right */
   int nmove = ss->nsize - left;
   if (nmove > 0) {
-    memmove(&ss->data[(left + 1) * 2], &ss->data[left * 2], nmove * 2 * sizeof(TValue));
+    memmove(entrykey(ss, left + 1), entrykey(ss, left), nmove * 2 * sizeof(TValue));
   }
 
-  setobj2t(L, &ss->data[left * 2], key);
-  setobj2t(L, &ss->data[left * 2 + 1], val);
+  setobj2t(L, entrykey(ss, left), key);
+  setobj2t(L, entryval(ss, left), val);
   ss->nsize++;
 }
 
 const TValue *luaS_getsuperstruct (SuperStruct *ss, TValue *key) {
-  int left = 0;
-  int right = ss->nsize - 1;
-  while (left <= right) {
-    int mid = left + (right - left) / 2;
-    TValue *k = &ss->data[mid * 2];
-    int cmp = super_compare(key, k);
-    if (cmp == 0) return &ss->data[mid * 2 + 1];
-    if (cmp < 0) right = mid - 1;
-    else left = mid + 1;
+  int i;
+  if (ss->index) {
+    i = hashfind(ss, key, NULL);
+    if (i >= 0 && !ttisnil(entryval(ss, i)))
+      return entryval(ss, i);
+    return NULL;
   }
-  return NULL;
+  i = sortedfind(ss, key, NULL);
+  return (i >= 0) ? entryval(ss, i) : NULL;
 }
 
 const TValue *luaS_getsuperstruct_str (SuperStruct *ss, TString *key) {
@@ -141,34 +297,27 @@ const TValue *luaS_getsuperstruct_str (SuperStruct *ss, TString *key) {
 int luaS_next (lua_State *L, SuperStruct *ss, StkId key) {
   unsigned int i = 0;
   if (!ttisnil(s2v(key))) {
-    /* Binary search for key */
-    int left = 0;
-    int right = ss->nsize - 1;
-    int mid;
-    int cmp;
-    int found = 0;
-
-    while (left <= right) {
-      mid = left + (right - left) / 2;
-      TValue *k = &ss->data[mid * 2];
-      cmp = super_compare(s2v(key), k);
-      if (cmp == 0) {
-        i = mid + 1;
-        found = 1;
-        break;
-      }
-      if (cmp < 0) right = mid - 1;
-      else left = mid + 1;
+    int e;
+    if (ss->index) {
+      e = hashfind(ss, s2v(key), NULL);
+      if (e < 0)
+        luaG_runerror(L, "invalid key to 'next'");
+      i = e + 1;
     }
-    if (!found) {
-      luaG_runerror(L, "invalid key to 'next'");
+    else {
+      int pos = 0;
+      e = sortedfind(ss, s2v(key), &pos);
+      /* a key deleted during the traversal resumes at its successor */
+      i = (e >= 0) ? cast_uint(e + 1) : cast_uint(pos);
     }
   }
 
-  if (i < ss->nsize) {
-    setobj2s(L, key, &ss->data[i * 2]);
-    setobj2s(L, key + 1, &ss->data[i * 2 + 1]);
-    return 1;
+  for (; i < ss->nsize; i++) {
+    if (!ttisnil(entryval(ss, i))) {
+      setobj2s(L, key, entrykey(ss, i));
+      setobj2s(L, key + 1, entryval(ss, i));
+      return 1;
+    }
   }
   return 0;
 }
@@ -3,6 +3,16 @@
 
 #include "lobject.h"
 
+
+/*
+** SuperStructs with more entries than this switch from a sorted array
+** to an insertion-ordered array with a hash index.
+*/
+#if !defined(LUAI_SUPERHASHMIN)
+#define LUAI_SUPERHASHMIN	32
+#endif
+
+
 LUAI_FUNC SuperStruct *luaS_newsuperstruct (lua_State *L, TString *name, unsigned int size);
 LUAI_FUNC void luaS_setsuperstruct (lua_State *L, SuperStruct *ss, TValue *key, TValue *val);
 LUAI_FUNC const TValue *luaS_getsuperstruct (SuperStruct *ss, TValue *key);
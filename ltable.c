@@ -38,6 +38,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lslice.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -1249,6 +1250,7 @@ Table *luaH_new (lua_State *L) {
   t->alimit = 0;
   t->using_next = NULL;
   t->is_shared = 0;
+  t->viewed = 0;
   l_rwlock_init(&t->lock);
   setnodevector(L, t, 0);
   return t;
@@ -1484,6 +1486,8 @@ const TValue *luaH_get (Table *t, const TValue *key) {
  */
 void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                    const TValue *slot, TValue *value) {
+  if (ttisnumber(key))  /* only integer keys can be seen by views */
+    luaSL_checkviews(L, t);
   if (isabstkey(slot))
     luaH_newkey(L, t, key, value);
   else
@@ -1523,6 +1527,7 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
     setivalue(&k, key);
     log_key_value(&k, value, "SET");
   }
+  luaSL_checkviews(L, t);
   if (isabstkey(p)) {
     TValue k;
     setivalue(&k, key);
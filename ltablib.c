@@ -22,6 +22,8 @@
 
 #include "lstate.h"
 #include "lobject.h"
+#include "lgc.h"
+#include "lvm.h"
 
 
 /*
@@ -284,6 +286,17 @@ static int tmove (lua_State *L) {
 }
 
 
+/*
+** table.view(t [, i [, j [, step]]]): a view of 't[i:j:step]' that reads
+** the source in place and copies it only when one of them is written.
+*/
+static int tview (lua_State *L) {
+  lua_settop(L, 4);
+  lua_sliceview(L, 1, 2, 3, 4);
+  return 1;
+}
+
+
 static void addfield (lua_State *L, luaL_Buffer *b, lua_Integer i) {
   lua_geti(L, 1, i);
   if (l_unlikely(!lua_isstring(L, -1)))
@@ -536,14 +549,556 @@ static void auxsort (lua_State *L, IdxT lo, IdxT up,
 }
 
 
+/* }=========================================== */
+
+
+/*
+** {===========================================
+** Sorting homogeneous arrays in place
+** (pdqsort: Orson Peters, "Pattern-defeating Quicksort", 2021;
+**  block partitioning: Edelkamp & Weiss, "BlockQuicksort", 2016)
+** ============================================
+**
+** Without a comparator, when elements 1..n all live in the array part
+** and are all numbers or all strings, 'table.sort' sorts the TValues
+** directly. Integer-only and float-only arrays use an LSD radix sort on
+** order-preserving keys; other cases use pdqsort with 'luaV_lessthan'
+** semantics. Anything else (holes, other types, NaNs, slice views)
+** takes the generic path above. Comparisons here cannot raise errors or
+** allocate, so the array cannot move while it is being sorted.
+*/
+
+/* below this size, sort by insertion */
+#define PDQ_INSERTION	24
+
+/* above this size, choose pivots by Tukey's ninther */
+#define PDQ_NINTHER	128
+
+/* most elements moved by 'partialinsertion' before giving up */
+#define PDQ_PARTIALMAX	8
+
+/* elements per block when partitioning without branches */
+#define PDQ_BLOCK	64
+
+/* radix sort only arrays at least this long */
+#define RADIXMIN	256
+
+
+typedef struct SortState {
+  lua_State *L;
+  int branchless;  /* cheap comparisons: use block partitioning */
+} SortState;
+
+
+static int sortlt (SortState *S, const TValue *a, const TValue *b) {
+  if (ttisinteger(a) && ttisinteger(b))
+    return ivalue(a) < ivalue(b);
+  else if (ttisfloat(a) && ttisfloat(b))
+    return luai_numlt(fltvalue(a), fltvalue(b));
+  else
+    return luaV_lessthan(S->L, a, b);
+}
+
+#define LT(a,b)		sortlt(S, a, b)
+
+#define tvswap(L,a,b) \
+	{ TValue t_; setobj(L, &t_, a); setobj(L, a, b); setobj(L, b, &t_); }
+
+
+static void insertion (SortState *S, TValue *begin, TValue *end) {
+  lua_State *L = S->L;
+  TValue *cur;
+  if (begin == end) return;
+  for (cur = begin + 1; cur < end; cur++) {
+    TValue *sift = cur;
+    if (LT(sift, sift - 1)) {
+      TValue tmp;
+      setobj(L, &tmp, sift);
+      do {
+        setobj(L, sift, sift - 1);
+        sift--;
+      } while (sift != begin && LT(&tmp, sift - 1));
+      setobj(L, sift, &tmp);
+    }
+  }
+}
+
+
+/* insertion sort for a range preceded by an element not above any of it */
+static void unguardedinsertion (SortState *S, TValue *begin, TValue *end) {
+  lua_State *L = S->L;
+  TValue *cur;
+  for (cur = begin + 1; cur < end; cur++) {
+    TValue *sift = cur;
+    if (LT(sift, sift - 1)) {
+      TValue tmp;
+      setobj(L, &tmp, sift);
+      do {
+        setobj(L, sift, sift - 1);
+        sift--;
+      } while (LT(&tmp, sift - 1));
+      setobj(L, sift, &tmp);
+    }
+  }
+}
+
+
+/*
+** Insertion sort that gives up after moving PDQ_PARTIALMAX elements;
+** returns whether the range ended up sorted.
+*/
+static int partialinsertion (SortState *S, TValue *begin, TValue *end) {
+  lua_State *L = S->L;
+  size_t moved = 0;
+  TValue *cur;
+  if (begin == end) return 1;
+  for (cur = begin + 1; cur < end; cur++) {
+    TValue *sift = cur;
+    if (LT(sift, sift - 1)) {
+      TValue tmp;
+      setobj(L, &tmp, sift);
+      do {
+        setobj(L, sift, sift - 1);
+        sift--;
+      } while (sift != begin && LT(&tmp, sift - 1));
+      setobj(L, sift, &tmp);
+      moved += cur - sift;
+    }
+    if (moved > PDQ_PARTIALMAX) return 0;
+  }
+  return 1;
+}
+
+
+static void sort2 (SortState *S, TValue *a, TValue *b) {
+  if (LT(b, a)) tvswap(S->L, a, b);
+}
+
+static void sort3 (SortState *S, TValue *a, TValue *b, TValue *c) {
+  sort2(S, a, b);
+  sort2(S, b, c);
+  sort2(S, a, b);
+}
+
+
+static void siftdown (SortState *S, TValue *a, size_t i, size_t n) {
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if (c >= n) break;
+    if (c + 1 < n && LT(a + c, a + c + 1)) c++;
+    if (!LT(a + i, a + c)) break;
+    tvswap(S->L, a + i, a + c);
+    i = c;
+  }
+}
+
+/* last resort after too many bad partitions: O(n log n) guaranteed */
+static void heapsort (SortState *S, TValue *begin, TValue *end) {
+  size_t n = end - begin;
+  size_t i;
+  for (i = n / 2; i-- > 0; )
+    siftdown(S, begin, i, n);
+  for (i = n; i-- > 1; ) {
+    tvswap(S->L, begin, begin + i);
+    siftdown(S, begin, 0, i);
+  }
+}
+
+
+/*
+** Partition [begin, end) around the pivot *begin: elements less than
+** the pivot go left, the others right. Returns the final pivot position
+** and sets '*done' if no element had to move.
+*/
+static TValue *partitionright (SortState *S, TValue *begin, TValue *end,
+                               int *done) {
+  lua_State *L = S->L;
+  TValue pivot;
+  TValue *first = begin, *last = end, *pos;
+  setobj(L, &pivot, begin);
+  while (LT(++first, &pivot)) ;
+  if (first - 1 == begin)
+    while (first < last && !LT(--last, &pivot)) ;
+  else
+    while (!LT(--last, &pivot)) ;
+  *done = (first >= last);
+  while (first < last) {
+    tvswap(L, first, last);
+    while (LT(++first, &pivot)) ;
+    while (!LT(--last, &pivot)) ;
+  }
+  pos = first - 1;
+  setobj(L, begin, pos);
+  setobj(L, pos, &pivot);
+  return pos;
+}
+
+
+static void swapoffsets (lua_State *L, TValue *first, TValue *last,
+                         unsigned char *ol, unsigned char *or_, int num,
+                         int useswaps) {
+  int i;
+  if (useswaps) {
+    for (i = 0; i < num; i++)
+      tvswap(L, first + ol[i], last - or_[i]);
+  }
+  else if (num > 0) {  /* cyclic permutation: fewer moves than swaps */
+    TValue *l = first + ol[0];
+    TValue *r = last - or_[0];
+    TValue tmp;
+    setobj(L, &tmp, l);
+    setobj(L, l, r);
+    for (i = 1; i < num; i++) {
+      l = first + ol[i];
+      setobj(L, r, l);
+      r = last - or_[i];
+      setobj(L, l, r);
+    }
+    setobj(L, r, &tmp);
+  }
+}
+
+
+/*
+** Same as 'partitionright', but comparing whole blocks first and
+** recording misplaced offsets without branching on the outcome, so
+** cheap comparisons do not stall on mispredictions.
+*/
+static TValue *partitionblock (SortState *S, TValue *begin, TValue *end,
+                               int *done) {
+  lua_State *L = S->L;
+  TValue pivot;
+  TValue *first = begin, *last = end, *pos;
+  setobj(L, &pivot, begin);
+  while (LT(++first, &pivot)) ;
+  if (first - 1 == begin)
+    while (first < last && !LT(--last, &pivot)) ;
+  else
+    while (!LT(--last, &pivot)) ;
+  *done = (first >= last);
+  if (!*done) {
+    unsigned char ol[PDQ_BLOCK], or_[PDQ_BLOCK];
+    TValue *basel, *baser;
+    int numl = 0, numr = 0, startl = 0, startr = 0, num;
+    tvswap(L, first, last);
+    first++;
+    basel = first;
+    baser = last;
+    while (first < last) {
+      /* fill the empty offset blocks with misplaced elements */
+      size_t unknown = last - first;
+      size_t lsplit = (numl == 0) ? ((numr == 0) ? unknown / 2 : unknown) : 0;
+      size_t rsplit = (numr == 0) ? unknown - lsplit : 0;
+      size_t i;
+      if (lsplit > PDQ_BLOCK) lsplit = PDQ_BLOCK;
+      if (rsplit > PDQ_BLOCK) rsplit = PDQ_BLOCK;
+      for (i = 0; i < lsplit; i++, first++) {
+        ol[numl] = cast_byte(i);
+        numl += !LT(first, &pivot);
+      }
+      for (i = 0; i < rsplit; i++) {
+        or_[numr] = cast_byte(i + 1);
+        numr += LT(--last, &pivot);
+      }
+      /* swap as many pairs as both blocks have */
+      num = (numl < numr) ? numl : numr;
+      swapoffsets(L, basel, baser, ol + startl, or_ + startr, num,
+                  numl == numr);
+      numl -= num; numr -= num;
+      startl += num; startr += num;
+      if (numl == 0) {
+        startl = 0;
+        basel = first;
+      }
+      if (numr == 0) {
+        startr = 0;
+        baser = last;
+      }
+    }
+    /* one block may still hold misplaced elements: move them to the gap */
+    if (numl) {
+      while (numl--) {
+        --last;
+        tvswap(L, basel + ol[startl + numl], last);
+      }
+      first = last;
+    }
+    if (numr) {
+      while (numr--) {
+        tvswap(L, baser - or_[startr + numr], first);
+        first++;
+      }
+      last = first;
+    }
+  }
+  pos = first - 1;
+  setobj(L, begin, pos);
+  setobj(L, pos, &pivot);
+  return pos;
+}
+
+
+/*
+** Partition with elements equal to the pivot going left. Used when the
+** pivot equals the element before the range: everything equal to it is
+** then in its final place.
+*/
+static TValue *partitionleft (SortState *S, TValue *begin, TValue *end) {
+  lua_State *L = S->L;
+  TValue pivot;
+  TValue *first = begin, *last = end, *pos;
+  setobj(L, &pivot, begin);
+  while (LT(&pivot, --last)) ;
+  if (last + 1 == end)
+    while (first < last && !LT(&pivot, ++first)) ;
+  else
+    while (!LT(&pivot, ++first)) ;
+  while (first < last) {
+    tvswap(L, first, last);
+    while (LT(&pivot, --last)) ;
+    while (!LT(&pivot, ++first)) ;
+  }
+  pos = last;
+  setobj(L, begin, pos);
+  setobj(L, pos, &pivot);
+  return pos;
+}
+
+
+/* break patterns that made a partition unbalanced */
+static void shuffle (lua_State *L, TValue *begin, TValue *pos, TValue *end) {
+  size_t ls = pos - begin, rs = end - (pos + 1);
+  if (ls >= PDQ_INSERTION) {
+    tvswap(L, begin, begin + ls / 4);
+    tvswap(L, pos - 1, pos - ls / 4);
+    if (ls > PDQ_NINTHER) {
+      tvswap(L, begin + 1, begin + (ls / 4 + 1));
+      tvswap(L, begin + 2, begin + (ls / 4 + 2));
+      tvswap(L, pos - 2, pos - (ls / 4 + 1));
+      tvswap(L, pos - 3, pos - (ls / 4 + 2));
+    }
+  }
+  if (rs >= PDQ_INSERTION) {
+    tvswap(L, pos + 1, pos + (1 + rs / 4));
+    tvswap(L, end - 1, end - rs / 4);
+    if (rs > PDQ_NINTHER) {
+      tvswap(L, pos + 2, pos + (2 + rs / 4));
+      tvswap(L, pos + 3, pos + (3 + rs / 4));
+      tvswap(L, end - 2, end - (1 + rs / 4));
+      tvswap(L, end - 3, end - (2 + rs / 4));
+    }
+  }
+}
+
+
+/*
+** Sort [begin, end). 'bad' counts the unbalanced partitions still
+** allowed before switching to heapsort; 'leftmost' tells whether there
+** is no element before 'begin' bounding the range from below. Recurses
+** into the smaller side, so the C stack stays logarithmic.
+*/
+static void pdqsort (SortState *S, TValue *begin, TValue *end, int bad,
+                     int leftmost) {
+  lua_State *L = S->L;
+  for (;;) {
+    size_t size = end - begin;
+    size_t half = size / 2;
+    TValue *pos;
+    int done;
+    if (size < PDQ_INSERTION) {
+      if (leftmost) insertion(S, begin, end);
+      else unguardedinsertion(S, begin, end);
+      return;
+    }
+    if (size > PDQ_NINTHER) {
+      sort3(S, begin, begin + half, end - 1);
+      sort3(S, begin + 1, begin + (half - 1), end - 2);
+      sort3(S, begin + 2, begin + (half + 1), end - 3);
+      sort3(S, begin + (half - 1), begin + half, begin + (half + 1));
+      tvswap(L, begin, begin + half);
+    }
+    else
+      sort3(S, begin + half, begin, end - 1);
+    /* pivot equal to its left bound? then equal elements are done */
+    if (!leftmost && !LT(begin - 1, begin)) {
+      begin = partitionleft(S, begin, end) + 1;
+      continue;
+    }
+    pos = S->branchless ? partitionblock(S, begin, end, &done)
+                        : partitionright(S, begin, end, &done);
+    {
+      size_t ls = pos - begin, rs = end - (pos + 1);
+      if (ls < size / 8 || rs < size / 8) {  /* highly unbalanced? */
+        if (--bad == 0) {
+          heapsort(S, begin, end);
+          return;
+        }
+        shuffle(L, begin, pos, end);
+      }
+      else if (done && partialinsertion(S, begin, pos) &&
+                       partialinsertion(S, pos + 1, end))
+        return;  /* input was (nearly) sorted already */
+      if (ls < rs) {
+        pdqsort(S, begin, pos, bad, leftmost);
+        begin = pos + 1;
+        leftmost = 0;
+      }
+      else {
+        pdqsort(S, pos + 1, end, bad, 0);
+        end = pos;
+      }
+    }
+  }
+}
+
+
+/*
+** LSD radix sort of 'n' order-preserving keys, one byte per pass.
+** Passes where every key has the same byte are skipped. Returns the
+** array holding the result ('a' or 'tmp').
+*/
+static lua_Unsigned *radixsort (lua_Unsigned *a, lua_Unsigned *tmp,
+                                size_t n) {
+  unsigned int count[sizeof(lua_Unsigned)][256];
+  unsigned int pass;
+  size_t i;
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < n; i++) {
+    lua_Unsigned k = a[i];
+    for (pass = 0; pass < sizeof(lua_Unsigned); pass++)
+      count[pass][(k >> (8 * pass)) & 0xff]++;
+  }
+  for (pass = 0; pass < sizeof(lua_Unsigned); pass++) {
+    unsigned int *c = count[pass];
+    unsigned int sum = 0;
+    int b;
+    if (c[(a[0] >> (8 * pass)) & 0xff] == n)
+      continue;  /* all keys share this byte */
+    for (b = 0; b < 256; b++) {  /* counts to starting positions */
+      unsigned int cb = c[b];
+      c[b] = sum;
+      sum += cb;
+    }
+    for (i = 0; i < n; i++) {
+      lua_Unsigned k = a[i];
+      tmp[c[(k >> (8 * pass)) & 0xff]++] = k;
+    }
+    { lua_Unsigned *t = a; a = tmp; tmp = t; }
+  }
+  return a;
+}
+
+
+#define SIGNBIT		((lua_Unsigned)1 << (sizeof(lua_Unsigned) * 8 - 1))
+
+/* floats can be radix sorted when they have the size of the keys */
+#define RADIXFLT	(sizeof(lua_Number) == sizeof(lua_Unsigned))
+
+/* order-preserving key for a float and back (after 'memcpy' to bits) */
+#define flt2key(u)	(((u) & SIGNBIT) ? ~(u) : ((u) | SIGNBIT))
+#define key2flt(k)	(((k) & SIGNBIT) ? ((k) ^ SIGNBIT) : ~(k))
+
+
+/*
+** Radix sort an array of integers only or floats only. Returns 0 if
+** there was no memory for the keys, leaving the array untouched.
+*/
+static int radixarray (lua_State *L, TValue *a, size_t n, int isint) {
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  lua_Unsigned *keys, *res;
+  size_t i;
+  if (n > (~(size_t)0) / (2 * sizeof(lua_Unsigned)))
+    return 0;
+  keys = (lua_Unsigned *)f(ud, NULL, 0, 2 * n * sizeof(lua_Unsigned));
+  if (keys == NULL)
+    return 0;
+  if (isint) {
+    for (i = 0; i < n; i++)
+      keys[i] = l_castS2U(ivalue(&a[i])) ^ SIGNBIT;
+  }
+  else {
+    for (i = 0; i < n; i++) {
+      lua_Number x = fltvalue(&a[i]);
+      lua_Unsigned u;
+      memcpy(&u, &x, sizeof(u));
+      keys[i] = flt2key(u);
+    }
+  }
+  res = radixsort(keys, keys + n, n);
+  if (isint) {
+    for (i = 0; i < n; i++)
+      setivalue(&a[i], l_castU2S(res[i] ^ SIGNBIT));
+  }
+  else {
+    for (i = 0; i < n; i++) {
+      lua_Unsigned u = key2flt(res[i]);
+      lua_Number x;
+      memcpy(&x, &u, sizeof(x));
+      setfltvalue(&a[i], x);
+    }
+  }
+  f(ud, keys, 2 * n * sizeof(lua_Unsigned), 0);
+  return 1;
+}
+
+
+/*
+** Try to sort t[1..n] in place. Returns 0, without touching the table,
+** when it does not qualify.
+*/
+static int fastsort (lua_State *L, lua_Integer n) {
+  Table *t;
+  TValue *a;
+  size_t i, nint = 0, nflt = 0, nstr = 0;
+  SortState S;
+  int bad = 0;
+  if (lua_type(L, 1) != LUA_TTABLE || !lua_isnil(L, 2))
+    return 0;
+  t = (Table *)lua_topointer(L, 1);
+  if (t->viewed || (lua_Unsigned)n > t->alimit)
+    return 0;
+  a = t->array;
+  for (i = 0; i < (size_t)n; i++) {
+    const TValue *v = &a[i];
+    if (ttisinteger(v)) nint++;
+    else if (ttisfloat(v)) {
+      if (luai_numisnan(fltvalue(v))) return 0;
+      nflt++;
+    }
+    else if (ttisstring(v)) nstr++;
+    else return 0;
+  }
+  if (nstr != 0 && nstr != (size_t)n)
+    return 0;  /* strings mixed with numbers */
+  if ((size_t)n >= RADIXMIN && (nint == (size_t)n ||
+                                (nflt == (size_t)n && RADIXFLT))) {
+    if (radixarray(L, a, (size_t)n, nint == (size_t)n))
+      return 1;
+  }
+  S.L = L;
+  S.branchless = (nstr == 0);
+  for (i = (size_t)n; i > 1; i >>= 1) bad++;
+  pdqsort(&S, a, a + n, bad, 1);
+  return 1;
+}
+
+/* }=========================================== */
+
+
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
+    int done;
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    lua_locktable(L, 1);
+    done = fastsort(L, n);
+    lua_unlocktable(L, 1);
+    if (!done)
+      auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
 }
@@ -795,6 +1350,7 @@ static const luaL_Reg tab_funcs[] = {
 	{"unpack", tunpack},
 	{"remove", tremove},
 	{"move", tmove},
+	{"view", tview},
 	{"sort", sort},
 	{NULL, NULL}
 };
@@ -8,12 +8,16 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <time.h>
+#include <math.h>
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "lapi.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
+#include "ltable.h"
 #include "lundump.h"
 #include "ltcc.h"
 #include "lopnames.h"
@@ -100,6 +104,80 @@ LUA_API void lua_tcc_store_results(lua_State *L, int start_reg, int count) {
     }
 }
 
+/*
+** Direct-slot helpers for the "fast" emission mode.  Register indices
+** passed here are always positive stack indices of the running C
+** function (R[x] is index x + 1), so they are resolved against
+** 'ci->func' without going through the generic index translation.
+** Constants live in a table stored as upvalue 'kup' of every closure.
+*/
+#define tcc_reg(L,idx)	s2v((L)->ci->func.p + (idx))
+
+static const TValue *tcc_kvalue(lua_State *L, int kup, int slot) {
+    CClosure *f = clCvalue(s2v(L->ci->func.p));
+    return luaH_getint(hvalue(&f->upvalue[kup - 1]), slot);
+}
+
+LUA_API void lua_tcc_move(lua_State *L, int from, int to) {
+    lua_lock(L);
+    setobj2s(L, L->ci->func.p + to, tcc_reg(L, from));
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_pushk(lua_State *L, int kup, int slot) {
+    lua_lock(L);
+    setobj2s(L, L->top.p, tcc_kvalue(L, kup, slot));
+    api_incr_top(L);
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_loadk_slot(lua_State *L, int dest, int kup, int slot) {
+    lua_lock(L);
+    setobj2s(L, L->ci->func.p + dest, tcc_kvalue(L, kup, slot));
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_setint(lua_State *L, int dest, lua_Integer v) {
+    lua_lock(L);
+    setivalue(tcc_reg(L, dest), v);
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_setflt(lua_State *L, int dest, lua_Number v) {
+    lua_lock(L);
+    setfltvalue(tcc_reg(L, dest), v);
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_setbool(lua_State *L, int dest, int b) {
+    lua_lock(L);
+    if (b) setbtvalue(tcc_reg(L, dest));
+    else setbfvalue(tcc_reg(L, dest));
+    lua_unlock(L);
+}
+
+LUA_API void lua_tcc_setnil(lua_State *L, int dest, int n) {
+    lua_lock(L);
+    for (int i = 0; i < n; i++)
+        setnilvalue(tcc_reg(L, dest + i));
+    lua_unlock(L);
+}
+
+LUA_API int lua_tcc_getint(lua_State *L, int idx, lua_Integer *v) {
+    const TValue *o = tcc_reg(L, idx);
+    if (!ttisinteger(o)) return 0;
+    *v = ivalue(o);
+    return 1;
+}
+
+LUA_API int lua_tcc_getnum(lua_State *L, int idx, lua_Number *v) {
+    const TValue *o = tcc_reg(L, idx);
+    if (ttisfloat(o)) *v = fltvalue(o);
+    else if (ttisinteger(o)) *v = cast_num(ivalue(o));
+    else return 0;
+    return 1;
+}
+
 /*
 ** Interface Obfuscation Support
 */
@@ -219,6 +297,7 @@ LUA_API void *lua_tcc_get_interface(lua_State *L, int seed) {
 typedef struct ProtoInfo {
     Proto *p;
     int id;
+    int kbase;  /* first constant-table slot of this proto, -1 if unused */
     char name[16];
 } ProtoInfo;
 
@@ -229,6 +308,7 @@ static void collect_protos(Proto *p, int *count, ProtoInfo **list, int *capacity
     }
     (*list)[*count].p = p;
     (*list)[*count].id = *count;
+    (*list)[*count].kbase = -1;
     if (obfuscate) {
         get_random_name((*list)[*count].name, sizeof((*list)[*count].name), seed);
     } else {
@@ -293,8 +373,27 @@ static void emit_quoted_string(luaL_Buffer *B, const char *s, size_t len) {
     add_fmt(B, "\"");
 }
 
+/* Upvalue index holding the constant table of a fast-mode closure */
+#define kupval(p)	((p)->sizeupvalues + 1)
+
+/* Emit code to push a string constant */
+static void emit_kstring_push(luaL_Buffer *B, Proto *p, int k_index, int str_encrypt, int seed, int obfuscate, int kbase) {
+    TString *ts = tsvalue(&p->k[k_index]);
+    unsigned int obf_seed = seed + k_index;
+    if (kbase >= 0) {
+        add_fmt(B, "    lua_tcc_pushk(L, %s, ", obf_int(kupval(p), &obf_seed, obfuscate));
+        add_fmt(B, "%s);\n", obf_int(kbase + k_index + 1, &obf_seed, obfuscate));
+    } else if (str_encrypt) {
+        emit_encrypted_string_push(B, getstr(ts), tsslen(ts), seed);
+    } else {
+        add_fmt(B, "    lua_pushlstring(L, ");
+        emit_quoted_string(B, getstr(ts), tsslen(ts));
+        add_fmt(B, ", %s);\n", obf_int((int)tsslen(ts), &obf_seed, obfuscate));
+    }
+}
+
 /* Emit code to push a constant */
-static void emit_loadk(luaL_Buffer *B, Proto *p, int k_index, int str_encrypt, int seed, int obfuscate) {
+static void emit_loadk(luaL_Buffer *B, Proto *p, int k_index, int str_encrypt, int seed, int obfuscate, int kbase) {
     TValue *k = &p->k[k_index];
     unsigned int obf_seed = seed + k_index;
     switch (ttype(k)) {
@@ -311,24 +410,90 @@ static void emit_loadk(luaL_Buffer *B, Proto *p, int k_index, int str_encrypt, i
                 add_fmt(B, "    lua_pushnumber(L, %f);\n", fltvalue(k));
             }
             break;
-        case LUA_TSTRING: {
-            TString *ts = tsvalue(k);
-            if (str_encrypt) {
-                emit_encrypted_string_push(B, getstr(ts), tsslen(ts), seed);
-            } else {
-                add_fmt(B, "    lua_pushlstring(L, ");
-                emit_quoted_string(B, getstr(ts), tsslen(ts));
-                add_fmt(B, ", %s);\n", obf_int((int)tsslen(ts), &obf_seed, obfuscate));
-            }
+        case LUA_TSTRING:
+            emit_kstring_push(B, p, k_index, str_encrypt, seed, obfuscate, kbase);
             break;
-        }
         default:
             add_fmt(B, "    lua_pushnil(L); /* UNKNOWN CONSTANT TYPE */\n");
             break;
     }
 }
 
-static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, ProtoInfo *protos, int proto_count, int use_pure_c, int str_encrypt, int seed, int obfuscate) {
+/*
+** Fast mode: load constant K[k_index] straight into register 'a'.
+** Returns 0 when the constant has no direct-slot form.
+*/
+static int emit_loadk_fast(luaL_Buffer *B, Proto *p, int k_index, int a, int kbase, unsigned int *obf_seed, int obfuscate) {
+    TValue *k = &p->k[k_index];
+    if (ttisstring(k)) {
+        add_fmt(B, "    lua_tcc_loadk_slot(L, %s, ", obf_int(a + 1, obf_seed, obfuscate));
+        add_fmt(B, "%s, ", obf_int(kupval(p), obf_seed, obfuscate));
+        add_fmt(B, "%s);\n", obf_int(kbase + k_index + 1, obf_seed, obfuscate));
+    } else if (ttisinteger(k)) {
+        if (ivalue(k) == LUA_MININTEGER) return 0;
+        add_fmt(B, "    lua_tcc_setint(L, %s, %lldLL);\n", obf_int(a + 1, obf_seed, obfuscate), (long long)ivalue(k));
+    } else if (ttisfloat(k) && isfinite(fltvalue(k))) {
+        add_fmt(B, "    lua_tcc_setflt(L, %s, %.17g);\n", obf_int(a + 1, obf_seed, obfuscate), fltvalue(k));
+    } else if (ttisboolean(k)) {
+        add_fmt(B, "    lua_tcc_setbool(L, %s, %d);\n", obf_int(a + 1, obf_seed, obfuscate), !l_isfalse(k));
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+** Fast mode: arithmetic between R[b] and a statically known numeric
+** constant is emitted as a C expression guarded by a type check on the
+** register; anything else (strings, metamethods) goes to 'lua_arith'.
+** Returns 0 when the operation has no such form.
+*/
+static int emit_arith_fast(luaL_Buffer *B, OpCode op, int a, int b, const TValue *k, unsigned int *obf_seed, int obfuscate) {
+    const char *op_str;
+    int op_enum;
+    int int_only = 0;
+    char k_str[64];
+    switch (op) {
+        case OP_ADDI: case OP_ADDK: op_str = "+"; op_enum = LUA_OPADD; break;
+        case OP_SUBK: op_str = "-"; op_enum = LUA_OPSUB; break;
+        case OP_MULK: op_str = "*"; op_enum = LUA_OPMUL; break;
+        case OP_DIVK: op_str = "/"; op_enum = LUA_OPDIV; break;
+        case OP_BANDK: op_str = "&"; op_enum = LUA_OPBAND; int_only = 1; break;
+        case OP_BORK: op_str = "|"; op_enum = LUA_OPBOR; int_only = 1; break;
+        case OP_BXORK: op_str = "^"; op_enum = LUA_OPBXOR; int_only = 1; break;
+        default: return 0;
+    }
+    if (ttisinteger(k) && ivalue(k) != LUA_MININTEGER)
+        snprintf(k_str, sizeof(k_str), "%lldLL", (long long)ivalue(k));
+    else if (ttisfloat(k) && !int_only && isfinite(fltvalue(k)))
+        snprintf(k_str, sizeof(k_str), "%.17g", fltvalue(k));
+    else
+        return 0;
+
+    const char *kw = "if";
+    add_fmt(B, "    {\n");
+    add_fmt(B, "        lua_Integer i_; lua_Number n_; (void)i_; (void)n_;\n");
+    if (ttisinteger(k) && op != OP_DIVK) {
+        add_fmt(B, "        %s (lua_tcc_getint(L, %s, &i_))\n", kw, obf_int(b + 1, obf_seed, obfuscate));
+        add_fmt(B, "            lua_tcc_setint(L, %s, (lua_Integer)((lua_Unsigned)i_ %s (lua_Unsigned)%s));\n", obf_int(a + 1, obf_seed, obfuscate), op_str, k_str);
+        kw = "else if";
+    }
+    if (!int_only) {
+        add_fmt(B, "        %s (lua_tcc_getnum(L, %s, &n_))\n", kw, obf_int(b + 1, obf_seed, obfuscate));
+        add_fmt(B, "            lua_tcc_setflt(L, %s, n_ %s (lua_Number)%s);\n", obf_int(a + 1, obf_seed, obfuscate), op_str, k_str);
+    }
+    add_fmt(B, "        else {\n");
+    add_fmt(B, "            lua_pushvalue(L, %s);\n", obf_int(b + 1, obf_seed, obfuscate));
+    if (ttisinteger(k)) add_fmt(B, "            lua_pushinteger(L, %s);\n", k_str);
+    else add_fmt(B, "            lua_pushnumber(L, %s);\n", k_str);
+    add_fmt(B, "            lua_arith(L, %s);\n", obf_int(op_enum, obf_seed, obfuscate));
+    add_fmt(B, "            lua_replace(L, %s);\n", obf_int(a + 1, obf_seed, obfuscate));
+    add_fmt(B, "        }\n");
+    add_fmt(B, "    }\n");
+    return 1;
+}
+
+static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, ProtoInfo *protos, int proto_count, int use_pure_c, int str_encrypt, int seed, int obfuscate, int kbase) {
     OpCode op = GET_OPCODE(i);
     int a = GETARG_A(i);
 
@@ -341,6 +506,11 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
     switch (op) {
         case OP_MOVE: {
             int b = GETARG_B(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_move(L, %s, ", obf_int(b + 1, &obf_seed, obfuscate));
+                add_fmt(B, "%s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
@@ -348,6 +518,9 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_LOADK: {
             int bx = GETARG_Bx(i);
             TValue *k = &p->k[bx];
+            if (kbase >= 0 && emit_loadk_fast(B, p, bx, a, kbase, &obf_seed, obfuscate)) {
+                break;
+            }
             if (ttisstring(k)) {
                  if (str_encrypt) {
                      emit_encrypted_string_push(B, getstr(tsvalue(k)), tsslen(tsvalue(k)), seed);
@@ -362,23 +535,36 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             } else if (ttisnumber(k)) {
                  add_fmt(B, "    lua_tcc_loadk_flt(L, %s, %f);\n", obf_int(a + 1, &obf_seed, obfuscate), fltvalue(k));
             } else {
-                 emit_loadk(B, p, bx, str_encrypt, seed, obfuscate);
+                 emit_loadk(B, p, bx, str_encrypt, seed, obfuscate, kbase);
                  add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             }
             break;
         }
         case OP_LOADI: {
             int sbx = GETARG_sBx(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_setint(L, %s, %d);\n", obf_int(a + 1, &obf_seed, obfuscate), sbx);
+                break;
+            }
             add_fmt(B, "    lua_tcc_loadk_int(L, %s, %d);\n", obf_int(a + 1, &obf_seed, obfuscate), sbx);
             break;
         }
          case OP_LOADF: {
             int sbx = GETARG_sBx(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_setflt(L, %s, (lua_Number)%d);\n", obf_int(a + 1, &obf_seed, obfuscate), sbx);
+                break;
+            }
             add_fmt(B, "    lua_tcc_loadk_flt(L, %s, (lua_Number)%d);\n", obf_int(a + 1, &obf_seed, obfuscate), sbx);
             break;
         }
         case OP_LOADNIL: {
             int b = GETARG_B(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_setnil(L, %s, ", obf_int(a + 1, &obf_seed, obfuscate));
+                add_fmt(B, "%s);\n", obf_int(b + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    for (int i = 0; i <= %s; i++) {\n", obf_int(b, &obf_seed, obfuscate));
             add_fmt(B, "        lua_pushnil(L);\n");
             add_fmt(B, "        lua_replace(L, %s + i);\n", obf_int(a + 1, &obf_seed, obfuscate));
@@ -386,6 +572,10 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             break;
         }
         case OP_LOADFALSE:
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_setbool(L, %s, 0);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushboolean(L, 0);\n");
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
@@ -401,12 +591,21 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             break;
         }
         case OP_LOADTRUE:
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_tcc_setbool(L, %s, 1);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushboolean(L, 1);\n");
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
 
         case OP_GETUPVAL: {
             int b = GETARG_B(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_copy(L, lua_upvalueindex(%s), ", obf_int(b + 1, &obf_seed, obfuscate));
+                add_fmt(B, "%s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, lua_upvalueindex(%s));\n", obf_int(b + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
@@ -415,6 +614,9 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             if (pc + 1 < p->sizecode && GET_OPCODE(p->code[pc+1]) == OP_EXTRAARG) {
                 int ax = GETARG_Ax(p->code[pc+1]);
                 TValue *k = &p->k[ax];
+                if (kbase >= 0 && emit_loadk_fast(B, p, ax, a, kbase, &obf_seed, obfuscate)) {
+                    break;
+                }
                 if (ttisstring(k)) {
                      if (str_encrypt) {
                          emit_encrypted_string_push(B, getstr(tsvalue(k)), tsslen(tsvalue(k)), seed);
@@ -427,7 +629,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                 } else if (ttisinteger(k)) {
                      add_fmt(B, "    lua_tcc_loadk_int(L, %s, %lld);\n", obf_int(a + 1, &obf_seed, obfuscate), (long long)ivalue(k));
                 } else {
-                     emit_loadk(B, p, ax, str_encrypt, seed, obfuscate);
+                     emit_loadk(B, p, ax, str_encrypt, seed, obfuscate, kbase);
                      add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
                 }
             }
@@ -435,6 +637,11 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         }
         case OP_SETUPVAL: {
             int b = GETARG_B(i);
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_copy(L, %s, ", obf_int(a + 1, &obf_seed, obfuscate));
+                add_fmt(B, "lua_upvalueindex(%s));\n", obf_int(b + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, lua_upvalueindex(%s));\n", obf_int(b + 1, &obf_seed, obfuscate));
             break;
@@ -444,7 +651,11 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int c = GETARG_C(i);
             TValue *k = &p->k[c];
             if (ttisstring(k)) {
-                 if (str_encrypt) {
+                 if (kbase >= 0) {
+                     emit_kstring_push(B, p, c, str_encrypt, seed, obfuscate, kbase);
+                     add_fmt(B, "    lua_gettable(L, lua_upvalueindex(%s));\n", obf_int(b + 1, &obf_seed, obfuscate));
+                     add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                 } else if (str_encrypt) {
                      emit_encrypted_string_push(B, getstr(tsvalue(k)), tsslen(tsvalue(k)), seed);
                      add_fmt(B, "    lua_getfield(L, lua_upvalueindex(%s), lua_tostring(L, %s));\n", obf_int(b + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
                      add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
@@ -456,7 +667,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                  }
             } else {
                  add_fmt(B, "    lua_pushvalue(L, lua_upvalueindex(%s));\n", obf_int(b + 1, &obf_seed, obfuscate)); // table
-                 emit_loadk(B, p, c, str_encrypt, seed, obfuscate); // key
+                 emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase); // key
                  add_fmt(B, "    lua_gettable(L, %s);\n", obf_int(-2, &obf_seed, obfuscate));
                  add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate)); // result to R[A]
                  add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate)); // pop table
@@ -469,11 +680,19 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int c = GETARG_C(i);
             TValue *k = &p->k[b];
             if (ttisstring(k)) {
-                if (str_encrypt) {
+                if (kbase >= 0) {
+                    emit_kstring_push(B, p, b, str_encrypt, seed, obfuscate, kbase);
+                    if (TESTARG_k(i)) {
+                        emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
+                    } else {
+                        add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
+                    }
+                    add_fmt(B, "    lua_settable(L, lua_upvalueindex(%s));\n", obf_int(a + 1, &obf_seed, obfuscate));
+                } else if (str_encrypt) {
                     emit_encrypted_string_push(B, getstr(tsvalue(k)), tsslen(tsvalue(k)), seed);
                     // RK(C)
                     if (TESTARG_k(i)) {
-                        emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+                        emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
                     } else {
                         add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
                     }
@@ -482,7 +701,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                 } else {
                     // RK(C)
                     if (TESTARG_k(i)) {
-                        emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+                        emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
                     } else {
                         add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
                     }
@@ -492,10 +711,10 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                 }
             } else {
                 add_fmt(B, "    lua_pushvalue(L, lua_upvalueindex(%s));\n", obf_int(a + 1, &obf_seed, obfuscate)); // table
-                emit_loadk(B, p, b, str_encrypt, seed, obfuscate); // key
+                emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase); // key
                 // RK(C)
                 if (TESTARG_k(i)) {
-                    emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+                    emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
                 } else {
                     add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
                 }
@@ -593,9 +812,11 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                      add_fmt(B, "    lua_pushnumber(L, (lua_Number)lua_tonumber(L, %s) %s (lua_Number)%s);\n", obf_int(b + 1, &obf_seed, obfuscate), op_str, k_str);
                 }
                 add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+            } else if (kbase >= 0 && emit_arith_fast(B, op, a, b, &p->k[c], &obf_seed, obfuscate)) {
+                /* emitted as a C expression */
             } else {
                 add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
-                emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+                emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
                 int op_enum = -1;
                 if (op == OP_ADDK) op_enum = LUA_OPADD;
                 else if (op == OP_SUBK) op_enum = LUA_OPSUB;
@@ -617,6 +838,14 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_SELF: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
+            if (kbase >= 0 && TESTARG_k(i) && ttisstring(&p->k[c])) {
+                emit_kstring_push(B, p, c, str_encrypt, seed, obfuscate, kbase);
+                add_fmt(B, "    lua_gettable(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
+                add_fmt(B, "    lua_tcc_move(L, %s, ", obf_int(b + 1, &obf_seed, obfuscate));
+                add_fmt(B, "%s);\n", obf_int(a + 2, &obf_seed, obfuscate));
+                add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 2, &obf_seed, obfuscate));
@@ -634,7 +863,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                       add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
                       add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
                  } else {
-                      emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+                      emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
                       add_fmt(B, "    lua_gettable(L, %s);\n", obf_int(-2, &obf_seed, obfuscate));
                       add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
                       add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -654,6 +883,10 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
              if (use_pure_c) {
                  add_fmt(B, "    lua_pushinteger(L, (lua_Integer)lua_tointeger(L, %s) + %d);\n", obf_int(b + 1, &obf_seed, obfuscate), sc);
                  add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+             } else if (kbase >= 0) {
+                 TValue kv;
+                 setivalue(&kv, sc);
+                 emit_arith_fast(B, op, a, b, &kv, &obf_seed, obfuscate);
              } else {
                  add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
                  add_fmt(B, "    lua_pushinteger(L, %s);\n", obf_int(sc, &obf_seed, obfuscate));
@@ -834,7 +1067,10 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                  }
             }
 
-            add_fmt(B, "    lua_pushcclosure(L, %s, %s);\n", protos[child_id].name, obf_int(child->sizeupvalues, &obf_seed, obfuscate));
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_pushvalue(L, lua_upvalueindex(%s)); /* constant table */\n", obf_int(kupval(p), &obf_seed, obfuscate));
+            }
+            add_fmt(B, "    lua_pushcclosure(L, %s, %s);\n", protos[child_id].name, obf_int(child->sizeupvalues + (kbase >= 0), &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
         }
@@ -853,7 +1089,10 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
                  }
             }
 
-            add_fmt(B, "    lua_pushcclosure(L, %s, %s); /* concept */\n", protos[child_id].name, obf_int(child->sizeupvalues, &obf_seed, obfuscate));
+            if (kbase >= 0) {
+                add_fmt(B, "    lua_pushvalue(L, lua_upvalueindex(%s)); /* constant table */\n", obf_int(kupval(p), &obf_seed, obfuscate));
+            }
+            add_fmt(B, "    lua_pushcclosure(L, %s, %s); /* concept */\n", protos[child_id].name, obf_int(child->sizeupvalues + (kbase >= 0), &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             break;
         }
@@ -918,7 +1157,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             get_label_name(target_label, sizeof(target_label), pc + 1 + 2, seed, obfuscate);
             add_fmt(B, "    {\n");
             add_fmt(B, "        lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "        int res = lua_compare(L, %s, %s, %s);\n", obf_int(-2, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate), obf_int(LUA_OPEQ, &obf_seed, obfuscate));
             add_fmt(B, "        lua_pop(L, %s);\n", obf_int(2, &obf_seed, obfuscate));
             add_fmt(B, "        if (res != %s) goto %s;\n", obf_int(k, &obf_seed, obfuscate), target_label);
@@ -1080,7 +1319,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate)); // table
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate)); // key
-            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate); // value K
+            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase); // value K
             else add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate)); // value R
             add_fmt(B, "    lua_settable(L, %s);\n", obf_int(-3, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -1090,6 +1329,12 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_GETFIELD: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
+            if (kbase >= 0 && ttisstring(&p->k[c])) {
+                emit_kstring_push(B, p, c, str_encrypt, seed, obfuscate, kbase);
+                add_fmt(B, "    lua_gettable(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
+                add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
             TValue *k = &p->k[c];
             if (ttisstring(k)) {
@@ -1112,8 +1357,15 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_SETFIELD: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
+            if (kbase >= 0 && ttisstring(&p->k[b])) {
+                emit_kstring_push(B, p, b, str_encrypt, seed, obfuscate, kbase);
+                if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
+                else add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
+                add_fmt(B, "    lua_settable(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
+                break;
+            }
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate)); // table
-            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate); // value K
+            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase); // value K
             else add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate)); // value R
             TValue *k = &p->k[b];
             if (ttisstring(k)) {
@@ -1147,7 +1399,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int b = GETARG_B(i);
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate)); // table
-            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate); // value K
+            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase); // value K
             else add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate)); // value R
             add_fmt(B, "    lua_seti(L, %s, %d);\n", obf_int(-2, &obf_seed, obfuscate), b);
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -1318,7 +1570,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
 
         case OP_NEWCLASS: {
             int bx = GETARG_Bx(i);
-            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_newclass(L, lua_tostring(L, %s));\n", obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -1334,7 +1586,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_SETMETHOD: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_setmethod(L, %s, lua_tostring(L, %s), %s);\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate), obf_int(c + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
             break;
@@ -1343,7 +1595,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_SETSTATIC: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_setstatic(L, %s, lua_tostring(L, %s), %s);\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate), obf_int(c + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
             break;
@@ -1353,7 +1605,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int b = GETARG_B(i);
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
-            emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_getsuper(L, %s, lua_tostring(L, %s));\n", obf_int(-2, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(2, &obf_seed, obfuscate));
@@ -1378,7 +1630,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int b = GETARG_B(i);
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
-            emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_getprop(L, %s, lua_tostring(L, %s));\n", obf_int(-2, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(2, &obf_seed, obfuscate));
@@ -1389,8 +1641,8 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int b = GETARG_B(i);
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate);
-            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase);
+            if (TESTARG_k(i)) emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase);
             else add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(c + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_setprop(L, %s, lua_tostring(L, %s), %s);\n", obf_int(-3, &obf_seed, obfuscate), obf_int(-2, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(3, &obf_seed, obfuscate));
@@ -1448,7 +1700,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             int b = GETARG_B(i);
             int c = GETARG_C(i);
             add_fmt(B, "    lua_pushvalue(L, %s);\n", obf_int(b + 1, &obf_seed, obfuscate));
-            emit_loadk(B, p, c, str_encrypt, seed, obfuscate); /* name */
+            emit_loadk(B, p, c, str_encrypt, seed, obfuscate, kbase); /* name */
             add_fmt(B, "    lua_checktype(L, %s, lua_tostring(L, %s));\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(2, &obf_seed, obfuscate));
             break;
@@ -1468,7 +1720,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
             char target_label[16];
             get_label_name(target_label, sizeof(target_label), pc + 1 + 2, seed, obfuscate);
             add_fmt(B, "    {\n");
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate); // Push type name K[B]
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase); // Push type name K[B]
             add_fmt(B, "        int res = lua_is(L, %s, lua_tostring(L, %s));\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "        lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
             add_fmt(B, "        if (res != %s) goto %s;\n", obf_int(k, &obf_seed, obfuscate), target_label);
@@ -1478,7 +1730,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
 
         case OP_NEWNAMESPACE: {
             int bx = GETARG_Bx(i);
-            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_newnamespace(L, lua_tostring(L, %s));\n", obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -1493,7 +1745,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
 
         case OP_NEWSUPER: {
             int bx = GETARG_Bx(i);
-            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate);
+            emit_loadk(B, p, bx, str_encrypt, seed, obfuscate, kbase);
             add_fmt(B, "    lua_newsuperstruct(L, lua_tostring(L, %s));\n", obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_replace(L, %s);\n", obf_int(a + 1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
@@ -1522,7 +1774,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
         case OP_ADDMETHOD: {
             int b = GETARG_B(i);
             int c = GETARG_C(i);
-            emit_loadk(B, p, b, str_encrypt, seed, obfuscate); // method name
+            emit_loadk(B, p, b, str_encrypt, seed, obfuscate, kbase); // method name
             add_fmt(B, "    lua_addmethod(L, %s, lua_tostring(L, %s), %s);\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate), obf_int(c, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
             break;
@@ -1542,7 +1794,7 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
 
         case OP_ERRNNIL: {
             int bx = GETARG_Bx(i);
-            emit_loadk(B, p, bx - 1, str_encrypt, seed, obfuscate); // global name
+            emit_loadk(B, p, bx - 1, str_encrypt, seed, obfuscate, kbase); // global name
             add_fmt(B, "    lua_errnnil(L, %s, lua_tostring(L, %s));\n", obf_int(a + 1, &obf_seed, obfuscate), obf_int(-1, &obf_seed, obfuscate));
             add_fmt(B, "    lua_pop(L, %s);\n", obf_int(1, &obf_seed, obfuscate));
             break;
@@ -1622,7 +1874,8 @@ static void emit_instruction(luaL_Buffer *B, Proto *p, int pc, Instruction i, Pr
 static void process_proto(luaL_Buffer *B, Proto *p, int id, ProtoInfo *protos, int proto_count, int use_pure_c, int str_encrypt, int seed, int obfuscate, int inline_opt) {
     char L_name[16] = "L";
     char vtab_name[16] = "vtab_idx";
-    unsigned int obf_seed = (unsigned int)seed + id;
+    /* Salted so local names never replay the proto-name sequence of collect_protos */
+    unsigned int obf_seed = ((unsigned int)seed ^ 0x5bd1e995u) + id;
 
     if (obfuscate) {
         get_random_name(L_name, sizeof(L_name), &obf_seed);
@@ -1651,7 +1904,7 @@ static void process_proto(luaL_Buffer *B, Proto *p, int id, ProtoInfo *protos, i
     // Iterate instructions
     for (int i = 0; i < p->sizecode; i++) {
         if (obfuscate && (my_rand(&obf_seed) % 4 == 0)) emit_junk_code(B, &obf_seed);
-        emit_instruction(B, p, i, p->code[i], protos, proto_count, use_pure_c, str_encrypt, seed, obfuscate);
+        emit_instruction(B, p, i, p->code[i], protos, proto_count, use_pure_c, str_encrypt, seed, obfuscate, protos[id].kbase);
     }
 
     if (obfuscate) {
@@ -1712,6 +1965,8 @@ static int tcc_compile(lua_State *L) {
     int seed = 0;
     int provided_flags = 0;
     int inline_opt = 0;
+    int fast = 0;
+    int nconst = 0;
 
     if (lua_gettop(L) >= 2) {
         if (lua_type(L, 2) == LUA_TTABLE) {
@@ -1740,6 +1995,10 @@ static int tcc_compile(lua_State *L) {
              if (!lua_isnil(L, -1)) inline_opt = lua_toboolean(L, -1);
              lua_pop(L, 1);
 
+             lua_getfield(L, 2, "fast");
+             if (!lua_isnil(L, -1)) fast = lua_toboolean(L, -1);
+             lua_pop(L, 1);
+
              /* Parse boolean flags from table and merge into provided_flags */
              struct { const char *name; int flag; } bool_opts[] = {
                  {"block_shuffle", OBFUSCATE_BLOCK_SHUFFLE},
@@ -1799,6 +2058,10 @@ static int tcc_compile(lua_State *L) {
                      if (!lua_isnil(L, -1)) inline_opt = lua_toboolean(L, -1);
                      lua_pop(L, 1);
 
+                     lua_getfield(L, 3, "fast");
+                     if (!lua_isnil(L, -1)) fast = lua_toboolean(L, -1);
+                     lua_pop(L, 1);
+
                      /* Parse boolean flags from table (arg 3) and merge into provided_flags */
                      struct { const char *name; int flag; } bool_opts[] = {
                          {"block_shuffle", OBFUSCATE_BLOCK_SHUFFLE},
@@ -1870,6 +2133,14 @@ static int tcc_compile(lua_State *L) {
         }
     }
 
+    /* Fast mode: lay out every proto's constants in one module-wide table */
+    if (fast) {
+        for (int i = 0; i < count; i++) {
+            protos[i].kbase = nconst;
+            nconst += protos[i].p->sizek;
+        }
+    }
+
     // Start generating C code
     luaL_Buffer B;
     luaL_buffinit(L, &B);
@@ -1944,7 +2215,25 @@ static int tcc_compile(lua_State *L) {
         add_fmt(&B, "    luaL_ref(L, LUA_REGISTRYINDEX); /* Anchor interface to prevent GC */\n");
     }
 
-    if (p->sizeupvalues > 0) {
+    if (fast) {
+         if (p->sizeupvalues > 0) {
+             add_fmt(&B, "    lua_pushglobaltable(L);\n"); // Upvalue 1
+             for (int k = 1; k < p->sizeupvalues; k++) {
+                 add_fmt(&B, "    lua_pushnil(L);\n");
+             }
+         }
+         /* Constant table, materialized once and shared as the last upvalue */
+         add_fmt(&B, "    lua_createtable(L, %d, 0);\n", nconst);
+         for (int i = 0; i < count; i++) {
+             Proto *f = protos[i].p;
+             for (int k = 0; k < f->sizek; k++) {
+                 if (!ttisstring(&f->k[k])) continue;
+                 emit_kstring_push(&B, f, k, str_encrypt, seed, 0, -1);
+                 add_fmt(&B, "    lua_rawseti(L, -2, %d);\n", protos[i].kbase + k + 1);
+             }
+         }
+         add_fmt(&B, "    lua_pushcclosure(L, %s, %d);\n", protos[0].name, p->sizeupvalues + 1);
+    } else if (p->sizeupvalues > 0) {
          add_fmt(&B, "    lua_pushglobaltable(L);\n"); // Upvalue 1
          for (int k = 1; k < p->sizeupvalues; k++) {
              add_fmt(&B, "    lua_pushnil(L);\n");
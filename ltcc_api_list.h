@@ -83,3 +83,14 @@ X(lua_tcc_loadk_flt, void, (lua_State *L, int dest, lua_Number v))
 X(lua_tcc_in, int, (lua_State *L, int val_idx, int container_idx))
 X(lua_tcc_push_args, void, (lua_State *L, int start_reg, int count))
 X(lua_tcc_store_results, void, (lua_State *L, int start_reg, int count))
+
+/* Direct-slot ABI (fast emission mode) */
+X(lua_tcc_move, void, (lua_State *L, int from, int to))
+X(lua_tcc_pushk, void, (lua_State *L, int kup, int slot))
+X(lua_tcc_loadk_slot, void, (lua_State *L, int dest, int kup, int slot))
+X(lua_tcc_setint, void, (lua_State *L, int dest, lua_Integer v))
+X(lua_tcc_setflt, void, (lua_State *L, int dest, lua_Number v))
+X(lua_tcc_setbool, void, (lua_State *L, int dest, int b))
+X(lua_tcc_setnil, void, (lua_State *L, int dest, int n))
+X(lua_tcc_getint, int, (lua_State *L, int idx, lua_Integer *v))
+X(lua_tcc_getnum, int, (lua_State *L, int idx, lua_Number *v))
@@ -12,6 +12,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
 /**
  * @brief Thread handle structure for managing Lua threads.
  */
@@ -43,7 +47,8 @@ typedef struct Selector {
  * @brief Listener structure for channels to notify selectors.
  */
 typedef struct Listener {
-    Selector *sel;          /**< Pointer to the selector */
+    Selector *sel;          /**< Pointer to the selector, or NULL */
+    int fd;                 /**< Descriptor to write a byte to, or -1 */
     struct Listener *next;  /**< Next listener in the list */
 } Listener;
 
@@ -58,6 +63,7 @@ typedef struct {
     int closed;             /**< Flag indicating if the channel is closed */
     Listener *listeners;    /**< List of listeners waiting on this channel */
     int type_ref;           /**< Registry reference to the type constraint */
+    int finalized;          /**< Set by __gc: lock and listeners are gone */
 } Channel;
 
 /**
@@ -309,6 +315,7 @@ static int channel_create_impl(lua_State *L, int type_idx) {
     ch->closed = 0;
     ch->listeners = NULL;
     ch->type_ref = LUA_NOREF;
+    ch->finalized = 0;
     if (type_idx != 0) {
         lua_pushvalue(L, type_idx);
         ch->type_ref = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -374,6 +381,7 @@ static int channel_gc(lua_State *L) {
     l_mutex_unlock(&ch->lock);
     l_mutex_destroy(&ch->lock);
     l_cond_destroy(&ch->cond);
+    ch->finalized = 1;
     return 0;
 }
 
@@ -406,6 +414,33 @@ static int check_type_match(lua_State *L, int type_idx, int val_idx) {
     return 1; /* Match anything else or invalid type spec */
 }
 
+/**
+ * @brief Wakes everything listening on a channel.
+ *
+ * Selectors are signaled; descriptor listeners (see ch:watch) get one
+ * byte written to their descriptor. Must be called with the channel locked.
+ *
+ * @param ch The channel.
+ */
+static void notify_listeners(Channel *ch) {
+    Listener *l;
+    for (l = ch->listeners; l; l = l->next) {
+        if (l->sel) {
+            l_mutex_lock(&l->sel->lock);
+            l->sel->signaled = 1;
+            l_cond_signal(&l->sel->cond);
+            l_mutex_unlock(&l->sel->lock);
+        }
+#if !defined(_WIN32)
+        else {
+            char c = 1;
+            ssize_t n = write(l->fd, &c, 1);  /* a full pipe is awake anyway */
+            (void)n;
+        }
+#endif
+    }
+}
+
 /**
  * @brief Sends a value to the channel (blocking).
  *
@@ -453,14 +488,7 @@ static int channel_send(lua_State *L) {
 
     l_cond_signal(&ch->cond);
 
-    Listener *l = ch->listeners;
-    while (l) {
-        l_mutex_lock(&l->sel->lock);
-        l->sel->signaled = 1;
-        l_cond_signal(&l->sel->cond);
-        l_mutex_unlock(&l->sel->lock);
-        l = l->next;
-    }
+    notify_listeners(ch);
 
     l_mutex_unlock(&ch->lock);
     return 0;
@@ -522,14 +550,7 @@ static int channel_try_send(lua_State *L) {
 
     l_cond_signal(&ch->cond);
 
-    Listener *l = ch->listeners;
-    while (l) {
-        l_mutex_lock(&l->sel->lock);
-        l->sel->signaled = 1;
-        l_cond_signal(&l->sel->cond);
-        l_mutex_unlock(&l->sel->lock);
-        l = l->next;
-    }
+    notify_listeners(ch);
 
     l_mutex_unlock(&ch->lock);
     lua_pushboolean(L, 1);
@@ -578,16 +599,19 @@ static int channel_receive(lua_State *L) {
  * Usage: ch:try_recv()
  *
  * @param L The Lua state.
- * @return The received value, or nil if empty.
+ * @return The received value, or nil and whether the channel is closed
+ *         if it is empty.
  */
 static int channel_try_receive(lua_State *L) {
     Channel *ch = (Channel *)luaL_checkudata(L, 1, "lthread.channel");
 
     l_mutex_lock(&ch->lock);
     if (ch->head == NULL) {
+        int closed = ch->closed;
         l_mutex_unlock(&ch->lock);
         lua_pushnil(L);
-        return 1;
+        lua_pushboolean(L, closed);
+        return 2;
     }
 
     ChannelElem *elem = ch->head;
@@ -619,19 +643,62 @@ static int channel_close(lua_State *L) {
     ch->closed = 1;
     l_cond_broadcast(&ch->cond);
 
-    Listener *l = ch->listeners;
-    while (l) {
-        l_mutex_lock(&l->sel->lock);
-        l->sel->signaled = 1;
-        l_cond_signal(&l->sel->cond);
-        l_mutex_unlock(&l->sel->lock);
-        l = l->next;
-    }
+    notify_listeners(ch);
 
     l_mutex_unlock(&ch->lock);
     return 0;
 }
 
+/**
+ * @brief Registers a descriptor to be written to on every send and on close.
+ *
+ * Usage: ch:watch(fd)
+ *
+ * Lets event loops wait for a channel together with other descriptors.
+ *
+ * @param L The Lua state.
+ * @return 0.
+ */
+static int channel_watch(lua_State *L) {
+    Channel *ch = (Channel *)luaL_checkudata(L, 1, "lthread.channel");
+    int fd = (int)luaL_checkinteger(L, 2);
+    Listener *l = (Listener *)malloc(sizeof(Listener));
+    if (!l) return luaL_error(L, "out of memory");
+    l->sel = NULL;
+    l->fd = fd;
+    l_mutex_lock(&ch->lock);
+    l->next = ch->listeners;
+    ch->listeners = l;
+    l_mutex_unlock(&ch->lock);
+    return 0;
+}
+
+/**
+ * @brief Removes one registration made by ch:watch(fd).
+ *
+ * Usage: ch:unwatch(fd)
+ *
+ * @param L The Lua state.
+ * @return 0.
+ */
+static int channel_unwatch(lua_State *L) {
+    Channel *ch = (Channel *)luaL_checkudata(L, 1, "lthread.channel");
+    int fd = (int)luaL_checkinteger(L, 2);
+    Listener **pp;
+    if (ch->finalized) return 0;  /* finalizers may run in any order */
+    l_mutex_lock(&ch->lock);
+    for (pp = &ch->listeners; *pp; pp = &(*pp)->next) {
+        if ((*pp)->sel == NULL && (*pp)->fd == fd) {
+            Listener *rem = *pp;
+            *pp = rem->next;
+            free(rem);
+            break;
+        }
+    }
+    l_mutex_unlock(&ch->lock);
+    return 0;
+}
+
 /**
  * @brief Peeks at the next value in the channel without removing it.
  *
@@ -861,6 +928,7 @@ static int thread_pick(lua_State *L) {
             Listener *l = malloc(sizeof(Listener));
             if (l) {
                 l->sel = &sel;
+                l->fd = -1;
                 l->next = ch->listeners;
                 ch->listeners = l;
             }
@@ -956,6 +1024,8 @@ static const luaL_Reg channel_methods[] = {
     {"peek", channel_peek},
     {"recv_op", channel_recv_op},
     {"close", channel_close},
+    {"watch", channel_watch},
+    {"unwatch", channel_unwatch},
     {"__gc", channel_gc},
     {NULL, NULL}
 };
@@ -24,6 +24,7 @@
 #include "ltm.h"
 #include "lsuper.h"
 #include "lvm.h"
+#include "lbigint.h"
 
 
 static const char udatatypename[] = "userdata";
@@ -164,6 +165,14 @@ static int callbinTM (lua_State *L, const TValue *p1, const TValue *p2,
 
 void luaT_trybinTM (lua_State *L, const TValue *p1, const TValue *p2,
                     StkId res, TMS event) {
+  if ((ttisbigint(p1) || ttisbigint(p2)) && ttisnumber(p1) && ttisnumber(p2)) {
+    /* big integers take the operations the VM has no fast path for */
+    TValue v;
+    if (luaO_rawarith(L, (event - TM_ADD) + LUA_OPADD, p1, p2, &v)) {
+      setobj2s(L, res, &v);
+      return;
+    }
+  }
   if (l_unlikely(callbinTM(L, p1, p2, res, event) < 0)) {
     switch (event) {
       case TM_BAND: case TM_BOR: case TM_BXOR:
@@ -214,7 +223,12 @@ void luaT_trybiniTM (lua_State *L, const TValue *p1, lua_Integer i2,
 */
 int luaT_callorderTM (lua_State *L, const TValue *p1, const TValue *p2,
                       TMS event) {
-  int tag = callbinTM(L, p1, p2, L->top.p, event);  /* try original event */
+  int tag;
+  if ((ttisbigint(p1) || ttisbigint(p2)) && ttisnumber(p1) && ttisnumber(p2)) {
+    int c = luaB_compare((TValue*)p1, (TValue*)p2);  /* immediate operand */
+    return (event == TM_LT) ? (c < 0) : (c <= 0);
+  }
+  tag = callbinTM(L, p1, p2, L->top.p, event);  /* try original event */
   if (tag >= 0)  /* found tag method? */
     return !tagisfalse(tag);
   luaG_ordererror(L, p1, p2);  /* no metamethod found */
@@ -381,6 +381,19 @@ LUA_API void  (lua_rotate_multi) (lua_State *L, int idx, int n);
  */
 LUA_API void  (lua_xmove) (lua_State *from, lua_State *to, int n);
 
+/**
+ * @brief Copies into a state everything reachable from the registry of
+ * another one, plus values from its stack.
+ *
+ * Objects found at the same place in both registries are matched
+ * instead of copied. Errors are raised in 'to'.
+ *
+ * @param from The source state.
+ * @param to The destination state (an independent state).
+ * @param n The number of values on top of 'from' to copy onto 'to'.
+ */
+LUA_API void  (lua_clonestate) (lua_State *from, lua_State *to, int n);
+
 
 /*
 ** get functions (Lua -> stack)
@@ -1007,6 +1020,28 @@ LUA_API int (lua_dump_obfuscated) (lua_State *L, lua_Writer writer, void *data,
                                    const char *log_path);
 
 
+/**
+ * @brief Dumps a function in the plain format: no protection, loadable
+ * only by the same build, but much faster to dump and load.
+ *
+ * @param L The Lua state.
+ * @param writer Writer function.
+ * @param data User data for writer.
+ * @param strip Whether to strip debug information.
+ * @return Status code.
+ */
+LUA_API int (lua_dump_plain) (lua_State *L, lua_Writer writer, void *data,
+                              int strip);
+
+/**
+ * @brief Returns an identifier of the instruction set (a hash of the
+ * opcode names and modes); plain chunks only load in builds with the
+ * same one.
+ *
+ * @return The identifier.
+ */
+LUA_API unsigned int (lua_bytecodeid) (void);
+
 /*
 ** coroutine functions
 */
@@ -1099,6 +1134,8 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
 #define LUA_GCPARAM		12
+#define LUA_GCBGFREE		13
+#define LUA_GCTHREADPOOL	14
 /** @} */
 
 /*
@@ -1134,6 +1171,56 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
 
+/*
+** garbage-collection telemetry
+*/
+
+/**
+ * @name Garbage Collection Record Kinds
+ * @{
+ */
+#define LUA_GCSINCSTEP		0  /* incremental step */
+#define LUA_GCSYOUNG		1  /* minor (young) collection */
+#define LUA_GCSATOMIC2GEN	2  /* major collection entering generational mode */
+#define LUA_GCSGENFULL		3  /* major collection after a bad one */
+#define LUA_GCSFULLINC		4  /* full incremental collection */
+/** @} */
+
+/**
+ * @brief One collector record, as kept in the ring read by 'lua_gcstats'.
+ *
+ * Byte and object counts cover the time since the previous record, so
+ * consecutive records add up. Byte counts are net heap changes.
+ */
+typedef struct lua_GCStat {
+  lua_Unsigned seq;  /**< Sequence number, starting at 1. */
+  int kind;  /**< One of the LUA_GCS* kinds. */
+  lua_Unsigned nanos;  /**< Duration, finalizers included. */
+  lua_Unsigned allocated;  /**< Heap growth since the previous record. */
+  lua_Unsigned freed;  /**< Heap shrinkage during this one. */
+  lua_Unsigned heap;  /**< Heap size at the end. */
+  lua_Unsigned finalizers;  /**< Finalizers ('__gc') called. */
+  lua_Unsigned finnanos;  /**< Time spent in them. */
+  lua_Unsigned swept[LUA_NUMTYPES + 2];  /**< Objects freed, by basic type;
+                              the last two count upvalues and prototypes. */
+} lua_GCStat;
+
+/**
+ * @brief Copies collector records newer than 'after' into 'ar'.
+ *
+ * The collector keeps only the latest records (LUAI_GCSTATS of them);
+ * comparing 'seq' with 'after' tells how many were missed.
+ *
+ * @param L The Lua state.
+ * @param ar Array receiving the records, oldest first.
+ * @param n Size of 'ar'.
+ * @param after Sequence number of the last record already seen (0 for all).
+ * @return The number of records copied.
+ */
+LUA_API int (lua_gcstats) (lua_State *L, lua_GCStat *ar, int n,
+                           lua_Unsigned after);
+
+
 /*
 ** miscellaneous functions
 */
@@ -1239,6 +1326,23 @@ LUA_API unsigned  (lua_numbertocstring) (lua_State *L, int idx, char *buff);
  */
 LUA_API size_t  (lua_stringtonumber) (lua_State *L, const char *s);
 
+/**
+ * @brief Converts an integer numeral of any size to an integer or big integer.
+ *
+ * @param L The Lua state.
+ * @param s The numeral.
+ * @param len Length of the numeral.
+ * @return 1 if a value was pushed, 0 if 's' is not an integer numeral.
+ */
+LUA_API int  (lua_stringtobig) (lua_State *L, const char *s, size_t len);
+
+/**
+ * @brief Pops a base, an exponent and a modulus and pushes 'base^exp % mod'.
+ *
+ * @param L The Lua state.
+ */
+LUA_API void  (lua_powmod) (lua_State *L);
+
 /**
  * @brief Returns the memory allocation function of a given state.
  *
@@ -1295,6 +1399,15 @@ LUA_API int   (lua_tcc_in) (lua_State *L, int val_idx, int container_idx);
 LUA_API void  (lua_tcc_push_args) (lua_State *L, int start_reg, int count);
 LUA_API void  (lua_tcc_store_results) (lua_State *L, int start_reg, int count);
 LUA_API void  (lua_tcc_decrypt_string) (lua_State *L, const unsigned char *cipher, size_t len, unsigned int timestamp);
+LUA_API void  (lua_tcc_move) (lua_State *L, int from, int to);
+LUA_API void  (lua_tcc_pushk) (lua_State *L, int kup, int slot);
+LUA_API void  (lua_tcc_loadk_slot) (lua_State *L, int dest, int kup, int slot);
+LUA_API void  (lua_tcc_setint) (lua_State *L, int dest, lua_Integer v);
+LUA_API void  (lua_tcc_setflt) (lua_State *L, int dest, lua_Number v);
+LUA_API void  (lua_tcc_setbool) (lua_State *L, int dest, int b);
+LUA_API void  (lua_tcc_setnil) (lua_State *L, int dest, int n);
+LUA_API int   (lua_tcc_getint) (lua_State *L, int idx, lua_Integer *v);
+LUA_API int   (lua_tcc_getnum) (lua_State *L, int idx, lua_Number *v);
 
 
 /*
@@ -1648,6 +1761,39 @@ LUA_API int (lua_gethookmask) (lua_State *L);
  */
 LUA_API int (lua_gethookcount) (lua_State *L);
 
+/**
+ * @brief Plants or removes breakpoint traps for a source line.
+ *
+ * The first instruction of 'line' in every matching function is patched
+ * in place; code without traps runs at full speed with no hook set.
+ * Chunk names are compared without their directory part.
+ *
+ * @param L The Lua state.
+ * @param source Chunk name (file name) of the line.
+ * @param line The line number.
+ * @param on 1 to plant traps, 0 to remove them.
+ * @param ontop If nonzero, only the Lua function on the top of the stack
+ *              (and its nested functions) is patched; otherwise every
+ *              live function is.
+ * @return Number of traps planted or removed.
+ */
+LUA_API int (lua_setbreaktrap) (lua_State *L, const char *source, int line,
+                                int on, int ontop);
+
+/**
+ * @brief Sets the global breakpoint hooks.
+ *
+ * 'func' is called as a line hook whenever a trap is executed, in any
+ * thread. 'onload' is called after each successful 'lua_load', with the
+ * new function on the top of the stack, so traps can be planted in it.
+ *
+ * @param L The Lua state.
+ * @param func Breakpoint hook (NULL to ignore traps).
+ * @param onload Load notification (or NULL).
+ */
+LUA_API void (lua_setbreakhook) (lua_State *L, lua_Hook func,
+                                 void (*onload) (lua_State *L));
+
 /**
  * @brief Sets the C stack limit.
  *
@@ -1715,6 +1861,7 @@ LUA_API void  (lua_linknamespace) (lua_State *L, int idx1, int idx2);
 LUA_API void  (lua_newsuperstruct) (lua_State *L, const char *name);
 LUA_API void  (lua_setsuper) (lua_State *L, int idx, int key_idx, int val_idx);
 LUA_API void  (lua_slice) (lua_State *L, int idx, int start_idx, int end_idx, int step_idx);
+LUA_API void  (lua_sliceview) (lua_State *L, int idx, int start_idx, int end_idx, int step_idx);
 LUA_API void  (lua_setifaceflag) (lua_State *L, int idx);
 LUA_API void  (lua_addmethod) (lua_State *L, int idx, const char *name, int nparams);
 LUA_API void  (lua_getcmds) (lua_State *L);
@@ -26,6 +26,8 @@
 #include "lstate.h"
 #include "lundump.h"
 #include "lobfuscate.h"
+#include "lthread.h"
+#include "lualib.h"
 
 static void PrintFunction(const Proto* f, int full);
 #define luaU_print	PrintFunction
@@ -37,6 +39,8 @@ static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
 static int obfuscate_flags=0;		/* obfuscation flags */
+static int jobs=0;			/* worker threads for a bundle (0 = none) */
+static unsigned int seed=0;		/* dump seed (0 = time-based) */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -70,6 +74,8 @@ static void usage(const char* message)
   "  -f       enable control flow flattening\n"
   "  -b       enable binary search dispatcher (implies -f)\n"
   "  -O mask  enable obfuscation flags by bitmask\n"
+  "  -j n     compile on n threads into a module bundle\n"
+  "  -S seed  fixed seed for reproducible output\n"
   "  -v       show version information\n"
   "  --       stop handling options\n"
   "  -        stop handling options and process stdin\n"
@@ -119,6 +125,18 @@ static int doargs(int argc, char* argv[])
    if (mask == NULL || *mask == 0) usage("'-O' needs argument");
    obfuscate_flags |= strtol(mask, NULL, 0);
   }
+  else if (IS("-j"))			/* parallel bundle */
+  {
+   const char *n = argv[++i];
+   if (n == NULL || (jobs = (int)strtol(n, NULL, 10)) <= 0)
+    usage("'-j' needs a positive number");
+  }
+  else if (IS("-S"))			/* fixed seed */
+  {
+   const char *s = argv[++i];
+   if (s == NULL || *s == 0) usage("'-S' needs argument");
+   seed = (unsigned int)strtoul(s, NULL, 0);
+  }
   else if (IS("-v"))			/* show version */
    ++version;
   else					/* unknown option */
@@ -201,8 +219,8 @@ static int pmain(lua_State* L)
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   lua_lock(L);
-  if (obfuscate_flags)
-   luaU_dump_obfuscated(L,f,writer,D,stripping,obfuscate_flags,0,NULL);
+  if (obfuscate_flags || seed)
+   luaU_dump_obfuscated(L,f,writer,D,stripping,obfuscate_flags,seed,NULL);
   else
    luaU_dump(L,f,writer,D,stripping);
   lua_unlock(L);
@@ -212,12 +230,226 @@ static int pmain(lua_State* L)
  return 0;
 }
 
+/*
+** {======================================================
+** Parallel compilation into a module bundle ('-j')
+** =======================================================
+*/
+
+/*
+** With '-j N' every input file is compiled (and obfuscated and dumped)
+** on one of N worker threads, each with its own lua_State. The chunks
+** are not combined into one function but written, in command-line
+** order, into a bundle:
+**
+**   LUA_BUNDLE_SIGNATURE, version (u32), count (u32)
+**   count x { name length (u32), name, offset (u64), size (u64) }
+**   the dumped chunks
+**
+** (integers little-endian, offsets from the start of the file).
+** package.loadbundle installs its modules as 'package.preload' loaders.
+** A module is named after its file: "./a/b.lua" becomes "a.b". With
+** '-S seed' each module is dumped with a seed derived from 'seed' and
+** its name, so the bundle is the same for any N and any run.
+*/
+
+typedef struct Job {
+ const char* filename;
+ char* name;			/* module name */
+ char* chunk;			/* dumped chunk */
+ size_t size;
+ size_t capacity;
+ char* error;			/* error message, if compilation failed */
+} Job;
+
+typedef struct Batch {
+ Job* job;
+ int n;
+ int next;			/* next job to hand out */
+ l_mutex_t lock;
+} Batch;
+
+static char* copystring(const char* s, size_t l)
+{
+ char* p=(char*)malloc(l+1);
+ if (p==NULL) fatal("not enough memory");
+ memcpy(p,s,l);
+ p[l]=0;
+ return p;
+}
+
+static char* modulename(const char* filename)
+{
+ size_t l;
+ char* name;
+ char* p;
+ while (filename[0]=='.' && (filename[1]=='/' || filename[1]=='\\'))
+  filename+=2;
+ l=strlen(filename);
+ if (l>4 && strcmp(filename+l-4,".lua")==0) l-=4;
+ name=copystring(filename,l);
+ for (p=name; *p; p++)
+  if (*p=='/' || *p=='\\') *p='.';
+ return name;
+}
+
+static unsigned int jobseed(const char* name)
+{
+ unsigned int h=2166136261u;
+ if (seed==0) return 0;			/* time-based */
+ while (*name) h=(h ^ (unsigned char)*name++)*16777619u;
+ h^=seed;
+ return (h!=0) ? h : 1;
+}
+
+static int jobwriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ Job* j=(Job*)u;
+ UNUSED(L);
+ if (j->size+size>j->capacity)
+ {
+  size_t c=(j->capacity==0) ? 4096 : j->capacity;
+  char* q;
+  while (c<j->size+size) c*=2;
+  q=(char*)realloc(j->chunk,c);
+  if (q==NULL) return 1;
+  j->chunk=q;
+  j->capacity=c;
+ }
+ memcpy(j->chunk+j->size,p,size);
+ j->size+=size;
+ return 0;
+}
+
+static int pcompile(lua_State* L)
+{
+ Job* j=(Job*)lua_touserdata(L,1);
+ if (luaL_loadfile(L,j->filename)!=LUA_OK) lua_error(L);
+ if (dumping &&
+     lua_dump_obfuscated(L,jobwriter,j,stripping,obfuscate_flags,
+                         jobseed(j->name),NULL)!=0)
+  luaL_error(L,"cannot dump %s",j->filename);
+ return 0;
+}
+
+static void* worker(void* ud)
+{
+ Batch* b=(Batch*)ud;
+ lua_State* L=luaL_newstate();
+ for (;;)
+ {
+  Job* j;
+  l_mutex_lock(&b->lock);
+  j=(b->next<b->n) ? &b->job[b->next++] : NULL;
+  l_mutex_unlock(&b->lock);
+  if (j==NULL) break;
+  if (L==NULL)
+   j->error=copystring("cannot create state: not enough memory",38);
+  else
+  {
+   lua_pushcfunction(L,&pcompile);
+   lua_pushlightuserdata(L,j);
+   if (lua_pcall(L,1,0,0)!=LUA_OK)
+   {
+    size_t l;
+    const char* msg=lua_tolstring(L,-1,&l);
+    j->error=(msg!=NULL) ? copystring(msg,l) : copystring("error",5);
+   }
+   lua_settop(L,0);
+  }
+ }
+ if (L!=NULL) lua_close(L);
+ return NULL;
+}
+
+static void putint(FILE* D, unsigned long long x, int n)
+{
+ unsigned char b[8];
+ int i;
+ for (i=0; i<n; i++, x>>=8) b[i]=(unsigned char)(x & 0xff);
+ fwrite(b,1,n,D);
+}
+
+static void writebundle(const Batch* b)
+{
+ FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
+ unsigned long long offset;
+ int i;
+ if (D==NULL) cannot("open");
+ offset=(sizeof(LUA_BUNDLE_SIGNATURE)-1)+4+4;
+ for (i=0; i<b->n; i++) offset+=4+strlen(b->job[i].name)+8+8;
+ fwrite(LUA_BUNDLE_SIGNATURE,1,sizeof(LUA_BUNDLE_SIGNATURE)-1,D);
+ putint(D,LUA_BUNDLE_VERSION,4);
+ putint(D,(unsigned long long)b->n,4);
+ for (i=0; i<b->n; i++)
+ {
+  const Job* j=&b->job[i];
+  size_t l=strlen(j->name);
+  putint(D,l,4);
+  fwrite(j->name,1,l,D);
+  putint(D,offset,8);
+  putint(D,j->size,8);
+  offset+=j->size;
+ }
+ for (i=0; i<b->n; i++)
+  if (b->job[i].size>0) fwrite(b->job[i].chunk,1,b->job[i].size,D);
+ if (ferror(D)) cannot("write");
+ if (D!=stdout && fclose(D)) cannot("close");
+}
+
+static int bundle(int argc, char* argv[])
+{
+ Batch b;
+ l_thread_t* t;
+ int i, nt=(jobs<argc) ? jobs : argc;
+ lua_State* L=luaL_newstate();
+ if (L==NULL) fatal("cannot create state: not enough memory");
+ if (luaL_loadstring(L,"local _")!=LUA_OK)	/* initialize parser tables */
+  fatal(lua_tostring(L,-1));
+ lua_close(L);
+ b.n=argc;
+ b.next=0;
+ b.job=(Job*)calloc(argc,sizeof(Job));
+ t=(l_thread_t*)calloc(nt,sizeof(l_thread_t));
+ if (b.job==NULL || t==NULL) fatal("not enough memory");
+ for (i=0; i<argc; i++)
+ {
+  if (IS("-")) usage("'-j' cannot compile stdin");
+  b.job[i].filename=argv[i];
+  b.job[i].name=modulename(argv[i]);
+ }
+ l_mutex_init(&b.lock);
+ for (i=0; i<nt; i++)
+  if (l_thread_create(&t[i],worker,&b)!=0) fatal("cannot create thread");
+ for (i=0; i<nt; i++)
+  l_thread_join(t[i],NULL);
+ l_mutex_destroy(&b.lock);
+ for (i=0; i<argc; i++)
+  if (b.job[i].error) fatal(b.job[i].error);
+ if (dumping) writebundle(&b);
+ for (i=0; i<argc; i++)
+ {
+  free(b.job[i].name);
+  free(b.job[i].chunk);
+ }
+ free(b.job);
+ free(t);
+ return EXIT_SUCCESS;
+}
+
+/* }====================================================== */
+
 int main(int argc, char* argv[])
 {
  lua_State* L;
  int i=doargs(argc,argv);
  argc-=i; argv+=i;
  if (argc<=0) usage("no input files given");
+ if (jobs>0)
+ {
+  if (listing) usage("'-j' cannot be combined with '-l'");
+  return bundle(argc,argv);
+ }
  L=luaL_newstate();
  if (L==NULL) fatal("cannot create state: not enough memory");
  lua_pushcfunction(L,&pmain);
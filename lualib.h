@@ -246,6 +246,19 @@ LUAMOD_API int (luaopen_translator) (lua_State *L);
  */
 LUAMOD_API int (luaopen_lexer) (lua_State *L);
 
+/**
+ * @brief Name of the sampling profiler library.
+ */
+#define LUA_PROFLIBNAME	"profiler"
+
+/**
+ * @brief Opens the sampling profiler library.
+ *
+ * @param L The Lua state.
+ * @return 1 (the library table).
+ */
+LUAMOD_API int (luaopen_profiler) (lua_State *L);
+
 /**
  * @brief Name of the service manager library.
  */
@@ -259,6 +272,19 @@ LUAMOD_API int (luaopen_lexer) (lua_State *L);
  */
 LUAMOD_API int (luaopen_smgr) (lua_State *L);
 
+/**
+ * @brief Name of the event loop library for async functions.
+ */
+#define LUA_ASYNCLIBNAME	"asyncio"
+
+/**
+ * @brief Opens the event loop library for async functions.
+ *
+ * @param L The Lua state.
+ * @return 1 (the library table).
+ */
+LUAMOD_API int (luaopen_asyncio) (lua_State *L);
+
 /**
  * @brief Name of the package library.
  */
@@ -271,6 +297,13 @@ LUAMOD_API int (luaopen_smgr) (lua_State *L);
  * @return 1 (the library table).
  */
 LUAMOD_API int (luaopen_package) (lua_State *L);
+
+/**
+ * @brief Signature of module bundles written by 'luac -j' and read by
+ * package.loadbundle.
+ */
+#define LUA_BUNDLE_SIGNATURE	"LXBUNDLE"
+#define LUA_BUNDLE_VERSION	1
 #define LUA_PATCHLIBNAME "patch"
 LUAMOD_API int (luaopen_patch) (lua_State *L);
 
@@ -282,5 +315,16 @@ LUAMOD_API int (luaopen_patch) (lua_State *L);
  */
 LUALIB_API void (luaL_openlibs) (lua_State *L);
 
+/**
+ * @brief Opens the libraries of standard Lua at once and the others on
+ * first use.
+ *
+ * The other libraries go into package.preload, and the global table gets
+ * an '__index' metamethod that opens one when its name is first read.
+ *
+ * @param L The Lua state.
+ */
+LUALIB_API void (luaL_openlazylibs) (lua_State *L);
+
 
 #endif
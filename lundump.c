@@ -66,6 +66,7 @@ typedef struct {
   lu_byte fixed;  /* dump is fixed in memory */
   int is_standard; /* flag to indicate standard Lua bytecode */
   int force_standard; /* flag to force standard Lua bytecode */
+  int is_plain;  /* chunk is in the plain format */
 
   /* Segmented Loading fields */
   const char *mem_base;
@@ -1147,6 +1148,190 @@ static void fchecksize (LoadState *S, size_t size, const char *tname) {
 
 #define checksize(S,t)	fchecksize(S,sizeof(t),#t)
 
+/*
+** {======================================================
+** Plain format (see 'luaU_dump_plain')
+** =======================================================
+*/
+
+#define loadVarPlain(S,x)	loadBlock(S,&(x),sizeof(x))
+
+
+static int loadIntPlain (LoadState *S) {
+  int x;
+  loadVarPlain(S, x);
+  if (x < 0)
+    error(S, "negative count");
+  return x;
+}
+
+
+static TString *loadStringPlain (LoadState *S, Proto *p) {
+  lua_State *L = S->L;
+  TString *ts;
+  size_t size;
+  loadVarPlain(S, size);
+  if (size == 0)
+    return NULL;
+  else if (--size <= LUAI_MAXSHORTLEN) {  /* short string? */
+    char buff[LUAI_MAXSHORTLEN];
+    loadBlock(S, buff, size);
+    ts = luaS_newlstr(L, buff, size);
+  }
+  else {  /* long string: load directly in final place */
+    ts = luaS_createlngstrobj(L, size);
+    luaC_objbarrier(L, p, ts);
+    loadBlock(S, ts->contents, size);
+    return ts;
+  }
+  luaC_objbarrier(L, p, ts);
+  return ts;
+}
+
+
+static void loadFunctionPlain (LoadState *S, Proto *f, TString *psource) {
+  lua_State *L = S->L;
+  int i, n;
+  f->source = loadStringPlain(S, f);
+  if (f->source == NULL)  /* no source in dump? */
+    f->source = psource;  /* reuse parent's source */
+  f->linedefined = loadIntPlain(S);
+  f->lastlinedefined = loadIntPlain(S);
+  f->numparams = loadByte(S);
+  f->flag = loadByte(S);
+  f->is_vararg = loadByte(S);
+  f->maxstacksize = loadByte(S);
+  f->nodiscard = loadByte(S);
+  loadVarPlain(S, f->difierline_mode);
+  loadVarPlain(S, f->difierline_magicnum);
+  loadVarPlain(S, f->difierline_data);
+  /* code */
+  n = loadIntPlain(S);
+  f->code = luaM_newvectorchecked(L, n, Instruction);
+  f->sizecode = n;
+  loadVector(S, f->code, n);
+  /* constants */
+  n = loadIntPlain(S);
+  f->k = luaM_newvectorchecked(L, n, TValue);
+  f->sizek = n;
+  for (i = 0; i < n; i++)
+    setnilvalue(&f->k[i]);
+  for (i = 0; i < n; i++) {
+    TValue *o = &f->k[i];
+    int t = loadByte(S);
+    switch (t) {
+      case LUA_VNIL:
+        setnilvalue(o);
+        break;
+      case LUA_VFALSE:
+        setbfvalue(o);
+        break;
+      case LUA_VTRUE:
+        setbtvalue(o);
+        break;
+      case LUA_VNUMFLT: {
+        lua_Number x;
+        loadVarPlain(S, x);
+        setfltvalue(o, x);
+        break;
+      }
+      case LUA_VNUMINT: {
+        lua_Integer x;
+        loadVarPlain(S, x);
+        setivalue(o, x);
+        break;
+      }
+      case LUA_VSHRSTR:
+      case LUA_VLNGSTR: {
+        TString *ts = loadStringPlain(S, f);
+        if (ts == NULL)
+          error(S, "bad constant");
+        setsvalue2n(L, o, ts);
+        break;
+      }
+      default:
+        error(S, "bad constant");
+    }
+  }
+  /* upvalues */
+  n = loadIntPlain(S);
+  f->upvalues = luaM_newvectorchecked(L, n, Upvaldesc);
+  f->sizeupvalues = n;
+  for (i = 0; i < n; i++)  /* make array valid for GC */
+    f->upvalues[i].name = NULL;
+  for (i = 0; i < n; i++) {
+    f->upvalues[i].instack = loadByte(S);
+    f->upvalues[i].idx = loadByte(S);
+    f->upvalues[i].kind = loadByte(S);
+  }
+  /* nested functions */
+  n = loadIntPlain(S);
+  f->p = luaM_newvectorchecked(L, n, Proto *);
+  f->sizep = n;
+  for (i = 0; i < n; i++)
+    f->p[i] = NULL;
+  for (i = 0; i < n; i++) {
+    f->p[i] = luaF_newproto(L);
+    luaC_objbarrier(L, f, f->p[i]);
+    loadFunctionPlain(S, f->p[i], f->source);
+  }
+  /* debug information */
+  n = loadIntPlain(S);
+  f->lineinfo = luaM_newvectorchecked(L, n, ls_byte);
+  f->sizelineinfo = n;
+  loadVector(S, f->lineinfo, n);
+  n = loadIntPlain(S);
+  f->abslineinfo = luaM_newvectorchecked(L, n, AbsLineInfo);
+  f->sizeabslineinfo = n;
+  loadVector(S, f->abslineinfo, n);
+  n = loadIntPlain(S);
+  f->locvars = luaM_newvectorchecked(L, n, LocVar);
+  f->sizelocvars = n;
+  for (i = 0; i < n; i++)
+    f->locvars[i].varname = NULL;
+  for (i = 0; i < n; i++) {
+    f->locvars[i].varname = loadStringPlain(S, f);
+    f->locvars[i].startpc = loadIntPlain(S);
+    f->locvars[i].endpc = loadIntPlain(S);
+  }
+  n = loadIntPlain(S);
+  if (n != 0)  /* does it have debug information? */
+    n = f->sizeupvalues;  /* must be this many */
+  for (i = 0; i < n; i++)
+    f->upvalues[i].name = loadStringPlain(S, f);
+}
+
+
+/*
+** Rest of the header of a plain chunk: it is only valid for a build
+** with the same sizes and the same instruction set.
+*/
+static void checkHeaderPlain (LoadState *S, lu_byte version) {
+  lua_Integer i;
+  lua_Number n;
+  l_uint32 codeid;
+  if (version != LUAC_VERSION)
+    error(S, "version mismatch");
+  checkliteral(S, LUAC_DATA, "corrupted chunk");
+  checksize(S, Instruction);
+  checksize(S, lua_Integer);
+  checksize(S, lua_Number);
+  if (loadByte(S) != NUM_OPCODES)
+    error(S, "instruction set mismatch");
+  loadVarPlain(S, codeid);
+  if (codeid != luaP_codeid())
+    error(S, "instruction set mismatch");
+  loadVarPlain(S, i);
+  if (i != LUAC_INT)
+    error(S, "integer format mismatch");
+  loadVarPlain(S, n);
+  if (n != LUAC_NUM)
+    error(S, "float format mismatch");
+}
+
+/* }====================================================== */
+
+
 static void checkHeader (LoadState *S) {
   /* skip 1st char (already read and checked) */
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
@@ -1154,6 +1339,11 @@ static void checkHeader (LoadState *S) {
   lu_byte version = loadByte(S);
   lu_byte format = loadByte(S);
   
+  if (format == LUAC_FORMAT_PLAIN && !S->force_standard) {
+    S->is_plain = 1;
+    checkHeaderPlain(S, version);
+    return;
+  }
   if (format != LUAC_FORMAT)
     error(S, "format mismatch");
   
@@ -1255,6 +1445,8 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int force_standard
   S.Z = Z;
   S.offset = 1;
   S.force_standard = force_standard;
+  S.is_standard = 0;
+  S.is_plain = 0;
   S.mem_base = NULL;
   S.mem_size = 0;
   S.mem_offset = 0;
@@ -1282,7 +1474,9 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name, int force_standard
   cl->p = luaF_newproto(L);
   luaC_objbarrier(L, cl, cl->p);
 
-  if (S.is_standard) {
+  if (S.is_plain) {
+      loadFunctionPlain(&S, cl->p, NULL);
+  } else if (S.is_standard) {
       loadFunction_Standard(&S, cl->p);
   } else {
       loadSegmented(&S, cl->p);
@@ -24,6 +24,7 @@
 #define LUAC_VERSION  (((LUA_VERSION_NUM / 100) * 16) + LUA_VERSION_NUM % 100)
 
 #define LUAC_FORMAT	0	/* this is the official format */
+#define LUAC_FORMAT_PLAIN	1	/* unprotected image for same-build caches */
 
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name, int force_standard);
@@ -41,4 +42,8 @@ LUAI_FUNC int luaU_dump_obfuscated (lua_State* L, const Proto* f, lua_Writer w,
                                     void* data, int strip, int obfuscate_flags,
                                     unsigned int seed, const char *log_path);
 
+/* dump one chunk in the plain format; from ldump.c */
+LUAI_FUNC int luaU_dump_plain (lua_State* L, const Proto* f, lua_Writer w,
+                               void* data, int strip);
+
 #endif
@@ -58,7 +58,9 @@
 #include "lnamespace.h"
 #include "lsuper.h"
 #include "lbigint.h"
+#include "lslice.h"
 #include "lauxlib.h"
+#include "lualib.h"
 
 __attribute__((noinline))
 void lvm_vmp_hook_point(void) {
@@ -128,40 +130,17 @@ static int check_subtype_internal(lua_State *L, const TValue *val, const TValue
 
 static int lvm_async_start(lua_State *L) {
     int n = lua_gettop(L);
-    lua_State *co = lua_newthread(L);
-    lua_insert(L, 1);
-
-    lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
-    if (lua_isnil(L, -1)) {
+    /* tasks are run by the event loop of the 'async' library */
+    if (lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_SPAWN") != LUA_TFUNCTION) {
         lua_pop(L, 1);
-        if (luaL_dostring(L, "return function(f, ...) coroutine.yield(); return f(...) end") != LUA_OK) {
-            return lua_error(L);
-        }
-        lua_call(L, 0, 1); /* call chunk to get the wrapper function */
-        lua_pushvalue(L, -1);
-        lua_setfield(L, LUA_REGISTRYINDEX, "_ASYNC_LAZY_WRAPPER");
+        luaL_requiref(L, LUA_ASYNCLIBNAME, luaopen_asyncio, 0);
+        lua_pop(L, 1);
+        lua_getfield(L, LUA_REGISTRYINDEX, "_ASYNC_SPAWN");
     }
-    lua_xmove(L, co, 1);
-
+    lua_insert(L, 1);
     lua_pushvalue(L, lua_upvalueindex(1));
-    lua_xmove(L, co, 1);
-
-    lua_xmove(L, co, n);
-
-    int nres;
-    int status = lua_resume(co, L, n + 1, &nres);
-
-    if (status != LUA_YIELD) {
-        if (status != LUA_OK) {
-            lua_xmove(co, L, 1);
-            return lua_error(L);
-        }
-    }
-
-    if (nres > 0) {
-        lua_pop(co, nres);
-    }
-
+    lua_insert(L, 2);
+    lua_call(L, n + 1, 1);  /* spawn(f, ...) */
     return 1;
 }
 
@@ -399,6 +378,10 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
     *n = cast_num((L_P2I)ptrvalue(obj));
     return 1;
   }
+  else if (ttisbigint(obj)) {
+    *n = luaB_bigtonumber(obj);
+    return 1;
+  }
   else if (l_strton(obj, &v)) {  /* string coercible to number? */
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
@@ -872,6 +855,9 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
       } else if (ttisstruct(t)) {
         luaS_structindex(L, t, key, val);
         return;
+      } else if (ttisfulluserdata(t) && luaSL_isview(L, uvalue(t))) {
+        luaSL_get(L, uvalue(t), key, val);
+        return;
       } else if (ttispointer(t)) {
         if (ttisinteger(key)) {
           unsigned char *p = (unsigned char *)ptrvalue(t);
@@ -984,7 +970,12 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != LUA_NULLPTR) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
-      lua_assert(isempty(slot));  /* slot must be empty */
+      if (l_unlikely(!isempty(slot))) {  /* existing entry of a viewed table */
+        luaSL_checkviews(L, h);
+        setobj2t(L, cast(TValue *, slot), val);
+        luaC_barrierback(L, obj2gco(h), val);
+        return;
+      }
 
       if (h->using_next) {
          Namespace *ns = h->using_next;
@@ -1082,6 +1073,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
         luaS_setsuperstruct(L, ss, key, val);
         return;
       }
+      if (ttisfulluserdata(t) && luaSL_isview(L, uvalue(t))) {
+        luaSL_set(L, uvalue(t), key, val);
+        return;
+      }
       if (ttisstruct(t)) {
         luaS_structnewindex(L, t, key, val);
         return;
@@ -1108,6 +1103,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
          if (h->is_shared) l_rwlock_wrlock(&h->lock);
          const TValue *res = luaH_get(h, key);
          if (!isempty(res) && !isabstkey(res)) {
+            luaSL_checkviews(L, h);
             setobj2t(L, cast(TValue *, res), val);
             luaC_barrierback(L, obj2gco(h), val);
             if (h->is_shared) l_rwlock_unlock(&h->lock);
@@ -1148,6 +1144,7 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
        const TValue *res = luaH_get(h, key);
        if (!isempty(res) && !isabstkey(res)) {
           /* luaV_finishfastset just does setobj2t and barrier */
+          luaSL_checkviews(L, h);
           setobj2t(L, cast(TValue *, res), val);
           luaC_barrierback(L, obj2gco(h), val);
           if (h->is_shared) l_rwlock_unlock(&h->lock);
@@ -1448,6 +1445,8 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
          integer value, they cannot be equal; otherwise, compare their
          integer values. */
       lua_Integer i1, i2;
+      if (ttisbigint(t1) || ttisbigint(t2))  /* big integer and float? */
+        return luaB_compare((TValue*)t1, (TValue*)t2) == 0;
       return (luaV_tointegerns(t1, &i1, F2Ieq) &&
               luaV_tointegerns(t2, &i2, F2Ieq) &&
               i1 == i2);
@@ -1458,7 +1457,8 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_VNIL: case LUA_VFALSE: case LUA_VTRUE: return 1;
     case LUA_VNUMINT: return (ivalue(t1) == ivalue(t2));
     case LUA_VNUMFLT: return luai_numeq(fltvalue(t1), fltvalue(t2));
-    case LUA_VNUMBIG: return luaB_compare((TValue*)t1, (TValue*)t2) == 0;
+    case withvariant(LUA_VNUMBIG):
+      return luaB_compare((TValue*)t1, (TValue*)t2) == 0;
     case LUA_VLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
     case LUA_VPOINTER: return ptrvalue(t1) == ptrvalue(t2);
     case LUA_VLCF: return fvalue(t1) == fvalue(t2);
@@ -1749,7 +1749,9 @@ static void pushconcept (lua_State *L, Proto *p, UpVal **encup, StkId base,
 void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
-  Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
+  Proto *p = ci_func(ci)->p;
+  /* interrupted instruction (which may sit under a breakpoint trap) */
+  Instruction inst = luaV_getinst(p, pcRel(ci->u.l.savedpc, p));
   OpCode op = GET_OPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
@@ -1901,12 +1903,12 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
     if (tryop(i1, i2, &r)) { \
        pc++; setivalue(s2v(ra), r); \
     } else { \
-       bigop(L, v1, v2, s2v(ra)); \
+       Protect(bigop(L, v1, v2, s2v(ra))); \
        pc++; \
     } \
   }  \
   else if (ttisbigint(v1) || ttisbigint(v2)) { \
-      bigop(L, v1, v2, s2v(ra)); \
+      Protect(bigop(L, v1, v2, s2v(ra))); \
       pc++; \
   } \
   else op_arithf_aux(L, v1, v2, fop); }
@@ -1932,13 +1934,13 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
        pc++; setivalue(s2v(ra), r); \
     } else { \
        TValue vimm; setivalue(&vimm, imm); \
-       bigop(L, v1, &vimm, s2v(ra)); \
+       Protect(bigop(L, v1, &vimm, s2v(ra))); \
        pc++; \
     } \
   }  \
   else if (ttisbigint(v1)) { \
       TValue vimm; setivalue(&vimm, imm); \
-      bigop(L, v1, &vimm, s2v(ra)); \
+      Protect(bigop(L, v1, &vimm, s2v(ra))); \
       pc++; \
   } \
   else if (ttisfloat(v1)) {  \
@@ -2114,11 +2116,19 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
 	{ if (l_unlikely(trap)) { updatebase(ci); ra = RA(i); } }
 
 
+/*
+** Polls for a sample asked by the profiler: the next 'vmfetch' will call
+** 'luaG_traceexec', which takes it. Done on jumps and returns, so that
+** no Lua code runs for long without a check (see lprofile.c).
+*/
+#define checkprof(L)	(trap |= l_atomic_load(&G(L)->profpending))
+
+
 /*
 ** Execute a jump instruction. The 'updatetrap' allows signals to stop
 ** tight loops. (Without it, the local copy of 'trap' could never change.)
 */
-#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
+#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); checkprof(L); }
 
 
 /* for test instructions, execute the jump instruction that follows it */
@@ -2175,6 +2185,131 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
            luai_threadyield(L); }
 
 
+/*
+** {==================================================================
+** Per-opcode statistics (compiled in only with LUAI_OPSTATS)
+** ===================================================================
+*/
+#if defined(LUAI_OPSTATS)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define l_threadlocal	__declspec(thread)
+#else
+#define l_threadlocal	_Thread_local
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#if !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+#define opstats_clock()		((unsigned long long)__rdtsc())
+#define OPSTATS_CLOCK		"rdtsc"
+#elif defined(CLOCK_MONOTONIC) || defined(LUA_USE_POSIX)
+#include <time.h>
+static unsigned long long opstats_clock (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#define OPSTATS_CLOCK		"ns"
+#else
+#include <time.h>
+#define opstats_clock()		((unsigned long long)clock())
+#define OPSTATS_CLOCK		"clock"
+#endif
+
+
+static l_threadlocal OpStats *opstats_mine;  /* block of this thread */
+static OpStats *_Atomic opstats_all;  /* list of all blocks */
+static _Atomic int opstats_timing;  /* are cycles being counted? */
+static OpStats opstats_sink;  /* used when a block cannot be allocated */
+
+
+/*
+** Create the block of the running thread and push it on the global
+** list. Blocks outlive their threads, so counts are never lost.
+*/
+static OpStats *opstats_new (void) {
+  OpStats *s = (OpStats *)calloc(1, sizeof(OpStats));
+  if (s == NULL)
+    return (opstats_mine = &opstats_sink);
+  s->last = -1;
+  s->next = atomic_load(&opstats_all);
+  while (!atomic_compare_exchange_weak(&opstats_all, &s->next, s)) {}
+  return (opstats_mine = s);
+}
+
+
+/*
+** Count one fetch. With timing on, the ticks since the previous fetch
+** are charged to the previous opcode (so a call instruction is charged
+** with the time spent in its callee until the callee's first fetch).
+*/
+static l_inline void opstats_record (int op) {
+  OpStats *s = opstats_mine;
+  if (l_unlikely(s == NULL))
+    s = opstats_new();
+  if (op > NUM_OPCODES) op = NUM_OPCODES;
+  s->count[op]++;
+  if (s->last >= 0)
+    s->pairs[s->last][op]++;
+  if (atomic_load_explicit(&opstats_timing, memory_order_relaxed)) {
+    unsigned long long now = opstats_clock();
+    if (s->last >= 0 && s->lastclock != 0)
+      s->cycles[s->last] += now - s->lastclock;
+    s->lastclock = now;
+  }
+  s->last = op;
+}
+
+
+OpStats *luaV_opstatslist (void) {
+  return atomic_load(&opstats_all);
+}
+
+
+/*
+** Clear every block. Other threads may be counting at the same time;
+** at worst a few of their increments survive the reset.
+*/
+void luaV_opstatsreset (void) {
+  OpStats *s;
+  for (s = atomic_load(&opstats_all); s != NULL; s = s->next) {
+    memset(s->count, 0, sizeof(s->count));
+    memset(s->cycles, 0, sizeof(s->cycles));
+    memset(s->pairs, 0, sizeof(s->pairs));
+    s->lastclock = 0;
+    s->last = -1;
+  }
+}
+
+
+/* turn timing on (1) or off (0), or just query it (-1); returns old state */
+int luaV_opstatstiming (int on) {
+  OpStats *s;
+  if (on < 0)
+    return atomic_load(&opstats_timing);
+  for (s = atomic_load(&opstats_all); s != NULL; s = s->next)
+    s->lastclock = 0;  /* do not charge the time spent with timing off */
+  return atomic_exchange(&opstats_timing, on != 0);
+}
+
+
+const char *luaV_opstatsclock (void) {
+  return OPSTATS_CLOCK;
+}
+
+#define opstats_count(i)	opstats_record(GET_OPCODE(i))
+
+#else
+
+#define opstats_count(i)	((void)0)
+
+#endif
+/* }================================================================== */
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -2182,6 +2317,7 @@ static void inopr (lua_State *L, StkId ra, TValue *a, TValue *b) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  opstats_count(i); \
 }
 
 #define vmdispatch(o)	switch(o)
@@ -2252,6 +2388,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
     lua_assert(base <= L->top.p && L->top.p <= L->stack_last.p);
     /* invalidate top for instructions not expecting it */
     lua_assert(isIT(i) || (cast_void(L->top.p = base), 1));
+#if !LUA_USE_JUMPTABLE
+   l_dispatch:
+#endif
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE) {
         StkId ra = RA(i);
@@ -2455,7 +2594,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            Table *h = hvalue(s2v(ra));
            if (h->is_shared) l_rwlock_wrlock(&h->lock);
            const TValue *res = luaH_get_optimized(h, rb);
-           if (!isempty(res) && !isabstkey(res)) {
+           if (!isempty(res) && !isabstkey(res) && !h->viewed) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
               if (h->is_shared) l_rwlock_unlock(&h->lock);
@@ -2476,7 +2615,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            Table *h = hvalue(s2v(ra));
            if (h->is_shared) l_rwlock_wrlock(&h->lock);
            const TValue *res = luaH_getint(h, c);
-           if (!isempty(res) && !isabstkey(res)) {
+           if (!isempty(res) && !isabstkey(res) && !h->viewed) {
               setobj2t(L, cast(TValue *, res), rc);
               luaC_barrierback(L, obj2gco(h), rc);
               if (h->is_shared) l_rwlock_unlock(&h->lock);
@@ -3092,6 +3231,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           return;  /* end this frame */
         else {
           ci = ci->previous;
+          checkprof(L);
           goto returning;  /* continue running caller in this frame */
         }
       }
@@ -3112,6 +3252,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         else if (floatforloop(ra))  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
         updatetrap(ci);  /* allows a signal to break the loop */
+        checkprof(L);
         vmbreak;
       }
       vmcase(OP_FORPREP) {
@@ -3160,6 +3301,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          checkprof(L);
         }
         vmbreak;
       }}
@@ -3586,152 +3728,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         ** Slice operation - Python-style slice t[start:end:step]
         ** Format: OP_SLICE A B C
         ** Function: R[A] := slice(R[B], R[B+1], R[B+2], R[B+3])
-        **   B = Source table
-        **   B+1 = start (nil -> 1)
-        **   B+2 = end (nil -> #t)
+        **   B = Source table or string
+        **   B+1 = start (nil -> first element)
+        **   B+2 = end (nil -> last element)
         **   B+3 = step (nil -> 1)
         **   C = Flags (reserved)
         **
         ** Supports negative indices. Result includes end element.
+        ** Tables give a new table and strings a string; views come
+        ** only from table.view/lua_sliceview (see lslice.c).
         */
         StkId ra = RA(i);
-        int b = GETARG_B(i);
-        StkId base_reg = base + b;
-        TValue *src_table = s2v(base_reg);
-        TValue *start_val = s2v(base_reg + 1);
-        TValue *end_val = s2v(base_reg + 2);
-        TValue *step_val = s2v(base_reg + 3);
-        
-        Table *t;
-        Table *result_t;
-        lua_Integer tlen;
-        lua_Integer start_idx, end_idx, step;
-        lua_Integer result_idx;
-        
-        /* Check if source is a table */
-        if (l_unlikely(!ttistable(src_table))) {
-          luaG_typeerror(L, src_table, "slice");
-        }
-        t = hvalue(src_table);
-        tlen = luaH_getn(t);
-        
-        /* Parse start */
-        if (ttisnil(start_val)) {
-          start_idx = 1;
-        }
-        else if (ttisinteger(start_val)) {
-          start_idx = ivalue(start_val);
-        }
-        else if (ttisfloat(start_val)) {
-          lua_Number n = fltvalue(start_val);
-          lua_Integer ni;
-          if (luaV_flttointeger(n, &ni, F2Ieq)) {
-            start_idx = ni;
-          }
-          else {
-            luaG_runerror(L, "slice start index must be integer");
-          }
-        }
-        else {
-          luaG_runerror(L, "slice start index must be integer or nil");
-        }
-        
-        /* Parse end */
-        if (ttisnil(end_val)) {
-          end_idx = tlen;
-        }
-        else if (ttisinteger(end_val)) {
-          end_idx = ivalue(end_val);
-        }
-        else if (ttisfloat(end_val)) {
-          lua_Number n = fltvalue(end_val);
-          lua_Integer ni;
-          if (luaV_flttointeger(n, &ni, F2Ieq)) {
-            end_idx = ni;
-          }
-          else {
-            luaG_runerror(L, "slice end index must be integer");
-          }
-        }
-        else {
-          luaG_runerror(L, "slice end index must be integer or nil");
-        }
-        
-        /* Parse step */
-        if (ttisnil(step_val)) {
-          step = 1;
-        }
-        else if (ttisinteger(step_val)) {
-          step = ivalue(step_val);
-        }
-        else if (ttisfloat(step_val)) {
-          lua_Number n = fltvalue(step_val);
-          lua_Integer ni;
-          if (luaV_flttointeger(n, &ni, F2Ieq)) {
-            step = ni;
-          }
-          else {
-            luaG_runerror(L, "slice step must be integer");
-          }
-        }
-        else {
-          luaG_runerror(L, "slice step must be integer or nil");
-        }
-        
-        if (step == 0) {
-          luaG_runerror(L, "slice step cannot be 0");
-        }
-        
-        /* Handle negative indices */
-        if (start_idx < 0) {
-          start_idx = tlen + start_idx + 1;
-        }
-        if (end_idx < 0) {
-          end_idx = tlen + end_idx + 1;
-        }
-        
-        /* Clamp indices */
-        if (step > 0) {
-          if (start_idx < 1) start_idx = 1;
-          if (end_idx > tlen) end_idx = tlen;
-        }
-        else {
-          if (start_idx > tlen) start_idx = tlen;
-          if (end_idx < 1) end_idx = 1;
-        }
-        
-        /* Create result table */
-        L->top.p = ra + 1;
-        result_t = luaH_new(L);
-        sethvalue2s(L, ra, result_t);
-        
-        /* Copy elements */
-        result_idx = 1;
-        if (step > 0) {
-          lua_Integer idx;
-          for (idx = start_idx; idx <= end_idx; idx += step) {
-            const TValue *val = luaH_getint(t, idx);
-            if (!ttisnil(val)) {
-              TValue temp;
-              setobj(L, &temp, val);
-              luaH_setint(L, result_t, result_idx, &temp);
-            }
-            result_idx++;
-          }
-        }
-        else {  /* step < 0 */
-          lua_Integer idx;
-          for (idx = start_idx; idx >= end_idx; idx += step) {
-            const TValue *val = luaH_getint(t, idx);
-            if (!ttisnil(val)) {
-              TValue temp;
-              setobj(L, &temp, val);
-              luaH_setint(L, result_t, result_idx, &temp);
-            }
-            result_idx++;
-          }
-        }
-        
+        Protect(luaSL_slice(L, ra, vRB(i)));
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -3978,6 +3986,17 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_BREAKPOINT) {
+        savepc(L);
+        i = luaG_breakpoint(L, pc);  /* run hook; get original instruction */
+        updatetrap(ci);
+        updatebase(ci);
+#if LUA_USE_JUMPTABLE
+        vmdispatch(GET_OPCODE(i));
+#else
+        goto l_dispatch;
+#endif
+      }
     }
   }
 }
@@ -3985,5 +4004,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
 /* }======================================================= */
 
 Instruction luaV_getinst(const Proto *p, int pc) {
-  return p->code[pc];
+  Instruction i = p->code[pc];
+  if (l_unlikely(GET_OPCODE(i) == OP_BREAKPOINT))
+    return p->bpcode[pc];  /* look through breakpoint trap */
+  return i;
 }
@@ -144,4 +144,37 @@ LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
 LUAI_FUNC Instruction luaV_getinst(const Proto *p, int pc);
 
+
+/*
+** Per-opcode execution statistics ('make linux-profile'). When
+** LUAI_OPSTATS is not defined the interpreter carries no trace of them.
+*/
+#if defined(LUAI_OPSTATS)
+
+#include "lopcodes.h"
+
+/* slots per table: every opcode plus the breakpoint trap */
+#define OPSTATS_N	(NUM_OPCODES + 1)
+
+/**
+ * @brief Counters of one OS thread. Each thread running the interpreter
+ * gets its own block, so counting needs no synchronization; blocks are
+ * never freed and stay chained in a global list read by 'vm.opstats'.
+ */
+typedef struct OpStats {
+  unsigned long long count[OPSTATS_N];  /**< Executions per opcode. */
+  unsigned long long cycles[OPSTATS_N];  /**< Clock ticks per opcode. */
+  unsigned long long pairs[OPSTATS_N][OPSTATS_N];  /**< [previous][current]. */
+  unsigned long long lastclock;  /**< Clock at the last fetch (timing on). */
+  int last;  /**< Opcode of the previous fetch (-1 if none). */
+  struct OpStats *next;  /**< Next block in the global list. */
+} OpStats;
+
+LUAI_FUNC OpStats *luaV_opstatslist (void);
+LUAI_FUNC void luaV_opstatsreset (void);
+LUAI_FUNC int luaV_opstatstiming (int on);
+LUAI_FUNC const char *luaV_opstatsclock (void);
+
+#endif
+
 #endif
@@ -453,6 +453,221 @@ static int vm_traceback (lua_State *L) {
 }
 
 
+/*
+** {==================================================================
+** Per-opcode statistics
+** ===================================================================
+*/
+#if defined(LUAI_OPSTATS)
+
+#include "lopnames.h"
+
+
+static const char *opstats_name (int op) {
+  return (op < NUM_OPCODES) ? opnames[op] : "BREAKPOINT";
+}
+
+
+/* sum the blocks of all threads into 'acc'; returns number of threads */
+static int opstats_sum (OpStats *acc) {
+  OpStats *s;
+  int n = 0;
+  memset(acc, 0, sizeof(*acc));
+  for (s = luaV_opstatslist(); s != NULL; s = s->next, n++) {
+    int a, b;
+    for (a = 0; a < OPSTATS_N; a++) {
+      acc->count[a] += s->count[a];
+      acc->cycles[a] += s->cycles[a];
+      for (b = 0; b < OPSTATS_N; b++)
+        acc->pairs[a][b] += s->pairs[a][b];
+    }
+  }
+  return n;
+}
+
+
+static void opstats_table (lua_State *L, const OpStats *acc, int nthreads) {
+  unsigned long long total = 0;
+  int a, b;
+  lua_newtable(L);
+  lua_newtable(L);  /* ops */
+  for (a = 0; a < OPSTATS_N; a++) {
+    if (acc->count[a] == 0) continue;
+    total += acc->count[a];
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, (lua_Integer)acc->count[a]);
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, (lua_Integer)acc->cycles[a]);
+    lua_setfield(L, -2, "cycles");
+    lua_setfield(L, -2, opstats_name(a));
+  }
+  lua_setfield(L, -2, "ops");
+  lua_newtable(L);  /* pairs */
+  for (a = 0; a < OPSTATS_N; a++) {
+    for (b = 0; b < OPSTATS_N; b++) {
+      if (acc->pairs[a][b] == 0) continue;
+      lua_pushfstring(L, "%s %s", opstats_name(a), opstats_name(b));
+      lua_pushinteger(L, (lua_Integer)acc->pairs[a][b]);
+      lua_rawset(L, -3);
+    }
+  }
+  lua_setfield(L, -2, "pairs");
+  lua_pushinteger(L, (lua_Integer)total);
+  lua_setfield(L, -2, "total");
+  lua_pushinteger(L, nthreads);
+  lua_setfield(L, -2, "threads");
+  lua_pushboolean(L, luaV_opstatstiming(-1));
+  lua_setfield(L, -2, "timing");
+  lua_pushstring(L, luaV_opstatsclock());
+  lua_setfield(L, -2, "clock");
+}
+
+
+/*
+** Text export, one record per line:
+**   op <name> <count> <cycles>
+**   pair <previous> <current> <count>
+*/
+static void opstats_export (lua_State *L, const OpStats *acc) {
+  luaL_Buffer b;
+  char line[128];
+  int x, y;
+  luaL_buffinit(L, &b);
+  snprintf(line, sizeof(line), "# opstats clock=%s timing=%d\n",
+           luaV_opstatsclock(), luaV_opstatstiming(-1));
+  luaL_addstring(&b, line);
+  for (x = 0; x < OPSTATS_N; x++) {
+    if (acc->count[x] == 0) continue;
+    snprintf(line, sizeof(line), "op %s %llu %llu\n", opstats_name(x),
+             acc->count[x], acc->cycles[x]);
+    luaL_addstring(&b, line);
+  }
+  for (x = 0; x < OPSTATS_N; x++) {
+    for (y = 0; y < OPSTATS_N; y++) {
+      if (acc->pairs[x][y] == 0) continue;
+      snprintf(line, sizeof(line), "pair %s %s %llu\n", opstats_name(x),
+               opstats_name(y), acc->pairs[x][y]);
+      luaL_addstring(&b, line);
+    }
+  }
+  luaL_pushresult(&b);
+}
+
+
+/*
+** vm.opstats() -> snapshot table
+** vm.opstats("reset")
+** vm.opstats("timing" [, on]) -> previous timing state
+** vm.opstats("export" [, filename]) -> text (or true after writing file)
+*/
+static int vm_opstats (lua_State *L) {
+  static const char *const opts[] = {"get", "reset", "timing", "export", NULL};
+  int o = luaL_checkoption(L, 1, "get", opts);
+  const char *fname;
+  OpStats *acc;
+  int n;
+  switch (o) {
+    case 1:
+      luaV_opstatsreset();
+      return 0;
+    case 2: {
+      int old = luaV_opstatstiming(-1);
+      if (!lua_isnone(L, 2))
+        luaV_opstatstiming(lua_toboolean(L, 2));
+      lua_pushboolean(L, old);
+      return 1;
+    }
+    default: break;
+  }
+  fname = luaL_optstring(L, 2, NULL);
+  acc = (OpStats *)lua_newuserdatauv(L, sizeof(OpStats), 0);
+  n = opstats_sum(acc);
+  if (o == 0) {
+    opstats_table(L, acc, n);
+    return 1;
+  }
+  opstats_export(L, acc);
+  if (fname != NULL) {
+    size_t len;
+    const char *text = lua_tolstring(L, -1, &len);
+    FILE *f = fopen(fname, "w");
+    int ok;
+    if (f == NULL)
+      return luaL_fileresult(L, 0, fname);
+    ok = (fwrite(text, 1, len, f) == len);
+    ok = (fclose(f) == 0) && ok;
+    return luaL_fileresult(L, ok, fname);
+  }
+  return 1;
+}
+
+#else
+
+static int vm_opstats (lua_State *L) {
+  luaL_pushfail(L);
+  lua_pushliteral(L, "opstats not compiled in (build with 'make linux-profile')");
+  return 2;
+}
+
+#endif
+/* }================================================================== */
+
+
+/*
+** vm.clone(f, ...): copy this state (see 'luaL_clonestate'), call the
+** copy of 'f' with copies of the arguments in the new state and return
+** its results, which must be nil, booleans, numbers or strings. The new
+** state is closed afterwards.
+*/
+static int vm_clone (lua_State *L) {
+  int n = lua_gettop(L);
+  int top, i, status;
+  lua_State *L1;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  L1 = luaL_clonestate(L, n, luaL_openlibs);
+  if (L1 == NULL)
+    return lua_error(L);
+  status = lua_pcall(L1, n - 1, LUA_MULTRET, 0);
+  top = lua_gettop(L1);
+  if (status == LUA_OK && !lua_checkstack(L, top)) {
+    lua_close(L1);
+    return luaL_error(L, "too many results");
+  }
+  for (i = 1; i <= top; i++) {
+    size_t l;
+    switch (lua_type(L1, i)) {
+      case LUA_TNIL: lua_pushnil(L); break;
+      case LUA_TBOOLEAN: lua_pushboolean(L, lua_toboolean(L1, i)); break;
+      case LUA_TNUMBER: {
+        char buff[LUA_N2SBUFFSZ];
+        if (lua_isinteger(L1, i))
+          lua_pushinteger(L, lua_tointeger(L1, i));
+        else if (lua_numbertocstring(L1, i, buff) > 0)
+          lua_pushnumber(L, lua_tonumber(L1, i));
+        else {  /* big integer */
+          const char *s = luaL_tolstring(L1, i, &l);
+          lua_stringtobig(L, s, l);
+          lua_pop(L1, 1);
+        }
+        break;
+      }
+      case LUA_TSTRING: {
+        const char *s = lua_tolstring(L1, i, &l);
+        lua_pushlstring(L, s, l);
+        break;
+      }
+      default:
+        lua_pushfstring(L, "cannot return a %s from a cloned state",
+                        luaL_typename(L1, i));
+        lua_close(L1);
+        return lua_error(L);
+    }
+  }
+  lua_close(L1);
+  return (status == LUA_OK) ? top : lua_error(L);
+}
+
+
 static const luaL_Reg vm_funcs[] = {
   {"execute", vm_execute},
   {"concat", vm_concat},
@@ -502,6 +717,8 @@ static const luaL_Reg vm_funcs[] = {
   {"error", vm_error},
   {"assert", vm_assert},
   {"traceback", vm_traceback},
+  {"opstats", vm_opstats},
+  {"clone", vm_clone},
   {NULL, NULL}
 };
 
@@ -2,6 +2,7 @@
 #include <string.h>
 #include "lua.h"
 #include "lauxlib.h"
+#include "lualib.h"
 #include "wasm3.h"
 #include "m3_env.h"
 #include "m3_api_libc.h"
@@ -11,30 +12,97 @@
 #define WASM3_RUNTIME_METATABLE "wasm3.runtime"
 #define WASM3_MODULE_METATABLE "wasm3.module"
 #define WASM3_FUNCTION_METATABLE "wasm3.function"
+#define WASM3_MEMORY_METATABLE "wasm3.memory"
+#define WASM3_POOL_METATABLE "wasm3.pool"
 
 typedef struct {
     IM3Environment env;
 } wasm3_Environment;
 
+#define WASM3_MAX_ARGS 128
+
+// A Lua function linked as a wasm import; owned by its runtime. The
+// function itself lives in the runtime's table of linked functions (its
+// user value), so a function that captures the runtime does not keep it
+// alive.
+typedef struct wasm3_Link {
+    struct wasm3_Link *next;
+    int func_ref; // reference in the runtime's table of linked functions
+    uint32_t argc;
+    uint32_t retc;
+    uint8_t argt[WASM3_MAX_ARGS];
+    uint8_t rett[WASM3_MAX_ARGS];
+} wasm3_Link;
+
+// Initial state of a runtime, restored by runtime:restore()
+typedef struct {
+    uint8_t *memory;
+    size_t memory_size;
+    uint32_t pages;
+    uint64_t *globals;
+    uint32_t num_globals;
+} wasm3_Snapshot;
+
 typedef struct {
     IM3Runtime runtime;
     // Keep a reference to the environment so it doesn't get GC'd
     int env_ref;
+    // State running the current call, for host functions (NULL when idle)
+    lua_State *L;
+    // Error raised by a host function during the current call
+    int error_ref;
+    wasm3_Link *links;
+    // Stack index (in L) of the table of linked functions during a call
+    int links_idx;
+    // Bytes of the loaded modules: wasm3 compiles lazily from them
+    int bytes_ref;
+    wasm3_Snapshot *snapshot;
+    // Whether it is back in the pool that created it (user value 2)
+    int pooled;
 } wasm3_Runtime;
 
+// Instances of one module, reset from their snapshot between uses
+typedef struct {
+    lua_Integer stack_size;
+    int created;
+} wasm3_Pool;
+
+// User values of a pool
+#define POOL_ENV 1
+#define POOL_BYTES 2
+#define POOL_LINK 3
+#define POOL_FREE 4
+
+// User value of a runtime holding the pool that created it
+#define RUNTIME_POOL 2
+
 typedef struct {
     IM3Module module;
     // Keep a reference to the environment so it doesn't get GC'd
     int env_ref;
     int loaded; // whether it has been loaded into a runtime
+    int bytes_ref; // the wasm binary, which the module points into
+    // Runtime it was loaded into (kept alive in the user value)
+    wasm3_Runtime *wr;
 } wasm3_Module;
 
 typedef struct {
     IM3Function function;
-    // Keep a reference to the runtime so it doesn't get GC'd
-    int runtime_ref;
+    wasm3_Runtime *wr; // kept alive in the user value
+    // Signature, cached at findFunction time
+    uint32_t argc;
+    uint32_t retc;
+    uint8_t argt[WASM3_MAX_ARGS];
+    uint8_t rett[WASM3_MAX_ARGS];
 } wasm3_Function;
 
+// A view of a runtime's linear memory. It never caches the base address:
+// every access asks the runtime again, so the view stays valid when the
+// memory is grown (and moved). The runtime is kept alive in the user value.
+typedef struct {
+    wasm3_Runtime *wr;
+} wasm3_Memory;
+
 
 static int l_new_environment(lua_State *L) {
     IM3Environment env = m3_NewEnvironment();
@@ -71,9 +139,12 @@ static int env_parse_module(lua_State *L) {
         return luaL_error(L, "Failed to parse wasm module: %s", result);
     }
 
-    wasm3_Module *wm = (wasm3_Module*)lua_newuserdata(L, sizeof(wasm3_Module));
+    wasm3_Module *wm = (wasm3_Module*)lua_newuserdatauv(L, sizeof(wasm3_Module), 1);
     wm->module = module;
     wm->loaded = 0;
+    wm->wr = NULL;
+    lua_pushvalue(L, 2);
+    wm->bytes_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
     // Store reference to environment
     lua_pushvalue(L, 1);
@@ -89,18 +160,31 @@ static int env_new_runtime(lua_State *L) {
     wasm3_Environment *we = (wasm3_Environment*)luaL_checkudata(L, 1, WASM3_ENV_METATABLE);
     lua_Integer stack_size = luaL_optinteger(L, 2, 64 * 1024);
 
-    IM3Runtime runtime = m3_NewRuntime(we->env, stack_size, NULL);
+    wasm3_Runtime *wr = (wasm3_Runtime*)lua_newuserdatauv(L, sizeof(wasm3_Runtime), 2);
+    wr->runtime = NULL;
+    wr->env_ref = LUA_NOREF;
+    wr->L = NULL;
+    wr->error_ref = LUA_NOREF;
+    wr->links = NULL;
+    wr->links_idx = 0;
+    wr->bytes_ref = LUA_NOREF;
+    wr->snapshot = NULL;
+    wr->pooled = 0;
+
+    IM3Runtime runtime = m3_NewRuntime(we->env, stack_size, wr);
     if (!runtime) {
         return luaL_error(L, "Failed to create wasm3 runtime");
     }
-
-    wasm3_Runtime *wr = (wasm3_Runtime*)lua_newuserdata(L, sizeof(wasm3_Runtime));
     wr->runtime = runtime;
 
     // Store reference to environment
     lua_pushvalue(L, 1);
     wr->env_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
+    // Table of linked functions
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+
     luaL_getmetatable(L, WASM3_RUNTIME_METATABLE);
     lua_setmetatable(L, -2);
 
@@ -114,6 +198,8 @@ static int module_gc(lua_State *L) {
         wm->module = NULL;
     }
     luaL_unref(L, LUA_REGISTRYINDEX, wm->env_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, wm->bytes_ref);
+    wm->bytes_ref = LUA_NOREF;
     return 0;
 }
 
@@ -123,7 +209,23 @@ static int runtime_gc(lua_State *L) {
         m3_FreeRuntime(wr->runtime);
         wr->runtime = NULL;
     }
+    while (wr->links) {
+        wasm3_Link *link = wr->links;
+        wr->links = link->next;
+        free(link);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, wr->error_ref);
+    wr->error_ref = LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, wr->bytes_ref);
+    wr->bytes_ref = LUA_NOREF;
+    if (wr->snapshot) {
+        free(wr->snapshot->memory);
+        free(wr->snapshot->globals);
+        free(wr->snapshot);
+        wr->snapshot = NULL;
+    }
     luaL_unref(L, LUA_REGISTRYINDEX, wr->env_ref);
+    wr->env_ref = LUA_NOREF;
     return 0;
 }
 
@@ -141,6 +243,19 @@ static int runtime_load(lua_State *L) {
     }
 
     wm->loaded = 1; // Ownership transferred to runtime
+
+    // The runtime now keeps the module's bytes alive
+    if (wr->bytes_ref == LUA_NOREF) {
+        lua_newtable(L);
+        wr->bytes_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, wr->bytes_ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, wm->bytes_ref);
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+    lua_pop(L, 1);
+    wm->wr = wr;
+    lua_pushvalue(L, 1);
+    lua_setiuservalue(L, 2, 1);
     return 0;
 }
 
@@ -154,12 +269,27 @@ static int runtime_find_function(lua_State *L) {
         return luaL_error(L, "Failed to find function '%s': %s", func_name, result);
     }
 
-    wasm3_Function *wf = (wasm3_Function*)lua_newuserdata(L, sizeof(wasm3_Function));
+    uint32_t argc = m3_GetArgCount(function);
+    uint32_t retc = m3_GetRetCount(function);
+    if (argc > WASM3_MAX_ARGS || retc > WASM3_MAX_ARGS) {
+        return luaL_error(L, "Function '%s' has too many parameters or results", func_name);
+    }
+
+    wasm3_Function *wf = (wasm3_Function*)lua_newuserdatauv(L, sizeof(wasm3_Function), 1);
     wf->function = function;
+    wf->wr = wr;
+    wf->argc = argc;
+    wf->retc = retc;
+    for (uint32_t i = 0; i < argc; i++) {
+        wf->argt[i] = (uint8_t)m3_GetArgType(function, i);
+    }
+    for (uint32_t i = 0; i < retc; i++) {
+        wf->rett[i] = (uint8_t)m3_GetRetType(function, i);
+    }
 
-    // Store reference to runtime
+    // Keep the runtime alive
     lua_pushvalue(L, 1);
-    wf->runtime_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    lua_setiuservalue(L, -2, 1);
 
     luaL_getmetatable(L, WASM3_FUNCTION_METATABLE);
     lua_setmetatable(L, -2);
@@ -167,90 +297,198 @@ static int runtime_find_function(lua_State *L) {
     return 1;
 }
 
-static int function_gc(lua_State *L) {
-    wasm3_Function *wf = (wasm3_Function*)luaL_checkudata(L, 1, WASM3_FUNCTION_METATABLE);
-    luaL_unref(L, LUA_REGISTRYINDEX, wf->runtime_ref);
-    return 0;
+
+// Store the Lua value at idx into a native slot of the given wasm type.
+// Returns 0 if the value cannot be converted.
+static int wasm3_toslot(lua_State *L, int idx, uint8_t type, uint64_t *slot) {
+    int ok = 1;
+    *slot = 0;
+    if (lua_type(L, idx) == LUA_TBOOLEAN) {
+        switch (type) {
+            case c_m3Type_f32: *(float*)slot = (float)lua_toboolean(L, idx); break;
+            case c_m3Type_f64: *(double*)slot = (double)lua_toboolean(L, idx); break;
+            default: *(int64_t*)slot = lua_toboolean(L, idx); break;
+        }
+        return 1;
+    }
+    switch (type) {
+        case c_m3Type_i32:
+            *(int32_t*)slot = (int32_t)(uint32_t)lua_tointegerx(L, idx, &ok);
+            break;
+        case c_m3Type_i64:
+            *(int64_t*)slot = (int64_t)lua_tointegerx(L, idx, &ok);
+            break;
+        case c_m3Type_f32:
+            *(float*)slot = (float)lua_tonumberx(L, idx, &ok);
+            break;
+        case c_m3Type_f64:
+            *(double*)slot = (double)lua_tonumberx(L, idx, &ok);
+            break;
+        default:
+            ok = 0;
+            break;
+    }
+    return ok;
 }
 
-static int function_call(lua_State *L) {
-    wasm3_Function *wf = (wasm3_Function*)luaL_checkudata(L, 1, WASM3_FUNCTION_METATABLE);
-    int top = lua_gettop(L);
-    int argc = top - 1; // first arg is the function object itself
+static void wasm3_checkslot(lua_State *L, int idx, uint8_t type, uint64_t *slot, int argn) {
+    if (!wasm3_toslot(L, idx, type, slot)) {
+        if (lua_type(L, idx) == LUA_TNUMBER || lua_type(L, idx) == LUA_TSTRING) {
+            luaL_error(L, "Argument %d has no %s representation", argn,
+                       (type == c_m3Type_i32 || type == c_m3Type_i64) ? "integer" : "number");
+        }
+        luaL_error(L, "Argument %d must be number, string, or boolean", argn);
+    }
+}
 
-    int expected_argc = m3_GetArgCount(wf->function);
-    if (argc != expected_argc) {
-        return luaL_error(L, "Function expects %d arguments, but %d provided", expected_argc, argc);
+// Push a native slot of the given wasm type
+static void wasm3_pushslot(lua_State *L, uint8_t type, const uint64_t *slot) {
+    switch (type) {
+        case c_m3Type_i32: lua_pushinteger(L, *(const int32_t*)slot); break;
+        case c_m3Type_i64: lua_pushinteger(L, *(const int64_t*)slot); break;
+        case c_m3Type_f32: lua_pushnumber(L, *(const float*)slot); break;
+        case c_m3Type_f64: lua_pushnumber(L, *(const double*)slot); break;
+        default: lua_pushnil(L); break;
     }
+}
 
-    const char* argv[128]; // Max 128 arguments for simplicity in this binding
-    if (argc > 128) {
-        return luaL_error(L, "Too many arguments");
+// Raise the error of a failed call: the error value of a host function
+// if one raised, otherwise wasm3's message
+static void wasm3_raise(lua_State *L, wasm3_Runtime *wr, const char *what, M3Result result) {
+    if (wr->error_ref != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, wr->error_ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, wr->error_ref);
+        wr->error_ref = LUA_NOREF;
+        lua_error(L);
     }
+    luaL_error(L, "%s: %s", what, result);
+}
 
-    // We keep strings to pass to m3_CallArgv. We need to format numbers properly as strings.
-    char arg_bufs[128][64]; // Buffers for string conversion if needed
-    for (int i = 0; i < argc; i++) {
-        int idx = i + 2;
-        if (lua_type(L, idx) == LUA_TNUMBER) {
-            if (lua_isinteger(L, idx)) {
-                snprintf(arg_bufs[i], sizeof(arg_bufs[i]), "%lld", (long long)lua_tointeger(L, idx));
-            } else {
-                snprintf(arg_bufs[i], sizeof(arg_bufs[i]), "%f", lua_tonumber(L, idx));
-            }
-            argv[i] = arg_bufs[i];
-        } else if (lua_type(L, idx) == LUA_TSTRING) {
-            argv[i] = lua_tostring(L, idx);
-        } else if (lua_type(L, idx) == LUA_TBOOLEAN) {
-            snprintf(arg_bufs[i], sizeof(arg_bufs[i]), "%d", lua_toboolean(L, idx));
-            argv[i] = arg_bufs[i];
-        } else {
-            return luaL_error(L, "Argument %d must be number, string, or boolean", i+1);
-        }
+// Push the table of linked functions of the runtime at idx and make it
+// the one host functions are taken from during the call that follows
+static void wasm3_enter(lua_State *L, wasm3_Runtime *wr, int idx) {
+    lua_getiuservalue(L, idx, 1);
+    wr->links_idx = lua_gettop(L);
+    wr->L = L;
+}
+
+// Call wf (at index 1) with its argc arguments taken from the stack
+// starting at base
+static void wasm3_invoke(lua_State *L, wasm3_Function *wf, int base) {
+    uint64_t slots[WASM3_MAX_ARGS];
+    const void *argptrs[WASM3_MAX_ARGS];
+    for (uint32_t i = 0; i < wf->argc; i++) {
+        wasm3_checkslot(L, base + (int)i, wf->argt[i], &slots[i], (int)i + 1);
+        argptrs[i] = &slots[i];
+    }
+    wasm3_Runtime *wr = wf->wr;
+    if (wr->L) {
+        luaL_error(L, "Function call failed: runtime is already running a call");
+    }
+    lua_getiuservalue(L, 1, 1); // the runtime
+    wasm3_enter(L, wr, -1);
+    M3Result result = m3_Call(wf->function, wf->argc, argptrs);
+    wr->L = NULL;
+    lua_pop(L, 2);
+    if (result) {
+        wasm3_raise(L, wr, "Function call failed", result);
     }
+}
+
+// Push the results of the last call of wf (caller ensures stack space)
+static void wasm3_pushresults(lua_State *L, wasm3_Function *wf) {
+    uint64_t val[WASM3_MAX_ARGS];
+    const void *valptrs[WASM3_MAX_ARGS];
+    if (wf->retc == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < wf->retc; i++) valptrs[i] = &val[i];
 
-    M3Result result = m3_CallArgv(wf->function, argc, argv);
+    M3Result result = m3_GetResults(wf->function, wf->retc, valptrs);
     if (result) {
-        return luaL_error(L, "Function call failed: %s", result);
+        luaL_error(L, "Failed to get results: %s", result);
+    }
+
+    for (uint32_t i = 0; i < wf->retc; i++) {
+        wasm3_pushslot(L, wf->rett[i], &val[i]);
     }
+}
 
-    int retc = m3_GetRetCount(wf->function);
-    if (retc == 0) {
-        return 0;
-    } else if (retc > 0) {
-        uint64_t val[128]; // Max 128 returns
-        const void* valptrs[128];
-        for(int i=0; i<retc; i++) valptrs[i] = &val[i];
+static int function_call(lua_State *L) {
+    wasm3_Function *wf = (wasm3_Function*)luaL_checkudata(L, 1, WASM3_FUNCTION_METATABLE);
+    int argc = lua_gettop(L) - 1; // first arg is the function object itself
+
+    if (argc != (int)wf->argc) {
+        return luaL_error(L, "Function expects %d arguments, but %d provided", (int)wf->argc, argc);
+    }
+
+    if (wf->retc > LUA_MINSTACK) {
+        luaL_checkstack(L, (int)wf->retc, "too many results");
+    }
+    wasm3_invoke(L, wf, 2);
+    wasm3_pushresults(L, wf);
+    return (int)wf->retc;
+}
+
+// fn:call_batch({ {a, b}, {c, d}, ... }) -> { r1, r2, ... }
+// Single-argument functions also take plain values; multiple results
+// come back as one table per call.
+static int function_call_batch(lua_State *L) {
+    wasm3_Function *wf = (wasm3_Function*)luaL_checkudata(L, 1, WASM3_FUNCTION_METATABLE);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_Integer n = luaL_len(L, 2);
+    int argc = (int)wf->argc;
 
-        M3Result resResult = m3_GetResults(wf->function, retc, valptrs);
-        if (resResult) {
-            return luaL_error(L, "Failed to get results: %s", resResult);
+    lua_settop(L, 2);
+    lua_createtable(L, (int)n, 0); // results at 3
+    luaL_checkstack(L, argc + (int)wf->retc + 2, "too many arguments");
+
+    for (lua_Integer i = 1; i <= n; i++) {
+        int base;
+        if (lua_rawgeti(L, 2, i) == LUA_TTABLE) { // at 4
+            for (int j = 1; j <= argc; j++) {
+                lua_rawgeti(L, 4, j);
+            }
+            base = 5;
+        } else if (argc == 1) {
+            base = 4;
+        } else {
+            return luaL_error(L, "Call %d: expected a table of %d arguments", (int)i, argc);
         }
 
-        for (int i = 0; i < retc; i++) {
-            M3ValueType type = m3_GetRetType(wf->function, i);
-            switch (type) {
-                case c_m3Type_i32:
-                    lua_pushinteger(L, *(int32_t*)&val[i]);
-                    break;
-                case c_m3Type_i64:
-                    lua_pushinteger(L, *(int64_t*)&val[i]);
-                    break;
-                case c_m3Type_f32:
-                    lua_pushnumber(L, *(float*)&val[i]);
-                    break;
-                case c_m3Type_f64:
-                    lua_pushnumber(L, *(double*)&val[i]);
-                    break;
-                default:
-                    lua_pushnil(L);
-                    break;
+        wasm3_invoke(L, wf, base);
+        if (wf->retc == 1) {
+            wasm3_pushresults(L, wf);
+            lua_rawseti(L, 3, i);
+        } else if (wf->retc > 1) {
+            int first = lua_gettop(L) + 1;
+            wasm3_pushresults(L, wf);
+            lua_createtable(L, (int)wf->retc, 0);
+            for (uint32_t j = 0; j < wf->retc; j++) {
+                lua_pushvalue(L, first + (int)j);
+                lua_rawseti(L, -2, j + 1);
             }
+            lua_rawseti(L, 3, i);
         }
-        return retc;
+        lua_settop(L, 3);
     }
+    return 1;
+}
 
-    return 0;
+// fn:signature() -> { "i32", ... }, { "i64", ... }
+static int function_signature(lua_State *L) {
+    wasm3_Function *wf = (wasm3_Function*)luaL_checkudata(L, 1, WASM3_FUNCTION_METATABLE);
+    lua_createtable(L, (int)wf->argc, 0);
+    for (uint32_t i = 0; i < wf->argc; i++) {
+        lua_pushstring(L, c_waTypes[wf->argt[i]]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_createtable(L, (int)wf->retc, 0);
+    for (uint32_t i = 0; i < wf->retc; i++) {
+        lua_pushstring(L, c_waTypes[wf->rett[i]]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    return 2;
 }
 
 
@@ -276,6 +514,117 @@ static int module_linkLibC(lua_State *L) {
     return 0;
 }
 
+/*
+** Host functions. The import's stack frame holds the result slots
+** followed by the argument slots, 8 bytes each. The trampoline moves the
+** arguments straight into Lua and runs the function in protected mode; a
+** Lua error is kept in the runtime and traps the guest, and the call that
+** entered the guest then rethrows it.
+*/
+static const char wasm3_hostError[] = "Lua error in host function";
+
+static const void *wasm3_trampoline(IM3Runtime runtime, IM3ImportContext ctx, uint64_t *sp, void *mem) {
+    wasm3_Link *link = (wasm3_Link*)ctx->userdata;
+    wasm3_Runtime *wr = (wasm3_Runtime*)m3_GetUserData(runtime);
+    lua_State *L = wr->L;
+    (void)mem;
+    if (!L) {
+        return "host function called outside of a Lua call";
+    }
+
+    int top = lua_gettop(L);
+    if (!lua_checkstack(L, (int)(link->argc + link->retc) + 2)) {
+        return m3Err_trapStackOverflow;
+    }
+    lua_rawgeti(L, wr->links_idx, link->func_ref);
+    const uint64_t *args = sp + link->retc;
+    for (uint32_t i = 0; i < link->argc; i++) {
+        wasm3_pushslot(L, link->argt[i], &args[i]);
+    }
+
+    if (lua_pcall(L, (int)link->argc, (int)link->retc, 0) != LUA_OK) {
+        wr->error_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_settop(L, top);
+        return wasm3_hostError;
+    }
+
+    for (uint32_t i = 0; i < link->retc; i++) {
+        if (!wasm3_toslot(L, top + 1 + (int)i, link->rett[i], &sp[i])) {
+            lua_pushfstring(L, "host function result %d: expected %s, got %s",
+                            (int)i + 1, c_waTypes[link->rett[i]], luaL_typename(L, top + 1 + (int)i));
+            wr->error_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            lua_settop(L, top);
+            return wasm3_hostError;
+        }
+    }
+    lua_settop(L, top);
+    return m3Err_none;
+}
+
+// Parse a wasm3 signature ("i(iI)", "v()", ...) into the link's type lists
+static int wasm3_parsesig(wasm3_Link *link, const char *sig) {
+    const char *open = strchr(sig, '(');
+    const char *close = open ? strchr(open, ')') : NULL;
+    if (!open || !close || close[1] != '\0') return 0;
+    link->argc = link->retc = 0;
+    for (const char *p = sig; p < close; p++) {
+        uint8_t type;
+        if (p == open || *p == ' ') continue;
+        switch (*p) {
+            case 'v': continue;
+            case 'i': case '*': type = c_m3Type_i32; break;
+            case 'I': type = c_m3Type_i64; break;
+            case 'f': type = c_m3Type_f32; break;
+            case 'F': type = c_m3Type_f64; break;
+            default: return 0;
+        }
+        if (p < open) {
+            if (link->retc == WASM3_MAX_ARGS) return 0;
+            link->rett[link->retc++] = type;
+        } else {
+            if (link->argc == WASM3_MAX_ARGS) return 0;
+            link->argt[link->argc++] = type;
+        }
+    }
+    return 1;
+}
+
+// module:linkFunction(modname, fname, signature, luafunc)
+static int module_linkFunction(lua_State *L) {
+    wasm3_Module *wm = (wasm3_Module*)luaL_checkudata(L, 1, WASM3_MODULE_METATABLE);
+    const char *modname = luaL_checkstring(L, 2);
+    const char *fname = luaL_checkstring(L, 3);
+    const char *sig = luaL_checkstring(L, 4);
+    luaL_checktype(L, 5, LUA_TFUNCTION);
+    if (!wm->wr) {
+        return luaL_error(L, "Module must be loaded into a runtime before linking functions");
+    }
+
+    wasm3_Link *link = (wasm3_Link*)malloc(sizeof(wasm3_Link));
+    if (!link) {
+        return luaL_error(L, "not enough memory");
+    }
+    if (!wasm3_parsesig(link, sig)) {
+        free(link);
+        return luaL_argerror(L, 4, "malformed signature");
+    }
+
+    M3Result result = m3_LinkRawFunctionEx(wm->module, modname, fname, sig, wasm3_trampoline, link);
+    if (result) {
+        free(link);
+        return luaL_error(L, "Failed to link function '%s.%s': %s", modname, fname, result);
+    }
+
+    lua_getiuservalue(L, 1, 1); // the runtime
+    lua_getiuservalue(L, -1, 1); // its linked functions
+    lua_pushvalue(L, 5);
+    link->func_ref = luaL_ref(L, -2);
+    lua_pop(L, 2);
+    link->next = wm->wr->links;
+    wm->wr->links = link;
+    return 0;
+}
+
 static int module_getName(lua_State *L) {
     wasm3_Module *wm = (wasm3_Module*)luaL_checkudata(L, 1, WASM3_MODULE_METATABLE);
     const char *name = m3_GetModuleName(wm->module);
@@ -301,19 +650,208 @@ static int runtime_getMemorySize(lua_State *L) {
     return 1;
 }
 
+// runtime:getMemory([offset [, len]]) -> copy of (part of) the memory
 static int runtime_getMemory(lua_State *L) {
     wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
     uint32_t memorySize;
     uint8_t* memory = m3_GetMemory(wr->runtime, &memorySize, 0);
     if (memory) {
-        // Return memory contents as string
-        lua_pushlstring(L, (const char*)memory, memorySize);
+        lua_Integer offset = luaL_optinteger(L, 2, 0);
+        luaL_argcheck(L, offset >= 0 && offset <= (lua_Integer)memorySize, 2, "offset out of bounds");
+        lua_Integer len = luaL_optinteger(L, 3, (lua_Integer)memorySize - offset);
+        luaL_argcheck(L, len >= 0 && len <= (lua_Integer)memorySize - offset, 3, "length out of bounds");
+        lua_pushlstring(L, (const char*)memory + offset, (size_t)len);
     } else {
         lua_pushnil(L);
     }
     return 1;
 }
 
+// runtime:memory() -> view of the linear memory
+static int runtime_memory(lua_State *L) {
+    wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
+    wasm3_Memory *wm = (wasm3_Memory*)lua_newuserdatauv(L, sizeof(wasm3_Memory), 1);
+    wm->wr = wr;
+    lua_pushvalue(L, 1);
+    lua_setiuservalue(L, -2, 1);
+    luaL_getmetatable(L, WASM3_MEMORY_METATABLE);
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+/*
+** Memory views. Offsets are 0-based byte addresses, as in wasm; every
+** access is bounds-checked against the current memory size.
+*/
+
+// Current base address and size of the memory (NULL/0 if there is none)
+static uint8_t *memory_base(wasm3_Memory *wm, uint32_t *size) {
+    uint8_t *base = wm->wr->runtime ? m3_GetMemory(wm->wr->runtime, size, 0) : NULL;
+    if (!base) *size = 0;
+    return base;
+}
+
+// Resolve [offset, offset + len) to a host pointer; raises on out-of-bounds
+static uint8_t *memory_range(lua_State *L, wasm3_Memory *wm, lua_Integer offset, lua_Integer len) {
+    uint32_t size;
+    uint8_t *base = memory_base(wm, &size);
+    if (offset < 0 || len < 0 || offset > (lua_Integer)size || len > (lua_Integer)size - offset) {
+        luaL_error(L, "memory access out of bounds (offset %I, length %I, memory size %d)",
+                   (LUAI_UACINT)offset, (LUAI_UACINT)len, (int)size);
+    }
+    return base + offset;
+}
+
+static wasm3_Memory *check_memory(lua_State *L) {
+    return (wasm3_Memory*)luaL_checkudata(L, 1, WASM3_MEMORY_METATABLE);
+}
+
+static int memory_size(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    uint32_t size;
+    memory_base(wm, &size);
+    lua_pushinteger(L, size);
+    return 1;
+}
+
+// view:read(offset, len) -> string
+static int memory_read(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    lua_Integer len = luaL_checkinteger(L, 3);
+    uint8_t *p = memory_range(L, wm, offset, len);
+    lua_pushlstring(L, (const char*)p, (size_t)len);
+    return 1;
+}
+
+// view:write(offset, str) -> number of bytes written
+static int memory_write(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    size_t len;
+    const char *str = luaL_checklstring(L, 3, &len);
+    uint8_t *p = memory_range(L, wm, offset, (lua_Integer)len);
+    memcpy(p, str, len);
+    lua_pushinteger(L, (lua_Integer)len);
+    return 1;
+}
+
+// view:fill(offset, len [, byte])
+static int memory_fill(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    lua_Integer len = luaL_checkinteger(L, 3);
+    int byte = (int)luaL_optinteger(L, 4, 0);
+    uint8_t *p = memory_range(L, wm, offset, len);
+    memset(p, byte, (size_t)len);
+    return 0;
+}
+
+// view:copy(dst, src, len); the ranges may overlap
+static int memory_copy(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    lua_Integer dst = luaL_checkinteger(L, 2);
+    lua_Integer src = luaL_checkinteger(L, 3);
+    lua_Integer len = luaL_checkinteger(L, 4);
+    uint8_t *s = memory_range(L, wm, src, len);
+    uint8_t *d = memory_range(L, wm, dst, len);
+    memmove(d, s, (size_t)len);
+    return 0;
+}
+
+// view:unpack(fmt [, offset]) -> values..., next offset
+// Same formats as string.unpack, read in place from the memory.
+static int memory_unpack(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    const char *fmt = luaL_checkstring(L, 2);
+    lua_Integer offset = luaL_optinteger(L, 3, 0);
+    uint32_t size;
+    uint8_t *base = memory_base(wm, &size);
+    memory_range(L, wm, offset, 0);
+    int n = luaL_unpackbuff(L, fmt, (const char*)base, size, (size_t)offset);
+    lua_pushinteger(L, lua_tointeger(L, -1) - 1); // next position, as an offset
+    lua_replace(L, -2);
+    return n;
+}
+
+// view:pack(offset, fmt, ...) -> next offset
+// Same formats as string.pack; only the packed bytes are copied in.
+static int memory_pack(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    luaL_checkstring(L, 3);
+    int nargs = lua_gettop(L) - 2;
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_getfield(L, -1, LUA_STRLIBNAME);
+    if (!lua_istable(L, -1) || lua_getfield(L, -1, "pack") != LUA_TFUNCTION) {
+        return luaL_error(L, "string library not loaded");
+    }
+    lua_replace(L, 2); // string.pack in place of the offset
+    lua_settop(L, nargs + 2);
+    lua_call(L, nargs, 1);
+    size_t len;
+    const char *bytes = lua_tolstring(L, -1, &len);
+    uint8_t *p = memory_range(L, wm, offset, (lua_Integer)len);
+    memcpy(p, bytes, len);
+    lua_pushinteger(L, offset + (lua_Integer)len);
+    return 1;
+}
+
+// Typed accessors: view:<kind>(offset) reads, view:<kind>(offset, value) writes
+enum { MEM_U8, MEM_I8, MEM_U16, MEM_I16, MEM_U32, MEM_I32, MEM_U64, MEM_I64, MEM_F32, MEM_F64 };
+
+static const struct {
+    const char *name;
+    int size;
+} memory_kinds[] = {
+    {"u8", 1}, {"i8", 1}, {"u16", 2}, {"i16", 2}, {"u32", 4}, {"i32", 4},
+    {"u64", 8}, {"i64", 8}, {"f32", 4}, {"f64", 8}, {NULL, 0}
+};
+
+static int memory_access(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    int kind = (int)lua_tointeger(L, lua_upvalueindex(1));
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    uint8_t *p = memory_range(L, wm, offset, memory_kinds[kind].size);
+    int size = memory_kinds[kind].size;
+    if (lua_isnone(L, 3)) {
+        if (kind == MEM_F32) {
+            float v; memcpy(&v, p, 4); lua_pushnumber(L, v);
+        } else if (kind == MEM_F64) {
+            double v; memcpy(&v, p, 8); lua_pushnumber(L, v);
+        } else {
+            uint64_t v = 0; // wasm memory is little-endian
+            for (int i = 0; i < size; i++) v |= (uint64_t)p[i] << (8 * i);
+            int is_signed = (kind == MEM_I8 || kind == MEM_I16 || kind == MEM_I32);
+            if (is_signed && size < 8 && (v >> (8 * size - 1)) & 1) {
+                v |= ~(uint64_t)0 << (8 * size); // sign-extend
+            }
+            lua_pushinteger(L, (lua_Integer)v);
+        }
+        return 1;
+    }
+    if (kind == MEM_F32) {
+        float v = (float)luaL_checknumber(L, 3);
+        memcpy(p, &v, 4);
+    } else if (kind == MEM_F64) {
+        double v = (double)luaL_checknumber(L, 3);
+        memcpy(p, &v, 8);
+    } else {
+        // integers wrap to the width of the slot, as wasm stores do
+        uint64_t v = (uint64_t)luaL_checkinteger(L, 3);
+        for (int i = 0; i < size; i++) p[i] = (uint8_t)(v >> (8 * i));
+    }
+    return 0;
+}
+
+static int memory_tostring(lua_State *L) {
+    wasm3_Memory *wm = check_memory(L);
+    uint32_t size;
+    memory_base(wm, &size);
+    lua_pushfstring(L, "wasm3.memory (%d bytes): %p", (int)size, (void*)wm);
+    return 1;
+}
+
 static int runtime_printInfo(lua_State *L) {
 #if defined(DEBUG)
     wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
@@ -342,6 +880,264 @@ static int runtime_getBacktrace(lua_State *L) {
 }
 
 
+// runtime:compile() -- compile every function and run the start functions
+static int runtime_compile(lua_State *L) {
+    wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
+    if (wr->L) {
+        return luaL_error(L, "runtime is already running a call");
+    }
+    for (IM3Module m = wr->runtime->modules; m; m = m->next) {
+        M3Result result = m3_CompileModule(m);
+        if (result) {
+            return luaL_error(L, "Failed to compile module: %s", result);
+        }
+    }
+    for (IM3Module m = wr->runtime->modules; m; m = m->next) {
+        wasm3_enter(L, wr, 1); // the start function may call host functions
+        M3Result result = m3_RunStart(m);
+        wr->L = NULL;
+        lua_pop(L, 1);
+        if (result) {
+            wasm3_raise(L, wr, "Start function failed", result);
+        }
+    }
+    return 0;
+}
+
+static uint32_t runtime_numglobals(IM3Runtime runtime) {
+    uint32_t n = 0;
+    for (IM3Module m = runtime->modules; m; m = m->next) n += m->numGlobals;
+    return n;
+}
+
+static void free_snapshot(wasm3_Snapshot *snap) {
+    if (snap) {
+        free(snap->memory);
+        free(snap->globals);
+        free(snap);
+    }
+}
+
+// runtime:snapshot() -- compile everything and record the linear memory
+// and globals; runtime:restore() resets the runtime to that state
+static int runtime_snapshot(lua_State *L) {
+    wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
+    lua_settop(L, 1);
+    lua_pushcfunction(L, runtime_compile);
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, 0);
+
+    IM3Runtime runtime = wr->runtime;
+    uint32_t size = 0;
+    uint8_t *memory = m3_GetMemory(runtime, &size, 0);
+    if (!memory) size = 0;
+    uint32_t num_globals = runtime_numglobals(runtime);
+
+    wasm3_Snapshot *snap = (wasm3_Snapshot*)calloc(1, sizeof(wasm3_Snapshot));
+    if (snap) {
+        snap->memory = (uint8_t*)malloc(size ? size : 1);
+        snap->globals = (uint64_t*)malloc(num_globals ? num_globals * sizeof(uint64_t) : 1);
+    }
+    if (!snap || !snap->memory || !snap->globals) {
+        free_snapshot(snap);
+        return luaL_error(L, "not enough memory");
+    }
+
+    if (size) memcpy(snap->memory, memory, size);
+    snap->memory_size = size;
+    snap->pages = runtime->memory.numPages;
+    snap->num_globals = num_globals;
+    uint32_t g = 0;
+    for (IM3Module m = runtime->modules; m; m = m->next) {
+        for (uint32_t i = 0; i < m->numGlobals; i++) {
+            memcpy(&snap->globals[g++], &m->globals[i].i64Value, sizeof(uint64_t));
+        }
+    }
+
+    free_snapshot(wr->snapshot);
+    wr->snapshot = snap;
+    return 0;
+}
+
+static void wasm3_restore(lua_State *L, wasm3_Runtime *wr) {
+    wasm3_Snapshot *snap = wr->snapshot;
+    IM3Runtime runtime = wr->runtime;
+    if (!snap) {
+        luaL_error(L, "runtime has no snapshot");
+    }
+    if (wr->L) {
+        luaL_error(L, "runtime is running a call");
+    }
+    if (runtime_numglobals(runtime) != snap->num_globals) {
+        luaL_error(L, "runtime changed since its snapshot");
+    }
+
+    if (runtime->memory.numPages != snap->pages) {
+        // drop the pages grown since the snapshot
+        M3Result result = ResizeMemory(runtime, snap->pages);
+        if (result) {
+            luaL_error(L, "Failed to restore memory: %s", result);
+        }
+    }
+    if (snap->memory_size) {
+        uint32_t size = 0;
+        uint8_t *memory = m3_GetMemory(runtime, &size, 0);
+        if (!memory || size != snap->memory_size) {
+            luaL_error(L, "Failed to restore memory: size mismatch");
+        }
+        memcpy(memory, snap->memory, size);
+    }
+
+    uint32_t g = 0;
+    for (IM3Module m = runtime->modules; m; m = m->next) {
+        for (uint32_t i = 0; i < m->numGlobals; i++) {
+            memcpy(&m->globals[i].i64Value, &snap->globals[g++], sizeof(uint64_t));
+        }
+    }
+    runtime->lastCalled = NULL;
+}
+
+static int runtime_restore(lua_State *L) {
+    wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 1, WASM3_RUNTIME_METATABLE);
+    wasm3_restore(L, wr);
+    return 0;
+}
+
+/*
+** Runtime pools. Each instance parses, links, compiles and snapshots the
+** module once; after that, handing one out again only takes restoring
+** its snapshot (a memcpy of the initial linear memory and the globals).
+*/
+
+// Create, link and snapshot a new instance; leaves the runtime on the stack
+static void pool_instantiate(lua_State *L, wasm3_Pool *pool) {
+    int p = lua_gettop(L); // the pool
+    lua_pushcfunction(L, env_new_runtime);
+    lua_getiuservalue(L, p, POOL_ENV);
+    lua_pushinteger(L, pool->stack_size);
+    lua_call(L, 2, 1); // runtime at p + 1
+
+    lua_pushcfunction(L, env_parse_module);
+    lua_getiuservalue(L, p, POOL_ENV);
+    lua_getiuservalue(L, p, POOL_BYTES);
+    lua_call(L, 2, 1); // module at p + 2
+
+    lua_pushcfunction(L, runtime_load);
+    lua_pushvalue(L, p + 1);
+    lua_pushvalue(L, p + 2);
+    lua_call(L, 2, 0);
+
+    if (lua_getiuservalue(L, p, POOL_LINK) == LUA_TFUNCTION) {
+        lua_pushvalue(L, p + 2);
+        lua_pushvalue(L, p + 1);
+        lua_call(L, 2, 0);
+    } else {
+        lua_pop(L, 1);
+    }
+
+    lua_pushcfunction(L, runtime_snapshot);
+    lua_pushvalue(L, p + 1);
+    lua_call(L, 1, 0);
+
+    lua_pushvalue(L, p);
+    lua_setiuservalue(L, p + 1, RUNTIME_POOL);
+    pool->created++;
+    lua_settop(L, p + 1);
+}
+
+// pool:acquire() -> runtime in its initial state
+static int pool_acquire(lua_State *L) {
+    wasm3_Pool *pool = (wasm3_Pool*)luaL_checkudata(L, 1, WASM3_POOL_METATABLE);
+    lua_settop(L, 1);
+    lua_getiuservalue(L, 1, POOL_FREE);
+    lua_Integer n = luaL_len(L, 2);
+    if (n > 0) {
+        lua_rawgeti(L, 2, n);
+        lua_pushnil(L);
+        lua_rawseti(L, 2, n);
+        wasm3_Runtime *wr = (wasm3_Runtime*)lua_touserdata(L, -1);
+        wr->pooled = 0;
+        return 1;
+    }
+    lua_settop(L, 1);
+    pool_instantiate(L, pool);
+    return 1;
+}
+
+// pool:release(runtime) -- reset the runtime and put it back
+static int pool_release(lua_State *L) {
+    luaL_checkudata(L, 1, WASM3_POOL_METATABLE);
+    wasm3_Runtime *wr = (wasm3_Runtime*)luaL_checkudata(L, 2, WASM3_RUNTIME_METATABLE);
+    lua_getiuservalue(L, 2, RUNTIME_POOL);
+    luaL_argcheck(L, lua_rawequal(L, -1, 1), 2, "runtime does not belong to this pool");
+    lua_pop(L, 1);
+    luaL_argcheck(L, !wr->pooled, 2, "runtime already released");
+    wasm3_restore(L, wr);
+    wr->pooled = 1;
+    lua_getiuservalue(L, 1, POOL_FREE);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+    return 0;
+}
+
+// pool:stats() -> instances created, instances available
+static int pool_stats(lua_State *L) {
+    wasm3_Pool *pool = (wasm3_Pool*)luaL_checkudata(L, 1, WASM3_POOL_METATABLE);
+    lua_getiuservalue(L, 1, POOL_FREE);
+    lua_Integer n = luaL_len(L, -1);
+    lua_pushinteger(L, pool->created);
+    lua_pushinteger(L, n);
+    return 2;
+}
+
+// wasm3.newPool(bytes [, { size = n, stack = bytes, link = function(module, runtime) }])
+static int l_new_pool(lua_State *L) {
+    luaL_checkstring(L, 1);
+    lua_Integer size = 0, stack_size = 64 * 1024;
+    lua_settop(L, 2);
+    lua_pushnil(L); // link function at 3
+    if (!lua_isnil(L, 2)) {
+        luaL_checktype(L, 2, LUA_TTABLE);
+        lua_getfield(L, 2, "size");
+        size = luaL_optinteger(L, -1, 0);
+        lua_getfield(L, 2, "stack");
+        stack_size = luaL_optinteger(L, -1, stack_size);
+        lua_getfield(L, 2, "link");
+        if (!lua_isnil(L, -1)) luaL_checktype(L, -1, LUA_TFUNCTION);
+        lua_replace(L, 3);
+        lua_settop(L, 3);
+    }
+
+    wasm3_Pool *pool = (wasm3_Pool*)lua_newuserdatauv(L, sizeof(wasm3_Pool), 4);
+    pool->stack_size = stack_size;
+    pool->created = 0;
+    luaL_getmetatable(L, WASM3_POOL_METATABLE);
+    lua_setmetatable(L, -2);
+
+    lua_pushcfunction(L, l_new_environment);
+    lua_call(L, 0, 1);
+    lua_setiuservalue(L, 4, POOL_ENV);
+    lua_pushvalue(L, 1);
+    lua_setiuservalue(L, 4, POOL_BYTES);
+    lua_pushvalue(L, 3);
+    lua_setiuservalue(L, 4, POOL_LINK);
+    lua_createtable(L, size > 0 ? (int)size : 0, 0);
+    lua_setiuservalue(L, 4, POOL_FREE);
+
+    // instantiate the first instances up front
+    for (lua_Integer i = 0; i < size; i++) {
+        lua_pushcfunction(L, pool_release);
+        lua_pushvalue(L, 4);
+        lua_pushvalue(L, 4);
+        pool_instantiate(L, pool);
+        lua_remove(L, -2);
+        lua_call(L, 2, 0);
+    }
+    lua_settop(L, 4);
+    return 1;
+}
+
+
 static const struct luaL_Reg env_methods[] = {
     {"parseModule", env_parse_module},
     {"newRuntime", env_new_runtime},
@@ -352,6 +1148,7 @@ static const struct luaL_Reg env_methods[] = {
 static const struct luaL_Reg module_methods[] = {
     {"linkWASI", module_linkWASI},
     {"linkLibC", module_linkLibC},
+    {"linkFunction", module_linkFunction},
     {"getName", module_getName},
     {"setName", module_setName},
     {"__gc", module_gc},
@@ -363,20 +1160,46 @@ static const struct luaL_Reg runtime_methods[] = {
     {"findFunction", runtime_find_function},
     {"getMemorySize", runtime_getMemorySize},
     {"getMemory", runtime_getMemory},
+    {"memory", runtime_memory},
     {"printInfo", runtime_printInfo},
     {"getBacktrace", runtime_getBacktrace},
+    {"compile", runtime_compile},
+    {"snapshot", runtime_snapshot},
+    {"restore", runtime_restore},
     {"__gc", runtime_gc},
     {NULL, NULL}
 };
 
 static const struct luaL_Reg function_methods[] = {
     {"call", function_call},
-    {"__gc", function_gc},
+    {"call_batch", function_call_batch},
+    {"signature", function_signature},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg memory_methods[] = {
+    {"size", memory_size},
+    {"read", memory_read},
+    {"write", memory_write},
+    {"fill", memory_fill},
+    {"copy", memory_copy},
+    {"unpack", memory_unpack},
+    {"pack", memory_pack},
+    {"__len", memory_size},
+    {"__tostring", memory_tostring},
+    {NULL, NULL}
+};
+
+static const struct luaL_Reg pool_methods[] = {
+    {"acquire", pool_acquire},
+    {"release", pool_release},
+    {"stats", pool_stats},
     {NULL, NULL}
 };
 
 static const struct luaL_Reg wasm3_lib[] = {
     {"newEnvironment", l_new_environment},
+    {"newPool", l_new_pool},
     {NULL, NULL}
 };
 
@@ -394,6 +1217,16 @@ int luaopen_wasm3(lua_State *L) {
     create_meta(L, WASM3_RUNTIME_METATABLE, runtime_methods);
     create_meta(L, WASM3_MODULE_METATABLE, module_methods);
     create_meta(L, WASM3_FUNCTION_METATABLE, function_methods);
+    create_meta(L, WASM3_MEMORY_METATABLE, memory_methods);
+    create_meta(L, WASM3_POOL_METATABLE, pool_methods);
+
+    luaL_getmetatable(L, WASM3_MEMORY_METATABLE);
+    for (int i = 0; memory_kinds[i].name; i++) {
+        lua_pushinteger(L, i);
+        lua_pushcclosure(L, memory_access, 1);
+        lua_setfield(L, -2, memory_kinds[i].name);
+    }
+    lua_pop(L, 1);
 
     luaL_newlib(L, wasm3_lib);
     return 1;
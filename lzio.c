@@ -37,53 +37,90 @@ static void nirithy_derive_key(uint64_t timestamp, uint8_t *key) {
   memcpy(key, digest, 16); /* Use first 16 bytes as AES-128 key */
 }
 
+/*
+** XOR 'n' bytes from 'in' with the CTR keystream into 'out'. Whole
+** blocks go through AES_CTR_xcrypt_blocks in one call; a partial last
+** block keeps the rest of its keystream for the next call.
+*/
+static void ctr_xcrypt (ZIO *z, char *out, const char *in, size_t n) {
+  size_t nblocks;
+  while (n > 0 && z->keystream_idx < AES_BLOCKLEN) {
+    *out++ = cast_char(*in++ ^ z->keystream[z->keystream_idx++]);
+    n--;
+  }
+  nblocks = n / AES_BLOCKLEN;
+  if (nblocks > 0) {
+    AES_CTR_xcrypt_blocks(&z->ctx, cast(uint8_t *, out),
+                          cast(const uint8_t *, in), nblocks);
+    out += nblocks * AES_BLOCKLEN;
+    in += nblocks * AES_BLOCKLEN;
+    n -= nblocks * AES_BLOCKLEN;
+  }
+  if (n > 0) {
+    memset(z->keystream, 0, AES_BLOCKLEN);
+    AES_CTR_xcrypt_blocks(&z->ctx, z->keystream, z->keystream, 1);
+    z->keystream_idx = 0;
+    while (n-- > 0)
+      *out++ = cast_char(*in++ ^ z->keystream[z->keystream_idx++]);
+  }
+}
+
+
+/*
+** Decrypt the next window of cipher text into 'plain' and make it the
+** current buffer. Returns 0 if there is no cipher text left.
+*/
+static int decryptwindow (ZIO *z) {
+  size_t m = (z->ncipher < ZIO_CRYPTSIZE) ? z->ncipher : ZIO_CRYPTSIZE;
+  if (m == 0)
+    return 0;
+  ctr_xcrypt(z, z->plain, z->cipher, m);
+  z->cipher += m;
+  z->ncipher -= m;
+  z->p = z->plain;
+  z->n = m;
+  return 1;
+}
+
+
 /**
- * @brief Initializes decryption state for ZIO.
+ * @brief Switches the stream to decryption (\x1bEnc chunks).
+ *
+ * Everything after the current position is cipher text. The bytes
+ * still in the current buffer are decrypted right away; later buffers
+ * are decrypted by luaZ_fill as they are read. Must be paired with
+ * luaZ_freedecrypt.
  */
 void luaZ_init_decrypt (ZIO *z, uint64_t timestamp, const uint8_t *iv) {
   uint8_t key[16];
   nirithy_derive_key(timestamp, key);
   AES_init_ctx_iv(&z->ctx, key, iv);
-  z->keystream_idx = 16;
+  z->keystream_idx = AES_BLOCKLEN;
+  z->plain = luaM_newvector(z->L, ZIO_CRYPTSIZE, char);
   z->encrypted = 1;
+  z->cipher = z->p;
+  z->ncipher = z->n;
+  z->n = 0;
+  decryptwindow(z);
 }
 
+
 /**
- * @brief Reads and decrypts a byte from the stream.
- *
- * Should only be called via zgetc macro when z->encrypted is true.
- * Assumes z->n > 0.
+ * @brief Frees the decryption buffer of a stream, if it has one.
  */
-int luaZ_read_decrypt (ZIO *z) {
-  uint8_t b = cast_uchar(*(z->p++));
-
-  if (z->keystream_idx >= 16) {
-    int i;
-    /* Generate new keystream block */
-    memcpy(z->keystream, z->ctx.Iv, 16);
-    AES_ECB_encrypt(&z->ctx, z->keystream);
-
-    /* Increment IV */
-    for (i = 15; i >= 0; --i) {
-      if (z->ctx.Iv[i] == 255) {
-        z->ctx.Iv[i] = 0;
-        continue;
-      }
-      z->ctx.Iv[i]++;
-      break;
-    }
-    z->keystream_idx = 0;
+void luaZ_freedecrypt (lua_State *L, ZIO *z) {
+  if (z->plain != NULL) {
+    luaM_freearray(L, z->plain, ZIO_CRYPTSIZE);
+    z->plain = NULL;
   }
-
-  b ^= z->keystream[z->keystream_idx++];
-  return b;
 }
 
 
 /**
  * @brief Fills the buffer of the input stream.
  *
- * Calls the reader function to get more data.
+ * Calls the reader function to get more data. For encrypted streams
+ * the data is decrypted in bulk here, so 'zgetc' never has to.
  *
  * @param z The input stream.
  * @return The first character of the new buffer, or EOZ if end of stream.
@@ -92,18 +129,24 @@ int luaZ_fill (ZIO *z) {
   size_t size;
   lua_State *L = z->L;
   const char *buff;
+  if (z->encrypted && decryptwindow(z)) {
+    z->n--;  /* discount char being returned */
+    return cast_uchar(*(z->p++));
+  }
   lua_unlock(L);
   buff = z->reader(L, z->data, &size);
   lua_lock(L);
   if (buff == NULL || size == 0)
     return EOZ;
-  z->n = size - 1;  /* discount char being returned */
-  z->p = buff;
-
   if (z->encrypted) {
-    return luaZ_read_decrypt(z);
+    z->cipher = buff;
+    z->ncipher = size;
+    decryptwindow(z);
+    z->n--;  /* discount char being returned */
+    return cast_uchar(*(z->p++));
   }
-
+  z->n = size - 1;  /* discount char being returned */
+  z->p = buff;
   return cast_uchar(*(z->p++));
 }
 
@@ -123,6 +166,9 @@ void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader, void *data) {
   z->n = 0;
   z->p = NULL;
   z->encrypted = 0;
+  z->cipher = NULL;
+  z->ncipher = 0;
+  z->plain = NULL;
 }
 
 
@@ -155,34 +201,12 @@ size_t luaZ_read (ZIO *z, void *b, size_t n) {
     if (!checkbuffer(z))
       return n;  /* no more input; return number of missing bytes */
 
-    /* If encrypted, we must decrypt byte-by-byte (or block-by-block if optimized)
-       Since our decryption logic is byte-based (AES-CTR), we can iterate.
-       Optimization: decrypt directly into 'b' if possible?
-       Our decrypt function reads from z->p and increments it.
-    */
-    if (z->encrypted) {
-      uint8_t *dst = (uint8_t *)b;
-      size_t i;
-      m = (n <= z->n) ? n : z->n;
-
-      for (i = 0; i < m; i++) {
-        dst[i] = (uint8_t)luaZ_read_decrypt(z);
-      }
-      z->n -= m; /* n decremented by caller of read_decrypt? No, read_decrypt only decs p. */
-                 /* wait, zgetc macro decs n. luaZ_read needs to dec n. */
-                 /* luaZ_read_decrypt accesses z->p directly but DOES NOT decrement z->n. */
-                 /* So we handle n here. */
-
-      b = (char *)b + m;
-      n -= m;
-    } else {
-      m = (n <= z->n) ? n : z->n;  /* min. between n and z->n */
-      memcpy(b, z->p, m);
-      z->n -= m;
-      z->p += m;
-      b = (char *)b + m;
-      n -= m;
-    }
+    m = (n <= z->n) ? n : z->n;  /* min. between n and z->n */
+    memcpy(b, z->p, m);
+    z->n -= m;
+    z->p += m;
+    b = (char *)b + m;
+    n -= m;
   }
   return 0;
 }
@@ -18,7 +18,7 @@
 
 typedef struct Zio ZIO;
 
-#define zgetc(z)  (((z)->n--)>0 ?  ((z)->encrypted ? luaZ_read_decrypt(z) : cast_uchar(*(z)->p++)) : luaZ_fill(z))
+#define zgetc(z)  (((z)->n--)>0 ?  cast_uchar(*(z)->p++) : luaZ_fill(z))
 
 #define zungetc(z)  (((z)->n++), ((z)->p--))
 
@@ -62,16 +62,23 @@ struct Zio {
   void *data;			/* additional data */
   lua_State *L;			/* Lua state (for reader) */
 
-  /* Decryption state */
+  /* Decryption state: 'p' always points at plain text; 'luaZ_fill'
+     decrypts the reader's blocks into 'plain', ZIO_CRYPTSIZE bytes at
+     a time */
   int encrypted;
+  const char *cipher;		/* encrypted bytes not decrypted yet */
+  size_t ncipher;
+  char *plain;			/* decrypted window (or NULL) */
   struct AES_ctx ctx;
-  uint8_t keystream[16];
+  uint8_t keystream[16];	/* rest of a partially used keystream block */
   int keystream_idx;
 };
 
+#define ZIO_CRYPTSIZE	16384
+
 
 LUAI_FUNC int luaZ_fill (ZIO *z);
-LUAI_FUNC int luaZ_read_decrypt (ZIO *z);
 LUAI_FUNC void luaZ_init_decrypt (ZIO *z, uint64_t timestamp, const uint8_t *iv);
+LUAI_FUNC void luaZ_freedecrypt (lua_State *L, ZIO *z);
 
 #endif
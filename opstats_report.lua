@@ -0,0 +1,109 @@
+-- Rank opcodes and opcode pairs collected by vm.opstats.
+-- Needs an interpreter built with 'make linux-profile'.
+--
+-- usage:
+--   lxclua opstats_report.lua [-n N] [-t] script.lua [args...]
+--       run 'script.lua' and report what it executed (-t also times opcodes)
+--   lxclua opstats_report.lua [-n N] -f dump.txt
+--       report a file written by vm.opstats("export", "dump.txt")
+
+local vm = require "vm"
+
+local top, timing, dumpfile = 20, false, nil
+local i = 1
+while arg[i] and arg[i]:sub(1, 1) == "-" do
+    local opt = arg[i]
+    if opt == "-n" then
+        i = i + 1; top = assert(tonumber(arg[i]), "-n needs a number")
+    elseif opt == "-t" then
+        timing = true
+    elseif opt == "-f" then
+        i = i + 1; dumpfile = assert(arg[i], "-f needs a file name")
+    else
+        error("unknown option " .. opt)
+    end
+    i = i + 1
+end
+
+-- parse the text written by vm.opstats("export")
+local function parse(text)
+    local s = { ops = {}, pairs = {}, total = 0 }
+    for line in text:gmatch("[^\n]+") do
+        local kind, rest = line:match("^(%S+)%s+(.*)$")
+        if kind == "#" then
+            s.clock = rest:match("clock=(%S+)")
+            s.timing = rest:match("timing=1") ~= nil
+        elseif kind == "op" then
+            local name, count, cycles = rest:match("^(%S+)%s+(%d+)%s+(%d+)")
+            s.ops[name] = { count = tonumber(count), cycles = tonumber(cycles) }
+            s.total = s.total + tonumber(count)
+        elseif kind == "pair" then
+            local a, b, count = rest:match("^(%S+)%s+(%S+)%s+(%d+)")
+            s.pairs[a .. " " .. b] = tonumber(count)
+        end
+    end
+    return s
+end
+
+local stats
+if dumpfile then
+    local f = assert(io.open(dumpfile, "r"))
+    stats = parse(f:read("a"))
+    f:close()
+else
+    local script = assert(arg[i], "no script given")
+    local chunk = assert(loadfile(script))
+    local ok, err = vm.opstats("reset")
+    if ok == nil and err then error(err) end
+    vm.opstats("timing", timing)
+    chunk(table.unpack(arg, i + 1))
+    vm.opstats("timing", false)
+    stats = vm.opstats()
+    stats.timing = timing
+end
+
+local function ranked(t, key)
+    local list = {}
+    for name, v in pairs(t) do
+        list[#list + 1] = { name = name, value = key and v[key] or v }
+    end
+    table.sort(list, function(a, b)
+        if a.value ~= b.value then return a.value > b.value end
+        return a.name < b.name
+    end)
+    return list
+end
+
+local function pct(n, total)
+    return total > 0 and 100 * n / total or 0
+end
+
+local total = stats.total
+print(string.format("%d instructions executed", total))
+
+print(string.format("\n%-16s %14s %7s", "opcode", "count", "%"))
+for r, e in ipairs(ranked(stats.ops, "count")) do
+    if r > top then break end
+    print(string.format("%-16s %14d %6.2f%%", e.name, e.value, pct(e.value, total)))
+end
+
+if stats.timing then
+    local cycles = 0
+    for _, v in pairs(stats.ops) do cycles = cycles + v.cycles end
+    print(string.format("\n%-16s %14s %7s %10s", "opcode", stats.clock, "%", "per op"))
+    for r, e in ipairs(ranked(stats.ops, "cycles")) do
+        if r > top then break end
+        local n = stats.ops[e.name].count
+        print(string.format("%-16s %14d %6.2f%% %10.1f", e.name, e.value,
+                            pct(e.value, cycles), e.value / n))
+    end
+end
+
+local npairs = 0
+for _, n in pairs(stats.pairs) do npairs = npairs + n end
+print(string.format("\n%-32s %14s %7s", "pair", "count", "%"))
+for r, e in ipairs(ranked(stats.pairs)) do
+    if r > top then break end
+    print(string.format("%-32s %14d %6.2f%%", e.name:gsub(" ", " -> "), e.value,
+                        pct(e.value, npairs)))
+end
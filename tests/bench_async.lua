@@ -0,0 +1,90 @@
+-- Throughput of the asyncio event loop.
+-- usage: lxclua tests/bench_async.lua [tasks]
+local N = tonumber(arg and arg[1]) or 10000
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = asyncio.now()
+    local x = f()
+    print(string.format("%-34s %8.1f ms  (%s)", name, (asyncio.now() - t0) * 1000, x))
+end
+
+bench(string.format("%d tasks sleeping 10ms", N), function()
+    local done = 0
+    asyncio.run(function()
+        for _ = 1, N do
+            asyncio.spawn(function() asyncio.sleep(0.01) done = done + 1 end)
+        end
+    end)
+    return done
+end)
+
+bench(string.format("%d async calls awaited", N), function()
+    async function work(i) return i end
+    return asyncio.run(function()
+        local s = 0
+        for i = 1, N do s = s + await work(i) end
+        return s
+    end)
+end)
+
+bench(string.format("pipe ping-pong x%d", N), function()
+    local r1, w1 = asyncio.pipe()
+    local r2, w2 = asyncio.pipe()
+    local n = asyncio.run(function()
+        asyncio.spawn(function()
+            while true do
+                local s = asyncio.read(r1)
+                if not s then break end
+                asyncio.write(w2, s)
+            end
+            asyncio.close(w2)
+        end)
+        local count = 0
+        for _ = 1, N do
+            asyncio.write(w1, "x")
+            count = count + #asyncio.read(r2)
+        end
+        asyncio.close(w1)
+        return count
+    end)
+    asyncio.close(r1); asyncio.close(r2)
+    return n
+end)
+
+bench("tcp echo, 50 clients x 200 msgs", function()
+    local srv, port = asyncio.listen("127.0.0.1", 0)
+    local total = asyncio.run(function()
+        asyncio.spawn(function()
+            for _ = 1, 50 do
+                local c = asyncio.accept(srv)
+                asyncio.spawn(function()
+                    while true do
+                        local s = asyncio.read(c)
+                        if not s then break end
+                        asyncio.write(c, s)
+                    end
+                    asyncio.close(c)
+                end)
+            end
+        end)
+        local clients = {}
+        for i = 1, 50 do
+            clients[i] = asyncio.spawn(function()
+                local fd = asyncio.connect("127.0.0.1", port)
+                local got = 0
+                for _ = 1, 200 do
+                    asyncio.write(fd, "ping")
+                    got = got + #asyncio.read(fd)
+                end
+                asyncio.close(fd)
+                return got
+            end)
+        end
+        local t = 0
+        for i = 1, 50 do t = t + await clients[i] end
+        return t
+    end)
+    asyncio.close(srv)
+    return total
+end)
@@ -0,0 +1,47 @@
+-- Big integer throughput at RSA-like sizes.
+-- usage: lxclua tests/bench_bigint.lua [bits] [rounds]
+local BITS = tonumber(arg and arg[1]) or 4096
+local R = tonumber(arg and arg[2]) or 200
+
+local B = math.bigint
+
+-- deterministic operands of the requested size
+local function operand(bits, seed)
+    local digits, x = {}, seed
+    for i = 1, bits // 4 do
+        x = (x * 1103515245 + 12345) % 2147483648
+        digits[i] = string.format("%x", x % 16)
+    end
+    digits[1] = "f"
+    return B("0x" .. table.concat(digits))
+end
+
+local a = operand(BITS, 1)
+local b = operand(BITS, 2)
+local half = operand(BITS // 2, 3)
+local m = operand(BITS, 4)
+if m % 2 == 0 then m = m + 1 end
+local prod = a * b
+local str = tostring(a)
+
+local function bench(name, n, f)
+    collectgarbage()
+    local t0 = os.clock()
+    local x
+    for i = 1, n do x = f() end
+    local dt = os.clock() - t0
+    print(string.format("%-28s %10.3f ms/op", name, dt * 1000 / n))
+    return x
+end
+
+print(string.format("%d-bit operands", BITS))
+bench("add", R * 50, function() return a + b end)
+bench("mul", R * 10, function() return a * b end)
+bench("mul unbalanced", R * 10, function() return a * half end)
+bench("divmod 2n/n", R * 5, function() return prod // b, prod % b end)
+bench("tostring", R, function() return tostring(a) end)
+bench("parse", R, function() return B(str) end)
+bench("powmod (odd modulus)", math.max(R // 50, 1),
+      function() return math.powmod(a, b, m) end)
+bench("powmod (even modulus)", math.max(R // 50, 1),
+      function() return math.powmod(a, b, m + 1) end)
@@ -0,0 +1,35 @@
+-- Creating a state from a template (vm.clone / luaL_clonestate) versus
+-- loading the same prelude again.
+-- usage: lxclua tests/bench_clonestate.lua [functions] [rounds]
+local NF = tonumber(arg and arg[1]) or 2000
+local ROUNDS = tonumber(arg and arg[2]) or 20
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = os.clock()
+    for _ = 1, ROUNDS do f() end
+    local dt = os.clock() - t0
+    print(string.format("%-34s %8.3f ms", name, dt * 1000 / ROUNDS))
+end
+
+-- a prelude with NF functions and some data tables
+local parts = {"local M = {}"}
+for i = 1, NF do
+    parts[#parts + 1] = string.format([[
+function M.f%d(x, y)
+    local t = {x, y, %d}
+    if x > y then return t[1] * %d + #t else return t[2] - %d end
+end
+M.data%d = {name = "item%d", weight = %d, tags = {"a%d", "b%d"}}]],
+        i, i, i, i, i, i, i, i, i)
+end
+parts[#parts + 1] = "return M"
+local src = table.concat(parts, "\n")
+local noop = function () end
+
+bench("clone, empty template", function () vm.clone(noop) end)
+bench("clone, empty template + load", function ()
+    vm.clone(function (s) load(s, "=prelude")() end, src) end)
+prelude = load(src, "=prelude")()
+bench("clone, template with prelude", function () vm.clone(noop) end)
+assert(vm.clone(function () return prelude.f10(1, 2) end) == prelude.f10(1, 2))
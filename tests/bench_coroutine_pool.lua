@@ -0,0 +1,33 @@
+-- Coroutine create + resume + finish throughput, with and without the
+-- pool of dead threads.
+-- usage: lxclua tests/bench_coroutine_pool.lua [count]
+local N = tonumber(arg and arg[1]) or 1000000
+
+local function body(a, b)
+    local x = coroutine.yield(a + b)
+    return x * 2
+end
+
+local function bench(name)
+    collectgarbage()
+    local create, resume = coroutine.create, coroutine.resume
+    local t0 = os.clock()
+    local sum = 0
+    for i = 1, N do
+        local co = create(body)
+        local _, r = resume(co, i, 1)
+        local _, s = resume(co, r)
+        sum = sum + s
+    end
+    local dt = os.clock() - t0
+    print(string.format("%-22s %8.1f ms  %10.0f coroutines/s  (%d)",
+        name, dt * 1000, N / dt, sum))
+end
+
+local limit = collectgarbage("threadpool", 0)
+bench("no pool")
+collectgarbage("threadpool", limit)
+bench("pool (" .. limit .. ")")
+collectgarbage("threadpool", 4096)
+bench("pool (4096)")
+collectgarbage("threadpool", limit)
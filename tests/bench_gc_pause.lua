@@ -0,0 +1,57 @@
+-- Full-collection pauses on a large heap, with and without background
+-- freeing of swept objects.
+-- usage: lxclua tests/bench_gc_pause.lua [heap MB] [rounds]
+local MB = tonumber(arg and arg[1]) or 64
+local ROUNDS = tonumber(arg and arg[2]) or 10
+
+-- about 100 bytes per small table plus its slot in 'live'
+local PER = math.floor(MB * 1024 * 1024 / 100)
+
+-- pauses are wall-clock time: 'os.clock' would also count the helper thread
+local clock = require("asyncio").now
+
+local function percentile(t, p)
+    local i = math.max(1, math.ceil(#t * p))
+    return t[i]
+end
+
+local function run(bgfree)
+    collectgarbage("bgfree", bgfree)
+    local live = {}
+    for i = 1, PER do live[i] = {i} end
+    collectgarbage()
+    local pauses = {}
+    for r = 1, ROUNDS do
+        -- replace half the heap, so each cycle has as much to free as to keep
+        for i = (r % 2) + 1, PER, 2 do live[i] = {i} end
+        local t0 = clock()
+        collectgarbage()
+        pauses[#pauses + 1] = (clock() - t0) * 1000
+    end
+    live = nil
+    collectgarbage()
+    collectgarbage("bgfree", false)
+    table.sort(pauses)
+    return pauses
+end
+
+local function report(name, pauses)
+    print(string.format("%-8s p50 %8.1f ms  p90 %8.1f ms  max %8.1f ms",
+        name, percentile(pauses, 0.5), percentile(pauses, 0.9),
+        pauses[#pauses]))
+    -- histogram in 20% buckets of the largest pause
+    local top = pauses[#pauses]
+    local buckets = {0, 0, 0, 0, 0}
+    for _, p in ipairs(pauses) do
+        local b = math.min(5, math.floor(p / top * 5) + 1)
+        buckets[b] = buckets[b] + 1
+    end
+    for b = 1, 5 do
+        print(string.format("  <= %8.1f ms  %s", top * b / 5,
+            string.rep("#", buckets[b])))
+    end
+end
+
+print(string.format("heap ~%d MB, %d objects, %d rounds", MB, PER, ROUNDS))
+report("inline", run(false))
+report("bgfree", run(true))
@@ -0,0 +1,55 @@
+-- Requests/sec and latency of http.get against the local server loop.
+-- usage: lxclua tests/bench_http.lua [requests] [client threads]
+local http = require "http"
+local N = tonumber(arg and arg[1]) or 5000
+local CLIENTS = tonumber(arg and arg[2]) or 4
+local now = asyncio.now
+
+local function start_server(nthreads)
+    local first = assert(http.server(0, {host = "127.0.0.1", reuseport = true}))
+    local _, port = first:getsockname()
+    local servers = {first}
+    for i = 2, nthreads do
+        servers[i] = assert(http.server(port, {host = "127.0.0.1", reuseport = true}))
+    end
+    local threads = {}
+    for i, s in ipairs(servers) do
+        threads[i] = thread.create(function(srv)
+            return srv:serve(function(req) return 200, "hello world" end)
+        end, s)
+    end
+    return "http://127.0.0.1:" .. port .. "/"
+end
+
+local function run(name, url, headers, nclients)
+    local per = N // nclients
+    local t0 = now()
+    local workers = {}
+    for w = 1, nclients do
+        workers[w] = thread.create(function(u, h, n)
+            local lat = {}
+            for i = 1, n do
+                local s = now()
+                local st = http.get(u, h)
+                lat[i] = now() - s
+                assert(st == 200)
+            end
+            return lat
+        end, url, headers, per)
+    end
+    local all = {}
+    for w = 1, nclients do
+        for _, v in ipairs(workers[w]:join()) do all[#all + 1] = v end
+    end
+    local dt = now() - t0
+    table.sort(all)
+    print(string.format("%-28s %9.0f req/s   p50 %6.3f ms   p99 %6.3f ms",
+        name, #all / dt, all[#all // 2] * 1000, all[math.ceil(#all * 0.99)] * 1000))
+end
+
+local url = start_server(2)
+run("keep-alive, 1 client", url, nil, 1)
+run(string.format("keep-alive, %d clients", CLIENTS), url, nil, CLIENTS)
+run("new connection, 1 client", url, "Connection: close", 1)
+run(string.format("new connection, %d clients", CLIENTS), url, "Connection: close", CLIENTS)
+os.exit(0)  -- the server threads run forever
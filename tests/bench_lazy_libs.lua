@@ -0,0 +1,24 @@
+-- Interpreter start-up with all libraries opened at once and with
+-- LUA_LAZYLIBS (non-standard libraries opened on first use).
+-- usage: lxclua tests/bench_lazy_libs.lua [runs]
+local RUNS = tonumber(arg and arg[1]) or 200
+local interp = arg and arg[-1] or "lxclua"
+local now = asyncio.now
+
+local function bench(name, env, code)
+    local cmd = env .. " " .. interp .. " -e '" .. code .. "'"
+    local f = io.popen(cmd)
+    local mem = f:read("a")
+    f:close()
+    local t0 = now()
+    for _ = 1, RUNS do os.execute(cmd .. " >/dev/null") end
+    local dt = now() - t0
+    print(string.format("%-28s %7.2f ms/run  %8s KB after start-up",
+        name, dt * 1000 / RUNS, mem))
+end
+
+local empty = "io.write(collectgarbage(\"count\") // 1)"
+local uses = "local _ = http, fs; " .. empty
+bench("eager", "", empty)
+bench("lazy", "LUA_LAZYLIBS=1", empty)
+bench("lazy, opens http and fs", "LUA_LAZYLIBS=1", uses)
@@ -0,0 +1,53 @@
+-- Build time of an obfuscated bundle with 1 and N compiler threads.
+-- usage: lxclua tests/bench_luac_bundle.lua [files] [threads] [luac options]
+local NFILES = tonumber(arg and arg[1]) or 200
+local NJOBS = tonumber(arg and arg[2]) or 8  -- wall-clock gain needs that many cores
+local OPTS = arg and arg[3] or "-f"
+
+local pwd = io.popen("pwd")
+local luac = pwd:read("l") .. "/luac"
+pwd:close()
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute("mkdir -p " .. dir .. "/src"))
+local files = {}
+for i = 1, NFILES do
+    local src = { "local M = {}" }
+    for k = 1, 20 do
+        src[#src + 1] = string.format([[
+function M.f%d(t)
+    local s = 0
+    for i = 1, #t do
+        if t[i] > %d then s = s + t[i] elseif t[i] < 0 then s = s - 1 else s = s * 2 end
+    end
+    return s
+end]], k, k)
+    end
+    src[#src + 1] = "return M"
+    local name = "src/m" .. i .. ".lua"
+    local f = assert(io.open(dir .. "/" .. name, "w"))
+    f:write(table.concat(src, "\n"))
+    f:close()
+    files[i] = name
+end
+
+local function build(jobs)
+    local cmd = string.format("cd %s && %s -j %d -S 1 %s -o out%d.bin %s 2>/dev/null",
+                              dir, luac, jobs, OPTS, jobs, table.concat(files, " "))
+    local p = io.popen("date +%s.%N")
+    local s0 = tonumber(p:read("a")) p:close()
+    assert(os.execute(cmd))
+    p = io.popen("date +%s.%N")
+    local s1 = tonumber(p:read("a")) p:close()
+    return s1 - s0
+end
+
+local t1 = build(1)
+local tn = build(NJOBS)
+local same = io.open(dir .. "/out1.bin", "rb"):read("a") == io.open(dir .. "/out" .. NJOBS .. ".bin", "rb"):read("a")
+os.execute("rm -rf " .. dir)
+
+print(string.format("%d files, luac %s", NFILES, OPTS))
+print(string.format("-j 1  %8.2f s", t1))
+print(string.format("-j %-2d %8.2f s  (%.1fx)  identical output: %s", NJOBS, tn, t1 / tn, tostring(same)))
@@ -0,0 +1,51 @@
+-- Cost of the sampling profiler on CPU-bound Lua code: the same workload
+-- with the profiler stopped and sampling at 1 kHz in each timer mode.
+-- usage: lxclua tests/bench_profiler.lua [rounds]
+local ROUNDS = tonumber(arg and arg[1]) or 10
+
+local profiler = require("profiler")
+
+local function leaf(n)
+    local s = 0
+    for i = 1, n do s = s + i % 7 end
+    return s
+end
+
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local function work()
+    local s = 0
+    for _ = 1, 1000 do s = s + leaf(10000) end
+    local t = {}
+    for i = 1, 1000000 do t[i] = i end
+    local i = 0
+    while i < #t do i = i + 1; s = s + t[i] end
+    return s + fib(27)
+end
+
+-- best of ROUNDS, in CPU seconds
+local function measure(opts)
+    local best = math.huge
+    for _ = 1, ROUNDS do
+        if opts then assert(profiler.start(opts)) end
+        local t0 = os.clock()
+        work()
+        local t = os.clock() - t0
+        if opts then profiler.stop() end
+        if t < best then best = t end
+    end
+    return best
+end
+
+work()  -- warm up
+local base = measure(nil)
+print(string.format("%-22s %8.1f ms", "no profiler", base * 1000))
+for _, mode in ipairs({"thread", "signal"}) do
+    local t = measure({ hz = 1000, mode = mode })
+    print(string.format("%-22s %8.1f ms  %+5.1f%%  (%d samples)",
+        mode .. " @ 1 kHz", t * 1000, (t / base - 1) * 100,
+        profiler.stats().samples))
+end
@@ -0,0 +1,58 @@
+-- Startup cost of requiring many modules: no cache, cold cache, warm cache.
+-- Each run is a fresh interpreter process.
+-- usage: lxclua tests/bench_require_cache.lua [modules] [functions per module]
+local N = tonumber(arg and arg[1]) or 800
+local NFUNCS = tonumber(arg and arg[2]) or 40
+local lua = arg[-1] or "lxclua"
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute("mkdir -p " .. dir .. "/src " .. dir .. "/cache"))
+
+for i = 1, N do
+    local src = { "local M = {}" }
+    for k = 1, NFUNCS do
+        src[#src + 1] = string.format([[
+function M.f%d(t, n)
+    local s = 0
+    for i = 1, n do
+        if t[i] and type(t[i]) == "number" then s = s + t[i] * %d
+        elseif t[i] then s = s + #tostring(t[i]) end
+    end
+    return s, "module %d function %d"
+end]], k, k, i, k)
+    end
+    src[#src + 1] = "return M"
+    local f = assert(io.open(string.format("%s/src/m%d.lua", dir, i), "w"))
+    f:write(table.concat(src, "\n"))
+    f:close()
+end
+
+local child = string.format([[
+package.path = %q
+package.cachepath = %s
+local t0 = os.clock()
+for i = 1, %d do require("m" .. i) end
+io.write(os.clock() - t0)
+]], dir .. "/src/?.lua", "%s", N)
+
+local function run(cachepath)
+    local script = dir .. "/run.lua"
+    local f = assert(io.open(script, "w"))
+    f:write(string.format(child, cachepath and string.format("%q", cachepath) or "nil"))
+    f:close()
+    local p = io.popen(lua .. " " .. script)
+    local t = tonumber(p:read("a"))
+    p:close()
+    return assert(t, "child failed")
+end
+
+local nocache = run(nil)
+local cold = run(dir .. "/cache")
+local warm = run(dir .. "/cache")
+os.execute("rm -rf " .. dir)
+
+print(string.format("%d modules", N))
+print(string.format("no cache   %8.1f ms", nocache * 1e3))
+print(string.format("cold cache %8.1f ms", cold * 1e3))
+print(string.format("warm cache %8.1f ms  (%.1fx)", warm * 1e3, nocache / warm))
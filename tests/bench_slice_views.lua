@@ -0,0 +1,68 @@
+-- Cost of viewing windows of a large array (table.view), against copying
+-- them.
+-- usage: lxclua tests/bench_slice_views.lua [array size] [window] [rounds]
+local N = tonumber(arg and arg[1]) or 1000000
+local W = tonumber(arg and arg[2]) or 10000
+local R = tonumber(arg and arg[3]) or 2000
+
+local data = {}
+for i = 1, N do data[i] = i end
+
+local function copy(t, i, j)
+    local r = {}
+    for k = i, j do r[#r + 1] = t[k] end
+    return r
+end
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = os.clock()
+    local x = f()
+    print(string.format("%-34s %8.1f ms  (%s)", name, (os.clock() - t0) * 1000, x))
+end
+
+-- a consumer that only looks at the ends of the window
+local function edges(w) return w[1] + w[#w] end
+
+-- a consumer that reads every element
+local function sum(w)
+    local s = 0
+    for i = 1, #w do s = s + w[i] end
+    return s
+end
+
+local step = (N - W) // R
+bench("copy window, read edges", function()
+    local s = 0
+    for r = 0, R - 1 do s = s + edges(copy(data, r * step + 1, r * step + W)) end
+    return s
+end)
+bench("slice syntax, read edges", function()
+    local s = 0
+    for r = 0, R - 1 do s = s + edges(data[r * step + 1:r * step + W]) end
+    return s
+end)
+bench("slice view, read edges", function()
+    local s = 0
+    for r = 0, R - 1 do s = s + edges(table.view(data, r * step + 1, r * step + W)) end
+    return s
+end)
+bench("copy window, read all", function()
+    local s = 0
+    for r = 0, R // 10 - 1 do s = s + sum(copy(data, r * step + 1, r * step + W)) end
+    return s
+end)
+bench("slice view, read all", function()
+    local s = 0
+    for r = 0, R // 10 - 1 do s = s + sum(table.view(data, r * step + 1, r * step + W)) end
+    return s
+end)
+bench("slice view, write one (copy)", function()
+    local s = 0
+    for r = 0, R // 10 - 1 do
+        local w = table.view(data, r * step + 1, r * step + W)
+        w[1] = 0
+        s = s + sum(w)
+    end
+    return s
+end)
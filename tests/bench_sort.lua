@@ -0,0 +1,37 @@
+-- table.sort on homogeneous arrays (radix / pdqsort fast paths) and on
+-- arrays that take the generic path.
+-- usage: lxclua tests/bench_sort.lua [n]
+local N = tonumber(arg and arg[1]) or 200000
+
+local function bench(name, make, cmp)
+    local t = make()
+    collectgarbage()
+    local t0 = os.clock()
+    table.sort(t, cmp)
+    local dt = os.clock() - t0
+    for i = 2, #t, #t // 1000 + 1 do
+        assert(not ((cmp or function(a, b) return a < b end)(t[i], t[i - 1])))
+    end
+    print(string.format("%-28s %9.1f ms  %6.1f ns/elem", name, dt * 1000,
+        dt * 1e9 / #t))
+end
+
+math.randomseed(42)
+local function fill(f) return function()
+    local t = {}
+    for i = 1, N do t[i] = f(i) end
+    return t
+end end
+
+bench("random integers", fill(function() return math.random(-1 << 40, 1 << 40) end))
+bench("random floats", fill(function() return math.random() * 1e6 - 5e5 end))
+bench("mixed numbers", fill(function(i)
+    return i % 2 == 0 and math.random(1, 1000000) or math.random() * 1e6 end))
+bench("sorted integers", fill(function(i) return i end))
+bench("reversed integers", fill(function(i) return N - i end))
+bench("few distinct integers", fill(function() return math.random(1, 8) end))
+bench("random strings", fill(function() return tostring(math.random(1, 1 << 30)) end))
+bench("integers, comparator", fill(function() return math.random(1, 1 << 30) end),
+    function(a, b) return a > b end)
+bench("tables, comparator", fill(function() return {math.random()} end),
+    function(a, b) return a[1] < b[1] end)
@@ -0,0 +1,82 @@
+-- Template-style rendering with '..', table.concat and string.builder.
+-- usage: lxclua tests/bench_string_builder.lua [rows] [pages]
+local ROWS = tonumber(arg and arg[1]) or 2000
+local PAGES = tonumber(arg and arg[2]) or 20
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = os.clock()
+    local r = f()
+    local dt = os.clock() - t0
+    print(string.format("%-28s %8.1f ms  (%d bytes)", name, dt * 1000, #r))
+    return r
+end
+
+local rows = {}
+for i = 1, ROWS do
+    rows[i] = {id = i, name = "item" .. i, price = i * 1.25, qty = i % 7}
+end
+
+local concat = bench("concat operator", function()
+    local out
+    for _ = 1, PAGES do
+        out = "<table>\n"
+        for _, r in ipairs(rows) do
+            out = out .. "<tr><td>" .. r.id .. "</td><td>" .. r.name ..
+                  "</td><td>" .. r.price .. "</td><td>" .. r.qty ..
+                  "</td></tr>\n"
+        end
+        out = out .. "</table>\n"
+    end
+    return out
+end)
+
+local tconcat = bench("table.concat", function()
+    local out
+    for _ = 1, PAGES do
+        local t = {"<table>\n"}
+        for _, r in ipairs(rows) do
+            t[#t + 1] = "<tr><td>"
+            t[#t + 1] = r.id
+            t[#t + 1] = "</td><td>"
+            t[#t + 1] = r.name
+            t[#t + 1] = "</td><td>"
+            t[#t + 1] = r.price
+            t[#t + 1] = "</td><td>"
+            t[#t + 1] = r.qty
+            t[#t + 1] = "</td></tr>\n"
+        end
+        t[#t + 1] = "</table>\n"
+        out = table.concat(t)
+    end
+    return out
+end)
+
+local sb = string.builder()
+local builder = bench("string.builder (reused)", function()
+    local out
+    for _ = 1, PAGES do
+        sb:reset():add("<table>\n")
+        for _, r in ipairs(rows) do
+            sb:add("<tr><td>", r.id, "</td><td>", r.name, "</td><td>",
+                   r.price, "</td><td>", r.qty, "</td></tr>\n")
+        end
+        out = sb:add("</table>\n"):tostring()
+    end
+    return out
+end)
+
+local addf = bench("string.builder addf", function()
+    local out
+    for _ = 1, PAGES do
+        sb:reset():add("<table>\n")
+        for _, r in ipairs(rows) do
+            sb:addf("<tr><td>%d</td><td>%s</td><td>%s</td><td>%d</td></tr>\n",
+                    r.id, r.name, r.price, r.qty)
+        end
+        out = sb:add("</table>\n"):tostring()
+    end
+    return out
+end)
+
+assert(concat == tconcat and tconcat == builder and builder == addf)
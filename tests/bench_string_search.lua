@@ -0,0 +1,48 @@
+-- Plain substring search on log-like text and on repetitive input.
+-- usage: lxclua tests/bench_string_search.lua [MB]
+local MB = tonumber(arg and arg[1]) or 16
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = os.clock()
+    local r = f()
+    local dt = os.clock() - t0
+    print(string.format("%-34s %8.1f ms  %7.1f MB/s  (%s)", name, dt * 1000,
+        MB / dt, tostring(r)))
+end
+
+math.randomseed(3)
+local lines = {}
+local size = 0
+local methods = {"GET", "POST", "PUT", "DELETE"}
+while size < MB * 1024 * 1024 do
+    local line = string.format(
+        "2024-05-%02d 12:%02d:%02d INFO [worker-%d] %s /api/v1/items/%d status=%d time=%dms",
+        math.random(1, 28), math.random(0, 59), math.random(0, 59),
+        math.random(1, 16), methods[math.random(1, 4)], math.random(1, 1e6),
+        math.random() < 0.99 and 200 or 500, math.random(1, 900))
+    lines[#lines + 1] = line
+    size = size + #line + 1
+end
+local log = table.concat(lines, "\n")
+lines = nil
+
+bench("split lines", function() return #string.split(log, "\n") end)
+bench("find rare token (absent)", function()
+    return log:find("status=404", 1, true) end)
+bench("count 'status=500' with find", function()
+    local n, i = 0, 1
+    while true do
+        local s, e = log:find("status=500", i, true)
+        if not s then return n end
+        n, i = n + 1, e + 1
+    end
+end)
+bench("gsub plain 'INFO' -> 'I'", function()
+    return select(2, log:gsub("INFO", "I")) end)
+
+local rep = string.rep("a", MB * 1024 * 1024)
+bench("repetitive: a^n vs a^64 b", function()
+    return rep:find(string.rep("a", 64) .. "b", 1, true) end)
+bench("repetitive: a^n vs a^4096 b", function()
+    return rep:find(string.rep("a", 4096) .. "b", 1, true) end)
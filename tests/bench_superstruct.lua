@@ -0,0 +1,36 @@
+-- Insert, lookup and delete cost on SuperStructs of growing size.
+-- usage: lxclua tests/bench_superstruct.lua [max keys]
+local MAX = tonumber(arg and arg[1]) or 20000
+
+local function bench(name, f)
+    collectgarbage()
+    local t0 = os.clock()
+    local x = f()
+    print(string.format("%-30s %8.1f ms  (%s)", name, (os.clock() - t0) * 1000, x))
+end
+
+local names = {}
+for i = 1, MAX do names[i] = "field" .. i end
+
+local n = 100
+while n <= MAX do
+    superstruct S [
+        seed: 0
+    ]
+    bench(string.format("insert %d", n), function()
+        for i = n, 1, -1 do S[names[i]] = i end
+        return n
+    end)
+    bench(string.format("lookup %d x10", n), function()
+        local s = 0
+        for r = 1, 10 do
+            for i = 1, n do s = s + S[names[i]] end
+        end
+        return s
+    end)
+    bench(string.format("delete %d", n), function()
+        for i = 1, n do S[names[i]] = nil end
+        return n
+    end)
+    n = n * 10
+end
@@ -0,0 +1,39 @@
+-- Lua -> wasm call overhead: one :call per invocation vs one :call_batch.
+-- usage: lxclua tests/bench_wasm3_call.lua [calls]
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+
+local N = tonumber(arg and arg[1]) or 200000
+
+local env = wasm3.newEnvironment()
+local runtime = env:newRuntime(64 * 1024)
+runtime:loadModule(env:parseModule(W.module{
+    funcs = {
+        { name = "add", params = { "i32", "i32" }, results = { "i32" },
+          code = W.get(0) .. W.get(1) .. W.op.i32_add },
+        { name = "addf", params = { "f64", "f64" }, results = { "f64" },
+          code = W.get(0) .. W.get(1) .. W.op.f64_add },
+    },
+}))
+
+local function bench(label, fn, a, b)
+    collectgarbage()
+    local t0 = os.clock()
+    local s = 0
+    for i = 1, N do s = s + fn:call(a, b) end
+    local single = os.clock() - t0
+
+    local args = {}
+    for i = 1, N do args[i] = { a, b } end
+    collectgarbage()
+    t0 = os.clock()
+    local res = fn:call_batch(args)
+    local batch = os.clock() - t0
+    assert(#res == N and res[N] == fn:call(a, b))
+
+    print(string.format("%-6s call %7.1f ns/call   call_batch %7.1f ns/call",
+                        label, single * 1e9 / N, batch * 1e9 / N))
+end
+
+bench("i32", runtime:findFunction("add"), 1, 2)
+bench("f64", runtime:findFunction("addf"), 1.5, 2.5)
@@ -0,0 +1,46 @@
+-- guest -> host -> guest overhead: a wasm loop calling a Lua import.
+-- usage: lxclua tests/bench_wasm3_import.lua [calls]
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local N = tonumber(arg and arg[1]) or 500000
+
+-- run(n): acc = 0; for i = 0, n - 1 do acc = f(acc) end; return acc
+local function looped(call)
+    return W.i32(0) .. W.set(1) .. W.i32(0) .. W.set(2)
+        .. op.block .. op.loop
+        .. W.get(1) .. W.get(0) .. op.i32_lt_s .. op.i32_eqz .. op.br_if .. W.uleb(1)
+        .. W.get(2) .. call .. W.set(2)
+        .. W.get(1) .. W.i32(1) .. op.i32_add .. W.set(1)
+        .. op.br .. W.uleb(0)
+        .. op["end"] .. op["end"]
+        .. W.get(2)
+end
+
+local env = wasm3.newEnvironment()
+local runtime = env:newRuntime(64 * 1024)
+local module = env:parseModule(W.module{
+    imports = { { "env", "inc", params = { "i32" }, results = { "i32" } } },
+    funcs = {
+        { name = "host", params = { "i32" }, results = { "i32" }, locals = { "i32", "i32" },
+          code = looped(W.call(0)) },
+        { name = "guest", params = { "i32" }, results = { "i32" }, locals = { "i32", "i32" },
+          code = looped(W.call(3)) },
+        { params = { "i32" }, results = { "i32" }, code = W.get(0) .. W.i32(1) .. op.i32_add },
+    },
+})
+runtime:loadModule(module)
+module:linkFunction("env", "inc", "i(i)", function(x) return x + 1 end)
+
+local function run(name)
+    local fn = runtime:findFunction(name)
+    collectgarbage()
+    local t0 = os.clock()
+    assert(fn:call(N) == N)
+    return (os.clock() - t0) * 1e9 / N
+end
+
+local guest, host = run("guest"), run("host")
+print(string.format("wasm->wasm %7.1f ns/call   wasm->Lua->wasm %7.1f ns/call (%.1f ns overhead)",
+                    guest, host, host - guest))
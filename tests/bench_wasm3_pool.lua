@@ -0,0 +1,50 @@
+-- Per-request instantiation: fresh runtime vs. pooled runtime reset from a snapshot.
+-- usage: lxclua tests/bench_wasm3_pool.lua [instances] [functions]
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local N = tonumber(arg and arg[1]) or 2000
+local NFUNCS = tonumber(arg and arg[2]) or 50
+
+-- a module with some code to compile and a couple of pages of memory
+local funcs = {}
+for i = 1, NFUNCS do
+    local code = W.get(0)
+    for k = 1, 20 do code = code .. W.i32(k) .. op.i32_add .. W.i32(3) .. op.i32_mul end
+    funcs[i] = { name = "f" .. i, params = { "i32" }, results = { "i32" }, code = code }
+end
+local bytes = W.module{
+    funcs = funcs,
+    memory = { min = 2 },
+    data = { { offset = 0, bytes = string.rep("x", 4096) } },
+}
+
+local function request(runtime)
+    local s = 0
+    for i = 1, NFUNCS, 7 do s = s + runtime:findFunction("f" .. i):call(i) end
+    return s
+end
+
+collectgarbage()
+local t0 = os.clock()
+for i = 1, N do
+    local env = wasm3.newEnvironment()
+    local rt = env:newRuntime(64 * 1024)
+    rt:loadModule(env:parseModule(bytes))
+    request(rt)
+end
+local fresh = os.clock() - t0
+
+local pool = wasm3.newPool(bytes, { size = 1 })
+collectgarbage()
+t0 = os.clock()
+for i = 1, N do
+    local rt = pool:acquire()
+    request(rt)
+    pool:release(rt)
+end
+local pooled = os.clock() - t0
+
+print(string.format("fresh  %8.1f us/request  %8.0f requests/s", fresh * 1e6 / N, N / fresh))
+print(string.format("pooled %8.1f us/request  %8.0f requests/s", pooled * 1e6 / N, N / pooled))
@@ -0,0 +1,231 @@
+-- asyncio: the event loop behind 'async' functions.
+
+local now = asyncio.now
+
+-- timers fire in deadline order; equal deadlines keep their order
+do
+    local order = {}
+    asyncio.run(function()
+        for i, d in ipairs{0.03, 0.01, 0.02, 0.01} do
+            asyncio.spawn(function()
+                asyncio.sleep(d)
+                order[#order + 1] = i
+            end)
+        end
+    end)
+    assert(table.concat(order, ",") == "2,4,3,1", table.concat(order, ","))
+end
+
+-- sleeping tasks run concurrently
+do
+    local t0 = now()
+    asyncio.run(function()
+        for _ = 1, 50 do
+            asyncio.spawn(asyncio.sleep, 0.05)
+        end
+    end)
+    local dt = now() - t0
+    assert(dt >= 0.045 and dt < 1, dt)
+end
+
+-- async functions start tasks; await returns their results
+do
+    async function double(x)
+        asyncio.sleep(0.001)
+        return x * 2, "ok"
+    end
+    local a, b = asyncio.run(function()
+        local t1, t2 = double(1), double(20)
+        assert(asyncio.status(t1) == "running")
+        local x = await t1
+        local y, s = await t2
+        assert(asyncio.status(t1) == "done")
+        return x + y, s
+    end)
+    assert(a == 42 and b == "ok")
+    -- a task that already finished answers right away
+    assert(asyncio.run(function()
+        local t = asyncio.spawn(function() return 7 end)
+        return await t
+    end) == 7)
+    -- awaiting plain values gives them back
+    assert(asyncio.run(function() return await 5 end) == 5)
+    -- several tasks may await the same one
+    local sum = asyncio.run(function()
+        local shared = double(5)
+        local a = asyncio.spawn(function() return (await shared) + 1 end)
+        local b = asyncio.spawn(function() return (await shared) + 2 end)
+        return (await a) + (await b)
+    end)
+    assert(sum == 23)
+end
+
+-- pipes: more data than fits the pipe buffer
+do
+    local r, w = asyncio.pipe()
+    local chunk = string.rep("x", 65536)
+    local got = asyncio.run(function()
+        local reader = asyncio.spawn(function()
+            local parts = {}
+            while true do
+                local s = asyncio.read(r, 16384)
+                if not s then break end
+                parts[#parts + 1] = s
+            end
+            return table.concat(parts)
+        end)
+        for _ = 1, 16 do asyncio.write(w, chunk) end
+        asyncio.close(w)
+        return await reader
+    end)
+    asyncio.close(r)
+    assert(#got == 16 * 65536)
+end
+
+-- TCP echo over the loopback interface
+do
+    local srv, port = asyncio.listen("127.0.0.1", 0)
+    assert(srv and port > 0)
+    local replies = asyncio.run(function()
+        asyncio.spawn(function()
+            for _ = 1, 3 do
+                local c = asyncio.accept(srv)
+                asyncio.spawn(function()
+                    while true do
+                        local s = asyncio.read(c)
+                        if not s then break end
+                        asyncio.write(c, s:upper())
+                    end
+                    asyncio.close(c)
+                end)
+            end
+        end)
+        local clients = {}
+        for i = 1, 3 do
+            clients[i] = asyncio.spawn(function()
+                local fd = assert(asyncio.connect("127.0.0.1", port))
+                asyncio.write(fd, "hello " .. i)
+                local s = asyncio.read(fd)
+                asyncio.close(fd)
+                return s
+            end)
+        end
+        local r = {}
+        for i = 1, 3 do r[i] = await clients[i] end
+        return r
+    end)
+    asyncio.close(srv)
+    for i = 1, 3 do assert(replies[i] == "HELLO " .. i, replies[i]) end
+end
+
+-- channels fed by another OS thread
+do
+    local ch = thread.channel()
+    local th = thread.create(function(c)
+        for i = 1, 100 do c:send(i) end
+        c:close()
+    end, ch)
+    local sum = asyncio.run(function()
+        local s = 0
+        while true do
+            local v = asyncio.recv(ch)
+            if v == nil then break end
+            s = s + v
+        end
+        return s
+    end)
+    th:join()
+    assert(sum == 5050, sum)
+    local v, closed = ch:try_recv()
+    assert(v == nil and closed == true)
+end
+
+-- cancel: waits are dropped, to-be-closed variables closed
+do
+    local closed = 0
+    local ch = thread.channel()
+    local r, w = asyncio.pipe()
+    local t0 = now()
+    local res = asyncio.run(function()
+        -- the closing value of a generic 'for' is a to-be-closed variable
+        local guard = setmetatable({}, {__close = function(_, e)
+            assert(e == nil, type(e))  -- not an error: no error object
+            closed = closed + 1
+        end})
+        local function parked(f, ...)
+            return asyncio.spawn(function(...)
+                local args = table.pack(...)
+                for _ in function() f(table.unpack(args, 1, args.n)) end,
+                         nil, nil, guard do end
+            end, ...)
+        end
+        local sleeper = parked(asyncio.sleep, 10)
+        local reader = parked(asyncio.read, r)
+        local receiver = parked(asyncio.recv, ch)
+        local waiter = asyncio.spawn(function() return await sleeper end)
+        asyncio.sleep(0)
+        assert(asyncio.cancel(sleeper) and asyncio.cancel(reader))
+        assert(asyncio.cancel(receiver))
+        assert(asyncio.status(receiver) == "done")
+        assert(asyncio.cancel(receiver) == false)
+        local ok, e = pcall(asyncio.cancel, coroutine.running())
+        assert(not ok and e:find("running task"))
+        return {await waiter}
+    end)
+    assert(now() - t0 < 5)
+    assert(closed == 3, closed)
+    assert(res[1] == nil and res[2] == "cancelled")
+    -- the channel is no longer watched by the cancelled task
+    ch:send(7)
+    assert(asyncio.run(function() return asyncio.recv(ch) end) == 7)
+    assert(asyncio.close(r) and asyncio.close(w))
+    local ok, e = pcall(asyncio.cancel, coroutine.create(print))
+    assert(not ok and e:find("not a task"))
+    -- the other timers keep their order
+    local order = {}
+    asyncio.run(function()
+        local tasks = {}
+        for i, d in ipairs{0.03, 0.01, 0.02, 0.04, 0.015} do
+            tasks[i] = asyncio.spawn(function()
+                asyncio.sleep(d)
+                order[#order + 1] = i
+            end)
+        end
+        asyncio.cancel(tasks[3])
+    end)
+    assert(table.concat(order, ",") == "2,5,1,4", table.concat(order, ","))
+end
+
+-- errors
+do
+    -- awaited failures come back as nil, message
+    local v, err = asyncio.run(function()
+        local t = asyncio.spawn(function() asyncio.sleep(0) error("boom", 0) end)
+        return await t
+    end)
+    assert(v == nil and err == "boom")
+    -- unobserved failures stop the loop
+    local ok, e = pcall(asyncio.run, function()
+        asyncio.spawn(function() asyncio.sleep(0) error("lost", 0) end)
+        asyncio.sleep(1)
+    end)
+    assert(not ok and e == "lost")
+    -- the loop can run again afterwards
+    assert(asyncio.run(function() asyncio.sleep(0) return 1 end) == 1)
+    -- primitives only work inside tasks
+    ok, e = pcall(asyncio.sleep, 0)
+    assert(not ok and e:find("inside an async task"))
+    ok, e = pcall(asyncio.run, function()
+        local co = coroutine.wrap(function() asyncio.sleep(0) end)
+        co()
+    end)
+    assert(not ok and e:find("inside an async task"))
+    -- tasks waiting on each other are reported
+    ok, e = pcall(asyncio.run, function()
+        local me = coroutine.running()
+        return await asyncio.spawn(function() return await me end)
+    end)
+    assert(not ok and e:find("wait for each other"))
+end
+
+print("ALL ASYNC LOOP TESTS PASSED")
@@ -0,0 +1,93 @@
+-- Big integers: arithmetic, division, powmod and radix conversion.
+
+local B = math.bigint
+local maxi, mini = math.maxinteger, math.mininteger
+
+local function eq(x, s, msg)
+    assert(tostring(x) == s, msg .. ": got " .. tostring(x))
+end
+
+-- integer overflow promotes, results that fit demote again
+local x = maxi + 1
+eq(x, "9223372036854775808", "maxinteger + 1")
+eq(mini - 1, "-9223372036854775809", "mininteger - 1")
+assert(math.type(x - 1) == "integer" and x - 1 == maxi)
+assert(x > maxi and -x - 1 < mini and x == B("9223372036854775808"))
+eq(maxi * maxi, "85070591730234615847396907784232501249", "maxinteger^2")
+eq(-x, "-9223372036854775808", "negation")
+assert(math.type(-x) == "integer" and -x == mini)
+
+-- conversions
+local two200 = "1606938044258990275541962092341162602522202993782792835301376"
+local p = B(1)
+for i = 1, 200 do p = p * 2 end
+eq(p, two200, "2^200")
+eq(B(two200), two200, "parse")
+eq(B("-" .. two200), "-" .. two200, "parse negative")
+eq(B("0x1" .. string.rep("0", 50)), two200, "parse hex")
+eq(B("  000123  "), "123", "leading zeros")
+eq(B(2.0^70), "1180591620717411303424", "from float")
+assert(B(42) == 42 and math.type(B("42")) == "integer")
+assert(not pcall(B, "12a") and not pcall(B, 1.5) and not pcall(B, ""))
+assert(p == B(two200) and p ~= p + 1 and p < p + 1 and p - 1 < p)
+assert(p > 1e60 and p < 1e61 and p + 0.5 == 2.0^200)
+
+local f = B(1)
+for i = 2, 50 do f = f * i end
+eq(f, "30414093201713378043612608166064768844377641568960512000000000000",
+   "50!")
+
+-- floor division and modulo follow the signs like integers do
+local a, b = B("100000000000000000000000000007"), B("100000000000000000003")
+for _, sa in ipairs({1, -1}) do
+    for _, sb in ipairs({1, -1}) do
+        local u, v = a * sa, b * sb
+        local q, r = u // v, u % v
+        assert(q * v + r == u, "division identity")
+        assert(r == 0 or (r < 0) == (v < 0), "remainder sign")
+        assert((r < 0 and -r or r) < (v < 0 and -v or v), "remainder size")
+    end
+end
+eq(a // 7, "14285714285714285714285714286", "single limb divisor")
+eq(a % 7, "5", "single limb remainder")
+assert(not pcall(function() return a // 0 end))
+assert(not pcall(function() return a % 0 end))
+assert(math.type(a / b) == "float" and math.abs(a / b - 1e9) < 1)
+
+-- large operands take the fast paths
+local big = B("0x" .. string.rep("f123456789abcdef", 80))  -- 5120 bits
+local small = B("0x" .. string.rep("9876543210fedcba", 30))
+local sq = big * big
+assert(sq // big == big and sq % big == 0, "karatsuba square")
+local prod = big * small
+assert(prod // small == big and prod // big == small, "unbalanced product")
+assert((prod + 12345) % small == 12345, "long division")
+local s = tostring(big)
+assert(#s == 1542 and B(s) == big, "radix conversion")
+assert(tostring(-big) == "-" .. s)
+
+-- exact powers of big integers
+eq(B("18446744073709551616") ^ 3,
+   "6277101735386680763835789423207666416102355444464034512896", "2^192")
+assert(math.type(x ^ 0.5) == "float")
+
+-- modular exponentiation
+local function pow2(n)
+    local r = B(1)
+    for i = 1, n do r = r * 2 end
+    return r
+end
+local m = pow2(127) - 1
+eq(math.powmod(3, B("100000000000000000000"), m),
+   "12025050231696925086731743046088503371", "odd modulus")
+eq(math.powmod(3, 200, pow2(128)), "175359258540093970667410787940678807713",
+   "even modulus")
+eq(math.powmod(-2, 3, 5), "2", "negative base")
+eq(math.powmod(big, 0, small), "1", "zero exponent")
+eq(math.powmod(big, 5, 1), "0", "unit modulus")
+-- Fermat: a^(p-1) = 1 mod p for the prime 2^521 - 1
+local m521 = pow2(521) - 1
+assert(math.powmod(big, m521 - 1, m521) == 1, "fermat")
+assert(not pcall(math.powmod, 2, -1, 5) and not pcall(math.powmod, 2, 3, 0))
+
+print("ALL BIGINT TESTS PASSED")
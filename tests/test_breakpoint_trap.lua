@@ -0,0 +1,87 @@
+-- Breakpoints are planted as traps in the bytecode: no hook is installed
+-- unless a stepping command is pending.
+
+local SRC = debug.getinfo(1, "S").source
+
+local function target(x)
+    local y = x * 2
+    return y + 1
+end
+
+local BP = debug.getinfo(target, "S").linedefined + 1
+
+local hits = {}
+debug.setoutputcallback(function(event, src, line)
+    hits[#hits + 1] = event .. ":" .. line
+end)
+
+-- plain breakpoint, no hook needed
+debug.setbreakpoint(SRC, BP)
+assert(debug.gethook() == nil, "breakpoint should not install a hook")
+assert(target(1) == 3)
+assert(#hits == 1 and hits[1] == "breakpoint:" .. BP, tostring(hits[1]))
+
+-- the debug interface still sees the original code
+assert(debug.getinfo(target, "L").activelines[BP])
+
+-- conditional breakpoint, compiled once and evaluated on every hit
+trap_limit = 3
+debug.setbreakpoint(SRC, BP, "trap_limit > 1")
+hits = {}
+for i = 1, 5 do
+    target(i)
+    trap_limit = trap_limit - 1
+end
+assert(#hits == 2, "conditional hits: " .. #hits)
+
+-- a condition that does not compile never stops
+debug.setbreakpoint(SRC, BP, "(((")
+hits = {}
+target(1)
+assert(#hits == 0)
+
+-- traps fire in coroutines too
+debug.setbreakpoint(SRC, BP)
+hits = {}
+local co = coroutine.wrap(function() return target(10) end)
+assert(co() == 21)
+assert(#hits == 1)
+
+-- dumped code carries no trap; reloaded code gets one from the load hook
+local dumped = string.dump(target)
+local reloaded = load(dumped, nil, "b")
+hits = {}
+assert(reloaded(4) == 9)
+assert(#hits == 1, "reloaded function should hit the breakpoint")
+
+-- disabled breakpoints cost nothing and do not stop
+debug.enablebreakpoint(SRC, BP, false)
+hits = {}
+target(1)
+assert(#hits == 0)
+debug.enablebreakpoint(SRC, BP, true)
+target(1)
+assert(#hits == 1)
+
+-- stepping installs the line hook only while a command is pending
+local stepped = {}
+debug.setoutputcallback(function(event, src, line)
+    stepped[#stepped + 1] = event
+    if event == "breakpoint" then debug.step() end
+end)
+target(1)
+assert(stepped[1] == "breakpoint" and stepped[2] == "step", table.concat(stepped, ","))
+assert(debug.gethook() == nil, "hook should be gone once stepping is over")
+
+-- removing the breakpoint restores the original instructions
+debug.setoutputcallback(function(event, src, line)
+    hits[#hits + 1] = event
+end)
+assert(debug.removebreakpoint(SRC, BP))
+hits = {}
+target(1)
+reloaded(1)
+assert(#hits == 0)
+
+assert(debug.clearbreakpoints() == 0)
+print("ALL BREAKPOINT TRAP TESTS PASSED")
@@ -0,0 +1,172 @@
+-- luaL_clonestate, through vm.clone
+
+local function check(cond, msg)
+  if not cond then error("FAILED: " .. msg, 2) end
+end
+
+-- a small "prelude": globals, nested and cyclic tables, metatables
+config = {name = "svc", limits = {cpu = 2, mem = 512}, tags = {"a", "b"}}
+config.self = config
+local Point = {}
+Point.__index = Point
+function Point.new(x, y) return setmetatable({x = x, y = y}, Point) end
+function Point:norm2() return self.x * self.x + self.y * self.y end
+P = Point
+origin = Point.new(3, 4)
+big = math.bigint("123456789012345678901234567890")
+keyt = {}
+bykey = {[keyt] = "found", [1.5] = "float", [true] = "yes"}
+
+-- closures sharing an upvalue
+do
+  local n = 0
+  function incr() n = n + 1 return n end
+  function peek() return n end
+end
+incr(); incr()
+
+-- additions to library tables and to the string metatable
+function string.shout(s) return s:upper() .. "!" end
+table.extra = "x"
+
+-- a module in package.loaded
+package.loaded.mymod = {answer = function () return 42 end}
+
+-- values are copied
+check(vm.clone(function () return config.limits.mem, config.self == config,
+                                  config.tags[2] end) == 512, "nested")
+local a, b, c = vm.clone(function () return config.limits.mem,
+                                            config.self == config,
+                                            config.tags[2] end)
+check(b == true and c == "b", "cycle and array")
+check(vm.clone(function () return origin:norm2() end) == 25, "metatable")
+check(vm.clone(function () return getmetatable(origin) == P end), "shared mt")
+check(vm.clone(function () return tostring(big) end) == tostring(big), "bigint")
+check(vm.clone(function () return bykey[keyt], bykey[1.5], bykey[true] end)
+      == "found", "table keys")
+
+-- shared upvalues stay shared, and start from the current value
+local i1, i2, p = vm.clone(function () return incr(), incr(), peek() end)
+check(i1 == 3 and i2 == 4 and p == 4, "shared upvalue")
+check(peek() == 2, "template upvalue untouched")
+
+-- locals of the caller reach the clone as upvalues of the function
+local secret = {v = 7}
+check(vm.clone(function () return secret.v end) == 7, "local upvalue")
+check(vm.clone(function (t) return t.v end, secret) == 7, "argument")
+
+-- functions made by a factory, with their debug information
+local src = "local function mk(k) return function (x) return x * k end end\n" ..
+            "return mk(2), mk(3), ('" .. string.rep("L", 100) .. "')"
+twice, thrice, long = load(src, "=factory")()
+local r2, r3, srcname, line, same = vm.clone(function ()
+  local info = debug.getinfo(twice, "S")
+  return twice(5), thrice(5), info.source, info.linedefined, long == ("L"):rep(100)
+end)
+check(r2 == 10 and r3 == 15, "factory closures")
+check(srcname == "=factory" and line == 1 and same, "debug info")
+
+-- libraries are the clone's own, with our additions merged in
+check(vm.clone(function () return ("hi"):shout() end) == "HI!", "string mt")
+check(vm.clone(function () return table.extra, type(table.insert) end)
+      == "x", "merged library table")
+check(vm.clone(function () return require("mymod").answer() end) == 42,
+      "package.loaded")
+check(vm.clone(function () return io.write == io.stdout.write or true end),
+      "io")
+
+-- the clone is isolated
+vm.clone(function () config.name = "changed"; newglobal = 1; table.extra = nil end)
+check(config.name == "svc" and newglobal == nil and table.extra == "x",
+      "isolation")
+
+-- errors inside the clone
+local ok, err = pcall(vm.clone, function () error("inside") end)
+check(not ok and err:find("inside"), "error propagates")
+ok, err = pcall(vm.clone, function () return {} end)
+check(not ok and err:find("cannot return a table"), "bad result")
+
+-- things that cannot be copied
+co = coroutine.create(function () end)
+ok, err = pcall(vm.clone, function () end)
+check(not ok and err:find("cannot clone a thread"), "thread: " .. tostring(err))
+co = nil
+
+local tmp = os.tmpname()
+f = io.open(tmp, "w")
+ok, err = pcall(vm.clone, function () end)
+check(not ok and err:find("finalizer"), "file: " .. tostring(err))
+f:close(); f = nil
+os.remove(tmp)
+
+-- a gmatch iterator keeps pointers into the template's string
+G = ("one two"):gmatch("%a+")
+ok, err = pcall(vm.clone, function () return G() end)
+check(not ok and err:find("without '__clone'"), "userdata: " .. tostring(err))
+G = nil
+
+-- loaded C libraries stay with the template ('_CLIBS' is not merged)
+local dir = os.tmpname()
+os.remove(dir)
+os.execute("mkdir -p " .. dir)
+local cf = io.open(dir .. "/clonefoo.c", "w")
+cf:write([[
+#include "lua.h"
+#include "lauxlib.h"
+static int hello (lua_State *L) { lua_pushliteral(L, "hello"); return 1; }
+/* a box of plain data, which opts in to being cloned */
+static int get (lua_State *L) {
+  lua_pushinteger(L, *(lua_Integer *)lua_touserdata(L, 1));
+  return 1;
+}
+static int box (lua_State *L) {
+  lua_Integer *p = (lua_Integer *)lua_newuserdatauv(L, sizeof(*p), 0);
+  *p = luaL_checkinteger(L, 1);
+  lua_newtable(L);
+  lua_pushboolean(L, lua_toboolean(L, 2));
+  lua_setfield(L, -2, "__clone");
+  lua_pushcfunction(L, get);
+  lua_setfield(L, -2, "__call");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+int luaopen_clonefoo (lua_State *L) {
+  lua_newtable(L);
+  lua_pushcfunction(L, hello);
+  lua_setfield(L, -2, "hello");
+  lua_pushcfunction(L, box);
+  lua_setfield(L, -2, "box");
+  return 1;
+}
+]])
+cf:close()
+if os.execute("cc -shared -fPIC -I. -o " .. dir .. "/clonefoo.so " .. dir ..
+              "/clonefoo.c 2>/dev/null") then
+  local cpath = package.cpath
+  package.cpath = dir .. "/?.so;" .. cpath
+  foo = require("clonefoo")
+  check(vm.clone(function () return foo.hello() end) == "hello", "C module")
+  check(vm.clone(function () return 1 end) == 1, "C module, again")
+  boxed = foo.box(42, true)
+  check(vm.clone(function () return boxed() end) == 42, "__clone userdata")
+  boxed = foo.box(42, false)
+  ok, err = pcall(vm.clone, function () return boxed() end)
+  check(not ok and err:find("without '__clone'"), "__clone false")
+  boxed = nil
+  check(foo.hello() == "hello", "C module still loaded")
+  package.cpath = cpath
+else
+  print("(no C compiler: skipping the C module case)")
+end
+os.execute("rm -rf " .. dir)
+
+-- the template still clones fine afterwards
+check(vm.clone(function () return P.new(1, 1):norm2() end) == 2, "again")
+
+-- many clones
+for k = 1, 50 do
+  check(vm.clone(function (x) return x + incr() end, k) == k + 3, "loop")
+end
+collectgarbage()
+
+print("ALL CLONESTATE TESTS PASSED")
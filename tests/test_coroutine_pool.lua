@@ -0,0 +1,133 @@
+-- Reuse of dead threads by coroutine.create
+
+local function check(cond, msg)
+  if not cond then error("FAILED: " .. msg, 2) end
+end
+
+-- option handling
+local limit0 = collectgarbage("threadpool")
+check(math.type(limit0) == "integer" and limit0 > 0, "default limit")
+check(collectgarbage("threadpool", 8) == limit0, "set returns old")
+check(collectgarbage("threadpool") == 8, "query")
+collectgarbage("threadpool", limit0)
+
+-- run many short coroutines through several collections
+local function churn(n, f)
+  for i = 1, n do
+    local co = coroutine.create(f)
+    local ok, v = coroutine.resume(co, i)
+    check(ok, "resume: " .. tostring(v))
+    if coroutine.status(co) == "suspended" then
+      ok, v = coroutine.resume(co, v)
+      check(ok and v == i * 2 + 1, "second resume")
+    end
+    if i % 1000 == 0 then collectgarbage("step") end
+  end
+end
+
+churn(20000, function (i) local x = coroutine.yield(i * 2) return x + 1 end)
+
+-- a reused thread starts clean: status, stack, upvalues
+for i = 1, 2000 do
+  local co = coroutine.create(function (...)
+    check(select("#", ...) == 1, "argument count")
+    local a, b, c
+    check(a == nil and b == nil and c == nil, "clean locals")
+    return coroutine.isyieldable(), coroutine.running()
+  end)
+  check(coroutine.status(co) == "suspended", "fresh status")
+  local ok, y, r = coroutine.resume(co, i)
+  check(ok and y == true and r == co, "running thread")
+  check(coroutine.status(co) == "dead", "dead")
+  if i % 200 == 0 then collectgarbage("step") end
+end
+
+-- threads that died with an error, were closed, or hold open upvalues
+local closures = {}
+for i = 1, 3000 do
+  local co = coroutine.create(function (k)
+    local v = k
+    closures[#closures + 1] = function () return v end
+    coroutine.yield()
+    if k % 3 == 0 then error("boom" .. k) end
+    return k
+  end)
+  coroutine.resume(co, i)
+  if i % 3 == 1 then
+    coroutine.close(co)
+  else
+    local ok, e = coroutine.resume(co)
+    check(ok == (i % 3 ~= 0), "error status")
+    if not ok then check(e:find("boom" .. i), "error message") end
+  end
+  if i % 300 == 0 then collectgarbage("step") end
+end
+collectgarbage()
+for i, f in ipairs(closures) do check(f() == i, "upvalue " .. i) end
+closures = nil
+
+-- threads with deep stacks (not pooled) and many CallInfos
+local function deep(n) if n == 0 then return coroutine.yield(0) end return deep(n - 1) + 1 end
+for i = 1, 300 do
+  local co = coroutine.create(deep)
+  coroutine.resume(co, i % 2 == 0 and 1000 or 10)
+  local ok, v = coroutine.resume(co, 5)
+  check(ok and v == 5 + (i % 2 == 0 and 1000 or 10), "deep result")
+  if i % 30 == 0 then collectgarbage("step") end
+end
+
+-- hooks set on the creator are inherited, not left from a previous user
+local count = 0
+debug.sethook(function () count = count + 1 end, "", 1)
+local co = coroutine.wrap(function () local s = 0 for i = 1, 10 do s = s + i end return s end)
+check(co() == 55, "hooked coroutine")
+debug.sethook()
+check(count > 0, "hook ran")
+count = 0
+churn(2000, function (i) return i end)
+check(count == 0, "no stale hook")
+
+-- the pool can be disabled and is emptied by full collections
+collectgarbage("threadpool", 0)
+churn(5000, function (i) return i end)
+collectgarbage("threadpool", limit0)
+churn(5000, function (i) return i end)
+collectgarbage()
+local before = collectgarbage("count")
+collectgarbage("threadpool", 0)
+check(collectgarbage("count") <= before, "trimmed")
+collectgarbage("threadpool", limit0)
+
+-- each cycle keeps the threads in use and frees the idle ones
+local function pooled()  -- memory freed by emptying the pool
+  local kb = collectgarbage("count")
+  collectgarbage("threadpool", 0)
+  local freed = kb - collectgarbage("count")
+  collectgarbage("threadpool", limit0)
+  return freed
+end
+for _, mode in ipairs({"incremental", "generational"}) do
+  local old = collectgarbage(mode)
+  local function cycle()
+    if mode == "incremental" then
+      repeat until collectgarbage("step")
+    else
+      collectgarbage("step")  -- a minor collection
+    end
+  end
+  collectgarbage()
+  local cos = {}
+  for i = 1, 200 do cos[i] = coroutine.create(print) end
+  cos = nil
+  cycle()  -- the threads die and enter the pool
+  check(pooled() > 0, mode .. ": pool filled")
+  for _ = 1, 100 do cos = coroutine.create(print) end
+  cos = nil
+  cycle()
+  check(pooled() > 0, mode .. ": pool kept while in use")
+  cycle(); cycle(); cycle()
+  check(pooled() == 0, mode .. ": idle pool drained")
+  collectgarbage(old)
+end
+
+print("ALL COROUTINE POOL TESTS PASSED")
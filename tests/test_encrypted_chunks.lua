@@ -0,0 +1,42 @@
+-- Encrypted ("Nirithy==") chunks: the ZIO decrypts them one window at a
+-- time, so sources are chosen to cross window and AES block boundaries.
+
+local function check(src, ...)
+    local env = string.envelop(src)
+    assert(env:sub(1, 9) == "Nirithy==", "not an envelope")
+    local f = assert(load(env, "=enc"))
+    local g = assert(load(src, "=plain"))
+    local a, b = table.pack(f(...)), table.pack(g(...))
+    assert(a.n == b.n)
+    for i = 1, a.n do assert(a[i] == b[i], "result " .. i .. " differs") end
+    return a[1]
+end
+
+assert(check("return 1 + 2") == 3)
+assert(check("return ...", "x") == "x")
+
+-- sizes around the AES block size
+for pad = 0, 40 do
+    local src = "return '" .. string.rep("a", pad) .. "'"
+    assert(check(src) == string.rep("a", pad))
+end
+
+-- a long string literal straddling several 16 KB windows
+for _, n in ipairs({ 16383, 16384, 16385, 50000, 100003 }) do
+    local body = {}
+    for i = 1, n do body[i] = string.char(97 + (i * 7) % 26) end
+    body = table.concat(body)
+    assert(check("return [[" .. body .. "]]") == body)
+end
+
+-- many statements, so tokens fall on every window boundary
+local parts = { "local t = 0" }
+for i = 1, 6000 do parts[#parts + 1] = "t = t + " .. i end
+parts[#parts + 1] = "return t"
+assert(check(table.concat(parts, "\n")) == 6000 * 6001 // 2)
+
+-- syntax errors are still reported through the envelope
+local ok, err = load(string.envelop("return +"), "=enc")
+assert(not ok and err:find("unexpected symbol"), err)
+
+print("ALL ENCRYPTED CHUNK TESTS PASSED")
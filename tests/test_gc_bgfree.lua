@@ -0,0 +1,60 @@
+-- collectgarbage("bgfree"): dead objects are freed by a helper thread.
+
+assert(collectgarbage("bgfree", true) == false)
+assert(collectgarbage("bgfree", true) == true)  -- already on
+
+local function churn(n)
+    local keep = {}
+    for i = 1, n do
+        local t = {i, tostring(i), {i}}
+        if i % 10 == 0 then keep[#keep + 1] = t end
+    end
+    return keep
+end
+
+-- incremental mode: sweeps run in steps and in full collections
+local keep = churn(100000)
+collectgarbage()
+for i = 1, 50 do collectgarbage("step", 0) end
+for i, t in ipairs(keep) do
+    assert(t[1] == i * 10 and t[2] == tostring(i * 10) and t[3][1] == i * 10)
+end
+keep = nil
+collectgarbage()
+local before = collectgarbage("count")
+
+-- generational mode sweeps with 'sweepgen' and 'sweep2old'
+collectgarbage("generational")
+keep = churn(100000)
+collectgarbage()
+keep = churn(50000)
+collectgarbage("step")
+assert(#keep == 5000 and keep[5000][1] == 50000)
+collectgarbage("incremental")
+
+-- strings and userdata go through the same path
+local s = {}
+for i = 1, 20000 do s[i] = string.rep("x", i % 200) .. i end
+s = nil
+collectgarbage()
+
+-- finalizers still run and see live objects
+local ran = 0
+for i = 1, 1000 do
+    setmetatable({}, {__gc = function(o) ran = ran + 1 end})
+end
+collectgarbage()
+collectgarbage()
+assert(ran == 1000)
+
+assert(collectgarbage("bgfree", false) == true)
+assert(collectgarbage("bgfree", false) == false)
+keep = nil
+collectgarbage()
+assert(collectgarbage("count") <= before * 2)
+
+-- states closed with the helper running free everything synchronously
+collectgarbage("bgfree", true)
+keep = churn(10000)
+
+print("ALL GC BGFREE TESTS PASSED")
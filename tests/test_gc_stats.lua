@@ -0,0 +1,76 @@
+-- collectgarbage("stats"): ring of collector records.
+
+local kinds = {incstep = true, young = true, atomic2gen = true,
+               genfull = true, fullinc = true}
+
+local function check(r)
+    assert(math.type(r.seq) == "integer" and r.seq > 0)
+    assert(kinds[r.kind], r.kind)
+    assert(r.time >= 0 and r.fintime >= 0 and r.fintime <= r.time + 1e-3)
+    assert(r.allocated >= 0 and r.freed >= 0 and r.heap > 0)
+    assert(type(r.swept) == "table")
+end
+
+local function last()
+    local s = collectgarbage("stats")
+    return s[#s]
+end
+
+-- a full incremental collection frees the dropped tables
+collectgarbage("incremental")
+collectgarbage()
+local t = {}
+for i = 1, 10000 do t[i] = {} end
+t = nil
+collectgarbage()
+local r = last()
+check(r)
+assert(r.kind == "fullinc")
+assert(r.swept.table >= 10000)
+assert(r.freed > 0)
+
+-- records are ordered and 'after' skips the ones already seen
+local seen = r.seq
+for i = 1, 100000 do local _ = {i} end  -- run some steps
+collectgarbage()
+local s = collectgarbage("stats", seen)
+assert(#s >= 1 and s[1].seq > seen)
+for i = 2, #s do assert(s[i].seq == s[i - 1].seq + 1) end
+for _, x in ipairs(s) do check(x) end
+local steps = 0  -- steps are recorded too
+for _, x in ipairs(s) do if x.kind == "incstep" then steps = steps + 1 end end
+assert(steps > 0)
+assert(#collectgarbage("stats", s[#s].seq) == 0)
+seen = s[#s].seq
+collectgarbage()
+s = collectgarbage("stats", seen)
+assert(#s == 1 and s[1].seq == seen + 1 and s[1].kind == "fullinc")
+
+-- finalizers are counted and timed
+local ran = 0
+for i = 1, 10 do setmetatable({}, {__gc = function() ran = ran + 1 end}) end
+seen = last().seq
+collectgarbage()
+collectgarbage()
+local fin = 0
+for _, x in ipairs(collectgarbage("stats", seen)) do fin = fin + x.finalizers end
+assert(ran == 10 and fin == 10)
+
+-- generational mode
+collectgarbage("generational")
+for i = 1, 100000 do local _ = {i} end
+collectgarbage("step")
+local young = 0
+for _, x in ipairs(collectgarbage("stats")) do
+    check(x)
+    if x.kind == "young" or x.kind == "atomic2gen" then young = young + 1 end
+end
+assert(young > 0)
+collectgarbage("incremental")
+
+-- the ring keeps only the latest records
+for i = 1, 200 do collectgarbage() end
+s = collectgarbage("stats")
+assert(#s < 200 and s[#s].seq - s[1].seq == #s - 1)
+
+print("ALL GC STATS TESTS PASSED")
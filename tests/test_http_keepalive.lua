@@ -0,0 +1,186 @@
+-- HTTP/1.1 client pool, chunked decoding and the epoll server loop.
+local http = require "http"
+
+local function listen()
+    local s = assert(http.server(0, {host = "127.0.0.1", backlog = 64}))
+    local _, port = s:getsockname()
+    return s, "http://127.0.0.1:" .. port, port
+end
+
+-- read from a raw socket until 'pred' accepts what arrived
+local function recv_until(sock, pred)
+    local data = ""
+    while not pred(data) do
+        local s = sock:recv(65536)
+        if not s then break end
+        data = data .. s
+    end
+    return data
+end
+
+local function head_done(d) return d:find("\r\n\r\n", 1, true) ~= nil end
+
+-- the client keeps the connection and decodes chunked bodies
+do
+    local srv, base = listen()
+    local th = thread.create(function(s)
+        local c = s:accept()
+        local got = {}
+        for i = 1, 2 do
+            local req = recv_until(c, head_done)
+            got[i] = req:match("^(%u+ %S+ HTTP/1%.1)")
+            if i == 1 then
+                c:send("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n" ..
+                       "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nX-Trailer: t\r\n\r\n")
+            else
+                c:send("HTTP/1.1 201 Created\r\nContent-Length: 3\r\nX-A: 1\r\nX-A: 2\r\n\r\nabc")
+            end
+        end
+        c:close()
+        s:close()
+        return table.concat(got, "|")
+    end, srv)
+    local st, body = http.get(base .. "/one")
+    assert(st == 200 and body == "hello, world", body)
+    local st2, body2, h = http.post(base .. "/two", "x")
+    assert(st2 == 201 and body2 == "abc")
+    assert(h["x-a"] == "1, 2" and h["content-length"] == "3")
+    -- both requests arrived on the same accepted connection
+    assert(th:join() == "GET /one HTTP/1.1|POST /two HTTP/1.1")
+end
+
+-- a pooled connection closed by the server is replaced transparently
+do
+    local srv, base = listen()
+    local th = thread.create(function(s)
+        for i = 1, 2 do
+            local c = s:accept()
+            recv_until(c, head_done)
+            c:send("HTTP/1.1 200 OK\r\nContent-Length: 1\r\n\r\n" .. i)
+            c:close()  -- without announcing it
+        end
+        s:close()
+    end, srv)
+    assert(select(2, http.get(base .. "/")) == "1")
+    assert(select(2, http.get(base .. "/")) == "2")
+    th:join()
+end
+
+-- bodies delimited by the end of the connection
+do
+    local srv, base = listen()
+    local th = thread.create(function(s)
+        local c = s:accept()
+        recv_until(c, head_done)
+        c:send("HTTP/1.0 200 OK\r\n\r\nuntil close")
+        c:close()
+        s:close()
+    end, srv)
+    assert(select(2, http.get(base .. "/")) == "until close")
+    th:join()
+end
+
+-- the server loop: keep-alive, pipelining, chunked requests
+do
+    local srv, base, port = listen()
+    local th = thread.create(function(s)
+        return s:serve(function(req)
+            if req.path == "/echo" then
+                return 200, req.body, {["X-Len"] = #req.body}
+            end
+            return 404, "no " .. req.path
+        end, 5)
+    end, srv)
+    local st, body, h = http.post(base .. "/echo", "payload")
+    assert(st == 200 and body == "payload" and h["x-len"] == "7")
+    st, body = http.get(base .. "/missing")
+    assert(st == 404 and body == "no /missing")
+    -- two pipelined requests and a chunked one in a single write
+    local c = http.client("127.0.0.1", port)
+    c:send("GET /a HTTP/1.1\r\nHost: x\r\n\r\n" ..
+           "POST /echo HTTP/1.1\r\nHost: x\r\nContent-Length: 2\r\n\r\nhi" ..
+           "POST /echo HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n" ..
+           "Connection: close\r\n\r\n3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n")
+    local all = recv_until(c, function() return false end)  -- until close
+    c:close()
+    local _, n404 = all:gsub("HTTP/1%.1 404", "")
+    assert(n404 == 1)
+    assert(all:find("Content%-Length: 2\r\n.-\r\n\r\nhi"))
+    assert(all:find("Connection: close\r\n.-\r\n\r\nabcde$"))
+    assert(th:join() == 5)
+end
+
+-- heads with a bare CR are refused, not read past
+do
+    local srv, base = listen()
+    local th = thread.create(function(s)
+        for _, head in ipairs{"HTTP/1.1 200 OK\r\nX: a\r\r\n\r\n",
+                              "HTTP/1.1 200 OK\rX: a\r\n\r\n"} do
+            local c = s:accept()
+            recv_until(c, head_done)
+            c:send(head)
+            c:close()
+        end
+        s:close()
+    end, srv)
+    for _ = 1, 2 do
+        local st, e = http.get(base .. "/")
+        assert(st == nil and e == "Invalid response", e)
+    end
+    th:join()
+end
+do
+    local srv, base, port = listen()
+    local th = thread.create(function(s)
+        return s:serve(function(req) return 200, req.path end, 1)
+    end, srv)
+    for _, req in ipairs{"GET /a HTTP/1.1\r\nX: a\r\r\n\r\n",
+                         "GET /b HTTP/1.1\rX: a\r\n\r\n"} do
+        local c = http.client("127.0.0.1", port)
+        c:send(req)
+        local got = recv_until(c, function() return false end)  -- until close
+        c:close()
+        assert(got == "", got)
+    end
+    assert(select(2, http.get(base .. "/ok")) == "/ok")
+    assert(th:join() == 1)
+end
+
+-- request bodies over 'maxbody' get 413 without reaching the handler
+do
+    local srv, base, port = listen()
+    local th = thread.create(function(s)
+        local calls = 0
+        local n = s:serve(function(req)
+            calls = calls + 1
+            return 200, req.body
+        end, {max = 2, maxbody = 4})
+        return n .. "/" .. calls
+    end, srv)
+    local st, body = http.post(base .. "/", "four")
+    assert(st == 200 and body == "four")
+    st = http.post(base .. "/", "fives")
+    assert(st == 413, st)
+    -- chunked: refused once the decoded body passes the limit
+    local c = http.client("127.0.0.1", port)
+    c:send("POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n" ..
+           "3\r\nabc\r\n3\r\ndef\r\n")
+    local all = recv_until(c, function() return false end)  -- until close
+    c:close()
+    assert(all:find("^HTTP/1%.1 413 Payload Too Large\r\n"))
+    assert(all:find("Connection: close\r\n", 1, true))
+    assert(select(2, http.post(base .. "/", "ok")) == "ok")
+    assert(th:join() == "2/2")
+end
+
+-- options
+do
+    local ok, e = pcall(http.server, 0, "x")
+    assert(not ok and e:find("integer or table"))
+    local a = assert(http.server(0, {host = "127.0.0.1", reuseport = true}))
+    local _, port = a:getsockname()
+    local b = assert(http.server(port, {host = "127.0.0.1", reuseport = true}))
+    a:close(); b:close()
+end
+
+print("ALL HTTP KEEPALIVE TESTS PASSED")
@@ -0,0 +1,53 @@
+-- luaL_openlazylibs, as used by the interpreter when LUA_LAZYLIBS is set
+
+local function check(cond, msg)
+  if not cond then error("FAILED: " .. msg, 2) end
+end
+
+local interp = arg and arg[-1] or "lxclua"
+
+local function run(env, code, opts)
+  local f = io.popen(env .. " " .. interp .. " " .. (opts or "") ..
+                     " -e '" .. code .. "' 2>&1")
+  local out = f:read("a")
+  f:close()
+  return out
+end
+
+local probe = [[
+local t = {}
+t[#t+1] = tostring(rawget(_G, "http") == nil)
+t[#t+1] = tostring(rawget(_G, "string") ~= nil)
+t[#t+1] = type(http.get)
+t[#t+1] = tostring(rawget(_G, "http") == http and package.loaded.http == http)
+t[#t+1] = tostring(require("wasm3") == wasm3)
+t[#t+1] = tostring(rawget(_G, "lexer") == nil)
+t[#t+1] = tostring(undefined_global)
+t[#t+1] = type(thread) .. "," .. type(asyncio) .. "," .. type(bit32)
+t[#t+1] = tostring(getmetatable(_G).__newindex ~= nil)
+io.write(table.concat(t, " "))
+]]
+probe = probe:gsub("\n", " ")
+
+local lazy = run("LUA_LAZYLIBS=1", probe)
+check(lazy == "true true function true true true nil table,table,table true",
+      "lazy: " .. lazy)
+
+local eager = run("env -u LUA_LAZYLIBS", probe)
+check(eager == "false true function true true false nil table,table,table true",
+      "eager: " .. eager)
+
+-- a script using several libraries behaves the same in both modes
+local script = [[
+local s = string.format("%d %s %s", struct and 1 or 0, type(fs), type(vm))
+io.write(s, " ", tostring(#ByteCode ~= nil))
+]]
+script = script:gsub("\n", " ")
+check(run("LUA_LAZYLIBS=1", script) == run("env -u LUA_LAZYLIBS", script),
+      "same results")
+
+-- '-E' ignores the variable
+check(run("LUA_LAZYLIBS=1", "io.write(tostring(rawget(_G, \"http\") ~= nil))",
+          "-E") == "true", "-E")
+
+print("ALL LAZY LIBS TESTS PASSED")
@@ -0,0 +1,93 @@
+local lexer = require("lexer")
+
+-- lexer.lex returns a columnar token buffer; token tables are built on demand.
+
+local code = [[
+local name = "hi"
+local name2 = name .. 'x' -- comment
+if name then print(name, 42, 1.5) end
+]]
+
+local toks = lexer.lex(code)
+assert(type(toks) == "userdata", "lex should return a token buffer")
+assert(#toks == 22, "token count " .. #toks)
+
+-- accessors and views agree
+local t = toks[2]
+assert(t.token == lexer.TK_NAME and t.type == "<name>" and t.value == "name" and t.line == 1)
+assert(toks:token(2) == lexer.TK_NAME and toks:value(2) == "name" and toks:line(2) == 1)
+assert(toks:type(1) == "'local'")
+assert(toks[0] == nil and toks[#toks + 1] == nil)
+
+-- spans point into the original source
+for i = 1, #toks do
+    local s, e = toks:span(i)
+    assert(code:sub(s, e) == toks:text(i))
+end
+assert(toks:text(4) == '"hi"' and toks:value(4) == "hi")
+assert(toks:text(9) == "..")
+assert(toks:source() == code)
+
+-- ipairs/pairs/totable walk views
+local n = 0
+for i, tk in ipairs(toks) do n = n + 1; assert(tk.token == toks:token(i)) end
+assert(n == #toks)
+n = 0
+for i, tk in pairs(toks) do n = n + 1 end
+assert(n == #toks)
+local plain = toks:totable()
+assert(#plain == #toks and plain[4].value == "hi")
+
+-- library functions give the same answers for buffers and tables
+assert(lexer.reconstruct(toks) == lexer.reconstruct(plain))
+local function same(a, b)
+    assert(#a == #b)
+    for i = 1, #a do assert(a[i] == b[i]) end
+end
+same(lexer.find_tokens(toks, lexer.TK_NAME), lexer.find_tokens(plain, lexer.TK_NAME))
+same(lexer.find_tokens(toks, "<name>"), lexer.find_tokens(plain, "<name>"))
+same(lexer.find_tokens(toks, "'if'"), { 11 })
+assert(lexer.find_match(toks, 11) == 22 and lexer.find_match(plain, 11) == 22)
+
+local tree = lexer.build_tree(toks)
+assert(lexer.reconstruct(lexer.flatten_tree(tree)) == lexer.reconstruct(toks))
+
+local stmts = lexer.split_statements(toks)
+assert(#stmts == 3 and getmetatable(stmts[1]) == getmetatable(toks))
+assert(lexer.reconstruct(stmts[1]) == 'local name="hi"')
+local names, rest = lexer.parse_local(stmts[2])
+assert(names[1] == "name2" and lexer.reconstruct(rest) == "=name..\"x\"")
+
+local part = lexer.extract_tokens(toks, 1, 4)
+assert(#part == 4 and part:text(4) == '"hi"')
+
+-- editing in place
+local edit = lexer.lex("a = b + c")
+lexer.replace_tokens(edit, 3, 3, lexer.lex("foo(1)"))
+assert(lexer.reconstruct(edit) == "a=foo(1)+c", lexer.reconstruct(edit))
+lexer.remove_tokens(edit, 4, 3)
+assert(lexer.reconstruct(edit) == "a=foo+c")
+lexer.insert_tokens(edit, 1, { token = lexer.TK_LOCAL, line = 1 })
+assert(lexer.reconstruct(edit) == "local a=foo+c")
+lexer.replace_tokens(edit, 5, 7, { { token = lexer.TK_INT, value = 7 } })
+assert(lexer.reconstruct(edit) == "local a=foo 7")
+assert(edit:span(5) == nil, "synthesized tokens have no span")
+
+-- appending, dropping the last token and replacing through indexing
+edit[#edit + 1] = { token = string.byte(";"), line = 1 }
+assert(lexer.reconstruct(edit) == "local a=foo 7;")
+edit[#edit] = nil
+edit[2] = { token = lexer.TK_NAME, value = "z" }
+assert(lexer.reconstruct(edit) == "local z=foo 7")
+assert(not pcall(function() edit[10] = { token = 1 } end))
+
+-- a large input builds no per-token tables
+local big = string.rep("local x = x + 1\n", 20000)
+collectgarbage()
+local before = collectgarbage("count")
+local bt = lexer.lex(big)
+assert(#bt == 120000)
+assert(collectgarbage("count") - before < 8 * 1024, "token buffer too large")
+assert(#lexer.find_tokens(bt, lexer.TK_LOCAL) == 20000)
+
+print("ALL LEXER TOKEN BUFFER TESTS PASSED")
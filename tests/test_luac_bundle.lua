@@ -0,0 +1,104 @@
+-- luac -j: parallel compilation into a module bundle.
+
+local pwd = io.popen("pwd")
+local luac = pwd:read("l") .. "/luac"
+pwd:close()
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute("mkdir -p " .. dir .. "/app/util"))
+
+local function write(name, text)
+    local f = assert(io.open(dir .. "/" .. name, "w"))
+    f:write(text)
+    f:close()
+end
+
+local function read(name)
+    local f = assert(io.open(dir .. "/" .. name, "rb"))
+    local s = f:read("a")
+    f:close()
+    return s
+end
+
+local function run(opts, out)
+    local files = "app/main.lua app/util/str.lua app/util/math.lua"
+    for i = 1, 20 do files = files .. " app/m" .. i .. ".lua" end
+    return os.execute(string.format("cd %s && %s %s -o %s %s 2>/dev/null",
+                                    dir, luac, opts, out, files))
+end
+
+write("app/main.lua", [[
+local name, where = ...
+local str = require("app.util.str")
+return { name = name, where = where, greet = str.upper("hi") }
+]])
+write("app/util/str.lua", "return { upper = function(s) return s:upper() end }")
+write("app/util/math.lua", [[
+local M = {}
+function M.fib(n) if n < 2 then return n end return M.fib(n - 1) + M.fib(n - 2) end
+for i = 1, 3 do
+    if i % 2 == 0 then M.even = i else M.odd = i end
+end
+return M
+]])
+for i = 1, 20 do
+    write("app/m" .. i .. ".lua", string.format(
+        "local t = {} for i = 1, %d do t[i] = i * i end return { n = #t, last = t[#t] }", i))
+end
+
+-- a fixed seed gives the same bundle for any number of threads
+assert(run("-j 4 -S 7", "a.out"))
+assert(run("-j 1 -S 7", "b.out"))
+assert(run("-j 8 -S 7", "c.out"))
+assert(read("a.out") == read("b.out") and read("a.out") == read("c.out"),
+       "bundle is not reproducible")
+assert(read("a.out"):sub(1, 8) == "LXBUNDLE")
+
+-- modules are installed as preload loaders, by name
+local names = package.loadbundle(dir .. "/a.out")
+assert(#names == 23 and names[1] == "app.main" and names[2] == "app.util.str")
+local main = require("app.main")
+assert(main.name == "app.main" and main.where == dir .. "/a.out" and main.greet == "HI")
+assert(require("app.util.math").fib(15) == 610)
+assert(require("app.util.math").even == 2)
+for i = 1, 20 do
+    local m = require("app.m" .. i)
+    assert(m.n == i and m.last == i * i)
+end
+
+-- obfuscated bundles are reproducible too and still run
+assert(run("-j 3 -f -S 99", "f1.out"))
+assert(run("-j 2 -f -S 99", "f2.out"))
+assert(read("f1.out") == read("f2.out"))
+for _, n in ipairs(package.loadbundle(dir .. "/f1.out")) do package.loaded[n] = nil end
+assert(require("app.util.math").fib(10) == 55)
+
+-- a compile error fails the whole build
+write("app/m7.lua", "return +")
+assert(not run("-j 4", "bad.out"))
+
+assert(not pcall(package.loadbundle, dir .. "/app/main.lua"))
+
+-- corrupted indexes install nothing
+do
+    local good = read("b.out")
+    local function refused(data)
+        for k in pairs(package.preload) do package.preload[k] = nil end
+        write("bad.out", data)
+        local ok, e = pcall(package.loadbundle, dir .. "/bad.out")
+        return not ok and e:find("corrupted bundle") and
+               next(package.preload) == nil
+    end
+    -- a count larger than the file could hold
+    assert(refused(good:sub(1, 12) .. string.pack("<I4", 0xffffffff) ..
+                   good:sub(17)))
+    -- an index cut after its first entries
+    local len = string.unpack("<I4", good, 17)
+    assert(refused(good:sub(1, 16 + 4 + len + 16 + 40)))
+    -- a chunk that overlaps the index
+    assert(refused(good:sub(1, 16 + 4 + len) .. string.pack("<I8", 16) ..
+                   good:sub(16 + 4 + len + 9)))
+end
+
+os.execute("rm -rf " .. dir)
+print("ALL LUAC BUNDLE TESTS PASSED")
@@ -0,0 +1,41 @@
+local vm = require("vm")
+
+-- Per-opcode statistics exist only in 'make linux-profile' builds.
+
+local snap, msg = vm.opstats()
+if snap == nil then
+    assert(msg:find("linux-profile", 1, true), tostring(msg))
+    print("ALL OPSTATS TESTS PASSED (not compiled in)")
+    return
+end
+
+vm.opstats("reset")
+assert(vm.opstats("timing", true) == false)
+
+local t = {}
+for i = 1, 1000 do t[i] = i * 2 end
+local c = { x = 1 }
+for i = 1, 100 do local _ = c?.x end
+
+assert(vm.opstats("timing", false) == true)
+local s = vm.opstats()
+assert(s.threads >= 1 and s.timing == false and type(s.clock) == "string")
+assert(s.ops.FORLOOP.count >= 1100, s.ops.FORLOOP.count)
+assert(s.ops.SETTABLE.count >= 1000)
+assert(s.ops.FORLOOP.cycles > 0, "timing produced no cycles")
+assert(s.pairs["SETTABLE FORLOOP"] >= 1000)
+
+local sum = 0
+for _, op in pairs(s.ops) do sum = sum + op.count end
+assert(sum == s.total)
+
+-- export round trip
+local text = vm.opstats("export")
+assert(text:find("op FORLOOP " .. s.ops.FORLOOP.count, 1, true))
+assert(text:find("pair SETTABLE FORLOOP ", 1, true))
+
+vm.opstats("reset")
+local after = vm.opstats()
+assert(after.total < 100, "reset left " .. after.total)
+
+print("ALL OPSTATS TESTS PASSED (" .. s.total .. " instructions)")
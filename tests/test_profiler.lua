@@ -0,0 +1,80 @@
+local profiler = require("profiler")
+
+-- Sampling profiler: folded stacks and per-line counts.
+
+local function leaf(n)
+    local s = 0
+    for i = 1, n do s = s + i % 7 end
+    return s
+end
+
+local function mid(n)
+    return leaf(n) + leaf(n // 2)
+end
+
+local function spin(seconds)
+    local t0 = os.clock()
+    while os.clock() - t0 < seconds do mid(20000) end
+end
+
+assert(not profiler.running())
+assert(profiler.start({ hz = 1000 }))
+assert(profiler.running())
+assert(not pcall(profiler.start), "second start should fail")
+
+spin(0.3)
+local co = coroutine.wrap(function()
+    while true do coroutine.yield(spin(0.01)) end
+end)
+for i = 1, 20 do co() end
+
+local n = profiler.stop()
+assert(not profiler.running())
+assert(n > 0, "no samples taken")
+
+local stats = profiler.stats()
+assert(stats.samples == n and stats.mode == "thread" and stats.hz == 1000)
+
+local folded = profiler.folded()
+local total, sawcoroutine = 0, false
+for stack, count in folded:gmatch("([^\n]+) (%d+)\n") do
+    total = total + tonumber(count)
+    assert(not stack:find(";;", 1, true), "empty frame in " .. stack)
+    if stack:find("(coroutine)", 1, true) then sawcoroutine = true end
+end
+assert(total == n, string.format("folded counts %d ~= samples %d", total, n))
+assert(folded:find("mid (", 1, true) and folded:find("leaf (", 1, true),
+       "hot functions missing from folded stacks")
+assert(sawcoroutine, "no sample attributed to the coroutine")
+
+local lines, hits = profiler.lines(), 0
+for key, count in pairs(lines) do
+    assert(key:match(":%-?%d+$"), key)
+    hits = hits + count
+end
+assert(hits == n)
+
+-- samples survive until reset
+assert(profiler.folded() == folded)
+profiler.reset()
+assert(profiler.folded() == "" and profiler.stats().samples == 0)
+
+-- a small ring is drained from inside the VM instead of dropping samples
+profiler.start({ hz = 1000, buffer = 256 })
+spin(0.2)
+local small = profiler.stop()
+assert(small > 0 and profiler.stats().dropped == 0)
+
+-- code without loops is sampled too: the VM also polls on returns
+local function fib(k)
+    if k < 2 then return k end
+    return fib(k - 1) + fib(k - 2)
+end
+profiler.reset()
+profiler.start({ hz = 1000 })
+local t0 = os.clock()
+while os.clock() - t0 < 0.2 do fib(20) end
+profiler.stop()
+assert(profiler.folded():find("fib (", 1, true), "recursion not sampled")
+
+print("ALL PROFILER TESTS PASSED (" .. n .. " samples)")
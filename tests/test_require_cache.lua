@@ -0,0 +1,100 @@
+-- package.cachepath: bytecode cache for modules found by searcher_Lua.
+
+local dir = os.tmpname()
+os.remove(dir)
+assert(os.execute("mkdir -p " .. dir .. "/src " .. dir .. "/cache"))
+
+local function write(name, text)
+    local f = assert(io.open(dir .. "/src/" .. name .. ".lua", "wb"))
+    f:write(text)
+    f:close()
+end
+
+local function entries()
+    local list = {}
+    local p = io.popen("ls " .. dir .. "/cache")
+    for l in p:lines() do list[#list + 1] = l end
+    p:close()
+    return list
+end
+
+local function fresh(name)
+    package.loaded[name] = nil
+    return require(name)
+end
+
+package.path = dir .. "/src/?.lua"
+package.cachepath = dir .. "/cache"
+
+write("cmod", "local x = ... return { name = x, v = 1 }")
+local m, where = fresh("cmod")
+assert(m.name == "cmod" and m.v == 1 and where == dir .. "/src/cmod.lua")
+local list = entries()
+assert(#list == 1 and list[1]:match("^%x+%.luac$"), "no cache entry written")
+
+-- warm load comes from the cache and gives the same module
+assert(fresh("cmod").v == 1)
+assert(#entries() == 1)
+
+-- same size, possibly same mtime: the source hash catches the edit
+write("cmod", "local x = ... return { name = x, v = 2 }")
+assert(fresh("cmod").v == 2, "stale cache entry used")
+
+-- a damaged entry falls back to the source and is rewritten
+local path = dir .. "/cache/" .. entries()[1]
+local f = assert(io.open(path, "r+b"))
+f:seek("end", -8)
+f:write("garbage!")
+f:close()
+assert(fresh("cmod").v == 2)
+assert(fresh("cmod").v == 2)
+
+-- debug information survives the round trip
+write("cerr", "local t = {}\n\nfunction t.boom() error('boom') end\nreturn t")
+fresh("cerr")
+local ok, err = pcall(fresh("cerr").boom)
+assert(not ok and err:find("cerr.lua:3: boom", 1, true), err)
+
+-- constants, nested closures and upvalues survive the plain format
+write("cfull", [[
+local long = string.rep("x", 10) .. "]] .. string.rep("long constant ", 20) .. [["
+local M = { pi = 3.25, big = 1 << 60, neg = -7, t = true, f = false }
+function M.counter(start)
+    local n = start
+    return function(...) n = n + select("#", ...) return n, long end
+end
+M.len = #long
+return M
+]])
+for _ = 1, 2 do
+    local c = fresh("cfull")
+    assert(c.pi == 3.25 and c.big == 1 << 60 and c.neg == -7 and c.t and not c.f)
+    assert(c.len == 10 + #string.rep("long constant ", 20))
+    local inc = c.counter(1)
+    assert(inc(1, 2) == 3)
+    local n, long = inc(nil)
+    assert(n == 4 and #long == c.len)
+end
+
+-- syntax errors are reported as before and nothing is cached
+write("cbad", "return +")
+local n = #entries()
+ok, err = pcall(require, "cbad")
+assert(not ok and err:find("cbad.lua", 1, true), err)
+assert(#entries() == n)
+
+-- encrypted modules are never stored decrypted
+f = assert(io.open(dir .. "/src/cenc.lua", "wb"))
+f:write(string.envelop("return 'secret'"))
+f:close()
+assert(fresh("cenc") == "secret")
+assert(#entries() == n)
+
+-- no cachepath: plain loading
+package.cachepath = nil
+write("cplain", "return 42")
+assert(fresh("cplain") == 42)
+assert(#entries() == n)
+
+os.execute("rm -rf " .. dir)
+print("ALL REQUIRE CACHE TESTS PASSED")
@@ -0,0 +1,33 @@
+-- Shifts by a constant (OP_SHRI/OP_SHLI) against shifts of two registers
+
+local function check(cond, msg)
+  if not cond then error("FAILED: " .. msg, 2) end
+end
+
+local x = 1
+check(x >> 3 == 0, "1 >> 3")
+check(x << 3 == 8, "1 << 3")
+check(3 << x == 6, "3 << 1")
+check(3 >> x == 1, "3 >> 1")
+
+local values = {0, 1, 2, 7, 255, 0x7fffffff, -1, -256, math.mininteger,
+                math.maxinteger}
+for _, v in ipairs(values) do
+  for _, n in ipairs({0, 1, 3, 8, 31, 63, 64, 70}) do
+    -- 'v >> n' with 'n' in a register is OP_SHR, never OP_SHRI
+    local byreg = v >> n
+    local byconst = load("local v = ... return v >> " .. n, "=shr")(v)
+    check(byconst == byreg, string.format("%d >> %d", v, n))
+    byreg = v << n
+    byconst = load("local v = ... return v << " .. n, "=shl")(v)
+    check(byconst == byreg, string.format("%d << %d", v, n))
+    -- constant on the left: 'k << v' is OP_SHLI
+    if v >= 0 and v < 64 then
+      byreg = n << v
+      byconst = load("local v = ... return " .. n .. " << v", "=kshl")(v)
+      check(byconst == byreg, string.format("%d << %d", n, v))
+    end
+  end
+end
+
+print("ALL CONSTANT SHIFT TESTS PASSED")
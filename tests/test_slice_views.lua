@@ -0,0 +1,142 @@
+-- Slices: tables from the slice syntax, copy-on-write views from
+-- table.view, string slices.
+
+local function range(n)
+    local t = {}
+    for i = 1, n do t[i] = i end
+    return t
+end
+
+local function same(a, b, msg)
+    assert(#a == #b, msg .. ": length " .. #a .. " ~= " .. #b)
+    for i = 1, #b do
+        assert(a[i] == b[i], msg .. ": element " .. i)
+    end
+end
+
+-- slices are plain tables, whatever their length
+local t = range(10)
+assert(type(t[2:4]) == "table")
+same(t[2:4], {2, 3, 4}, "short slice")
+same(t[: :-1], {10, 9, 8, 7, 6, 5, 4, 3, 2, 1}, "reversed")
+same(t[::-1], t[: :-1], "reversed with '::'")
+same(t[::3], {1, 4, 7, 10}, "'::' step")
+same(t[2::4], {2, 6, 10}, "start and '::' step")
+same(t[::], t, "'::' alone")
+same(t[-3:], {8, 9, 10}, "negative start")
+same(t[1:10:3], {1, 4, 7, 10}, "step")
+same(t[8:3], {}, "empty")
+
+local big = range(1000)
+local long = big[101:900]
+assert(type(long) == "table" and rawlen(long) == 800)
+assert(rawget(long, 1) == 101 and next(long) ~= nil)
+assert(setmetatable(long, {}) == long)
+long[1] = "x"
+assert(big[101] == 101)
+
+-- views are asked for explicitly
+local view = table.view
+local v = view(big, 101, 900)
+assert(type(v) == "userdata" and tostring(v):match("^slice: "))
+assert(#v == 800 and v[1] == 101 and v[800] == 900)
+assert(v[0] == nil and v[801] == nil and v.x == nil and v[1.0] == 101)
+same(view(big, 1000, 1, -2), (function()
+    local r = {}
+    for i = 1000, 1, -2 do r[#r + 1] = i end
+    return r
+end)(), "reversed view")
+same(view(t), t, "whole view")
+same(view(t, nil, nil, -1), t[: :-1], "reversed default bounds")
+assert(#view(t, 3, 4) == 2, "short view")
+
+-- iteration
+local n, sum = 0, 0
+for i, x in ipairs(v) do n = n + 1; sum = sum + x end
+assert(n == 800 and sum == (101 + 900) * 400)
+n = 0
+for k, x in pairs(v) do
+    n = n + 1
+    assert(x == k + 100)
+end
+assert(n == 800)
+assert(select("#", table.unpack(v)) == 800)
+assert(table.concat(big[1:40], ",", 1, 3) == "1,2,3")
+
+-- views of views compose; slicing a view copies it out
+local w = view(v, 1, 800, 10)
+assert(type(w) == "userdata" and #w == 80 and w[1] == 101 and w[80] == 891)
+local u = view(w, nil, nil, -1)
+assert(#u == 80 and u[1] == 891 and u[80] == 101)
+same(w[2:4], {111, 121, 131}, "slice of a view")
+assert(type(w[1:80]) == "table")
+
+-- writing to a view copies it
+local c = view(big, 1, 100)
+c[1] = "a"
+assert(c[1] == "a" and big[1] == 1 and #c == 100)
+c[#c + 1] = 101
+assert(#c == 101)
+table.sort(view(big, 1, 50), function(a, b) return a > b end)
+assert(big[1] == 1 and big[50] == 50)
+
+-- writing to the source copies its views first
+local src = range(200)
+local a, b = view(src, 1, 100), view(src, 50, 150, 2)
+src[1] = "changed"
+src[60] = "changed"
+assert(a[1] == 1 and a[60] == 60)
+assert(b[6] == 60)
+src[300] = 1
+table.insert(src, 1, 0)
+rawset(src, 2, "raw")
+assert(a[1] == 1 and a[2] == 2)
+local d = view(src, 1, 100)
+src.name = "string keys do not copy views"
+assert(d[1] == 0)
+src[1] = nil
+assert(d[1] == 0 and d[2] == "raw")
+
+-- holes and trailing nils
+local h = range(100)
+h[50] = nil
+local hv = view(h, 1, 60)
+assert(#hv == 60 and hv[50] == nil)
+h[60] = nil
+h[59] = nil
+assert(#view(h, 1, 60) == 58)
+
+-- the source stays alive while a view uses it, views die on their own
+local keep
+do
+    local tmp = range(500)
+    keep = view(tmp, 1, 400)
+end
+collectgarbage()
+collectgarbage()
+assert(keep[400] == 400)
+for i = 1, 2000 do
+    local s = view(big, 1, 500)
+    if i % 200 == 0 then collectgarbage() end
+end
+big[1] = 1
+assert(v[1] == 101)
+
+-- strings
+local str = "hello world"
+assert(str[1:5] == "hello" and str[-5:] == "world")
+assert(str[: :-1] == "dlrow olleh" and str[1:11:2] == "hlowrd")
+assert(str[::-1] == "dlrow olleh" and str[::2] == "hlowrd")
+assert(str[:] == str and str[20:] == "")
+local long = string.rep("0123456789", 20)
+assert(long[1:200:2] == string.rep("02468", 20))
+assert(long[11:60] == long:sub(11, 60))
+
+-- errors
+assert(not pcall(function() return t[1:2:0] end))
+assert(select(2, pcall(function() return t[1.5:2] end)):find("integer"))
+assert(not pcall(function() local x = 1; return x[1:2] end))
+assert(not pcall(view, big, 1, 2, 0))
+assert(not pcall(view, "str", 1, 2))
+
+print("ALL SLICE VIEW TESTS PASSED")
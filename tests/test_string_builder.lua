@@ -0,0 +1,89 @@
+-- string.builder tests
+
+local function check(cond, msg)
+  if not cond then error("FAILED: " .. msg, 2) end
+end
+
+local B = string.builder
+
+-- basic appends
+local sb = B()
+check(sb:len() == 0 and #sb == 0, "empty builder")
+check(sb:tostring() == "" and tostring(sb) == "", "empty tostring")
+sb:add("abc", 1, 2.5, true, nil, "x")
+check(sb:tostring() == "abc12.5truenilx", "mixed add: " .. sb:tostring())
+check(#sb == 15, "length")
+
+-- chaining and numbers
+local s = B():add(-0.0):add(" "):add(math.maxinteger):add(" ")
+             :add(math.mininteger):add(" "):add(1e300):add(" "):add(1/0)
+             :tostring()
+check(s == tostring(-0.0) .. " " .. tostring(math.maxinteger) .. " " ..
+           tostring(math.mininteger) .. " " .. tostring(1e300) .. " " ..
+           tostring(1/0), "number formatting: " .. s)
+
+-- __tostring metamethod on other values
+local obj = setmetatable({}, {__tostring = function () return "<obj>" end})
+check(B():add(obj):tostring() == "<obj>", "__tostring")
+
+-- embedded zeros
+check(B():add("a\0b", "\0"):tostring() == "a\0b\0", "embedded zeros")
+
+-- addf
+sb = B():addf("%d-%s-%5.2f", 42, "x", 3.14159)
+check(sb:tostring() == string.format("%d-%s-%5.2f", 42, "x", 3.14159), "addf")
+local q = string.format("[%q]", "a\nb")
+sb:addf("[%q]", "a\nb")
+check(sb:tostring():sub(-#q) == q, "addf %q")
+check(not pcall(sb.addf, sb, "%d", "x"), "addf bad arg")
+
+-- rep
+check(B():rep("ab", 3):tostring() == "ababab", "rep")
+check(B():rep("ab", 3, ","):tostring() == "ab,ab,ab", "rep sep")
+check(B():rep("ab", 0, ","):tostring() == "", "rep zero")
+check(B():rep("", 5, "-"):tostring() == "----", "rep empty")
+check(B():rep("", math.maxinteger):tostring() == "", "rep nothing")
+
+-- builder into builder, including itself
+local a = B():add("xy")
+local b = B():add("<", a, ">")
+check(b:tostring() == "<xy>", "builder arg")
+a:add(a):add(a)
+check(a:tostring() == "xyxyxyxy", "self append: " .. a:tostring())
+
+-- reset keeps the builder usable
+sb = B(16)
+for round = 1, 3 do
+  sb:reset()
+  for i = 1, 1000 do sb:add(i, ",") end
+  local t = {}
+  for i = 1, 1000 do t[#t + 1] = i .. "," end
+  check(sb:tostring() == table.concat(t), "round " .. round)
+end
+check(sb:reset():len() == 0, "reset")
+
+-- large growth
+sb = B()
+for i = 1, 100000 do sb:add("0123456789") end
+check(#sb == 1000000, "large")
+check(sb:tostring() == string.rep("0123456789", 100000), "large content")
+
+-- big integers go through tostring
+local big = math.bigint("123456789012345678901234567890")
+check(B():add(big, 1):tostring() == tostring(big) .. "1", "big integer")
+
+-- errors
+check(not pcall(B, -1), "negative capacity")
+check(not pcall(sb.add, {}), "bad self")
+check(not pcall(sb.rep, sb, "x"), "rep missing count")
+
+-- __close frees the buffer early
+local mt = getmetatable(B())
+sb = B():add("closing")
+mt.__close(sb)
+check(sb:len() == 0 and sb:tostring() == "", "close")
+sb:add("again")
+check(sb:tostring() == "again", "usable after close")
+collectgarbage()
+
+print("ALL STRING BUILDER TESTS PASSED")
@@ -0,0 +1,92 @@
+-- Plain substring search (find, gsub with plain patterns, split,
+-- contains), including repetitive inputs that switch to Two-Way.
+
+local function naive(s, p, init)
+    for i = init or 1, #s - #p + 1 do
+        if s:sub(i, i + #p - 1) == p then return i end
+    end
+    return nil
+end
+
+math.randomseed(11)
+
+local function randstr(n, alphabet)
+    local t = {}
+    for i = 1, n do
+        local k = math.random(1, #alphabet)
+        t[i] = alphabet:sub(k, k)
+    end
+    return table.concat(t)
+end
+
+-- random haystacks over tiny alphabets, every needle length
+for _, alpha in ipairs({"ab", "abc", "a\0"}) do
+    local s = randstr(3000, alpha)
+    for lp = 1, 40 do
+        for _ = 1, 5 do
+            local p = randstr(lp, alpha)
+            local init = math.random(1, 50)
+            assert(s:find(p, init, true) == naive(s, p, init), p)
+        end
+        -- a needle taken from the haystack is always found
+        local i = math.random(1, #s - lp + 1)
+        local p = s:sub(i, i + lp - 1)
+        assert(s:find(p, 1, true) == naive(s, p, 1))
+    end
+end
+
+-- worst cases for the first/last byte filter
+local big = string.rep("a", 200000)
+assert(big:find(string.rep("a", 100) .. "b", 1, true) == nil)
+assert((big .. "b"):find(string.rep("a", 100) .. "b", 1, true) == 200000 - 99)
+local periodic = string.rep("ab", 100000)
+assert(periodic:find(string.rep("ab", 50) .. "b", 1, true) == nil)
+assert((periodic .. "b"):find(string.rep("ab", 50) .. "b", 1, true) == 200000 - 99)
+assert((periodic .. "abba"):find("abababba", 1, true) == 200000 - 3)
+local t0 = os.clock()
+for i = 1, 20 do big:find(string.rep("a", 1000) .. "b", 1, true) end
+assert(os.clock() - t0 < 5, "search is not linear")
+
+-- empty needles and needles longer than the haystack
+assert(("abc"):find("", 1, true) == 1 and ("abc"):find("", 4, true) == 4)
+assert(("abc"):find("abcd", 1, true) == nil)
+assert(string.contains("hello world", "o w") and not string.contains("hello", "hello!"))
+
+-- gsub with a plain pattern behaves like the pattern matcher
+assert(select(2, ("a.b.c"):gsub("%.", "/")) == 2)
+local s, n = ("one two one two one"):gsub("one", "1")
+assert(s == "1 two 1 two 1" and n == 3)
+s, n = ("one two one two one"):gsub("one", "1", 2)
+assert(s == "1 two 1 two one" and n == 2)
+s, n = ("aaaa"):gsub("aa", "<%0>")
+assert(s == "<aa><aa>" and n == 2)
+s, n = ("x y x"):gsub("x", {x = "Z"})
+assert(s == "Z y Z" and n == 2)
+s, n = ("x y x"):gsub("x", function(m) assert(m == "x") return false end)
+assert(s == "x y x" and n == 2)
+s, n = ("abc"):gsub("zz", "!")
+assert(s == "abc" and n == 0)
+s, n = (periodic .. "b"):gsub(string.rep("ab", 50) .. "b", "X")
+assert(n == 1 and #s == 200001 - 101 + 1)
+
+-- split: k separators give k + 1 pieces
+local function same(t, u)
+    if #t ~= #u then return false end
+    for i = 1, #t do if t[i] ~= u[i] then return false end end
+    return true
+end
+assert(same(string.split("a,b,,c", ","), {"a", "b", "", "c"}))
+assert(same(string.split("", ","), {""}))
+assert(same(string.split("a,", ","), {"a", ""}))
+assert(same(string.split(",a", ","), {"", "a"}))
+assert(same(string.split(",", ","), {"", ""}))
+assert(same(string.split("a::b::", "::"), {"a", "b", ""}))
+assert(same(string.split("a:::b", "::"), {"a", ":b"}))
+assert(same(string.split("abc"), {"a", "b", "c"}))
+assert(#string.split("") == 0)
+assert(same(string.split("no separator", ";"), {"no separator"}))
+local parts = {}
+for i = 1, 10000 do parts[i] = tostring(i) end
+assert(same(string.split(table.concat(parts, "\r\n"), "\r\n"), parts))
+
+print("ALL STRING SEARCH TESTS PASSED")
@@ -0,0 +1,73 @@
+-- SuperStructs: sorted storage for few keys, hash index for many.
+
+local function keys(s)
+    local r = {}
+    for k in pairs(s) do r[#r + 1] = k end
+    return r
+end
+
+local function count(s)
+    local n = 0
+    for _ in pairs(s) do n = n + 1 end
+    return n
+end
+
+-- small superstructs iterate in key order
+superstruct Small [
+    b: 2,
+    a: 1,
+    c: 3
+]
+local ks = keys(Small)
+assert(ks[1] == "a" and ks[2] == "b" and ks[3] == "c")
+Small.b = nil
+assert(Small.b == nil and count(Small) == 2)
+
+-- growing past the threshold keeps every key reachable
+superstruct Big [
+    seed: 0
+]
+local N = 5000
+for i = 1, N do
+    Big["k" .. i] = i
+    Big[i] = -i
+end
+for i = 1, N do
+    assert(Big["k" .. i] == i and Big[i] == -i, "lookup " .. i)
+end
+assert(Big[1.0] == -1 and Big[N + 1] == nil and Big.missing == nil)
+assert(count(Big) == 2 * N + 1)
+
+-- large superstructs iterate in insertion order
+local order = keys(Big)
+assert(order[#order] == N and order[#order - 1] == "k" .. N)
+local again = keys(Big)
+for i = 1, #order do assert(order[i] == again[i]) end
+
+-- deleting during a traversal is allowed
+for k in pairs(Big) do
+    if type(k) == "number" then Big[k] = nil end
+end
+assert(count(Big) == N + 1 and Big[1] == nil and Big.k1 == 1)
+
+-- dead entries are reclaimed and keys can come back
+for i = 1, N do Big[i] = i * 2 end
+for i = 1, N, 2 do Big["k" .. i] = nil end
+for i = 1, N do
+    assert(Big[i] == i * 2)
+    assert(Big["k" .. i] == (i % 2 == 0 and i or nil))
+end
+assert(count(Big) == N + N // 2 + 1)
+
+-- long string keys
+local long = string.rep("x", 100)
+Big[long .. "1"] = "one"
+assert(Big[string.rep("x", 100) .. "1"] == "one")
+
+-- metamethods stored in a large superstruct still apply
+for i = 1, 100 do Big["f" .. i] = i end
+Big.__index = function(_, k) return "dflt:" .. k end
+local obj = setmetatable({}, Big)
+assert(obj.anything == "dflt:anything")
+
+print("ALL SUPERSTRUCT INDEX TESTS PASSED")
@@ -0,0 +1,120 @@
+-- table.sort: radix and pdqsort fast paths for homogeneous arrays, and
+-- the generic path for everything else.
+
+math.randomseed(7)
+
+local function check(t, orig, lt)
+    lt = lt or function(a, b) return a < b end
+    assert(#t == #orig)
+    for i = 2, #t do assert(not lt(t[i], t[i - 1]), i) end
+    local count = {}
+    for _, v in ipairs(orig) do
+        local k = (v ~= v) and "nan" or v
+        count[k] = (count[k] or 0) + 1
+    end
+    for _, v in ipairs(t) do
+        local k = (v ~= v) and "nan" or v
+        count[k] = count[k] - 1
+    end
+    for _, c in pairs(count) do assert(c == 0) end
+end
+
+local function trial(gen, sizes)
+    for _, n in ipairs(sizes) do
+        local t, orig = {}, {}
+        for i = 1, n do t[i] = gen(i, n); orig[i] = t[i] end
+        table.sort(t)
+        check(t, orig)
+    end
+end
+
+local sizes = {0, 1, 2, 3, 10, 23, 24, 25, 100, 129, 255, 256, 257, 1000, 5000, 30000}
+
+local shapes = {
+    random = function(i, n) return math.random(-n, n) end,
+    sorted = function(i) return i end,
+    reversed = function(i, n) return n - i end,
+    equal = function() return 5 end,
+    few = function() return math.random(1, 4) end,
+    organ = function(i, n) return i <= n // 2 and i or n - i end,
+    sawtooth = function(i) return i % 17 end,
+    almost = function(i) return (i % 100 == 0) and -i or i end,
+}
+for _, g in pairs(shapes) do
+    trial(g, sizes)                                        -- integers
+    trial(function(i, n) return g(i, n) + 0.5 end, sizes)  -- floats
+    trial(function(i, n)                                   -- mixed numbers
+        local v = g(i, n)
+        return (i % 3 == 0) and v + 0.25 or v
+    end, sizes)
+    trial(function(i, n) return string.format("%08d", g(i, n) + n) end, sizes)
+end
+
+-- extreme integers, signed zero and infinities
+local t = {math.maxinteger, math.mininteger, 0, -1, 1, math.mininteger + 1}
+for i = 1, 300 do t[#t + 1] = math.random(math.mininteger, math.maxinteger) end
+local o = {table.unpack(t)}
+table.sort(t)
+check(t, o)
+assert(t[1] == math.mininteger and t[#t] == math.maxinteger)
+
+t = {1/0, -1/0, 0.0, -0.0, 1e-300, -1e-300, 2^63, -2^63}
+for i = 1, 300 do t[#t + 1] = (math.random() - 0.5) * 10.0 ^ math.random(-20, 20) end
+o = {table.unpack(t)}
+table.sort(t)
+check(t, o)
+assert(t[1] == -1/0 and t[#t] == 1/0)
+
+-- integers and floats that are close or equal compare exactly
+t = {2^53, 2^53 + 1, math.tointeger(2^53) + 1, 2^53 - 1, 3, 3.0, 2.5}
+for i = 1, 100 do t[#t + 1] = math.random(1, 10) + (i % 2) * 0.5 end
+o = {table.unpack(t)}
+table.sort(t)
+check(t, o)
+
+-- strings with embedded zeros and shared prefixes
+t = {}
+for i = 1, 2000 do
+    t[i] = string.rep("a", math.random(0, 3)) .. "\0" .. math.random(1, 50)
+end
+o = {table.unpack(t)}
+table.sort(t)
+check(t, o)
+
+-- NaN keeps the generic path (which does not promise an order)
+t = {3, 0/0, 1, 2}
+table.sort(t)
+assert(#t == 4)
+
+-- mixed types still raise the usual error
+assert(not pcall(table.sort, {1, "x", 2}))
+assert(not pcall(table.sort, {1, 2, {}, 3}))
+
+-- comparators and non-array tables take the generic path
+t = {}
+for i = 1, 1000 do t[i] = math.random(1, 1000) end
+o = {table.unpack(t)}
+table.sort(t, function(a, b) return a > b end)
+check(t, o, function(a, b) return a > b end)
+
+local store = {5, 3, 1, 4, 2}
+local proxy = setmetatable({}, {
+    __index = store, __newindex = store, __len = function() return #store end})
+table.sort(proxy)
+assert(table.concat(store, ",") == "1,2,3,4,5")
+
+-- elements in the hash part
+t = {}
+for i = 1000, 1, -1 do t[i] = i end
+table.sort(t)
+for i = 1, 1000 do assert(t[i] == i) end
+
+-- a table with slice views keeps the views' contents
+t = {5, 4, 3, 2, 1, 0, 9, 8, 7, 6}
+for i = 11, 300 do t[i] = 300 - i end
+local v = table.view(t, 2, 4)
+table.sort(t)
+assert(v[1] == 4 and v[2] == 3 and v[3] == 2)
+for i = 2, #t do assert(t[i - 1] <= t[i]) end
+
+print("ALL TABLE SORT TESTS PASSED")
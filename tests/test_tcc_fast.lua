@@ -0,0 +1,79 @@
+local tcc = require("tcc")
+
+-- Fast emission mode: compare results against the interpreter for the
+-- same source, with and without obfuscation/string encryption.
+
+local function compile_and_load(name, code, opts)
+    local c_code = tcc.compile(code, opts, name)
+
+    local c_file = name .. ".c"
+    local so_file = name .. ".so"
+
+    local f = io.open(c_file, "w")
+    f:write(c_code)
+    f:close()
+
+    local cmd = string.format("gcc -std=c99 -shared -o %s %s -I. -fPIC", so_file, c_file)
+    local ret = os.execute(cmd)
+    if ret ~= 0 and ret ~= true then
+        error("GCC compilation failed for " .. name)
+    end
+
+    package.loaded[name] = nil
+    local old_path = package.cpath
+    package.cpath = "./?.so;" .. old_path
+    local ok, mod = pcall(require, name)
+    package.cpath = old_path
+
+    os.execute("rm -f " .. c_file .. " " .. so_file)
+    if not ok then
+        error("Failed to require module " .. name .. ": " .. tostring(mod))
+    end
+    return mod, c_code
+end
+
+local source = [[
+    local greeting = "hello"
+    local t = { name = "fast", count = 0 }
+    local function bump(n)
+        t.count = t.count + n
+        return t.count
+    end
+    local acc = 0
+    for i = 1, 10 do
+        acc = acc + i * 2
+        bump(1)
+    end
+    local f = 1.5
+    f = f * 2.0
+    local mixed = acc + 0.25
+    local bits = (acc & 0xF0) | 0x3
+    local s = greeting .. "," .. t.name
+    local mt = setmetatable({}, { __add = function(a, b) return 100 + b end })
+    local viamm = mt + 1
+    return table.concat({ acc, f, mixed, bits, s, t.count, viamm, acc / 4 }, " ")
+]]
+
+local expected = load(source)()
+
+local variants = {
+    { name = "tcc_fast_plain",   opts = { fast = true } },
+    { name = "tcc_fast_obf",     opts = { fast = true, obfuscate = true, seed = 1234 } },
+    { name = "tcc_fast_strenc",  opts = { fast = true, string_encryption = true, seed = 99 } },
+    { name = "tcc_fast_flatten", opts = { fast = true, flatten = true, seed = 7 } },
+}
+
+for _, v in ipairs(variants) do
+    local got, c_code = compile_and_load(v.name, source, v.opts)
+    assert(got == expected, string.format("%s: expected '%s', got '%s'", v.name, expected, tostring(got)))
+    if not v.opts.obfuscate then
+        assert(c_code:find("lua_tcc_move", 1, true), v.name .. ": expected direct-slot moves")
+        assert(not c_code:find("lua_tcc_loadk_str", 1, true), v.name .. ": string constants should come from the constant table")
+    end
+    if v.opts.string_encryption then
+        assert(not c_code:find("\"hello\"", 1, true), v.name .. ": string constant leaked in clear text")
+    end
+    print(v.name .. " passed: " .. tostring(got))
+end
+
+print("ALL FAST MODE TESTS PASSED")
@@ -0,0 +1,88 @@
+-- wasm3 typed calls: native argument slots, cached signatures, call_batch.
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local bytes = W.module{
+    funcs = {
+        { name = "add", params = { "i32", "i32" }, results = { "i32" },
+          code = W.get(0) .. W.get(1) .. op.i32_add },
+        { name = "div", params = { "i32", "i32" }, results = { "i32" },
+          code = W.get(0) .. W.get(1) .. op.i32_div_s },
+        { name = "add64", params = { "i64", "i64" }, results = { "i64" },
+          code = W.get(0) .. W.get(1) .. op.i64_add },
+        { name = "addf", params = { "f32", "f32" }, results = { "f32" },
+          code = W.get(0) .. W.get(1) .. op.f32_add },
+        { name = "mulf64", params = { "f64", "f64" }, results = { "f64" },
+          code = W.get(0) .. W.get(1) .. op.f64_mul },
+        { name = "sq", params = { "i32" }, results = { "i32" },
+          code = W.get(0) .. W.get(0) .. op.i32_mul },
+        { name = "nop", code = "" },
+        { name = "trap", code = op.unreachable },
+    },
+}
+
+local env = wasm3.newEnvironment()
+local runtime = env:newRuntime(64 * 1024)
+runtime:loadModule(env:parseModule(bytes))
+
+local add, div = runtime:findFunction("add"), runtime:findFunction("div")
+local add64, addf = runtime:findFunction("add64"), runtime:findFunction("addf")
+local mulf64, sq = runtime:findFunction("mulf64"), runtime:findFunction("sq")
+local nop, trap = runtime:findFunction("nop"), runtime:findFunction("trap")
+
+-- cached signature
+local p, r = add64:signature()
+assert(#p == 2 and p[1] == "i64" and p[2] == "i64" and #r == 1 and r[1] == "i64")
+p, r = nop:signature()
+assert(#p == 0 and #r == 0)
+
+-- integer widths are preserved exactly
+assert(add:call(10, 20) == 30)
+assert(add:call(0x7fffffff, 1) == -0x80000000, "i32 wraps")
+assert(add:call(-1, 0) == -1)
+assert(add:call(0xffffffff, 0) == -1, "i32 arguments are truncated")
+assert(add64:call(math.maxinteger - 1, 1) == math.maxinteger, "i64 keeps 64 bits")
+assert(add64:call(1 << 40, 1 << 40) == 1 << 41)
+assert(math.type(add64:call(1, 2)) == "integer")
+
+-- floats
+assert(addf:call(1.5, 2.25) == 3.75)
+assert(mulf64:call(0.1, 3) == 0.1 * 3)
+assert(math.type(mulf64:call(2, 2)) == "float")
+
+-- coercions: booleans and numeric strings
+assert(add:call(true, "41") == 42)
+assert(mulf64:call("0.5", 4) == 2.0)
+
+-- errors
+assert(nop:call() == nil)
+local ok, err = pcall(add.call, add, 1)
+assert(not ok and err:find("expects 2 arguments"), err)
+ok, err = pcall(add.call, add, 1, {})
+assert(not ok and err:find("Argument 2 must be"), err)
+ok, err = pcall(add.call, add, 1.5, 1)
+assert(not ok and err:find("integer representation"), err)
+ok, err = pcall(div.call, div, 1, 0)
+assert(not ok and err:find("Function call failed"), err)
+ok, err = pcall(trap.call, trap)
+assert(not ok and err:find("unreachable"), err)
+assert(div:call(7, 2) == 3, "runtime usable after a trap")
+
+-- call_batch
+local res = add:call_batch({ { 1, 2 }, { 3, 4 }, { -5, 5 } })
+assert(#res == 3 and res[1] == 3 and res[2] == 7 and res[3] == 0)
+res = sq:call_batch({ 1, 2, 3, { 4 } })
+assert(res[1] == 1 and res[2] == 4 and res[3] == 9 and res[4] == 16)
+assert(#add:call_batch({}) == 0)
+assert(#nop:call_batch({ {}, {} }) == 0)
+local batch = {}
+for i = 1, 1000 do batch[i] = { i, i } end
+res = add:call_batch(batch)
+for i = 1, 1000 do assert(res[i] == 2 * i) end
+ok, err = pcall(add.call_batch, add, { { 1, 2 }, 3 })
+assert(not ok and err:find("Call 2"), err)
+ok, err = pcall(div.call_batch, div, { { 1, 1 }, { 1, 0 } })
+assert(not ok and err:find("Function call failed"), err)
+
+print("ALL WASM3 CALL TESTS PASSED")
@@ -0,0 +1,125 @@
+-- wasm3 host functions: Lua functions linked as wasm imports.
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local bytes = W.module{
+    imports = {
+        { "env", "add", params = { "i32", "i32" }, results = { "i32" } },
+        { "env", "wide", params = { "i64", "f32", "f64" }, results = { "f64" } },
+        { "env", "log", params = { "i32" } },
+        { "env", "pair", results = { "i32", "i64" } },
+    },
+    funcs = {
+        { name = "call_add", params = { "i32", "i32" }, results = { "i32" },
+          code = W.get(0) .. W.get(1) .. W.call(0) },
+        { name = "call_wide", params = { "i64", "f32", "f64" }, results = { "f64" },
+          code = W.get(0) .. W.get(1) .. W.get(2) .. W.call(1) },
+        { name = "call_log", params = { "i32" }, code = W.get(0) .. W.call(2) },
+        { name = "call_pair", results = { "i32", "i64" }, code = W.call(3) },
+        -- add(x, 1) twice, with guest arithmetic in between
+        { name = "twice", params = { "i32" }, results = { "i32" },
+          code = W.get(0) .. W.i32(1) .. W.call(0) .. W.i32(10) .. op.i32_mul
+              .. W.i32(1) .. W.call(0) },
+    },
+}
+
+local env = wasm3.newEnvironment()
+local runtime = env:newRuntime(64 * 1024)
+local module = env:parseModule(bytes)
+
+assert(not pcall(module.linkFunction, module, "env", "add", "i(ii)", function() end),
+       "linking before loading must fail")
+runtime:loadModule(module)
+
+local logged = {}
+local addcalls = 0
+module:linkFunction("env", "add", "i(ii)", function(a, b)
+    addcalls = addcalls + 1
+    assert(math.type(a) == "integer" and math.type(b) == "integer")
+    if a == 13 then error("unlucky " .. b) end
+    if a == 14 then error({ code = b }) end
+    if a == 15 then return "nope" end
+    return a + b
+end)
+module:linkFunction("env", "wide", "F(IfF)", function(i, f, d)
+    assert(math.type(i) == "integer" and math.type(f) == "float")
+    return i + f + d
+end)
+module:linkFunction("env", "log", "v(i)", function(x) logged[#logged + 1] = x end)
+module:linkFunction("env", "pair", "iI()", function() return -1, math.maxinteger end)
+
+local ok, err = pcall(module.linkFunction, module, "env", "add", "i(i)", print)
+assert(not ok and err:find("signature mismatch"), err)
+ok, err = pcall(module.linkFunction, module, "env", "add", "i(ii", print)
+assert(not ok and err:find("malformed signature"), err)
+ok, err = pcall(module.linkFunction, module, "env", "missing", "v()", print)
+assert(not ok and err:find("Failed to link"), err)
+
+local call_add = runtime:findFunction("call_add")
+assert(call_add:call(2, 3) == 5 and addcalls == 1)
+assert(call_add:call(0x7fffffff, 0) == 0x7fffffff)
+assert(call_add:call(-4, 1) == -3)
+assert(runtime:findFunction("twice"):call(4) == 51)
+
+local wide = runtime:findFunction("call_wide")
+assert(wide:call(1 << 40, 0.5, 0.25) == (1 << 40) + 0.75)
+
+local log = runtime:findFunction("call_log")
+log:call(7); log:call(-1)
+assert(#logged == 2 and logged[1] == 7 and logged[2] == -1)
+
+local a, b = runtime:findFunction("call_pair"):call()
+assert(a == -1 and b == math.maxinteger)
+
+-- Lua errors trap the guest and come back to the caller unchanged
+ok, err = pcall(call_add.call, call_add, 13, 4)
+assert(not ok and err:find("unlucky 4"), err)
+ok, err = pcall(call_add.call, call_add, 14, 9)
+assert(not ok and type(err) == "table" and err.code == 9)
+ok, err = pcall(call_add.call, call_add, 15, 0)
+assert(not ok and err:find("expected i32, got string"), err)
+assert(call_add:call(1, 1) == 2, "runtime usable after a host error")
+
+-- re-entering the runtime from a host function is refused
+module = nil
+local rt2 = env:newRuntime(64 * 1024)
+local m2 = env:parseModule(bytes)
+rt2:loadModule(m2)
+local inner
+m2:linkFunction("env", "add", "i(ii)", function(x, y) return inner:call(x, y) end)
+inner = rt2:findFunction("call_add")
+ok, err = pcall(inner.call, inner, 1, 2)
+assert(not ok and err:find("already running"), err)
+
+-- the linked function stays alive with the runtime
+local rt3 = env:newRuntime(64 * 1024)
+local m3 = env:parseModule(bytes)
+rt3:loadModule(m3)
+do
+    local k = 100
+    m3:linkFunction("env", "add", "i(ii)", function(x, y) return x + y + k end)
+end
+m3 = nil
+collectgarbage(); collectgarbage()
+assert(rt3:findFunction("call_add"):call(1, 2) == 103)
+
+-- a host function that captures its runtime, memory or functions does
+-- not keep the runtime alive
+local alive = setmetatable({}, {__mode = "k"})
+for i = 1, 200 do
+    local rt = env:newRuntime(64 * 1024)
+    local m = env:parseModule(bytes)
+    rt:loadModule(m)
+    local fn
+    m:linkFunction("env", "add", "i(ii)", function(x, y)
+        return x + y + (rt and 0 or 1) + (fn and 0 or 1)
+    end)
+    fn = rt:findFunction("call_add")
+    assert(fn:call(i, 1) == i + 1)
+    alive[rt] = true
+end
+for _ = 1, 5 do collectgarbage() end
+assert(next(alive) == nil, "runtimes with linked functions collected")
+
+print("ALL WASM3 IMPORT TESTS PASSED")
@@ -0,0 +1,107 @@
+-- wasm3 memory views: typed access, bulk read/write, pack/unpack, growth.
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local bytes = W.module{
+    funcs = {
+        { name = "load", params = { "i32" }, results = { "i32" },
+          code = W.get(0) .. W.load(op.i32_load) },
+        { name = "store", params = { "i32", "i32" },
+          code = W.get(0) .. W.get(1) .. W.store(op.i32_store) },
+        { name = "grow", params = { "i32" }, results = { "i32" },
+          code = W.get(0) .. op.memory_grow },
+        { name = "pages", results = { "i32" }, code = op.memory_size },
+    },
+    memory = { min = 1, max = 4, name = "memory" },
+    data = { { offset = 16, bytes = "hello" } },
+}
+
+local env = wasm3.newEnvironment()
+local runtime = env:newRuntime(64 * 1024)
+runtime:loadModule(env:parseModule(bytes))
+local load, store = runtime:findFunction("load"), runtime:findFunction("store")
+local grow, pages = runtime:findFunction("grow"), runtime:findFunction("pages")
+
+local mem = runtime:memory()
+assert(mem:size() == 65536 and #mem == 65536)
+assert(tostring(mem):find("wasm3.memory", 1, true))
+
+-- ranges
+assert(mem:read(16, 5) == "hello")
+assert(mem:write(100, "world!") == 6)
+assert(mem:read(100, 6) == "world!")
+assert(mem:read(0, 0) == "")
+assert(runtime:getMemory(16, 5) == "hello")
+assert(#runtime:getMemory() == 65536)
+
+-- host writes are seen by the guest and the other way round
+mem:i32(200, 0x12345678)
+assert(load:call(200) == 0x12345678)
+store:call(204, -2)
+assert(mem:i32(204) == -2 and mem:u32(204) == 0xfffffffe)
+assert(mem:u8(200) == 0x78, "little-endian")
+assert(mem:u16(200) == 0x5678 and mem:i16(204) == -2 and mem:u16(204) == 0xfffe)
+
+-- typed accessors
+mem:u8(300, 0x1ff)
+assert(mem:u8(300) == 0xff and mem:i8(300) == -1)
+mem:i64(304, math.mininteger)
+assert(mem:i64(304) == math.mininteger and mem:u64(304) == math.mininteger)
+mem:f32(312, 1.5)
+assert(mem:f32(312) == 1.5)
+mem:f64(320, math.pi)
+assert(mem:f64(320) == math.pi)
+
+-- fill / copy
+mem:fill(400, 8, 0x41)
+assert(mem:read(400, 8) == "AAAAAAAA")
+mem:copy(402, 100, 6)
+assert(mem:read(400, 8) == "AAworld!")
+mem:copy(401, 400, 4)
+assert(mem:read(400, 8) == "AAAwold!", "overlapping copy")
+
+-- string.pack / string.unpack compatible
+local fmt = "<i4 d s1 z"
+local nxt = mem:pack(512, fmt, -7, 2.5, "abc", "zed")
+assert(nxt == 512 + #string.pack(fmt, -7, 2.5, "abc", "zed"))
+assert(mem:read(512, nxt - 512) == string.pack(fmt, -7, 2.5, "abc", "zed"))
+local a, b, c, d, after = mem:unpack(fmt, 512)
+assert(a == -7 and b == 2.5 and c == "abc" and d == "zed" and after == nxt)
+assert(select("#", mem:unpack("<I2 I2", 200)) == 3)
+assert(mem:unpack("<I4", 200) == 0x12345678)
+
+-- bounds
+local function fails(f, ...)
+    local ok, err = pcall(f, ...)
+    assert(not ok and err:find("out of bounds"), err)
+end
+fails(mem.read, mem, 65530, 7)
+fails(mem.write, mem, 65535, "ab")
+fails(mem.i32, mem, 65533)
+fails(mem.f64, mem, -1)
+fails(mem.pack, mem, 65535, "i4", 1)
+fails(mem.fill, mem, 65536, 1)
+assert(not pcall(mem.unpack, mem, "i4", 65534))
+assert(mem:read(65536, 0) == "")
+
+-- the view follows the memory when the guest grows it
+mem:write(65000, "tail")
+assert(grow:call(2) == 1 and pages:call() == 3)
+assert(mem:size() == 3 * 65536)
+assert(mem:read(16, 5) == "hello" and mem:read(65000, 4) == "tail")
+mem:i32(3 * 65536 - 4, 99)
+assert(load:call(3 * 65536 - 4) == 99)
+fails(mem.u8, mem, 3 * 65536)
+
+-- the view keeps the runtime alive
+local view = env:newRuntime(64 * 1024)
+do
+    local rt = view
+    rt:loadModule(env:parseModule(bytes))
+    view = rt:memory()
+end
+collectgarbage(); collectgarbage()
+assert(view:read(16, 5) == "hello")
+
+print("ALL WASM3 MEMORY TESTS PASSED")
@@ -0,0 +1,122 @@
+-- wasm3 runtime snapshots and pools.
+local wasm3 = require("wasm3")
+local W = dofile("tests/wasm_builder.lua")
+local op = W.op
+
+local bytes = W.module{
+    imports = { { "env", "note", params = { "i32" }, results = { "i32" } } },
+    funcs = {
+        -- counter(): g = g + 1; mem[0] = mem[0] + note(g); return g
+        { name = "counter", results = { "i32" },
+          code = W.gget(0) .. W.i32(1) .. op.i32_add .. W.gset(0)
+              .. W.i32(0) .. W.i32(0) .. W.load(op.i32_load)
+              .. W.gget(0) .. W.call(0) .. op.i32_add .. W.store(op.i32_store)
+              .. W.gget(0) },
+        { name = "grow", params = { "i32" }, results = { "i32" },
+          code = W.get(0) .. op.memory_grow },
+        { name = "pages", results = { "i32" }, code = op.memory_size },
+    },
+    memory = { min = 1, max = 8 },
+    globals = { { type = "i32", mut = true, init = 5 } },
+    data = { { offset = 16, bytes = "initial" } },
+}
+
+local notes = 0
+local function link(module, runtime)
+    module:linkFunction("env", "note", "i(i)", function(x) notes = notes + 1; return x * 2 end)
+end
+
+-- snapshot / restore on a plain runtime
+local env = wasm3.newEnvironment()
+local rt = env:newRuntime(64 * 1024)
+local mod = env:parseModule(bytes)
+rt:loadModule(mod)
+assert(not pcall(rt.restore, rt), "restore without snapshot must fail")
+link(mod, rt)
+rt:snapshot()
+
+local counter, grow, pages = rt:findFunction("counter"), rt:findFunction("grow"), rt:findFunction("pages")
+local mem = rt:memory()
+assert(counter:call() == 6 and counter:call() == 7)
+assert(mem:i32(0) == 12 + 14)
+mem:write(16, "CHANGED")
+assert(grow:call(3) == 1 and pages:call() == 4)
+
+rt:restore()
+assert(pages:call() == 1 and mem:size() == 65536, "grown pages dropped")
+assert(mem:read(16, 7) == "initial" and mem:i32(0) == 0)
+assert(counter:call() == 6, "globals restored")
+rt:restore()
+
+-- pools
+local pool = wasm3.newPool(bytes, { size = 2, link = link })
+local created, free = pool:stats()
+assert(created == 2 and free == 2)
+
+local a = pool:acquire()
+local b = pool:acquire()
+local c = pool:acquire()
+created, free = pool:stats()
+assert(created == 3 and free == 0)
+assert(a ~= b and b ~= c)
+
+local ca = a:findFunction("counter")
+assert(ca:call() == 6 and ca:call() == 7)
+assert(b:findFunction("counter"):call() == 6, "instances are isolated")
+a:memory():write(16, "dirty!!")
+a:findFunction("grow"):call(2)
+
+pool:release(a)
+assert(not pcall(pool.release, pool, a), "double release must fail")
+assert(not pcall(pool.release, pool, rt), "foreign runtime must be refused")
+local again = pool:acquire()
+assert(again == a, "released instance is reused")
+assert(again:findFunction("counter"):call() == 6)
+assert(again:memory():read(16, 7) == "initial" and again:memory():size() == 65536)
+pool:release(again)
+pool:release(b)
+pool:release(c)
+created, free = pool:stats()
+assert(created == 3 and free == 3)
+
+-- errors while instantiating surface from acquire
+local bad = wasm3.newPool(bytes)
+local ok, err = pcall(bad.acquire, bad)
+assert(not ok and err:find("missing imported function"), err)
+
+-- many cheap instantiations
+local t0 = os.clock()
+for i = 1, 2000 do
+    local r = pool:acquire()
+    r:findFunction("counter"):call()
+    pool:release(r)
+end
+local rate = 2000 / (os.clock() - t0)
+assert(rate > 1000, "pooled instantiation too slow: " .. rate)
+assert(select(1, pool:stats()) == 3)
+
+-- pools whose link function captures the runtime are collected
+local gone = setmetatable({}, {__mode = "k"})
+for _ = 1, 20 do
+    local p = wasm3.newPool(bytes, { size = 1, link = function(module, runtime)
+        module:linkFunction("env", "note", "i(i)", function(x)
+            return runtime and x or 0 end)
+    end })
+    local r = p:acquire()
+    assert(r:findFunction("counter"):call() == 6)
+    p:release(r)
+    gone[p], gone[r] = true, true
+end
+for _ = 1, 5 do collectgarbage() end
+assert(next(gone) == nil, "pools collected")
+
+-- a runtime keeps its pool: other pools refuse it, even one created
+-- after every reference to its own pool was dropped
+local stray = wasm3.newPool(bytes, { link = link }):acquire()
+for _ = 1, 5 do collectgarbage() end
+for _ = 1, 20 do
+    local p = wasm3.newPool(bytes, { link = link })
+    assert(not pcall(p.release, p, stray), "runtime of another pool refused")
+end
+
+print(string.format("ALL WASM3 POOL TESTS PASSED (%.0f instances/s)", rate))
@@ -0,0 +1,128 @@
+-- Minimal WebAssembly binary writer for the wasm3 tests.
+--
+-- local W = dofile("tests/wasm_builder.lua")
+-- local bytes = W.module{
+--     imports = { { "env", "cb", params = { "i32" }, results = { "i32" } } },
+--     funcs = { { name = "add", params = { "i32", "i32" }, results = { "i32" },
+--                 locals = { "i32" }, code = W.get(0) .. W.get(1) .. W.op.i32_add } },
+--     memory = { min = 1, max = 4, name = "memory" },
+--     globals = { { type = "i32", mut = true, init = 7, name = "g" } },
+--     data = { { offset = 16, bytes = "hello" } },
+-- }
+-- Functions are numbered after the imports, in order.
+
+local W = {}
+
+local VT = { i32 = 0x7f, i64 = 0x7e, f32 = 0x7d, f64 = 0x7c }
+
+local function uleb(n)
+    local out = {}
+    repeat
+        local b = n & 0x7f
+        n = n >> 7
+        if n ~= 0 then b = b | 0x80 end
+        out[#out + 1] = string.char(b)
+    until n == 0
+    return table.concat(out)
+end
+
+local function sleb(n)
+    local out = {}
+    while true do
+        local b = n & 0x7f
+        n = n // 128  -- arithmetic shift
+        local done = (n == 0 and b & 0x40 == 0) or (n == -1 and b & 0x40 ~= 0)
+        if not done then b = b | 0x80 end
+        out[#out + 1] = string.char(b)
+        if done then return table.concat(out) end
+    end
+end
+
+local function name(s) return uleb(#s) .. s end
+
+local function vec(items) return uleb(#items) .. table.concat(items) end
+
+local function section(id, items)
+    if #items == 0 then return "" end
+    local body = vec(items)
+    return string.char(id) .. uleb(#body) .. body
+end
+
+local function valtypes(list)
+    local t = {}
+    for i, v in ipairs(list or {}) do t[i] = string.char((assert(VT[v], v))) end
+    return vec(t)
+end
+
+W.uleb, W.sleb = uleb, sleb
+
+function W.get(i) return "\x20" .. uleb(i) end
+function W.set(i) return "\x21" .. uleb(i) end
+function W.call(i) return "\x10" .. uleb(i) end
+function W.i32(n) return "\x41" .. sleb(n) end
+function W.i64(n) return "\x42" .. sleb(n) end
+function W.f64(x) return "\x44" .. string.pack("<d", x) end
+function W.gget(i) return "\x23" .. uleb(i) end
+function W.gset(i) return "\x24" .. uleb(i) end
+function W.load(op, offset) return op .. "\x00" .. uleb(offset or 0) end
+function W.store(op, offset) return op .. "\x00" .. uleb(offset or 0) end
+
+W.op = {
+    i32_add = "\x6a", i32_sub = "\x6b", i32_mul = "\x6c", i32_div_s = "\x6d",
+    i32_eqz = "\x45", i32_lt_s = "\x48",
+    i64_add = "\x7c", i64_mul = "\x7e",
+    f32_add = "\x92", f32_mul = "\x94",
+    f64_add = "\xa0", f64_mul = "\xa2",
+    i32_load = "\x28", i32_load8_u = "\x2d", i32_store = "\x36", i32_store8 = "\x3a",
+    memory_size = "\x3f\x00", memory_grow = "\x40\x00",
+    drop = "\x1a", ret = "\x0f", unreachable = "\x00",
+    block = "\x02\x40", loop = "\x03\x40", br = "\x0c", br_if = "\x0d", ["end"] = "\x0b",
+}
+
+function W.module(spec)
+    local types, typeidx = {}, {}
+    local function typeof(f)
+        local enc = "\x60" .. valtypes(f.params) .. valtypes(f.results)
+        if not typeidx[enc] then
+            types[#types + 1] = enc
+            typeidx[enc] = #types - 1
+        end
+        return typeidx[enc]
+    end
+
+    local imports, funcs, exports, codes, globals, datas = {}, {}, {}, {}, {}, {}
+    for _, im in ipairs(spec.imports or {}) do
+        imports[#imports + 1] = name(im[1]) .. name(im[2]) .. "\x00" .. uleb(typeof(im))
+    end
+    for i, f in ipairs(spec.funcs or {}) do
+        funcs[#funcs + 1] = uleb(typeof(f))
+        if f.name then
+            exports[#exports + 1] = name(f.name) .. "\x00" .. uleb(#imports + i - 1)
+        end
+        local locals = {}
+        for j, v in ipairs(f.locals or {}) do locals[j] = "\x01" .. string.char(VT[v]) end
+        local body = vec(locals) .. f.code .. "\x0b"
+        codes[#codes + 1] = uleb(#body) .. body
+    end
+    local mems = {}
+    if spec.memory then
+        local m = spec.memory
+        mems[1] = m.max and ("\x01" .. uleb(m.min) .. uleb(m.max)) or ("\x00" .. uleb(m.min))
+        if m.name then exports[#exports + 1] = name(m.name) .. "\x02\x00" end
+    end
+    for i, g in ipairs(spec.globals or {}) do
+        local init = (g.type == "i64" and W.i64(g.init)) or (g.type == "f64" and W.f64(g.init))
+                     or W.i32(g.init)
+        globals[#globals + 1] = string.char(VT[g.type]) .. (g.mut and "\x01" or "\x00") .. init .. "\x0b"
+        if g.name then exports[#exports + 1] = name(g.name) .. "\x03" .. uleb(i - 1) end
+    end
+    for _, d in ipairs(spec.data or {}) do
+        datas[#datas + 1] = "\x00" .. W.i32(d.offset) .. "\x0b" .. name(d.bytes)
+    end
+
+    return "\0asm\1\0\0\0" .. section(1, types) .. section(2, imports) .. section(3, funcs)
+        .. section(5, mems) .. section(6, globals) .. section(7, exports)
+        .. section(10, codes) .. section(11, datas)
+end
+
+return W